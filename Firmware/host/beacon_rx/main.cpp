@@ -0,0 +1,368 @@
+// Listens for the fleet's multicast telemetry beacons and aggregates them
+// per unit: the latest reading, beacons received, copies dropped, sequence
+// numbers never seen and units gone quiet. With --simulate it is also its
+// own load test, sending for that many simulated units from a second thread
+// and injecting duplicates, losses, reordering and reboots; at the end it
+// checks that each beacon that went out was counted exactly once.
+//
+//   pio run -e host_beacon_rx && .pio/build/host_beacon_rx/program [options]
+//     --group G          multicast group, or a unicast address to listen
+//                        on (default 239.255.42.42)
+//     --port P           default 4242
+//     --seconds S        run time (default: until killed; 20 with --simulate)
+//     --report S         seconds between reports (default 5)
+//     --simulate N       send for N simulated units (500 for the load test)
+//     --interval MS      their beacon interval (default 1000)
+//     --dup P --loss P --reorder P --reboot P
+//                        percent of their beacons duplicated, not sent,
+//                        held back behind the next one, or followed by a
+//                        reboot (default 0)
+//
+//   Load test: program --simulate 500 --dup 5 --loss 2 --reorder 5 --reboot 0.1
+
+#include <atomic>
+#include <chrono>
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "Beacon.h"
+
+static uint32_t nowMs() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t deviceKey(const uint8_t* id) {
+    uint64_t key = 0;
+    for (int i = 0; i < 6; i++) {
+        key = key << 8 | id[i];
+    }
+    return key;
+}
+
+struct Unit {
+    BeaconWindow window;
+    BeaconPacket last;
+    uint32_t lastHeardMs;
+};
+
+// What the simulator put on the wire, for the end-of-run check
+struct SimulatorCounts {
+    std::atomic<uint32_t> unique{0};      // Distinct (boot, sequence) sent
+    std::atomic<uint32_t> copies{0};      // Extra copies sent
+    std::atomic<uint32_t> skipped{0};     // Sequence numbers never sent
+    std::atomic<uint32_t> reboots{0};
+    std::atomic<uint32_t> sendFailures{0};
+};
+
+struct SimulatorOptions {
+    const char* group;
+    uint16_t port;
+    uint32_t units;
+    uint32_t intervalMs;
+    float dup, loss, reorder, reboot;  // Percent
+};
+
+static std::atomic<bool> simulatorRunning{true};
+
+static uint32_t nextRandom(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static bool chance(uint32_t& state, float percent) {
+    return percent > 0 && (nextRandom(state) % 100000) < percent * 1000;
+}
+
+static void simulate(SimulatorOptions options, SimulatorCounts* counts) {
+    BeaconSender sender;
+    if (!sender.begin(options.group, options.port, 1)) {
+        fprintf(stderr, "simulator can't send to %s:%u\n", options.group, options.port);
+        return;
+    }
+    struct SimUnit {
+        BeaconPacket packet;
+        uint32_t nextMs;
+        float aqi;
+        bool holding;
+        BeaconPacket held;
+    };
+    uint32_t rng = 12345;
+    std::vector<SimUnit> units(options.units);
+    uint32_t start = nowMs();
+    for (uint32_t i = 0; i < options.units; i++) {
+        SimUnit& unit = units[i];
+        memset(&unit.packet, 0, sizeof(unit.packet));
+        uint8_t id[6] = {0x02, 0x0A, 0x1B, (uint8_t)(i >> 16), (uint8_t)(i >> 8), (uint8_t)i};
+        memcpy(unit.packet.deviceId, id, 6);
+        unit.packet.bootId = nextRandom(rng) & 0xFFFF;
+        unit.packet.pm25 = NAN;
+        unit.packet.pm10 = NAN;
+        unit.packet.threshold = 100;
+        unit.packet.flags = BEACON_AUTO;
+        unit.packet.intervalMs = options.intervalMs;
+        unit.aqi = 30 + nextRandom(rng) % 60;
+        unit.nextMs = start + nextRandom(rng) % options.intervalMs;  // Spread out like a real fleet
+        unit.holding = false;
+    }
+
+    // Sends one beacon; a failed send just counts, as the receiver will see
+    // that sequence number as missing
+    auto transmit = [&](const BeaconPacket& packet) {
+        if (!sender.send(packet)) {
+            counts->sendFailures++;
+        }
+    };
+
+    while (simulatorRunning) {
+        uint32_t now = nowMs();
+        for (SimUnit& unit : units) {
+            if ((int32_t)(now - unit.nextMs) < 0) {
+                continue;
+            }
+            unit.nextMs += options.intervalMs;
+            unit.aqi += ((int)(nextRandom(rng) % 21) - 10) / 10.0f;
+            unit.aqi = unit.aqi < 5 ? 5 : unit.aqi > 300 ? 300 : unit.aqi;
+            unit.packet.aqi = unit.aqi;
+            unit.packet.flags = BEACON_AUTO | (unit.aqi > unit.packet.threshold ? BEACON_FAN_ON : 0);
+
+            if (chance(rng, options.loss)) {
+                counts->skipped++;
+            } else {
+                counts->unique++;
+                if (chance(rng, options.reorder) && !unit.holding) {
+                    unit.held = unit.packet;  // Goes out after the next one
+                    unit.holding = true;
+                } else {
+                    transmit(unit.packet);
+                    if (unit.holding) {
+                        transmit(unit.held);
+                        unit.holding = false;
+                    }
+                }
+                if (chance(rng, options.dup)) {
+                    transmit(unit.packet);
+                    counts->copies++;
+                }
+            }
+            unit.packet.sequence++;
+
+            if (chance(rng, options.reboot)) {
+                if (unit.holding) {
+                    transmit(unit.held);  // Last word before the reboot
+                    unit.holding = false;
+                }
+                unit.packet.bootId = nextRandom(rng) & 0xFFFF;
+                unit.packet.sequence = 0;
+                counts->reboots++;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    for (SimUnit& unit : units) {
+        if (unit.holding) {
+            transmit(unit.held);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* group = BEACON_GROUP;
+    uint16_t port = BEACON_PORT;
+    double seconds = 0;
+    double reportSeconds = 5;
+    SimulatorOptions simulator = {nullptr, 0, 0, 1000, 0, 0, 0, 0};
+
+    for (int i = 1; i < argc; i++) {
+        const char* name = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "missing value for %s\n", name);
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (strcmp(name, "--group") == 0) group = value;
+        else if (strcmp(name, "--port") == 0) port = (uint16_t)atoi(value);
+        else if (strcmp(name, "--seconds") == 0) seconds = atof(value);
+        else if (strcmp(name, "--report") == 0) reportSeconds = atof(value);
+        else if (strcmp(name, "--simulate") == 0) simulator.units = (uint32_t)atoi(value);
+        else if (strcmp(name, "--interval") == 0) simulator.intervalMs = (uint32_t)atoi(value);
+        else if (strcmp(name, "--dup") == 0) simulator.dup = atof(value);
+        else if (strcmp(name, "--loss") == 0) simulator.loss = atof(value);
+        else if (strcmp(name, "--reorder") == 0) simulator.reorder = atof(value);
+        else if (strcmp(name, "--reboot") == 0) simulator.reboot = atof(value);
+        else {
+            fprintf(stderr, "unknown option %s\n", name);
+            return 2;
+        }
+    }
+    if (simulator.units > 0 && seconds == 0) {
+        seconds = 20;
+    }
+    if (simulator.intervalMs == 0) {
+        simulator.intervalMs = 1;
+    }
+
+    struct in_addr groupAddress;
+    if (inet_pton(AF_INET, group, &groupAddress) != 1) {
+        fprintf(stderr, "bad group address %s\n", group);
+        return 2;
+    }
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    int bufferSize = 4 << 20;  // Rides out bursts when the whole fleet is in phase
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        fprintf(stderr, "can't bind port %u: %s\n", port, strerror(errno));
+        return 1;
+    }
+    if (IN_MULTICAST(ntohl(groupAddress.s_addr))) {
+        struct ip_mreq membership;
+        membership.imr_multiaddr = groupAddress;
+        membership.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0) {
+            fprintf(stderr, "can't join %s: %s\n", group, strerror(errno));
+            return 1;
+        }
+    }
+    printf("listening on %s:%u\n", group, port);
+
+    SimulatorCounts simulated;
+    std::thread simulatorThread;
+    if (simulator.units > 0) {
+        simulator.group = group;
+        simulator.port = port;
+        simulatorThread = std::thread(simulate, simulator, &simulated);
+    }
+
+    std::unordered_map<uint64_t, Unit> units;
+    uint32_t datagrams = 0, invalid = 0, accepted = 0;
+    uint32_t start = nowMs();
+    uint32_t endMs = (uint32_t)(seconds * 1000);
+    uint32_t nextReport = start + (uint32_t)(reportSeconds * 1000);
+    uint32_t lastReportDatagrams = 0;
+    uint32_t lastReportMs = start;
+    bool stopping = false;
+    uint32_t stopMs = 0;
+
+    printf("  time   units  quiet  datagrams/s  accepted  duplicates  missing  invalid  max AQI\n");
+    for (;;) {
+        uint32_t now = nowMs();
+        if (endMs && !stopping && now - start >= endMs) {
+            // Stop sending, then give the last datagrams time to arrive
+            simulatorRunning = false;
+            stopping = true;
+            stopMs = now;
+        }
+        if (stopping && now - stopMs >= 500) {
+            break;
+        }
+
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 50) > 0) {
+            uint8_t buffer[512];
+            ssize_t length;
+            while ((length = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT)) >= 0) {
+                datagrams++;
+                BeaconPacket packet;
+                if (!decodeBeacon(buffer, length, packet)) {
+                    invalid++;
+                    continue;
+                }
+                Unit& unit = units[deviceKey(packet.deviceId)];
+                if (!unit.window.accept(packet.bootId, packet.sequence)) {
+                    continue;
+                }
+                accepted++;
+                unit.last = packet;
+                unit.lastHeardMs = now;
+            }
+        }
+
+        if ((int32_t)(now - nextReport) >= 0 || stopping) {
+            uint32_t quiet = 0, duplicates = 0, missing = 0;
+            float maxAqi = 0;
+            for (auto& entry : units) {
+                Unit& unit = entry.second;
+                // Quiet: three intervals without a word
+                if (now - unit.lastHeardMs > 3 * unit.last.intervalMs + 1000) {
+                    quiet++;
+                }
+                duplicates += unit.window.duplicates();
+                missing += unit.window.missing();
+                if (unit.last.aqi > maxAqi) {
+                    maxAqi = unit.last.aqi;
+                }
+            }
+            float rate = (datagrams - lastReportDatagrams) * 1000.0f / (now - lastReportMs ? now - lastReportMs : 1);
+            printf("%5.0fs  %6zu  %5u  %11.0f  %8u  %10u  %7u  %7u  %7.1f\n", (now - start) / 1000.0, units.size(),
+                   quiet, rate, accepted, duplicates, missing, invalid, maxAqi);
+            fflush(stdout);
+            lastReportDatagrams = datagrams;
+            lastReportMs = now;
+            nextReport += (uint32_t)(reportSeconds * 1000);
+            if (stopping) {
+                break;
+            }
+        }
+    }
+
+    if (simulatorThread.joinable()) {
+        simulatorRunning = false;
+        simulatorThread.join();
+        // Drain what was sent while stopping
+        uint8_t buffer[512];
+        ssize_t length;
+        while ((length = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT)) >= 0) {
+            BeaconPacket packet;
+            if (decodeBeacon(buffer, length, packet) &&
+                units[deviceKey(packet.deviceId)].window.accept(packet.bootId, packet.sequence)) {
+                accepted++;
+            }
+        }
+
+        uint32_t duplicates = 0, missing = 0, restarts = 0;
+        for (auto& entry : units) {
+            duplicates += entry.second.window.duplicates();
+            missing += entry.second.window.missing();
+            restarts += entry.second.window.restarts();
+        }
+        // Sequence numbers skipped right before a reboot or at the end of
+        // the run leave no gap a receiver can see, so missing can come out
+        // a little under what was skipped. Beacons the kernel dropped show
+        // up as lost; nothing may ever be counted twice.
+        uint32_t unique = simulated.unique;
+        printf("\nsimulated %u units: %u beacons, %u extra copies, %u skipped, %u reboots, %u send failures\n",
+               simulator.units, unique, simulated.copies.load(), simulated.skipped.load(), simulated.reboots.load(),
+               simulated.sendFailures.load());
+        printf("received %zu units: %u accepted, %u duplicates dropped, %u missing, %u reboots seen\n",
+               units.size(), accepted, duplicates, missing, restarts);
+        bool ok = accepted <= unique && units.size() == simulator.units && restarts <= simulated.reboots;
+        if (ok) {
+            printf("OK: no beacon counted twice, %u lost in transit\n", unique - accepted - simulated.sendFailures);
+        } else {
+            printf("FAIL: counts don't add up\n");
+        }
+        return ok ? 0 : 1;
+    }
+    return 0;
+}
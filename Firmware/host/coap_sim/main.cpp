@@ -0,0 +1,162 @@
+// Serves the firmware's CoAP resources (/aqi, /history, /settings) from a
+// simulated filter so gateways and CoAP clients can be developed without
+// hardware. The AQI comes from the synthetic profile, the fan from the
+// firmware's controller, and settings updates go through the same checks
+// as on the device. Observers are notified as on the device: on every
+// sample that changes a representation.
+//
+//   pio run -e host_coap_sim && .pio/build/host_coap_sim/program [options]
+//     --port P          listen port (default 5683)
+//     --seconds S       run time (default: until killed)
+//     --interval MS     sample period (default 2000, the firmware's)
+//     --seed N          synthetic profile seed (default 1)
+//
+//   coap-client -m get coap://localhost/.well-known/core
+//   coap-client -m get -s 60 coap://localhost/aqi | xxd          observe
+//   printf '\x03\x20\xff\xff\xff\xff\xff\xff\xff\xff' |
+//     coap-client -m put -t 42 -f - coap://localhost/settings    threshold 80
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#include "AqiSim.h"
+#include "CoapServer.h"
+#include "FanControl.h"
+#include "OpenAirCoap.h"
+
+static uint32_t nowMs() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Simulated control state
+static FanController controller;
+static bool fanOn = false;
+static float aqi = 0;
+static float history[24];
+static CoapSettings settings = {100, 10, 0, 0, 1400};
+
+static void configureController() {
+    FanControlConfig config;
+    config.onThreshold = settings.threshold;
+    config.offThreshold = settings.threshold - settings.hysteresis;
+    config.minOnMs = (uint32_t)settings.minOnMs;
+    config.minOffMs = (uint32_t)settings.minOffMs;
+    controller.configure(config);
+}
+
+static uint8_t handleAqi(uint8_t method, const uint8_t*, size_t, uint8_t* out, size_t& outLength) {
+    if (method != COAP_GET) {
+        return COAP_METHOD_NOT_ALLOWED;
+    }
+    CoapAqi value = {aqi, fanOn, true, 0};
+    outLength = encodeCoapAqi(value, out);
+    return COAP_CONTENT;
+}
+
+static uint8_t handleHistory(uint8_t method, const uint8_t*, size_t, uint8_t* out, size_t& outLength) {
+    if (method != COAP_GET) {
+        return COAP_METHOD_NOT_ALLOWED;
+    }
+    outLength = encodeCoapHistory(history, 24, out, COAP_PAYLOAD_MAX);
+    return COAP_CONTENT;
+}
+
+static uint8_t handleSettings(uint8_t method, const uint8_t* payload, size_t length, uint8_t* out,
+                              size_t& outLength) {
+    if (method == COAP_GET) {
+        outLength = encodeCoapSettings(settings, out);
+        return COAP_CONTENT;
+    }
+    if (method != COAP_PUT && method != COAP_POST) {
+        return COAP_METHOD_NOT_ALLOWED;
+    }
+    CoapSettings value;
+    if (!decodeCoapSettings(payload, length, value) || !(isnan(value.threshold) || validThreshold(value.threshold)) ||
+        !(isnan(value.hysteresis) || validHysteresis(value.hysteresis)) ||
+        !(isnan(value.minOnMs) || validDwellMs(value.minOnMs)) ||
+        !(isnan(value.minOffMs) || validDwellMs(value.minOffMs))) {
+        printf("rejected settings update of %zu bytes\n", length);
+        return COAP_BAD_REQUEST;
+    }
+    if (!isnan(value.threshold)) settings.threshold = value.threshold;
+    if (!isnan(value.hysteresis)) settings.hysteresis = value.hysteresis;
+    if (!isnan(value.minOnMs)) settings.minOnMs = value.minOnMs;
+    if (!isnan(value.minOffMs)) settings.minOffMs = value.minOffMs;
+    if (!isnan(value.nominalRpm)) settings.nominalRpm = value.nominalRpm;
+    configureController();
+    printf("settings: threshold %.1f, hysteresis %.1f, min on %.0fs, min off %.0fs, nominal %.0f RPM\n",
+           settings.threshold, settings.hysteresis, settings.minOnMs / 1000, settings.minOffMs / 1000,
+           settings.nominalRpm);
+    fflush(stdout);
+    return COAP_CHANGED;
+}
+
+int main(int argc, char** argv) {
+    uint16_t port = 5683;
+    double seconds = 0;
+    uint32_t intervalMs = 2000;
+    uint32_t seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        const char* name = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "missing value for %s\n", name);
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (strcmp(name, "--port") == 0) port = (uint16_t)atoi(value);
+        else if (strcmp(name, "--seconds") == 0) seconds = atof(value);
+        else if (strcmp(name, "--interval") == 0) intervalMs = (uint32_t)atoi(value);
+        else if (strcmp(name, "--seed") == 0) seed = (uint32_t)atoi(value);
+        else {
+            fprintf(stderr, "unknown option %s\n", name);
+            return 2;
+        }
+    }
+
+    CoapServer server(port);
+    server.on("aqi", COAP_FORMAT_OCTET_STREAM, true, handleAqi);
+    server.on("history", COAP_FORMAT_OCTET_STREAM, true, handleHistory);
+    server.on("settings", COAP_FORMAT_OCTET_STREAM, true, handleSettings);
+    if (!server.begin()) {
+        fprintf(stderr, "can't listen on port %u\n", port);
+        return 1;
+    }
+    printf("CoAP on port %u\n", port);
+
+    configureController();
+    SyntheticAqi source(SyntheticAqi::defaults(seed));
+    uint32_t startMs = nowMs();
+    uint32_t nextSample = startMs;
+    uint32_t nextReport = startMs + 10000;
+    uint32_t endMs = (uint32_t)(seconds * 1000);
+
+    while (endMs == 0 || nowMs() - startMs < endMs) {
+        uint32_t now = nowMs();
+        if ((int32_t)(now - nextSample) >= 0) {
+            aqi = source.sample(now - startMs);
+            fanOn = controller.update(aqi, now);
+            memmove(history + 1, history, sizeof(history) - sizeof(history[0]));
+            history[0] = aqi;
+            server.notify("aqi");
+            server.notify("settings");
+            server.notify("history");
+            nextSample += intervalMs;
+        }
+        if ((int32_t)(now - nextReport) >= 0) {
+            printf("%6.0fs  aqi %.1f  fan %s  observers %zu  requests %u  notifications %u\n",
+                   (now - startMs) / 1000.0, aqi, fanOn ? "on" : "off", server.observerCount(),
+                   server.requestCount(), server.notificationCount());
+            fflush(stdout);
+            nextReport += 10000;
+        }
+        server.poll();
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    printf("%u requests, %u notifications\n", server.requestCount(), server.notificationCount());
+    return 0;
+}
@@ -0,0 +1,307 @@
+#include "SeriesFile.h"
+
+#include <string.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SERIES_HEADER_SIZE 5
+#define SERIES_MAX_RECORD (1 << 24)
+
+uint32_t seriesCrc32(const uint8_t* data, size_t length) {
+    static uint32_t table[256];
+    static bool ready = false;
+    if (!ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int bit = 0; bit < 8; bit++) {
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        ready = true;
+    }
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+static void putVarint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+static void putZigzag(std::vector<uint8_t>& out, int64_t value) {
+    putVarint(out, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+// Bounds-checked reader over one record's payload
+class PayloadReader {
+public:
+    PayloadReader(const uint8_t* data, size_t length) : p_(data), end_(data + length), ok_(true) {}
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (p_ >= end_) {
+                ok_ = false;
+                return 0;
+            }
+            uint8_t byte = *p_++;
+            value |= (uint64_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        ok_ = false;
+        return 0;
+    }
+
+    int64_t zigzag() {
+        uint64_t value = varint();
+        return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+    }
+
+    uint8_t byte() {
+        if (p_ >= end_) {
+            ok_ = false;
+            return 0;
+        }
+        return *p_++;
+    }
+
+    const uint8_t* rest(size_t* length) const {
+        *length = end_ - p_;
+        return p_;
+    }
+
+    bool ok() const { return ok_; }
+    bool done() const { return p_ == end_; }
+
+private:
+    const uint8_t* p_;
+    const uint8_t* end_;
+    bool ok_;
+};
+
+static bool decodeBlock(const uint8_t* data, size_t length, SeriesBlock& block) {
+    PayloadReader reader(data, length);
+    block.boot = (uint32_t)reader.varint();
+    block.sequence = (uint32_t)reader.varint();
+    block.device = (uint32_t)reader.varint();
+    block.stateVersion = (uint32_t)reader.varint();
+    uint64_t count = reader.varint();
+    if (!reader.ok() || count == 0 || count > length) {
+        return false;  // Every point takes at least a byte
+    }
+    block.points.resize(count);
+    int64_t time = (int64_t)reader.varint();
+    int64_t value = reader.zigzag();
+    int64_t delta = 0;
+    block.points[0].timeMs = time;
+    block.points[0].value = (int32_t)value;
+    for (uint64_t i = 1; i < count; i++) {
+        delta += reader.zigzag();
+        time += delta;
+        value += reader.zigzag();
+        block.points[i].timeMs = time;
+        block.points[i].value = (int32_t)value;
+    }
+    for (uint64_t i = 0; i < count && reader.ok();) {
+        uint8_t flags = reader.byte();
+        uint64_t run = reader.varint();
+        if (run == 0 || run > count - i) {
+            return false;
+        }
+        for (; run > 0; run--) {
+            block.points[i++].flags = flags;
+        }
+    }
+    return reader.ok() && reader.done();
+}
+
+static bool readVarint(FILE* file, uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        int c = fgetc(file);
+        if (c == EOF) {
+            return false;
+        }
+        *value |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SeriesFile::read(const char* path, DeviceHandler onDevice, BlockHandler onBlock, size_t* tailBytes) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    char header[SERIES_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, SERIES_MAGIC, 4) != 0 ||
+        header[4] != SERIES_VERSION) {
+        fclose(file);
+        return false;
+    }
+
+    std::vector<uint8_t> payload;
+    SeriesBlock block;
+    long good = SERIES_HEADER_SIZE;
+    while (true) {
+        int type = fgetc(file);
+        uint64_t length;
+        if (type == EOF || !readVarint(file, &length) || length > SERIES_MAX_RECORD) {
+            break;
+        }
+        payload.resize(length + 4);
+        if (fread(payload.data(), 1, payload.size(), file) != payload.size()) {
+            break;
+        }
+        const uint8_t* crc = payload.data() + length;
+        uint32_t expected = crc[0] | crc[1] << 8 | crc[2] << 16 | (uint32_t)crc[3] << 24;
+        if (seriesCrc32(payload.data(), length) != expected) {
+            break;
+        }
+        if (type == 'D') {
+            PayloadReader reader(payload.data(), length);
+            uint32_t id = (uint32_t)reader.varint();
+            size_t nameLength;
+            const uint8_t* name = reader.rest(&nameLength);
+            if (!reader.ok()) {
+                break;
+            }
+            if (onDevice) onDevice(id, std::string((const char*)name, nameLength));
+        } else if (type == 'B') {
+            if (!decodeBlock(payload.data(), length, block)) {
+                break;
+            }
+            if (onBlock) onBlock(block);
+        }
+        // Unknown record types are skipped, for forward compatibility
+        good = ftell(file);
+    }
+
+    if (tailBytes) {
+        fseek(file, 0, SEEK_END);
+        *tailBytes = (size_t)(ftell(file) - good);
+    }
+    fclose(file);
+    return true;
+}
+
+SeriesFile::SeriesFile() : file_(nullptr), devices_(0), bytesWritten_(0), pointsWritten_(0) {}
+
+SeriesFile::~SeriesFile() {
+    close();
+}
+
+bool SeriesFile::open(const char* path, DeviceHandler onDevice, BlockHandler onBlock) {
+    close();
+    devices_ = 0;
+    struct stat info;
+    if (stat(path, &info) == 0 && info.st_size > 0) {
+        size_t tail = 0;
+        DeviceHandler countDevices = [&](uint32_t id, const std::string& name) {
+            if (id >= devices_) devices_ = id + 1;
+            if (onDevice) onDevice(id, name);
+        };
+        if (!read(path, countDevices, onBlock, &tail)) {
+            return false;  // Not ours; don't touch it
+        }
+        if (tail > 0 && truncate(path, info.st_size - tail) != 0) {
+            return false;
+        }
+        file_ = fopen(path, "ab");
+        return file_ != nullptr;
+    }
+
+    file_ = fopen(path, "wb");
+    if (!file_) {
+        return false;
+    }
+    fwrite(SERIES_MAGIC, 1, 4, file_);
+    fputc(SERIES_VERSION, file_);
+    bytesWritten_ += SERIES_HEADER_SIZE;
+    return true;
+}
+
+void SeriesFile::close() {
+    if (file_) {
+        fclose(file_);
+        file_ = nullptr;
+    }
+}
+
+bool SeriesFile::writeRecord(uint8_t type, const std::vector<uint8_t>& payload) {
+    if (!file_) {
+        return false;
+    }
+    std::vector<uint8_t> head;
+    head.push_back(type);
+    putVarint(head, payload.size());
+    uint32_t crc = seriesCrc32(payload.data(), payload.size());
+    uint8_t trailer[4] = {(uint8_t)crc, (uint8_t)(crc >> 8), (uint8_t)(crc >> 16), (uint8_t)(crc >> 24)};
+    if (fwrite(head.data(), 1, head.size(), file_) != head.size() ||
+        fwrite(payload.data(), 1, payload.size(), file_) != payload.size() ||
+        fwrite(trailer, 1, sizeof(trailer), file_) != sizeof(trailer)) {
+        return false;
+    }
+    bytesWritten_ += head.size() + payload.size() + sizeof(trailer);
+    return true;
+}
+
+uint32_t SeriesFile::addDevice(const std::string& name) {
+    payload_.clear();
+    putVarint(payload_, devices_);
+    payload_.insert(payload_.end(), name.begin(), name.end());
+    writeRecord('D', payload_);
+    return devices_++;
+}
+
+bool SeriesFile::append(const SeriesBlock& block) {
+    if (block.points.empty()) {
+        return true;
+    }
+    const std::vector<SeriesPoint>& points = block.points;
+    payload_.clear();
+    putVarint(payload_, block.boot);
+    putVarint(payload_, block.sequence);
+    putVarint(payload_, block.device);
+    putVarint(payload_, block.stateVersion);
+    putVarint(payload_, points.size());
+    putVarint(payload_, (uint64_t)points[0].timeMs);
+    putZigzag(payload_, points[0].value);
+    int64_t lastDelta = 0;
+    for (size_t i = 1; i < points.size(); i++) {
+        int64_t delta = points[i].timeMs - points[i - 1].timeMs;
+        putZigzag(payload_, delta - lastDelta);
+        putZigzag(payload_, (int64_t)points[i].value - points[i - 1].value);
+        lastDelta = delta;
+    }
+    for (size_t i = 0; i < points.size();) {
+        size_t run = 1;
+        while (i + run < points.size() && points[i + run].flags == points[i].flags) {
+            run++;
+        }
+        payload_.push_back(points[i].flags);
+        putVarint(payload_, run);
+        i += run;
+    }
+    if (!writeRecord('B', payload_)) {
+        return false;
+    }
+    pointsWritten_ += points.size();
+    return true;
+}
+
+bool SeriesFile::flush() {
+    return file_ && fflush(file_) == 0;
+}
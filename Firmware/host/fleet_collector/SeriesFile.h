@@ -0,0 +1,93 @@
+#ifndef SERIES_FILE_H
+#define SERIES_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Append-only time-series file for the fleet collector. After a 5-byte
+// header ("OASF", version) the file is a sequence of records:
+//
+//   u8 type, varint payload length, payload, u32 CRC-32 of the payload (LE)
+//
+//   'D' device:  varint id, name bytes
+//   'B' block:   varint boot id, varint next sequence number, varint
+//                device id, varint state version, varint count, varint
+//                first time (Unix ms), zigzag first value, then for each
+//                further point a zigzag delta-of-delta time and a zigzag
+//                value delta, then the flags as (flags, varint run length)
+//                runs
+//
+// Values are AQI tenths. Samples arrive anywhere from twice a second to
+// every few minutes as the unit's sampling rate adapts; a device holding
+// one rate costs about two bytes per point, a change of rate a byte or two
+// more. Each block carries the
+// device's cursors after its last point (its state version and backlog
+// position, in the same record so a crash can't separate them); replaying
+// the file restores them, which is what lets a restarted collector carry
+// on without duplicates.
+// A torn record at the end (crash mid-write) is cut off on open.
+
+#define SERIES_MAGIC "OASF"
+#define SERIES_VERSION 2
+
+#define SERIES_FAN_ON 0x01
+#define SERIES_AUTO 0x02
+#define SERIES_GAP 0x04  // Samples were lost just before this point
+
+struct SeriesPoint {
+    int64_t timeMs;
+    int32_t value;  // AQI x10
+    uint8_t flags;
+};
+
+struct SeriesBlock {
+    uint32_t device;
+    uint32_t stateVersion;
+    uint32_t boot;
+    uint32_t sequence;  // Next sample wanted from that boot
+    std::vector<SeriesPoint> points;
+};
+
+class SeriesFile {
+public:
+    typedef std::function<void(uint32_t id, const std::string& name)> DeviceHandler;
+    typedef std::function<void(const SeriesBlock& block)> BlockHandler;
+
+    SeriesFile();
+    ~SeriesFile();
+
+    // Replays an existing file through the handlers (either may be empty),
+    // then leaves it open for appending. Creates the file if needed.
+    bool open(const char* path, DeviceHandler onDevice, BlockHandler onBlock);
+    void close();
+
+    // Reads a file without modifying it. False if it isn't a series file;
+    // a torn tail is reported through tailBytes.
+    static bool read(const char* path, DeviceHandler onDevice, BlockHandler onBlock, size_t* tailBytes = nullptr);
+
+    // Ids are assigned in order from 0
+    uint32_t addDevice(const std::string& name);
+    bool append(const SeriesBlock& block);
+    bool flush();
+
+    uint64_t bytesWritten() const { return bytesWritten_; }
+    uint64_t pointsWritten() const { return pointsWritten_; }
+    uint32_t deviceCount() const { return devices_; }
+
+private:
+    bool writeRecord(uint8_t type, const std::vector<uint8_t>& payload);
+
+    FILE* file_;
+    uint32_t devices_;
+    uint64_t bytesWritten_;
+    uint64_t pointsWritten_;
+    std::vector<uint8_t> payload_;
+};
+
+uint32_t seriesCrc32(const uint8_t* data, size_t length);
+
+#endif
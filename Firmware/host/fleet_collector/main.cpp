@@ -0,0 +1,737 @@
+// Collects AQI samples from a fleet of units over the firmware's own HTTP
+// routes and stores them in a compressed time-series file (SeriesFile.h).
+// One thread drives every unit through non-blocking sockets and epoll;
+// each unit costs one socket and a few hundred bytes of state.
+//
+// Per unit it long-polls /api/aqi?wait=&since=<state version>, which
+// returns as soon as the unit publishes anything new. When the state
+// version has moved it asks /api/sync for every sample after the last one
+// it holds (boot id and sequence number, see Backlog.h). That covers
+// outages as long as the unit's backlog (hours), fills in whatever the
+// unit sampled while unreachable, and never sends a sample twice; a 429
+// is retried after its Retry-After plus jitter, so a fleet coming back at
+// once spreads out. Times come from the unit's own clock, mapped onto
+// the collector's by the "now" in each response.
+//
+// Units without /api/sync (404, firmware from before the backlog) are
+// reported once and otherwise treated as unreachable.
+//
+//   pio run -e host_fleet_collector && .pio/build/host_fleet_collector/program [options]
+//     --devices FILE      one unit per line: host:port [name]
+//     --range H:P:N       N units at host H, ports P to P+N-1 (fleet_sim)
+//     --out FILE          series file to append to (default fleet.oasf)
+//     --wait S            long-poll time (default 25; 0 polls every --poll)
+//     --poll MS           poll period without long polling (default 10000)
+//     --flush S           write buffered points every S seconds (default 30)
+//     --seconds S         run time (default: until SIGINT/SIGTERM)
+//     --report S          status line period (default 10)
+//     --dump FILE         summarize a series file and exit
+//     --csv NAME          with --dump: print NAME's points ("all" for every unit)
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <map>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Backlog.h"
+#include "SeriesFile.h"
+
+#define RESPONSE_MAX 8192
+#define BLOCK_POINTS 256         // Points per block before it's written early
+#define RETRY_MIN_MS 1000
+#define RETRY_MAX_MS 30000
+#define RETRY_AFTER_MAX_S 60     // Cap on a unit's Retry-After
+#define REQUEST_SLACK_MS 5000    // On top of the long-poll time
+#define TIMER_PERIOD_MS 50
+
+static uint32_t nowMs() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static int64_t wallMs() {
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+static void setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+enum Phase { PHASE_IDLE, PHASE_CONNECTING, PHASE_SENDING, PHASE_READING };
+enum RequestKind { REQUEST_STATE, REQUEST_SYNC };
+
+struct Device {
+    std::string name;
+    struct sockaddr_in address;
+    uint32_t id;
+
+    int fd = -1;
+    Phase phase = PHASE_IDLE;
+    RequestKind kind = REQUEST_STATE;
+    char request[256];
+    size_t requestLength = 0;
+    size_t requestSent = 0;
+    std::string response;
+    uint32_t deadline = 0;
+    uint32_t nextMs = 0;
+    RequestKind nextKind = REQUEST_STATE;  // Started at nextMs
+    uint32_t retryMs = RETRY_MIN_MS;
+
+    // Cursors
+    bool haveState = false;
+    uint32_t stateVersion = 0;
+    bool gapPending = false;
+    bool syncSupported = true;  // Cleared, and reported, on the first 404
+    bool haveSync = false;
+    uint32_t syncBoot = 0;
+    uint32_t syncNext = 0;  // Next sequence number wanted
+
+    SeriesBlock pending;
+
+    uint32_t requests = 0;
+    uint32_t errors = 0;
+    uint32_t samples = 0;
+    uint32_t gaps = 0;
+    uint32_t restarts = 0;
+    bool online = false;
+};
+
+static std::vector<Device> devices;
+static SeriesFile series;
+static int epollFd = -1;
+static uint32_t waitSeconds = 25;
+static uint32_t pollMs = 10000;
+static volatile sig_atomic_t stopRequested = 0;
+
+static uint64_t totalRequests = 0;
+static uint64_t totalErrors = 0;
+static uint64_t totalSamples = 0;
+static uint64_t totalGaps = 0;
+static uint64_t totalThrottled = 0;
+static int inFlight = 0;
+
+static void onSignal(int) {
+    stopRequested = 1;
+}
+
+static bool resolve(const char* host, uint16_t port, struct sockaddr_in* address) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    if (getaddrinfo(host, nullptr, &hints, &result) != 0 || !result) {
+        return false;
+    }
+    memcpy(address, result->ai_addr, sizeof(*address));
+    address->sin_port = htons(port);
+    freeaddrinfo(result);
+    return true;
+}
+
+static bool addDevice(const char* host, uint16_t port, const char* name) {
+    Device device;
+    if (!resolve(host, port, &device.address)) {
+        fprintf(stderr, "can't resolve %s\n", host);
+        return false;
+    }
+    char fallback[96];
+    snprintf(fallback, sizeof(fallback), "%s:%u", host, port);
+    device.name = name && *name ? name : fallback;
+    devices.push_back(device);
+    return true;
+}
+
+static bool loadDeviceFile(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "can't open %s\n", path);
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        char host[128];
+        char name[96] = "";
+        unsigned port;
+        if (line[0] == '#' || sscanf(line, "%127[^:]:%u %95s", host, &port, name) < 2) {
+            continue;
+        }
+        if (!addDevice(host, (uint16_t)port, name)) {
+            fclose(file);
+            return false;
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+// --- Response parsing. The firmware's documents are flat and small, so
+// a key search is enough.
+
+static const char* findKey(const char* body, const char* key) {
+    char pattern[40];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char* p = strstr(body, pattern);
+    return p ? p + strlen(pattern) : nullptr;
+}
+
+static bool jsonNumber(const char* body, const char* key, double* value) {
+    const char* p = findKey(body, key);
+    if (!p) {
+        return false;
+    }
+    char* end;
+    *value = strtod(p, &end);
+    return end != p;
+}
+
+// --- Storage
+
+static void writeBlock(Device& device) {
+    if (device.pending.points.empty()) {
+        return;
+    }
+    device.pending.device = device.id;
+    device.pending.stateVersion = device.stateVersion;
+    device.pending.boot = device.syncBoot;
+    device.pending.sequence = device.syncNext;
+    if (!series.append(device.pending)) {
+        fprintf(stderr, "write failed: %s\n", strerror(errno));
+    }
+    device.pending.points.clear();
+}
+
+static void flushAll() {
+    for (Device& device : devices) {
+        writeBlock(device);
+    }
+    series.flush();
+}
+
+static void record(Device& device, int32_t value, int64_t timeMs, uint8_t flags) {
+    SeriesPoint point;
+    point.timeMs = timeMs;
+    point.value = value;
+    point.flags = flags;
+    if (device.gapPending) {
+        point.flags |= SERIES_GAP;
+        device.gapPending = false;
+    }
+    device.pending.points.push_back(point);
+    device.samples++;
+    totalSamples++;
+}
+
+static void noteGap(Device& device) {
+    device.gapPending = true;
+    device.gaps++;
+    totalGaps++;
+}
+
+// Takes a /api/sync response; false if it isn't one. Sets *more if the
+// unit has further blocks or the response was cut short.
+static bool takeSync(Device& device, const uint8_t* body, size_t length, bool* more) {
+    BacklogSyncHeader header;
+    if (!decodeSyncHeader(body, length, header)) {
+        return false;
+    }
+    // Samples from before a reboot that weren't collected are gone, and the
+    // unit wasn't sampling while it restarted
+    bool sameBoot = device.haveSync && header.boot == device.syncBoot;
+    if (device.haveSync && !sameBoot) {
+        noteGap(device);
+    }
+    bool cursor = sameBoot;
+    uint32_t next = sameBoot ? device.syncNext : 0;
+
+    int64_t now = wallMs();
+    size_t offset = BACKLOG_SYNC_HEADER;
+    while (offset < length) {
+        size_t used = decodeBacklogBlock(body + offset, length - offset, [&](const BacklogSample& sample) {
+            if (cursor && sample.sequence < next) {
+                return;  // Already held; blocks are sent whole
+            }
+            if (cursor && sample.sequence > next) {
+                noteGap(device);  // Dropped from the backlog before we got here
+            }
+            int64_t timeMs = now - (int32_t)(header.nowMs - sample.timeMs);
+            record(device, sample.value, timeMs, sample.flags & (SERIES_FAN_ON | SERIES_AUTO | SERIES_GAP));
+            next = sample.sequence + 1;
+            cursor = true;
+        });
+        if (used == 0) {
+            break;  // Cut off mid-block; ask again from there
+        }
+        offset += used;
+    }
+    device.haveSync = true;
+    device.syncBoot = header.boot;
+    device.syncNext = next;
+    *more = header.more || offset < length;
+    // Only now, so the cursors written with the block cover all its points
+    if (device.pending.points.size() >= BLOCK_POINTS) {
+        writeBlock(device);
+    }
+    return true;
+}
+
+// --- Requests
+
+static void closeSocket(Device& device) {
+    if (device.fd >= 0) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, device.fd, nullptr);
+        close(device.fd);
+        device.fd = -1;
+        inFlight--;
+    }
+    device.phase = PHASE_IDLE;
+}
+
+static void fail(Device& device) {
+    closeSocket(device);
+    device.errors++;
+    totalErrors++;
+    device.online = false;
+    device.nextKind = REQUEST_STATE;
+    device.nextMs = nowMs() + device.retryMs;
+    device.retryMs = device.retryMs * 2 > RETRY_MAX_MS ? RETRY_MAX_MS : device.retryMs * 2;
+}
+
+static void startRequest(Device& device, RequestKind kind) {
+    device.kind = kind;
+    uint32_t timeout = REQUEST_SLACK_MS;
+    if (kind == REQUEST_SYNC) {
+        if (device.haveSync && device.syncNext > 0) {
+            device.requestLength = snprintf(device.request, sizeof(device.request),
+                                            "GET /api/sync?boot=%lu&since=%lu HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n",
+                                            (unsigned long)device.syncBoot, (unsigned long)(device.syncNext - 1),
+                                            device.name.c_str());
+        } else {
+            device.requestLength = snprintf(device.request, sizeof(device.request),
+                                            "GET /api/sync HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n",
+                                            device.name.c_str());
+        }
+    } else if (device.haveState && waitSeconds > 0) {
+        device.requestLength = snprintf(device.request, sizeof(device.request),
+                                        "GET /api/aqi?wait=%u&since=%lu HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n",
+                                        waitSeconds, (unsigned long)device.stateVersion, device.name.c_str());
+        timeout += waitSeconds * 1000;
+    } else {
+        device.requestLength = snprintf(device.request, sizeof(device.request),
+                                        "GET /api/aqi HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n",
+                                        device.name.c_str());
+    }
+    device.requestSent = 0;
+    device.response.clear();
+    device.deadline = nowMs() + timeout;
+    device.requests++;
+    totalRequests++;
+
+    device.fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (device.fd < 0) {
+        device.phase = PHASE_IDLE;
+        device.nextMs = nowMs() + RETRY_MIN_MS;  // Out of descriptors; try again shortly
+        return;
+    }
+    inFlight++;
+    setNonBlocking(device.fd);
+    int noDelay = 1;
+    setsockopt(device.fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    if (connect(device.fd, (struct sockaddr*)&device.address, sizeof(device.address)) < 0 &&
+        errno != EINPROGRESS) {
+        fail(device);
+        return;
+    }
+    struct epoll_event event;
+    event.events = EPOLLOUT;
+    event.data.ptr = &device;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, device.fd, &event);
+    device.phase = PHASE_CONNECTING;
+}
+
+static void scheduleNext(Device& device, RequestKind kind) {
+    closeSocket(device);
+    if (kind == REQUEST_STATE && waitSeconds == 0) {
+        device.nextMs = nowMs() + pollMs;
+        return;
+    }
+    startRequest(device, kind);
+}
+
+static void complete(Device& device) {
+    const char* text = device.response.c_str();
+    int status = 0;
+    const char* body = strstr(text, "\r\n\r\n");
+    if (sscanf(text, "HTTP/1.%*d %d", &status) != 1 || !body) {
+        fail(device);
+        return;
+    }
+    body += 4;
+    device.online = true;
+    device.retryMs = RETRY_MIN_MS;
+
+    if (device.kind == REQUEST_SYNC) {
+        if (status == 404) {
+            if (device.syncSupported) {
+                fprintf(stderr, "%s: no /api/sync, firmware too old to collect from\n", device.name.c_str());
+                device.syncSupported = false;
+            }
+            fail(device);
+            return;
+        }
+        if (status == 429) {
+            // Come back when the unit says, give or take a second so a
+            // crowd of collectors doesn't return in step
+            const char* retry = strstr(text, "\r\nRetry-After:");
+            uint32_t seconds = retry ? (uint32_t)atoi(retry + 14) : 1;
+            if (seconds > RETRY_AFTER_MAX_S) seconds = RETRY_AFTER_MAX_S;
+            closeSocket(device);
+            totalThrottled++;
+            device.nextKind = REQUEST_SYNC;
+            device.nextMs = nowMs() + seconds * 1000 + rand() % 1000;
+            return;
+        }
+        bool more = false;
+        size_t offset = body - text;
+        if (status != 200 ||
+            !takeSync(device, (const uint8_t*)text + offset, device.response.size() - offset, &more)) {
+            fail(device);
+            return;
+        }
+        scheduleNext(device, more ? REQUEST_SYNC : REQUEST_STATE);
+        return;
+    }
+
+    double version;
+    if (status != 200 || !jsonNumber(body, "version", &version)) {
+        fail(device);
+        return;
+    }
+    if (device.haveState && (uint32_t)version < device.stateVersion) {
+        device.restarts++;
+    }
+    bool moved = !device.haveState || (uint32_t)version != device.stateVersion;
+    device.stateVersion = (uint32_t)version;
+    device.haveState = true;
+    // A long poll that timed out brings back the same version: just poll again
+    if (!moved) {
+        scheduleNext(device, REQUEST_STATE);
+    } else {
+        scheduleNext(device, REQUEST_SYNC);
+    }
+}
+
+static void onEvent(Device& device, uint32_t events) {
+    if (device.phase == PHASE_CONNECTING) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(device.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if (error != 0 || (events & EPOLLERR)) {
+            fail(device);
+            return;
+        }
+        device.phase = PHASE_SENDING;
+    }
+    if (device.phase == PHASE_SENDING) {
+        while (device.requestSent < device.requestLength) {
+            ssize_t sent = send(device.fd, device.request + device.requestSent,
+                                device.requestLength - device.requestSent, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return;
+                }
+                fail(device);
+                return;
+            }
+            device.requestSent += sent;
+        }
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = &device;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, device.fd, &event);
+        device.phase = PHASE_READING;
+        return;
+    }
+    if (device.phase == PHASE_READING) {
+        char buffer[4096];
+        while (true) {
+            ssize_t received = recv(device.fd, buffer, sizeof(buffer), 0);
+            if (received > 0) {
+                device.response.append(buffer, received);
+                if (device.response.size() > RESPONSE_MAX) {
+                    fail(device);
+                    return;
+                }
+                continue;
+            }
+            if (received == 0) {
+                complete(device);  // The firmware closes after each response
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                fail(device);
+            }
+            return;
+        }
+    }
+}
+
+static void runTimers() {
+    uint32_t now = nowMs();
+    for (Device& device : devices) {
+        if (device.phase != PHASE_IDLE) {
+            if ((int32_t)(now - device.deadline) >= 0) {
+                fail(device);
+            }
+        } else if ((int32_t)(now - device.nextMs) >= 0) {
+            startRequest(device, device.nextKind);
+            device.nextKind = REQUEST_STATE;
+        }
+    }
+}
+
+// --- Reading a file back
+
+static int dump(const char* path, const char* csv) {
+    struct Summary {
+        std::string name;
+        uint64_t points = 0;
+        uint64_t blocks = 0;
+        uint64_t gaps = 0;
+        int64_t first = 0;
+        int64_t last = 0;
+        double sum = 0;
+    };
+    std::map<uint32_t, Summary> units;
+    size_t tail = 0;
+    bool all = csv && strcmp(csv, "all") == 0;
+    if (csv) {
+        printf("unit,time_ms,aqi,fan,auto,gap\n");
+    }
+    bool ok = SeriesFile::read(
+        path, [&](uint32_t id, const std::string& name) { units[id].name = name; },
+        [&](const SeriesBlock& block) {
+            Summary& unit = units[block.device];
+            if (unit.points == 0) unit.first = block.points.front().timeMs;
+            unit.last = block.points.back().timeMs;
+            unit.blocks++;
+            for (const SeriesPoint& point : block.points) {
+                unit.points++;
+                unit.sum += point.value / 10.0;
+                if (point.flags & SERIES_GAP) unit.gaps++;
+                if (csv && (all || unit.name == csv)) {
+                    printf("%s,%lld,%.1f,%d,%d,%d\n", unit.name.c_str(), (long long)point.timeMs, point.value / 10.0,
+                           point.flags & SERIES_FAN_ON ? 1 : 0, point.flags & SERIES_AUTO ? 1 : 0,
+                           point.flags & SERIES_GAP ? 1 : 0);
+                }
+            }
+        },
+        &tail);
+    if (!ok) {
+        fprintf(stderr, "%s is not a series file\n", path);
+        return 1;
+    }
+    if (csv) {
+        return 0;
+    }
+
+    uint64_t points = 0;
+    for (const auto& entry : units) {
+        const Summary& unit = entry.second;
+        points += unit.points;
+        printf("%-24s %8llu points %5llu blocks %4llu gaps  %7.1f h  mean AQI %.1f\n", unit.name.c_str(),
+               (unsigned long long)unit.points, (unsigned long long)unit.blocks, (unsigned long long)unit.gaps,
+               (unit.last - unit.first) / 3600000.0, unit.points ? unit.sum / unit.points : 0.0);
+    }
+    FILE* file = fopen(path, "rb");
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    printf("%zu units, %llu points, %ld bytes (%.2f bytes/point)%s\n", units.size(), (unsigned long long)points, size,
+           points ? (double)size / points : 0.0, tail ? ", torn tail" : "");
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    const char* outPath = "fleet.oasf";
+    const char* dumpPath = nullptr;
+    const char* csv = nullptr;
+    double seconds = 0;
+    double flushSeconds = 30;
+    double reportSeconds = 10;
+
+    for (int i = 1; i < argc; i++) {
+        const char* name = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "missing value for %s\n", name);
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (strcmp(name, "--devices") == 0) {
+            if (!loadDeviceFile(value)) return 1;
+        } else if (strcmp(name, "--range") == 0) {
+            char host[128];
+            unsigned port, count;
+            if (sscanf(value, "%127[^:]:%u:%u", host, &port, &count) != 3) {
+                fprintf(stderr, "--range wants host:port:count\n");
+                return 2;
+            }
+            for (unsigned n = 0; n < count; n++) {
+                if (!addDevice(host, (uint16_t)(port + n), nullptr)) return 1;
+            }
+        }
+        else if (strcmp(name, "--out") == 0) outPath = value;
+        else if (strcmp(name, "--wait") == 0) waitSeconds = (uint32_t)atoi(value);
+        else if (strcmp(name, "--poll") == 0) pollMs = (uint32_t)atoi(value);
+        else if (strcmp(name, "--flush") == 0) flushSeconds = atof(value);
+        else if (strcmp(name, "--seconds") == 0) seconds = atof(value);
+        else if (strcmp(name, "--report") == 0) reportSeconds = atof(value);
+        else if (strcmp(name, "--dump") == 0) dumpPath = value;
+        else if (strcmp(name, "--csv") == 0) csv = value;
+        else {
+            fprintf(stderr, "unknown option %s\n", name);
+            return 2;
+        }
+    }
+    if (dumpPath) {
+        return dump(dumpPath, csv);
+    }
+    if (devices.empty()) {
+        fprintf(stderr, "no units: use --devices or --range\n");
+        return 2;
+    }
+    if (waitSeconds > 30) {
+        waitSeconds = 30;  // The firmware caps it there anyway
+    }
+
+    // One socket per unit, plus a little headroom
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < devices.size() + 64) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    // Restore ids and cursors from what's already in the file
+    std::map<std::string, uint32_t> ids;
+    std::map<uint32_t, SeriesBlock> lastBlocks;
+    bool opened = series.open(
+        outPath, [&](uint32_t id, const std::string& name) { ids[name] = id; },
+        [&](const SeriesBlock& block) {
+            SeriesBlock& last = lastBlocks[block.device];
+            last.stateVersion = block.stateVersion;
+            last.boot = block.boot;
+            last.sequence = block.sequence;
+        });
+    if (!opened) {
+        fprintf(stderr, "can't open %s as a series file\n", outPath);
+        return 1;
+    }
+    size_t resumed = 0;
+    for (Device& device : devices) {
+        auto found = ids.find(device.name);
+        if (found == ids.end()) {
+            device.id = series.addDevice(device.name);
+            continue;
+        }
+        device.id = found->second;
+        auto last = lastBlocks.find(device.id);
+        if (last != lastBlocks.end()) {
+            device.haveState = true;
+            device.stateVersion = last->second.stateVersion;
+            device.haveSync = true;
+            device.syncBoot = last->second.boot;
+            device.syncNext = last->second.sequence;
+            resumed++;
+        }
+    }
+    series.flush();
+    printf("%zu units, %zu resumed from %s\n", devices.size(), resumed, outPath);
+    fflush(stdout);
+
+    epollFd = epoll_create1(0);
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Spread the first requests over a second rather than opening every
+    // connection at once
+    uint32_t startMs = nowMs();
+    for (size_t i = 0; i < devices.size(); i++) {
+        devices[i].nextMs = startMs + (uint32_t)(i * 1000 / devices.size());
+    }
+
+    uint32_t endMs = (uint32_t)(seconds * 1000);
+    uint32_t flushMs = (uint32_t)(flushSeconds * 1000);
+    uint32_t reportMs = (uint32_t)(reportSeconds * 1000);
+    uint32_t nextFlush = startMs + flushMs;
+    uint32_t nextReport = startMs + reportMs;
+    uint32_t lastTimers = 0;
+    uint64_t reportedRequests = 0;
+    uint64_t reportedSamples = 0;
+    struct epoll_event events[256];
+
+    while (!stopRequested && (endMs == 0 || nowMs() - startMs < endMs)) {
+        int count = epoll_wait(epollFd, events, 256, TIMER_PERIOD_MS);
+        for (int i = 0; i < count; i++) {
+            onEvent(*(Device*)events[i].data.ptr, events[i].events);
+        }
+        uint32_t now = nowMs();
+        if (now - lastTimers >= TIMER_PERIOD_MS) {
+            runTimers();
+            lastTimers = now;
+        }
+        if ((int32_t)(now - nextFlush) >= 0) {
+            flushAll();
+            nextFlush += flushMs;
+        }
+        if (reportMs > 0 && (int32_t)(now - nextReport) >= 0) {
+            size_t online = 0;
+            for (const Device& device : devices) {
+                if (device.online) online++;
+            }
+            printf("%6.0fs  online %zu/%zu  open %d  %.0f req/s  %.0f samples/s  stored %llu (%.2f B/pt)  "
+                   "429s %llu  gaps %llu  errors %llu\n",
+                   (now - startMs) / 1000.0, online, devices.size(), inFlight,
+                   (totalRequests - reportedRequests) / reportSeconds, (totalSamples - reportedSamples) / reportSeconds,
+                   (unsigned long long)series.pointsWritten(),
+                   series.pointsWritten() ? (double)series.bytesWritten() / series.pointsWritten() : 0.0,
+                   (unsigned long long)totalThrottled,
+                   (unsigned long long)totalGaps,
+                   (unsigned long long)totalErrors);
+            fflush(stdout);
+            reportedRequests = totalRequests;
+            reportedSamples = totalSamples;
+            nextReport += reportMs;
+        }
+    }
+
+    for (Device& device : devices) {
+        closeSocket(device);
+    }
+    flushAll();
+    series.close();
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double elapsed = (nowMs() - startMs) / 1000.0;
+    double cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+                 (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    printf("%.0fs: %llu requests, %llu samples, %llu gaps, %llu errors; %.1f%% CPU, %ld MB peak RSS\n", elapsed,
+           (unsigned long long)totalRequests, (unsigned long long)totalSamples, (unsigned long long)totalGaps,
+           (unsigned long long)totalErrors, elapsed > 0 ? cpu * 100 / elapsed : 0.0, usage.ru_maxrss / 1024);
+    return 0;
+}
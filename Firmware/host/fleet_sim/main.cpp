@@ -0,0 +1,376 @@
+// Stands in for a fleet of units on one machine, for developing and
+// benchmarking the fleet collector. Every simulated unit runs the
+// firmware's HttpServer on its own port and serves /api/aqi (with the long
+// poll) and /api/history (the firmware's hourly means, null for hours
+// without readings) from Snapshots exactly as the firmware does, so ETags,
+// 304s, deferral limits and connection handling all match a real unit.
+// AQI comes from the synthetic profile (seeded per unit) and the fan
+// from the firmware's controller. Units are split across threads; each
+// thread services its units in turn, as loop() would.
+//
+// Units also keep the firmware's sample backlog and answer /api/sync with
+// the same blocks and rate limit.
+//
+// Three kinds of trouble can be injected: --fold publishes some samples
+// together with the next one (a late loop()), --restart reboots a random
+// unit every so often, resetting its versions, history and backlog, and
+// --outage takes a random unit off the network for a while (its listener
+// closes; it keeps sampling).
+//
+//   pio run -e host_fleet_sim && .pio/build/host_fleet_sim/program [options]
+//     --units N           number of units (default 100)
+//     --port P            first port; units use P to P+N-1 (default 9000)
+//     --threads T         serving threads (default 4)
+//     --interval MS       sample period (default 2000, the firmware's)
+//     --seconds S         run time (default: until killed)
+//     --seed N            first unit's profile seed, then N+1... (default 1)
+//     --fold P            chance a sample is published with the next (default 0)
+//     --restart S         reboot a random unit every S seconds (default never)
+//     --outage S          cut a random unit off every S seconds (default never)
+//     --outage-len S      how long it stays off (default 300)
+//
+//   .pio/build/host_fleet_sim/program --units 1000 &
+//   .pio/build/host_fleet_collector/program --range 127.0.0.1:9000:1000
+
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+
+#include "AqiPipeline.h"
+#include "AqiSim.h"
+#include "Backlog.h"
+#include "FanControl.h"
+#include "HttpServer.h"
+#include "Snapshot.h"
+
+#define LONG_POLL_MAX_MS 30000
+#define BACKLOG_BLOCKS 64
+#define SYNC_MAX_BLOCKS 8
+#define SYNC_RATE 4.0f
+#define SYNC_BURST 8.0f
+
+static uint32_t nowMs() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+struct Unit {
+    explicit Unit(uint16_t port) : server(port) {}
+
+    HttpServer server;
+    SyntheticAqi source;
+    FanController controller;
+    uint32_t seed;
+    uint32_t bootMs;
+    uint32_t nextSample;
+    bool fanOn;
+    float aqi;
+    HourlyHistory history;       // The firmware's, on the unit's clock
+    bool unpublished;            // A folded sample waits for the next one
+    std::atomic<bool> restart;   // Set by the main thread, acted on by the owner
+    std::atomic<uint32_t> outageMs;
+    bool offline;
+    uint32_t onlineAt;
+    SampleBacklog<BACKLOG_BLOCKS> backlog;
+    float syncTokens;
+    uint32_t syncRefillMs;
+    // Replaced on reboot so versions restart from 0
+    std::unique_ptr<Snapshot<384>> stateSnapshot;
+    std::unique_ptr<Snapshot<512>> historySnapshot;
+};
+
+static std::vector<std::unique_ptr<Unit>> units;
+static uint32_t intervalMs = 2000;
+static double foldChance = 0;
+static std::atomic<bool> running(true);
+static std::atomic<uint64_t> samplesTaken(0);
+
+template<size_t N> static void sendSnapshot(HttpServer& server, const Snapshot<N>& snapshot) {
+    server.sendHeader("ETag", snapshot.etag());
+    server.sendHeader("Cache-Control", "no-cache");
+    if (snapshot.matches(server.header("If-None-Match"))) {
+        server.send(304, "", "");
+        return;
+    }
+    server.send(200, "application/json", snapshot.data(), snapshot.length());
+}
+
+// Same documents as publishStateSnapshot() and publishHistorySnapshot()
+static void publishState(Unit& unit) {
+    Snapshot<384>& snapshot = *unit.stateSnapshot;
+    int length = snprintf(snapshot.beginPublish(), snapshot.capacity(),
+                          "{\"version\":%lu,\"aqi\":%.1f,\"fanAuto\":true,\"fanState\":%s,\"threshold\":100,"
+                          "\"hysteresis\":10,\"relayCycles\":%lu,\"fanRpm\":%d,\"fanAlert\":false,"
+                          "\"fanAlertReason\":\"none\",\"useRealSensor\":false}",
+                          (unsigned long)snapshot.nextVersion(), unit.aqi, unit.fanOn ? "true" : "false",
+                          (unsigned long)unit.controller.cycleCount(), unit.fanOn ? 1400 : 0);
+    snapshot.commit(length);
+}
+
+static void publishHistory(Unit& unit) {
+    Snapshot<512>& snapshot = *unit.historySnapshot;
+    char* out = snapshot.beginPublish();
+    size_t capacity = snapshot.capacity();
+    size_t length = snprintf(out, capacity, "{\"version\":%lu,\"bucketMs\":%lu,\"history\":[",
+                             (unsigned long)snapshot.nextVersion(), (unsigned long)HISTORY_BUCKET_MS);
+    for (int i = 0; i < HISTORY_LENGTH && length < capacity; i++) {
+        float mean = unit.history.means()[i];
+        if (i < unit.history.filled() && !isnan(mean)) {
+            length += snprintf(out + length, capacity - length, "%s%.1f", i ? "," : "", mean);
+        } else {
+            length += snprintf(out + length, capacity - length, "%snull", i ? "," : "");
+        }
+    }
+    if (length < capacity) {
+        length += snprintf(out + length, capacity - length, "]}");
+    }
+    snapshot.commit(length);
+}
+
+// Same as the firmware's handleSync()
+static void sync(Unit& unit) {
+    HttpServer& server = unit.server;
+    uint32_t now = nowMs();
+    unit.syncTokens += (now - unit.syncRefillMs) * SYNC_RATE / 1000.0f;
+    if (unit.syncTokens > SYNC_BURST) unit.syncTokens = SYNC_BURST;
+    unit.syncRefillMs = now;
+    if (unit.syncTokens < 1) {
+        char retryAfter[8];
+        snprintf(retryAfter, sizeof(retryAfter), "%d", 1 + rand() % 4);
+        server.sendHeader("Retry-After", retryAfter);
+        server.send(429, "text/plain", "Too Many Requests");
+        return;
+    }
+    unit.syncTokens -= 1;
+
+    SampleBacklog<BACKLOG_BLOCKS>::Range range =
+        unit.backlog.plan(server.hasArg("since"), strtoul(server.arg("boot"), nullptr, 10),
+                          strtoul(server.arg("since"), nullptr, 10), SYNC_MAX_BLOCKS);
+    uint8_t header[BACKLOG_SYNC_HEADER];
+    encodeSyncHeader(unit.backlog.header(range, now - unit.bootMs), header);
+    server.sendHeader("Cache-Control", "no-store");
+    server.setContentLength(range.bytes);
+    server.send(200, "application/octet-stream");
+    server.sendContent((const char*)header, sizeof(header));
+    for (size_t i = 0; i < range.count; i++) {
+        const BacklogBlock& block = unit.backlog.block(range.first + i);
+        uint8_t blockHeader[BACKLOG_BLOCK_HEADER];
+        encodeBlockHeader(block, blockHeader);
+        server.sendContent((const char*)blockHeader, sizeof(blockHeader));
+        server.sendContent((const char*)block.data, block.length);
+    }
+}
+
+static void boot(Unit& unit, uint32_t now) {
+    unit.stateSnapshot.reset(new Snapshot<384>());
+    unit.historySnapshot.reset(new Snapshot<512>());
+    uint32_t bootId = unit.seed * 2654435761u ^ now;
+    unit.stateSnapshot->begin(bootId);
+    unit.historySnapshot->begin(bootId);
+    unit.backlog.begin(bootId);
+    unit.syncTokens = SYNC_BURST;
+    unit.syncRefillMs = now;
+    unit.source.configure(SyntheticAqi::defaults(unit.seed));
+    FanControlConfig config = {100, 90, 0, 0};
+    unit.controller = FanController();
+    unit.controller.configure(config);
+    unit.bootMs = now;
+    unit.fanOn = false;
+    unit.unpublished = false;
+    // No readings yet: every hour is null
+    unit.aqi = 50;
+    unit.history.reset();
+    publishHistory(unit);
+    publishState(unit);
+}
+
+static void sample(Unit& unit, uint32_t now) {
+    unit.aqi = roundf(unit.source.sample(now - unit.bootMs) * 10) / 10;
+    unit.fanOn = unit.controller.update(unit.aqi, now);
+    unit.history.add(now - unit.bootMs, unit.aqi);
+    unit.backlog.add(now - unit.bootMs, (int32_t)lroundf(unit.aqi * 10),
+                     (unit.fanOn ? BACKLOG_FAN_ON : 0) | BACKLOG_AUTO);
+    samplesTaken++;
+    if (!unit.unpublished && foldChance > 0 && rand() < foldChance * RAND_MAX) {
+        unit.unpublished = true;
+        return;
+    }
+    unit.unpublished = false;
+    publishHistory(unit);
+    publishState(unit);
+}
+
+static void serve(size_t first, size_t last) {
+    while (running) {
+        uint32_t now = nowMs();
+        for (size_t i = first; i < last; i++) {
+            Unit& unit = *units[i];
+            if (unit.restart.exchange(false)) {
+                boot(unit, now);
+                unit.nextSample = now + intervalMs;
+            }
+            if ((int32_t)(now - unit.nextSample) >= 0) {
+                sample(unit, now);
+                unit.nextSample += intervalMs;
+            }
+            uint32_t outageMs = unit.outageMs.exchange(0);
+            if (outageMs > 0 && !unit.offline) {
+                unit.server.close();
+                unit.offline = true;
+                unit.onlineAt = now + outageMs;
+            }
+            if (unit.offline) {
+                if ((int32_t)(now - unit.onlineAt) < 0 || !unit.server.begin()) {
+                    continue;
+                }
+                unit.offline = false;
+            }
+            unit.server.handleClient();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t count = 100;
+    uint16_t port = 9000;
+    size_t threads = 4;
+    double seconds = 0;
+    uint32_t seed = 1;
+    double restartSeconds = 0;
+    double outageSeconds = 0;
+    double outageLength = 300;
+
+    for (int i = 1; i < argc; i++) {
+        const char* name = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "missing value for %s\n", name);
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (strcmp(name, "--units") == 0) count = (size_t)atoi(value);
+        else if (strcmp(name, "--port") == 0) port = (uint16_t)atoi(value);
+        else if (strcmp(name, "--threads") == 0) threads = (size_t)atoi(value);
+        else if (strcmp(name, "--interval") == 0) intervalMs = (uint32_t)atoi(value);
+        else if (strcmp(name, "--seconds") == 0) seconds = atof(value);
+        else if (strcmp(name, "--seed") == 0) seed = (uint32_t)atoi(value);
+        else if (strcmp(name, "--fold") == 0) foldChance = atof(value);
+        else if (strcmp(name, "--restart") == 0) restartSeconds = atof(value);
+        else if (strcmp(name, "--outage") == 0) outageSeconds = atof(value);
+        else if (strcmp(name, "--outage-len") == 0) outageLength = atof(value);
+        else {
+            fprintf(stderr, "unknown option %s\n", name);
+            return 2;
+        }
+    }
+    if (count == 0 || threads == 0) {
+        fprintf(stderr, "need at least one unit and one thread\n");
+        return 2;
+    }
+
+    // A listening socket per unit plus its connections
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    uint32_t startMs = nowMs();
+    for (size_t i = 0; i < count; i++) {
+        std::unique_ptr<Unit> unit(new Unit((uint16_t)(port + i)));
+        Unit* raw = unit.get();
+        raw->seed = seed + (uint32_t)i;
+        raw->restart = false;
+        raw->outageMs = 0;
+        raw->offline = false;
+        raw->server.on("/api/aqi", HTTP_GET, [raw]() {
+            HttpServer& server = raw->server;
+            if (server.hasArg("wait")) {
+                unsigned long waitS = strtoul(server.arg("wait"), nullptr, 10);
+                if (waitS > LONG_POLL_MAX_MS / 1000) waitS = LONG_POLL_MAX_MS / 1000;
+                uint32_t waitMs = waitS * 1000UL;
+                uint32_t since = server.hasArg("since") ? strtoul(server.arg("since"), nullptr, 10)
+                                                        : raw->stateSnapshot->version();
+                if (waitMs > 0 && raw->stateSnapshot->version() == since && server.defer(waitMs, since)) {
+                    return;
+                }
+            }
+            sendSnapshot(server, *raw->stateSnapshot);
+        });
+        raw->server.on("/api/history", HTTP_GET, [raw]() { sendSnapshot(raw->server, *raw->historySnapshot); });
+        raw->server.on("/api/sync", HTTP_GET, [raw]() { sync(*raw); });
+        raw->server.onDeferred([raw](uint32_t since, bool timedOut) {
+            if (raw->stateSnapshot->version() != since || timedOut) {
+                sendSnapshot(raw->server, *raw->stateSnapshot);
+            }
+        });
+        if (!raw->server.begin()) {
+            fprintf(stderr, "can't listen on port %u\n", (unsigned)(port + i));
+            return 1;
+        }
+        boot(*raw, startMs);
+        // Spread the units' sample times over the period
+        raw->nextSample = startMs + (uint32_t)(i * intervalMs / count);
+        units.push_back(std::move(unit));
+    }
+    printf("%zu units on ports %u-%u, %zu threads\n", count, port, (unsigned)(port + count - 1), threads);
+    fflush(stdout);
+
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++) {
+        workers.emplace_back(serve, count * t / threads, count * (t + 1) / threads);
+    }
+
+    uint32_t endMs = (uint32_t)(seconds * 1000);
+    uint32_t restartMs = (uint32_t)(restartSeconds * 1000);
+    uint32_t nextRestart = startMs + restartMs;
+    uint32_t outageMs = (uint32_t)(outageSeconds * 1000);
+    uint32_t nextOutage = startMs + outageMs;
+    uint32_t nextReport = startMs + 10000;
+    uint64_t lastServed = 0;
+    uint64_t restarts = 0;
+    uint64_t outages = 0;
+    while (endMs == 0 || nowMs() - startMs < endMs) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        uint32_t now = nowMs();
+        if (restartMs > 0 && (int32_t)(now - nextRestart) >= 0) {
+            units[rand() % count]->restart = true;
+            restarts++;
+            nextRestart += restartMs;
+        }
+        if (outageMs > 0 && (int32_t)(now - nextOutage) >= 0) {
+            units[rand() % count]->outageMs = (uint32_t)(outageLength * 1000);
+            outages++;
+            nextOutage += outageMs;
+        }
+        if ((int32_t)(now - nextReport) >= 0) {
+            uint64_t served = 0;
+            uint64_t rejected = 0;
+            int waiting = 0;
+            for (const auto& unit : units) {
+                served += unit->server.requestsServed();
+                rejected += unit->server.requestsRejected();
+                waiting += unit->server.deferredCount();
+            }
+            printf("%6.0fs  %llu samples  %.0f req/s  long polls %d  rejected %llu  restarts %llu  outages %llu\n",
+                   (now - startMs) / 1000.0, (unsigned long long)samplesTaken.load(), (served - lastServed) / 10.0,
+                   waiting, (unsigned long long)rejected, (unsigned long long)restarts, (unsigned long long)outages);
+            fflush(stdout);
+            lastServed = served;
+            nextReport += 10000;
+        }
+    }
+    running = false;
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    printf("%llu samples taken\n", (unsigned long long)samplesTaken.load());
+    return 0;
+}
@@ -0,0 +1,164 @@
+// Serves the firmware's request shapes through HttpServer on loopback and
+// counts heap allocations on the serving thread once it has warmed up.
+// Fails (exit 1) if steady-state request handling allocates at all, or if
+// any request gets the wrong status; the mix includes malformed and
+// oversized Content-Length headers, which must be refused before a handler
+// sees them.
+//
+//   pio run -e host_http_alloc && .pio/build/host_http_alloc/program [requests]
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include "AllocCounter.h"
+#include "HttpServer.h"
+
+static HttpServer server(0);
+static float threshold = 100.0f;
+static char response[512];
+
+// Same patterns as the firmware handlers: fixed buffers, in-place body
+static void handleGetAQI() {
+    snprintf(response, sizeof(response),
+             "{\"aqi\":%.1f,\"fanAuto\":true,\"fanState\":false,\"threshold\":%.1f}", 57.3, threshold);
+    server.send(200, "application/json", response);
+}
+
+static void handleSettings() {
+    if (!server.hasBody()) {
+        server.send(400, "application/json", "{\"error\":\"Invalid request\"}");
+        return;
+    }
+    const char* field = strstr(server.body(), "\"threshold\":");
+    if (field) {
+        threshold = strtof(field + 12, nullptr);
+    }
+    server.send(200, "application/json", "{\"status\":\"success\"}");
+}
+
+static void handleMetrics() {
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, "text/plain; version=0.0.4", "");
+    for (int i = 0; i < 20; i++) {
+        int length = snprintf(response, sizeof(response), "metric_%d{route=\"/x\"} %d\n", i, i * 7);
+        server.sendContent(response, length);
+    }
+    server.sendContent("");
+}
+
+static void handleNotFound() {
+    int used = snprintf(response, sizeof(response), "File Not Found\n\nURI: %s\nArguments: %d\n",
+                        server.uri(), server.args());
+    for (int i = 0; i < server.args() && used < (int)sizeof(response); i++) {
+        used += snprintf(response + used, sizeof(response) - used, " %s: %s\n",
+                         server.argName(i), server.arg(i));
+    }
+    server.send(404, "text/plain", response);
+}
+
+static const char* requests[] = {
+    "GET /api/aqi HTTP/1.1\r\nHost: openair\r\nIf-None-Match: \"41\"\r\n\r\n",
+    "POST /api/settings HTTP/1.1\r\nHost: openair\r\nContent-Type: application/json\r\n"
+    "Content-Length: 17\r\n\r\n{\"threshold\":120}",
+    "GET /metrics HTTP/1.1\r\nHost: openair\r\n\r\n",
+    "GET /missing?a=1&b=two%20words HTTP/1.1\r\nHost: openair\r\n\r\n",
+    "POST /api/settings HTTP/1.1\r\nHost: openair\r\nContent-Length: -1\r\n\r\n{\"threshold\":1}",
+    "POST /api/settings HTTP/1.1\r\nHost: openair\r\nContent-Length: 18446744073709551615\r\n\r\n{}",
+    "POST /api/settings HTTP/1.1\r\nHost: openair\r\nContent-Length: 99999999999999999999999\r\n\r\n{}",
+    "POST /api/settings HTTP/1.1\r\nHost: openair\r\nContent-Length: 17x\r\n\r\n{\"threshold\":120}",
+    "POST /api/settings HTTP/1.1\r\nHost: openair\r\nContent-Length: 4096\r\n\r\n{}",
+};
+static const int expectedStatus[] = {200, 200, 200, 404, 400, 413, 400, 400, 413};
+#define REQUEST_KINDS (int)(sizeof(requests) / sizeof(requests[0]))
+
+static int exchange(uint16_t port, const char* request) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    send(fd, request, strlen(request), 0);
+
+    char reply[2048];
+    size_t used = 0;
+    ssize_t received;
+    while ((received = recv(fd, reply + used, sizeof(reply) - 1 - used, 0)) > 0) {
+        used += received;
+    }
+    close(fd);
+    reply[used] = '\0';
+    int status = 0;
+    sscanf(reply, "HTTP/1.1 %d", &status);
+    return status;
+}
+
+int main(int argc, char** argv) {
+    int total = argc > 1 ? atoi(argv[1]) : 20000;
+    const int warmup = 200;
+
+    server.on("/api/aqi", HTTP_GET, handleGetAQI);
+    server.on("/api/settings", HTTP_POST, handleSettings);
+    server.on("/metrics", HTTP_GET, handleMetrics);
+    server.onNotFound(handleNotFound);
+    if (!server.begin()) {
+        perror("begin");
+        return 1;
+    }
+
+    std::atomic<int> completed(0);
+    std::atomic<int> failures(0);
+    std::thread client([&]() {
+        for (int i = 0; i < total; i++) {
+            int which = i % REQUEST_KINDS;
+            if (exchange(server.port(), requests[which]) != expectedStatus[which]) {
+                failures++;
+            }
+            completed++;
+        }
+    });
+
+    bool counting = false;
+    auto start = std::chrono::steady_clock::now();
+    uint32_t servedAtStart = 0;
+    while (completed.load() < total) {
+        if (!counting && completed.load() >= warmup) {
+            counting = true;
+            servedAtStart = server.requestsServed();
+            start = std::chrono::steady_clock::now();
+            allocCounterEnable(true);
+        }
+        server.handleClient();
+    }
+    allocCounterEnable(false);
+    client.join();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint32_t measured = server.requestsServed() - servedAtStart;
+    printf("requests: %d (%d failed), measured: %u in %.2f s (%.0f req/s)\n", total,
+           failures.load(), measured, seconds, measured / seconds);
+    printf("steady-state heap allocations: %llu\n", (unsigned long long)allocCount());
+
+    if (threshold != 120.0f) {
+        printf("threshold changed by a rejected request: %.1f\n", threshold);
+        failures++;
+    }
+    if (failures.load() > 0 || allocCount() > 0) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
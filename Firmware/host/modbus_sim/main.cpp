@@ -0,0 +1,173 @@
+// Serves the firmware's Modbus TCP register map from a simulated filter so a
+// BMS, SCADA package or any standard Modbus client can be pointed at it
+// without hardware. The AQI comes from the synthetic profile, the fan from
+// the firmware's controller, and writes go through the same checks as on
+// the device. Every accepted write is printed.
+//
+//   pio run -e host_modbus_sim && .pio/build/host_modbus_sim/program [options]
+//     --port P          listen port (default 1502; 502 needs root)
+//     --seconds S       run time (default: until killed)
+//     --interval MS     sample period (default 2000, the firmware's)
+//     --seed N          synthetic profile seed (default 1)
+//
+//   mbpoll -m tcp -p 1502 -a 1 -r 1 -c 12 -t 4 localhost     read the map
+//   mbpoll -m tcp -p 1502 -a 1 -r 8 -t 4 localhost 800       threshold 80.0
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#include "AqiSim.h"
+#include "FanControl.h"
+#include "ModbusTcp.h"
+#include "OpenAirRegisters.h"
+
+static uint32_t nowMs() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Simulated control state
+static FanController controller;
+static bool autoMode = true;
+static bool fanOn = false;
+static float aqi = 0;
+static float threshold = 100;
+static float hysteresis = 10;
+static uint16_t registers[REG_COUNT];
+static uint32_t startMs;
+
+static void configureController() {
+    FanControlConfig config = controller.config();
+    config.onThreshold = threshold;
+    config.offThreshold = threshold - hysteresis;
+    controller.configure(config);
+}
+
+static void publishRegisters() {
+    OpenAirValues values;
+    values.aqi = aqi;
+    values.pm25 = NAN;
+    values.pm10 = NAN;
+    values.fanOn = fanOn;
+    values.fanRpm = fanOn ? 1400 : 0;
+    values.autoMode = autoMode;
+    values.threshold = threshold;
+    values.hysteresis = hysteresis;
+    values.uptimeS = (nowMs() - startMs) / 1000;
+    values.fanAlert = 0;
+    encodeRegisters(values, registers);
+}
+
+static uint8_t readRegisters(bool, uint16_t address, uint16_t count, uint16_t* values) {
+    if (address + count > REG_COUNT) {
+        return MODBUS_ILLEGAL_ADDRESS;
+    }
+    encodeLiveRegisters(fanOn ? 1400 : 0, (nowMs() - startMs) / 1000, 0, registers);
+    memcpy(values, registers + address, count * sizeof(uint16_t));
+    return MODBUS_OK;
+}
+
+// Same rules as the firmware: the whole write is checked before any of it
+// is applied
+static uint8_t writeRegisters(uint16_t address, uint16_t count, const uint16_t* values) {
+    for (uint16_t i = 0; i < count; i++) {
+        uint16_t reg = address + i;
+        if (!registerWritable(reg)) {
+            return MODBUS_ILLEGAL_ADDRESS;
+        }
+        bool valid = true;
+        if (reg == REG_FAN_ON || reg == REG_AUTO_MODE) {
+            valid = values[i] <= 1;
+        } else if (reg == REG_THRESHOLD) {
+            valid = validThreshold(values[i] / 10.0f);
+        } else if (reg == REG_HYSTERESIS) {
+            valid = validHysteresis(values[i] / 10.0f);
+        }
+        if (!valid) {
+            printf("rejected write of %u to register %u\n", values[i], reg);
+            return MODBUS_ILLEGAL_VALUE;
+        }
+    }
+
+    uint32_t now = nowMs();
+    for (uint16_t i = 0; i < count; i++) {
+        uint16_t reg = address + i;
+        if (reg == REG_FAN_ON) {
+            autoMode = false;
+            fanOn = values[i] != 0;
+            controller.force(fanOn, now);
+        } else if (reg == REG_AUTO_MODE) {
+            autoMode = values[i] != 0;
+        } else if (reg == REG_THRESHOLD) {
+            threshold = values[i] / 10.0f;
+        } else if (reg == REG_HYSTERESIS) {
+            hysteresis = values[i] / 10.0f;
+        }
+    }
+    configureController();
+    publishRegisters();
+    printf("write %u..%u: fan %s, auto %s, threshold %.1f, hysteresis %.1f\n", address, address + count - 1,
+           fanOn ? "on" : "off", autoMode ? "on" : "off", threshold, hysteresis);
+    fflush(stdout);
+    return MODBUS_OK;
+}
+
+int main(int argc, char** argv) {
+    uint16_t port = 1502;
+    double seconds = 0;
+    uint32_t intervalMs = 2000;
+    uint32_t seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        const char* name = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "missing value for %s\n", name);
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (strcmp(name, "--port") == 0) port = (uint16_t)atoi(value);
+        else if (strcmp(name, "--seconds") == 0) seconds = atof(value);
+        else if (strcmp(name, "--interval") == 0) intervalMs = (uint32_t)atoi(value);
+        else if (strcmp(name, "--seed") == 0) seed = (uint32_t)atoi(value);
+        else {
+            fprintf(stderr, "unknown option %s\n", name);
+            return 2;
+        }
+    }
+
+    ModbusTcpServer server(port);
+    server.onRead(readRegisters);
+    server.onWrite(writeRegisters);
+    if (!server.begin()) {
+        fprintf(stderr, "can't listen on port %u\n", port);
+        return 1;
+    }
+    printf("Modbus TCP on port %u, %d registers\n", port, REG_COUNT);
+
+    FanControlConfig config = {threshold, threshold - hysteresis, 0, 0};
+    controller.configure(config);
+    SyntheticAqi source(SyntheticAqi::defaults(seed));
+    startMs = nowMs();
+    uint32_t nextSample = startMs;
+    uint32_t endMs = (uint32_t)(seconds * 1000);
+    publishRegisters();
+
+    while (endMs == 0 || nowMs() - startMs < endMs) {
+        uint32_t now = nowMs();
+        if ((int32_t)(now - nextSample) >= 0) {
+            aqi = source.sample(now - startMs);
+            if (autoMode) {
+                fanOn = controller.update(aqi, now);
+            }
+            publishRegisters();
+            nextSample += intervalMs;
+        }
+        server.poll();
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    printf("%u requests, %u exceptions\n", server.requestCount(), server.exceptionCount());
+    return 0;
+}
@@ -0,0 +1,228 @@
+// Runs the firmware's MQTT publisher against a real broker with synthetic
+// samples, printing the outbox and link counters every few seconds. Stop
+// the broker mid-run to watch the outbox fill (and drop its oldest samples
+// once full), start it again to watch the backlog drain in full batches at
+// the drain rate. With --check it subscribes to its own sample topic and at
+// the end reports samples that never arrived or arrived twice. With
+// --discovery it announces itself to Home Assistant like the firmware and
+// obeys the fan, auto-mode and threshold commands.
+//
+//   mosquitto -p 1883 &
+//   pio run -e host_mqtt_pub && .pio/build/host_mqtt_pub/program [options]
+//     --host H --port P     broker (default localhost:1883)
+//     --prefix P            topic prefix (default openair/host)
+//     --seconds S           run time (default 60)
+//     --interval MS         sample period (default 2000, the firmware's)
+//     --qos Q --batch N --drain-rate R --burst N --ack-timeout MS
+//     --check               subscribe to the samples and verify delivery
+//     --discovery           Home Assistant discovery and commands
+//
+//   mosquitto_sub -v -t 'openair/#' -t 'homeassistant/#' shows what goes out;
+//   mosquitto_pub -t openair/host/fan/set -m on switches the fan.
+
+#include <chrono>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#include "AqiSim.h"
+#include "HaDiscovery.h"
+#include "MqttClient.h"
+#include "MqttPublisher.h"
+
+static uint32_t nowMs() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static std::set<uint32_t> seen;
+static uint32_t duplicates = 0;
+
+// Simulated control state, changed by the AQI and by commands
+static bool fanOn = false;
+static bool autoMode = true;
+static float threshold = 100;
+static MqttClient client;
+static HaDevice device;
+static bool discovery = false;
+
+static void announce() {
+    char topic[96];
+    char payload[768];
+    for (int i = 0; i < HA_ENTITY_COUNT; i++) {
+        size_t length = discovery ? haConfigPayload(i, device, payload, sizeof(payload)) : 0;
+        if (haConfigTopic(i, device, topic, sizeof(topic))) {
+            client.publish(topic, (const uint8_t*)payload, length, 1, true);
+        }
+    }
+    if (haCommandFilter(device, topic, sizeof(topic))) {
+        client.subscribe(topic, 1);
+    }
+}
+
+static void onCommand(const char* topic, const uint8_t* payload, size_t length) {
+    HaCommand command = haParseCommand(device, topic, payload, length);
+    switch (command.type) {
+        case HA_COMMAND_FAN:
+            autoMode = false;
+            fanOn = command.on;
+            break;
+        case HA_COMMAND_AUTO:
+            autoMode = command.on;
+            break;
+        case HA_COMMAND_THRESHOLD:
+            threshold = command.value;
+            break;
+        case HA_COMMAND_NONE:
+            printf("ignored message on %s\n", topic);
+            return;
+    }
+    printf("command %s: fan %s, auto %s, threshold %.0f\n", topic, fanOn ? "on" : "off", autoMode ? "on" : "off",
+           threshold);
+}
+
+// Collects sample times from {"now":..,"samples":[[t,aqi],...]} payloads
+static void onSamples(const char*, const uint8_t* payload, size_t length) {
+    const char* p = (const char*)payload;
+    const char* end = p + length;
+    const char* samples = strstr(p, "\"samples\":[");
+    if (!samples) {
+        return;
+    }
+    for (p = samples + 11; p < end; p++) {
+        if (*p == '[') {
+            uint32_t timeMs = (uint32_t)strtoul(p + 1, nullptr, 10);
+            if (!seen.insert(timeMs).second) {
+                duplicates++;
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* host = "localhost";
+    uint16_t port = 1883;
+    const char* prefix = "openair/host";
+    double seconds = 60;
+    uint32_t intervalMs = 2000;
+    bool check = false;
+    MqttPublisherConfig config = MqttPublisher::defaults();
+
+    for (int i = 1; i < argc; i++) {
+        const char* name = argv[i];
+        if (strcmp(name, "--check") == 0) {
+            check = true;
+            continue;
+        }
+        if (strcmp(name, "--discovery") == 0) {
+            discovery = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "missing value for %s\n", name);
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (strcmp(name, "--host") == 0) host = value;
+        else if (strcmp(name, "--port") == 0) port = (uint16_t)atoi(value);
+        else if (strcmp(name, "--prefix") == 0) prefix = value;
+        else if (strcmp(name, "--seconds") == 0) seconds = atof(value);
+        else if (strcmp(name, "--interval") == 0) intervalMs = (uint32_t)atoi(value);
+        else if (strcmp(name, "--qos") == 0) config.qos = (uint8_t)atoi(value);
+        else if (strcmp(name, "--batch") == 0) config.maxBatch = (uint16_t)atoi(value);
+        else if (strcmp(name, "--drain-rate") == 0) config.drainRate = atof(value);
+        else if (strcmp(name, "--burst") == 0) config.drainBurst = (uint16_t)atoi(value);
+        else if (strcmp(name, "--ack-timeout") == 0) config.ackTimeoutMs = (uint32_t)atoi(value);
+        else {
+            fprintf(stderr, "unknown option %s\n", name);
+            return 2;
+        }
+    }
+
+    MqttPublisher publisher(client);
+    publisher.configure(config);
+    char clientId[32];
+    snprintf(clientId, sizeof(clientId), "openair-host-%u", (unsigned)(nowMs() % 100000));
+    publisher.setServer(host, port, clientId, nullptr, nullptr, prefix);
+    device.id = clientId;
+    device.name = "OpenFilter host";
+    device.topicPrefix = prefix;
+    publisher.onConnect(announce);
+    client.onMessage(onCommand);
+
+    MqttClient checker;
+    char sampleTopic[MQTT_TOPIC_MAX];
+    snprintf(sampleTopic, sizeof(sampleTopic), "%s/samples", prefix);
+    checker.onMessage(onSamples);
+    MqttConnectOptions checkerOptions = {"openair-check", nullptr, nullptr, 30, nullptr, nullptr, false};
+
+    SyntheticAqi aqi(SyntheticAqi::defaults(1));
+    uint32_t start = nowMs();
+    uint32_t nextSample = start;
+    uint32_t nextReport = start;
+    uint32_t produced = 0;
+    float lastValue = 0;
+    uint32_t endMs = (uint32_t)(seconds * 1000);
+
+    printf("   time  link  queued  dropped    sent  batches  connects  failures  ack timeouts\n");
+    while (nowMs() - start < endMs || (check && publisher.queued() > 0 && nowMs() - start < endMs + 30000)) {
+        uint32_t now = nowMs();
+        if (check && !checker.connected() && checker.connect(host, port, checkerOptions)) {
+            checker.subscribe(sampleTopic, 1);
+        }
+        if (check) {
+            checker.loop();
+        }
+        if (now - start < endMs && (int32_t)(now - nextSample) >= 0) {
+            // Sample times are unique, which is what --check counts on
+            float value = aqi.sample(now - start);
+            publisher.add(now, value);
+            lastValue = value;
+            produced++;
+            nextSample += intervalMs;
+            if (autoMode && value > threshold) fanOn = true;
+            if (autoMode && value < threshold - 10) fanOn = false;
+        }
+        char state[128];
+        snprintf(state, sizeof(state),
+                 "{\"aqi\":%.1f,\"fan\":\"%s\",\"auto\":%s,\"threshold\":%.1f,\"hysteresis\":10.0}",
+                 lastValue, fanOn ? "on" : "off", autoMode ? "true" : "false", threshold);
+        publisher.setState(state);
+        publisher.loop(now);
+        if ((int32_t)(now - nextReport) >= 0) {
+            printf("%6.1fs  %4s  %6zu  %7u  %6u  %7u  %8u  %8u  %12u\n", (now - start) / 1000.0,
+                   publisher.connected() ? "up" : "down", publisher.queued(), publisher.dropped(),
+                   publisher.samplesSent(), publisher.batchesSent(), publisher.connects(),
+                   publisher.connectFailures(), publisher.ackTimeouts());
+            fflush(stdout);
+            nextReport += 5000;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    publisher.stop();
+
+    printf("\nProduced %u samples, %u sent in %u messages (%.1f per message), %u dropped, %zu still queued\n",
+           produced, publisher.samplesSent(), publisher.batchesSent(),
+           publisher.batchesSent() ? (double)publisher.samplesSent() / publisher.batchesSent() : 0.0,
+           publisher.dropped(), publisher.queued());
+    if (!check) {
+        return 0;
+    }
+    // Give the last messages time to come back
+    uint32_t settle = nowMs();
+    while (nowMs() - settle < 1000) {
+        checker.loop();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    // A sample dropped from a full outbox may already have gone out in a
+    // batch whose ack was lost, so only a shortfall counts as missing
+    int missing = (int)(produced - publisher.dropped() - publisher.queued() - seen.size());
+    if (missing < 0) {
+        missing = 0;
+    }
+    printf("Received %zu distinct samples, %u duplicates (resent after a lost ack), %d missing\n", seen.size(),
+           duplicates, missing);
+    return missing == 0 ? 0 : 1;
+}
@@ -0,0 +1,434 @@
+// Uploads a firmware image to a unit over PUT /api/ota, resuming after
+// dropped connections, or (with --serve) stands in for a unit so the upload
+// path can be exercised on the host.
+//
+// Upload: reads the image, hashes it, asks the unit where an earlier upload
+// of the same image got to (GET /api/ota) and sends the rest, in --chunk
+// sized requests if given. After a failure it asks again and carries on from
+// what the unit actually has. The unit reboots into the image once it's all
+// in and the SHA-256 matches.
+//
+// Serve: the firmware's /api/ota routes over HttpServer, writing the image
+// to a file. --write-ms adds a delay per flash sector, and a stand-in for
+// loop()'s other work reports the longest gap between its runs, which is
+// what sensing and fan control would see during an upload.
+//
+//   pio run -e host_ota_upload && .pio/build/host_ota_upload/program [options]
+//     --file F            image to upload
+//     --host H            unit address (default 127.0.0.1)
+//     --port P            unit HTTP port (default 80)
+//     --chunk BYTES       bytes per request (default: all that's left)
+//     --retries N         attempts after failures (default 20)
+//     --drop-after BYTES  testing: cut each connection after sending this many
+//                         body bytes
+//     --token T           the unit's OTA token (set in its configuration mode)
+//
+//     --serve P           act as a unit on port P instead
+//     --image F           where the served unit writes images (default ota_image.bin)
+//     --capacity BYTES    largest image it takes (default 1310720, one app slot)
+//     --write-ms MS       simulated time to write a sector (default 0)
+//     --token T           token the served unit requires; without one it
+//                         refuses updates, as a unit with no token does
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "HttpServer.h"
+#include "OtaUpdate.h"
+#include "Sha256.h"
+
+static uint32_t nowMs() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// --- Unit stand-in
+
+// File target that takes as long as a flash sector erase and write would
+class SlowFileTarget : public FileOtaTarget {
+public:
+    SlowFileTarget(const char* path, size_t capacity, uint32_t writeMs)
+        : FileOtaTarget(path, capacity), writeMs_(writeMs) {}
+
+    bool write(const uint8_t* data, size_t length) override {
+        if (writeMs_ > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(writeMs_));
+        }
+        return FileOtaTarget::write(data, length);
+    }
+
+private:
+    uint32_t writeMs_;
+};
+
+static HttpServer* unitServer = nullptr;
+static OtaUpdate* unitOta = nullptr;
+static OtaResult requestResult = OTA_OK;
+static const char* token = "";
+
+static void sendStatus(int code, OtaResult result) {
+    char body[320];
+    snprintf(body, sizeof(body),
+             "{\"state\":\"%s\",\"size\":%zu,\"received\":%zu,\"sha256\":\"%s\",\"error\":\"%s\"}",
+             OtaUpdate::stateName(unitOta->state()), unitOta->size(), unitOta->received(), unitOta->digest(),
+             OtaUpdate::resultName(result));
+    unitServer->send(code, "application/json", body);
+}
+
+// Same checks as the firmware's startOtaUpload(), token first
+static OtaResult startUpload() {
+    OtaResult result = otaAuthorize(unitServer->header("Authorization"), token);
+    if (result != OTA_OK) {
+        return result;
+    }
+    result = unitOta->begin(strtoul(unitServer->arg("size"), nullptr, 10), unitServer->arg("sha256"));
+    if (result == OTA_OK && strtoul(unitServer->arg("offset"), nullptr, 10) != unitOta->received()) {
+        result = OTA_WRONG_OFFSET;
+    }
+    return result;
+}
+
+static int serve(uint16_t port, const char* imagePath, size_t capacity, uint32_t writeMs) {
+    SlowFileTarget target(imagePath, capacity, writeMs);
+    OtaUpdate ota(target);
+    HttpServer server(port);
+    unitServer = &server;
+    unitOta = &ota;
+
+    server.on("/api/ota", HTTP_GET, []() { sendStatus(200, unitOta->error()); });
+    server.on("/api/ota", HTTP_DELETE, []() {
+        OtaResult result = otaAuthorize(unitServer->header("Authorization"), token);
+        if (result != OTA_OK) {
+            sendStatus(result == OTA_DISABLED ? 403 : 401, result);
+            return;
+        }
+        unitOta->abort();
+        sendStatus(200, OTA_OK);
+    });
+    server.on(
+        "/api/ota", HTTP_PUT,
+        []() {
+            if (unitServer->streamedLength() == 0) {
+                requestResult = startUpload();
+            }
+            int code = 500;
+            switch (requestResult) {
+                case OTA_OK: code = 200; break;
+                case OTA_UNAUTHORIZED: code = 401; break;
+                case OTA_DISABLED: code = 403; break;
+                case OTA_BAD_REQUEST: code = 400; break;
+                case OTA_TOO_LARGE: code = 413; break;
+                case OTA_WRONG_OFFSET:
+                case OTA_NOT_RECEIVING: code = 409; break;
+                case OTA_DIGEST_MISMATCH:
+                case OTA_INVALID_IMAGE: code = 422; break;
+                case OTA_WRITE_FAILED: code = 500; break;
+            }
+            sendStatus(code, requestResult);
+        },
+        [](const uint8_t* data, size_t length) {
+            if (unitServer->streamedLength() == 0) {
+                requestResult = startUpload();
+                if (requestResult != OTA_OK) {
+                    return false;
+                }
+            }
+            requestResult = unitOta->write(data, length);
+            return requestResult == OTA_OK;
+        });
+    if (!server.begin()) {
+        fprintf(stderr, "can't listen on port %u\n", port);
+        return 1;
+    }
+    printf("unit on port %u, images to %s\n", server.port(), imagePath);
+    fflush(stdout);
+
+    // loop(): serve, then the rest of the work; track how long the rest
+    // waits while an upload is running
+    OtaState lastState = ota.state();
+    size_t lastReceived = 0;
+    uint32_t lastRun = nowMs();
+    uint32_t longestGap = 0;
+    while (true) {
+        server.handleClient();
+        uint32_t now = nowMs();
+        if (ota.state() == OTA_RECEIVING && now - lastRun > longestGap) {
+            longestGap = now - lastRun;
+        }
+        lastRun = now;
+
+        if (ota.state() != lastState || (ota.state() == OTA_RECEIVING && ota.received() / 65536 != lastReceived / 65536)) {
+            if (ota.state() == OTA_READY) {
+                printf("image of %zu bytes verified (%s); longest loop gap during upload %u ms\n", ota.size(),
+                       ota.digest(), longestGap);
+                longestGap = 0;
+            } else if (ota.state() == OTA_FAILED) {
+                printf("upload failed: %s\n", OtaUpdate::resultName(ota.error()));
+            } else {
+                printf("%s %zu/%zu\n", OtaUpdate::stateName(ota.state()), ota.received(), ota.size());
+            }
+            fflush(stdout);
+            lastState = ota.state();
+            lastReceived = ota.received();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+// --- Uploader
+
+struct Status {
+    int code = 0;
+    std::string state;
+    std::string sha256;
+    size_t size = 0;
+    size_t received = 0;
+    std::string error;
+};
+
+static std::string jsonString(const std::string& body, const char* key) {
+    std::string pattern = std::string("\"") + key + "\":\"";
+    size_t start = body.find(pattern);
+    if (start == std::string::npos) {
+        return "";
+    }
+    start += pattern.size();
+    size_t end = body.find('"', start);
+    return end == std::string::npos ? "" : body.substr(start, end - start);
+}
+
+static size_t jsonNumber(const std::string& body, const char* key) {
+    std::string pattern = std::string("\"") + key + "\":";
+    size_t start = body.find(pattern);
+    return start == std::string::npos ? 0 : strtoul(body.c_str() + start + pattern.size(), nullptr, 10);
+}
+
+static int connectTo(const char* host, uint16_t port) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    if (getaddrinfo(host, nullptr, &hints, &result) != 0 || !result) {
+        return -1;
+    }
+    struct sockaddr_in address;
+    memcpy(&address, result->ai_addr, sizeof(address));
+    address.sin_port = htons(port);
+    freeaddrinfo(result);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct timeval timeout = {10, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool sendAll(int fd, const uint8_t* data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+// One request; the unit closes the connection after answering. With
+// dropAfter set, the connection is cut once that much of the body is sent.
+static bool request(const char* host, uint16_t port, const char* method, const std::string& path,
+                    const uint8_t* body, size_t length, size_t dropAfter, Status& status) {
+    int fd = connectTo(host, port);
+    if (fd < 0) {
+        return false;
+    }
+    char authorization[80] = "";
+    if (token[0]) {
+        snprintf(authorization, sizeof(authorization), "Authorization: Bearer %s\r\n", token);
+    }
+    char head[512];
+    int headLength = snprintf(head, sizeof(head),
+                              "%s %s HTTP/1.1\r\nHost: %s\r\n%sContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                              method, path.c_str(), host, authorization, length);
+    bool cut = dropAfter > 0 && dropAfter < length;
+    if (!sendAll(fd, (const uint8_t*)head, headLength) || !sendAll(fd, body, cut ? dropAfter : length) || cut) {
+        close(fd);
+        return false;
+    }
+
+    std::string response;
+    char buffer[1024];
+    ssize_t received;
+    while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        response.append(buffer, received);
+    }
+    close(fd);
+    size_t bodyStart = response.find("\r\n\r\n");
+    if (sscanf(response.c_str(), "HTTP/1.%*d %d", &status.code) != 1 || bodyStart == std::string::npos) {
+        return false;
+    }
+    std::string json = response.substr(bodyStart + 4);
+    status.state = jsonString(json, "state");
+    status.sha256 = jsonString(json, "sha256");
+    status.error = jsonString(json, "error");
+    status.size = jsonNumber(json, "size");
+    status.received = jsonNumber(json, "received");
+    return true;
+}
+
+static int upload(const char* host, uint16_t port, const char* path, size_t chunk, int retries, size_t dropAfter) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "can't open %s\n", path);
+        return 1;
+    }
+    std::vector<uint8_t> image;
+    uint8_t buffer[65536];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        image.insert(image.end(), buffer, buffer + count);
+    }
+    fclose(file);
+    if (image.empty()) {
+        fprintf(stderr, "%s is empty\n", path);
+        return 1;
+    }
+
+    Sha256 sha;
+    sha.update(image.data(), image.size());
+    uint8_t digest[SHA256_SIZE];
+    sha.finish(digest);
+    char hex[SHA256_SIZE * 2 + 1];
+    Sha256::toHex(digest, hex);
+    printf("%s: %zu bytes, sha256 %s\n", path, image.size(), hex);
+
+    uint32_t startMs = nowMs();
+    size_t sent = 0;
+    int failures = 0;
+    bool done = false;
+    while (!done) {
+        // Where does the unit stand with this image?
+        Status status;
+        if (!request(host, port, "GET", "/api/ota", nullptr, 0, 0, status)) {
+            if (++failures > retries) {
+                fprintf(stderr, "giving up: unit not answering\n");
+                return 1;
+            }
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            continue;
+        }
+        bool same = status.sha256 == hex && status.size == image.size();
+        if (same && status.state == "ready") {
+            break;  // Already uploaded
+        }
+        size_t offset = same && status.state == "receiving" ? status.received : 0;
+        if (offset > 0) {
+            printf("unit has %zu bytes, continuing\n", offset);
+        }
+
+        // Send the rest, a chunk per request
+        while (offset < image.size()) {
+            size_t length = image.size() - offset;
+            if (chunk > 0 && length > chunk) {
+                length = chunk;
+            }
+            char query[160];
+            snprintf(query, sizeof(query), "/api/ota?size=%zu&sha256=%s&offset=%zu", image.size(), hex, offset);
+            sent += dropAfter > 0 && dropAfter < length ? dropAfter : length;
+            if (!request(host, port, "PUT", query, image.data() + offset, length, dropAfter, status)) {
+                failures++;
+                printf("connection lost after offset %zu\n", offset);
+                break;
+            }
+            if (status.code == 409) {
+                break;  // Out of step; ask again
+            }
+            if (status.code != 200) {
+                fprintf(stderr, "unit refused the upload: %d %s\n", status.code, status.error.c_str());
+                return 1;
+            }
+            offset = status.received;
+            done = status.state == "ready";
+        }
+        if (done) {
+            break;
+        }
+        if (failures > retries) {
+            fprintf(stderr, "giving up after %d failures\n", failures);
+            return 1;
+        }
+        // The unit may still be holding the cut connection; give it time
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+
+    double seconds = (nowMs() - startMs) / 1000.0;
+    printf("image verified by the unit, which reboots into it (%zu bytes sent in %.1f s, %d retries)\n", sent, seconds,
+           failures);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    const char* path = nullptr;
+    const char* host = "127.0.0.1";
+    uint16_t port = 80;
+    size_t chunk = 0;
+    int retries = 20;
+    size_t dropAfter = 0;
+    int servePort = -1;
+    const char* imagePath = "ota_image.bin";
+    size_t capacity = 1310720;
+    uint32_t writeMs = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char* name = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "missing value for %s\n", name);
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (strcmp(name, "--file") == 0) path = value;
+        else if (strcmp(name, "--host") == 0) host = value;
+        else if (strcmp(name, "--port") == 0) port = (uint16_t)atoi(value);
+        else if (strcmp(name, "--chunk") == 0) chunk = strtoul(value, nullptr, 10);
+        else if (strcmp(name, "--retries") == 0) retries = atoi(value);
+        else if (strcmp(name, "--drop-after") == 0) dropAfter = strtoul(value, nullptr, 10);
+        else if (strcmp(name, "--serve") == 0) servePort = atoi(value);
+        else if (strcmp(name, "--image") == 0) imagePath = value;
+        else if (strcmp(name, "--capacity") == 0) capacity = strtoul(value, nullptr, 10);
+        else if (strcmp(name, "--write-ms") == 0) writeMs = (uint32_t)atoi(value);
+        else if (strcmp(name, "--token") == 0) token = value;
+        else {
+            fprintf(stderr, "unknown option %s\n", name);
+            return 2;
+        }
+    }
+
+    if (servePort >= 0) {
+        return serve((uint16_t)servePort, imagePath, capacity, writeMs);
+    }
+    if (!path) {
+        fprintf(stderr, "--file is required\n");
+        return 2;
+    }
+    return upload(host, port, path, chunk, retries, dropAfter);
+}
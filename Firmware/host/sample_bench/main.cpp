@@ -0,0 +1,123 @@
+// Throughput of SampleQueue with one producer and several consumer threads.
+// The last consumer is deliberately slow to show that it only loses samples
+// (counted as missed) and never slows the producer or the other consumers.
+// The producer runs at a fixed rate (0 = flat out, which mostly measures
+// how fast consumers can be lapped). Fails (exit 1) if a consumer sees a
+// corrupt or out-of-order sample, or if received + missed doesn't account
+// for every published sample.
+//
+//   pio run -e host_sample_bench && .pio/build/host_sample_bench/program [samples] [consumers] [slowDelayUs] [rate/s]
+
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#include "SampleQueue.h"
+
+// Same shape as the firmware's sample plus a check word
+struct BenchSample {
+    uint32_t sequence;
+    uint32_t timeMs;
+    float aqi;
+    uint32_t check;
+};
+
+static SampleQueue<BenchSample, 64> queue;
+static std::atomic<bool> producing(true);
+static std::atomic<int> ready(0);
+static std::atomic<bool> failed(false);
+
+static uint32_t checkFor(uint32_t sequence) { return sequence * 2654435761u; }
+
+struct ConsumerResult {
+    uint32_t received;
+    uint32_t missed;
+    uint32_t maxGap;
+};
+
+int main(int argc, char** argv) {
+    uint32_t samples = argc > 1 ? (uint32_t)atol(argv[1]) : 1000000;
+    int consumers = argc > 2 ? atoi(argv[2]) : 4;
+    int slowDelayUs = argc > 3 ? atoi(argv[3]) : 50;
+    double rate = argc > 4 ? atof(argv[4]) : 200000;
+
+    std::vector<ConsumerResult> results(consumers);
+    std::vector<std::thread> threads;
+    for (int c = 0; c < consumers; c++) {
+        threads.emplace_back([&, c]() {
+            bool slow = c == consumers - 1 && slowDelayUs > 0;
+            SampleQueue<BenchSample, 64>::Cursor cursor = queue.subscribe(true);
+            ready++;
+            uint32_t expected = 0;
+            uint32_t maxGap = 0;
+            BenchSample sample;
+            for (;;) {
+                bool done = !producing.load(std::memory_order_acquire);
+                while (queue.read(cursor, sample)) {
+                    if (sample.sequence < expected || sample.check != checkFor(sample.sequence) ||
+                        sample.aqi != (float)(sample.sequence % 500)) {
+                        fprintf(stderr, "consumer %d: bad sample %lu (expected >= %lu)\n", c,
+                                (unsigned long)sample.sequence, (unsigned long)expected);
+                        failed = true;
+                        return;
+                    }
+                    if (sample.sequence - expected > maxGap) {
+                        maxGap = sample.sequence - expected;
+                    }
+                    expected = sample.sequence + 1;
+                    if (slow) {
+                        std::this_thread::sleep_for(std::chrono::microseconds(slowDelayUs));
+                    }
+                }
+                if (done) {
+                    break;
+                }
+                std::this_thread::yield();
+            }
+            results[c] = {cursor.received, cursor.missed, maxGap};
+        });
+    }
+
+    while (ready.load() < consumers) {
+        std::this_thread::yield();
+    }
+    auto start = std::chrono::steady_clock::now();
+    double publishNs = 0;
+    for (uint32_t i = 0; i < samples; i++) {
+        if (rate > 0 && (i & 63) == 0) {
+            // Pace in batches of 64, sleeping so consumers get the CPU
+            // even on a single core
+            std::this_thread::sleep_until(start + std::chrono::nanoseconds((uint64_t)(i / rate * 1e9)));
+        }
+        BenchSample sample = {i, i * 2, (float)(i % 500), checkFor(i)};
+        auto before = std::chrono::steady_clock::now();
+        queue.publish(sample);
+        if ((i & 1023) == 0) {
+            publishNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - before).count();
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    producing.store(false, std::memory_order_release);
+    for (auto& t : threads) t.join();
+
+    printf("%lu samples, %d consumers, ring of %lu\n", (unsigned long)samples, consumers,
+           (unsigned long)queue.capacity());
+    printf("producer: %.3f s, %.2f M samples/s, %.0f ns/publish (sampled, incl. clock read)\n", seconds,
+           samples / seconds / 1e6, publishNs / ((samples + 1023) / 1024));
+    for (int c = 0; c < consumers; c++) {
+        const ConsumerResult& r = results[c];
+        printf("consumer %d%s: received %lu (%.1f%%), missed %lu, largest gap %lu\n", c,
+               c == consumers - 1 && slowDelayUs > 0 ? " (slow)" : "", (unsigned long)r.received,
+               100.0 * r.received / samples, (unsigned long)r.missed, (unsigned long)r.maxGap);
+        if (!failed && r.received + r.missed != samples) {
+            fprintf(stderr, "consumer %d: received + missed = %lu, published %lu\n", c,
+                    (unsigned long)(r.received + r.missed), (unsigned long)samples);
+            failed = true;
+        }
+    }
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? 1 : 0;
+}
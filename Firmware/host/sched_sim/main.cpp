@@ -0,0 +1,123 @@
+// Runs the firmware's job table under a virtual clock and reports per-job
+// jitter and overruns. The simulated loop() spends a random amount of time
+// per iteration and occasionally blocks in a slow HTTP handler; the timer
+// keeps releasing jobs on schedule regardless, as esp_timer does on the
+// device. The old "millis() - last > 2000" gate is simulated alongside for
+// comparison. Ten minutes in, the hourly beacon is switched to once a second,
+// as POST /api/beacon can, and the wait for its next run is reported.
+//
+//   pio run -e host_sched_sim && .pio/build/host_sched_sim/program [hours] [seed]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "Scheduler.h"
+
+static Scheduler scheduler(VirtualClock::now);
+static uint32_t rngState = 1;
+
+static uint32_t nextRandom() {
+    // xorshift32: deterministic for a given seed
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+static uint32_t randomBetween(uint32_t low, uint32_t high) {
+    return low + nextRandom() % (high - low + 1);
+}
+
+// Move virtual time forward, firing the "hardware timer" at every release
+// time crossed on the way, even in the middle of a blocking call
+static void spend(uint64_t us) {
+    uint64_t end = VirtualClock::now() + us;
+    while (scheduler.nextReleaseUs() <= end) {
+        uint64_t next = scheduler.nextReleaseUs();
+        if (next > VirtualClock::now()) {
+            VirtualClock::set(next);
+        }
+        scheduler.release();
+    }
+    VirtualClock::set(end);
+}
+
+// Job bodies cost roughly what they do on the device
+static void sensorJob() { spend(randomBetween(800, 1500)); }
+static void controlJob() { spend(randomBetween(20, 60)); }
+static void tachJob() { spend(randomBetween(10, 30)); }
+static void displayJob() { spend(randomBetween(20000, 26000)); }  // I2C frame push
+
+static uint64_t beaconChangedUs = 0;
+static uint64_t beaconAfterChangeUs = 0;  // First run after the change
+
+static void beaconJob() {
+    if (beaconChangedUs && !beaconAfterChangeUs) {
+        beaconAfterChangeUs = VirtualClock::now();
+    }
+    spend(randomBetween(300, 600));
+}
+
+int main(int argc, char** argv) {
+    double hours = argc > 1 ? atof(argv[1]) : 1.0;
+    rngState = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10) : 1;
+    if (rngState == 0) rngState = 1;
+    uint64_t duration = (uint64_t)(hours * 3600e6);
+
+    scheduler.addJob("sensor", 2000, sensorJob);
+    scheduler.addJob("control", 250, controlJob, 50);
+    scheduler.addJob("tach", 1000, tachJob, 100);
+    scheduler.addJob("display", 1000, displayJob, 150);
+    int beacon = scheduler.addJob("beacon", 3600000, beaconJob, 200);
+    scheduler.start();
+
+    uint64_t legacyLast = 0;
+    uint32_t legacySamples = 0;
+    uint32_t blockingCalls = 0;
+
+    while (VirtualClock::now() < duration) {
+        // handleClient(), buttons and encoder: usually cheap, now and then
+        // a slow request (WiFi save, large response) blocks for a while
+        if (nextRandom() % 2000 == 0) {
+            spend(randomBetween(100000, 400000));
+            blockingCalls++;
+        } else {
+            spend(randomBetween(200, 3000));
+        }
+
+        // What the firmware used to do: gate on elapsed time, then reset
+        uint64_t now = VirtualClock::now();
+        if (now - legacyLast > 2000000) {
+            legacySamples++;
+            legacyLast = now;
+        }
+
+        if (!beaconChangedUs && VirtualClock::now() >= 600000000ULL) {
+            beaconChangedUs = VirtualClock::now();
+            scheduler.setPeriod(beacon, 1000);
+        }
+
+        scheduler.runPending();
+    }
+
+    printf("Simulated %.2f h, %u blocking handler calls\n\n", hours, blockingCalls);
+    printf("%-8s %8s %8s %9s %12s %12s %10s\n", "job", "period", "runs", "overruns",
+           "avg jit us", "max jit us", "max run us");
+    for (int i = 0; i < scheduler.jobCount(); i++) {
+        JobStats stats = scheduler.stats(i);
+        printf("%-8s %6ums %8u %9u %12llu %12u %10u\n", scheduler.jobName(i),
+               scheduler.jobPeriodMs(i), stats.runs, stats.overruns,
+               stats.runs ? (unsigned long long)(stats.totalJitterUs / stats.runs) : 0ULL,
+               stats.maxJitterUs, stats.maxRunUs);
+    }
+
+    uint32_t expected = (uint32_t)(duration / 2000000);
+    JobStats sensor = scheduler.stats(0);
+    printf("\nSensor samples: expected %u, scheduler %u (+%u overrun), legacy gate %u (%.2f%% drift)\n",
+           expected, sensor.runs, sensor.overruns, legacySamples,
+           100.0 * ((double)expected - legacySamples) / expected);
+    if (beaconAfterChangeUs) {
+        printf("Beacon 1 h -> 1 s at %.0f s: next beacon %.1f ms later\n", beaconChangedUs / 1e6,
+               (beaconAfterChangeUs - beaconChangedUs) / 1e3);
+    }
+    return 0;
+}
@@ -0,0 +1,154 @@
+// Hammers SeqLock and CommandQueue from several threads. One writer thread
+// owns the state, drains commands and publishes; reader threads check every
+// copy they get is internally consistent, producer threads push commands and
+// count the ones accepted. Fails (exit 1) on a torn read or a lost command.
+//
+//   pio run -e host_state_stress && .pio/build/host_state_stress/program [seconds] [readers] [producers]
+
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#include "SharedState.h"
+
+// Every field is derived from `generation`, so a copy mixing two writes is detectable
+struct TestState {
+    uint32_t generation;
+    float aqi;
+    bool fanOn;
+    float threshold;
+    uint32_t applied;
+    uint64_t appliedSum;
+    uint32_t check[8];
+};
+
+struct TestCommand {
+    uint32_t producer;
+    uint32_t value;
+};
+
+static SeqLock<TestState> state;
+static CommandQueue<TestCommand, 16> commands;
+static std::atomic<bool> running(true);
+static std::atomic<bool> failed(false);
+
+static bool consistent(const TestState& s) {
+    if (s.aqi != (float)(s.generation % 500) || s.fanOn != (s.generation % 3 == 0) ||
+        s.threshold != (float)(s.generation % 200)) {
+        return false;
+    }
+    for (int i = 0; i < 8; i++) {
+        if (s.check[i] != s.generation * (uint32_t)(i + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 3;
+    int readerCount = argc > 2 ? atoi(argv[2]) : 4;
+    int producerCount = argc > 3 ? atoi(argv[3]) : 3;
+
+    std::vector<uint64_t> reads(readerCount, 0);
+    std::vector<uint64_t> acceptedSum(producerCount, 0);
+    std::vector<uint32_t> accepted(producerCount, 0);
+    uint64_t writes = 0;
+
+    std::thread writer([&]() {
+        TestState s = {};
+        TestCommand command;
+        for (;;) {
+            bool draining = !running.load(std::memory_order_relaxed);
+            while (commands.pop(command)) {
+                s.applied++;
+                s.appliedSum += command.value;
+            }
+            if (draining) {
+                break;
+            }
+            s.generation++;
+            s.aqi = (float)(s.generation % 500);
+            s.fanOn = s.generation % 3 == 0;
+            s.threshold = (float)(s.generation % 200);
+            for (int i = 0; i < 8; i++) {
+                s.check[i] = s.generation * (uint32_t)(i + 1);
+            }
+            state.write(s);
+            writes++;
+        }
+        // Final drain after the producers have stopped
+        while (commands.pop(command)) {
+            s.applied++;
+            s.appliedSum += command.value;
+        }
+        state.write(s);
+    });
+
+    std::vector<std::thread> threads;
+    for (int r = 0; r < readerCount; r++) {
+        threads.emplace_back([&, r]() {
+            uint32_t lastGeneration = 0;
+            while (running.load(std::memory_order_relaxed)) {
+                TestState s = state.read();
+                if (!consistent(s) || s.generation < lastGeneration) {
+                    fprintf(stderr, "reader %d: torn or stale read at generation %lu\n", r,
+                            (unsigned long)s.generation);
+                    failed = true;
+                    return;
+                }
+                lastGeneration = s.generation;
+                reads[r]++;
+            }
+        });
+    }
+    std::vector<std::thread> producers;
+    for (int p = 0; p < producerCount; p++) {
+        producers.emplace_back([&, p]() {
+            uint32_t value = (uint32_t)p * 1000003u;
+            while (running.load(std::memory_order_relaxed)) {
+                value = value * 1664525u + 1013904223u;
+                TestCommand command = {(uint32_t)p, value & 0xffff};
+                if (commands.push(command)) {
+                    accepted[p]++;
+                    acceptedSum[p] += command.value;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    running = false;
+    for (auto& t : producers) t.join();
+    for (auto& t : threads) t.join();
+    writer.join();
+
+    uint64_t totalReads = 0, totalSum = 0;
+    uint32_t totalAccepted = 0;
+    for (uint64_t n : reads) totalReads += n;
+    for (int p = 0; p < producerCount; p++) {
+        totalAccepted += accepted[p];
+        totalSum += acceptedSum[p];
+    }
+    TestState final = state.read();
+
+    printf("%d s, %d readers, %d producers\n", seconds, readerCount, producerCount);
+    printf("writes:   %llu (%.0f/s)\n", (unsigned long long)writes, writes / (double)seconds);
+    printf("reads:    %llu (%.0f/s)\n", (unsigned long long)totalReads, totalReads / (double)seconds);
+    printf("commands: %lu accepted, %lu rejected (queue full), %lu applied\n",
+           (unsigned long)totalAccepted, (unsigned long)commands.rejected(), (unsigned long)final.applied);
+
+    if (final.applied != totalAccepted || final.appliedSum != totalSum) {
+        fprintf(stderr, "lost commands: applied %lu (sum %llu), accepted %lu (sum %llu)\n",
+                (unsigned long)final.applied, (unsigned long long)final.appliedSum,
+                (unsigned long)totalAccepted, (unsigned long long)totalSum);
+        failed = true;
+    }
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,194 @@
+// Checks RollingStats against a brute-force recomputation. Seeded synthetic
+// days are sampled every 2 s (the firmware's resampled series) into the
+// firmware's 5m, 1h and 24h windows; every few simulated minutes each
+// window's answer is compared with the exact figures over the same samples.
+// Count, min, max and mean must match; p50 and p95 are P-squared estimates,
+// compared with the exact quantiles over the span the estimator covers
+// (quantileMs). Fails (exit 1) on any mismatch, or if the quantile error,
+// averaged or at its 90th percentile over the checks, exceeds its limit.
+//
+//   pio run -e host_stats_check && .pio/build/host_stats_check/program [options]
+//     --days D           simulated days per seed (default 2)
+//     --seeds N          synthetic profiles, seeds 1..N (default 3)
+//     --check-every S    seconds between checks (default 300)
+
+#include <algorithm>
+#include <deque>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "AqiSim.h"
+#include "StreamStats.h"
+
+#define SAMPLE_MS 2000
+
+struct Window {
+    const char* name;
+    uint32_t windowMs;
+    float meanLimit;  // Largest mean relative error allowed for p50/p95
+    float p90Limit;   // ... and for nine checks in ten
+};
+
+// P-squared lags the onset and decay of pollution events, where single
+// checks can be off by a lot, so the limits are on typical error. Longer
+// windows mix the daily swing with events and do worse.
+static const Window windows[] = {
+    {"5m", 5UL * 60 * 1000, 0.02f, 0.04f},
+    {"1h", 60UL * 60 * 1000, 0.05f, 0.12f},
+    {"24h", 24UL * 60 * 60 * 1000, 0.12f, 0.30f},
+};
+#define WINDOW_COUNT (sizeof(windows) / sizeof(windows[0]))
+
+struct Sample {
+    uint32_t timeMs;
+    float value;
+};
+
+struct Errors {
+    uint32_t checks;
+    uint32_t exactFailures;  // count/min/max/mean mismatches
+    double worstMean;        // Relative
+    std::vector<double> p50;  // Relative error of each check
+    std::vector<double> p95;
+};
+
+struct Spread {
+    double mean;
+    double p90;
+    double worst;
+};
+
+static Spread spread(std::vector<double>& errors) {
+    Spread spread = {0, 0, 0};
+    if (errors.empty()) {
+        return spread;
+    }
+    for (double error : errors) {
+        spread.mean += error;
+    }
+    spread.mean /= errors.size();
+    std::sort(errors.begin(), errors.end());
+    spread.p90 = errors[(size_t)(0.9 * (errors.size() - 1))];
+    spread.worst = errors.back();
+    return spread;
+}
+
+static float exactQuantile(std::vector<float>& values, float quantile) {
+    size_t rank = (size_t)ceil(quantile * values.size());
+    size_t index = rank > 0 ? rank - 1 : 0;
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+static double relative(double estimate, double exact) {
+    return fabs(estimate - exact) / (fabs(exact) > 1 ? fabs(exact) : 1);
+}
+
+static void check(RollingStats& stats, const Window& window, const std::deque<Sample>& samples, uint32_t nowMs,
+                  Errors& errors) {
+    WindowStats result = stats.stats(nowMs);
+    uint32_t bucketMs = window.windowMs / STATS_BUCKETS;
+    uint32_t bucket = nowMs / bucketMs;
+
+    // In the window: the current bucket and the STATS_BUCKETS - 1 before it
+    uint32_t count = 0;
+    double sum = 0;
+    float min = INFINITY, max = -INFINITY;
+    std::vector<float> covered;
+    uint32_t quantileBuckets = result.quantileMs / bucketMs;
+    for (const Sample& sample : samples) {
+        uint32_t age = bucket - sample.timeMs / bucketMs;
+        if (age >= STATS_BUCKETS) {
+            continue;
+        }
+        count++;
+        sum += sample.value;
+        min = std::min(min, sample.value);
+        max = std::max(max, sample.value);
+        if (age < quantileBuckets) {
+            covered.push_back(sample.value);
+        }
+    }
+
+    errors.checks++;
+    double meanError = count ? relative(result.mean, sum / count) : 0;
+    errors.worstMean = std::max(errors.worstMean, meanError);
+    if (result.count != count || (count && (result.min != min || result.max != max || meanError > 1e-4))) {
+        if (errors.exactFailures++ < 5) {
+            printf("  %s at %u s: count %u/%u min %.2f/%.2f max %.2f/%.2f mean %.3f/%.3f\n", window.name,
+                   nowMs / 1000, result.count, count, result.min, min, result.max, max, result.mean,
+                   count ? sum / count : 0.0);
+        }
+    }
+    if (!covered.empty()) {
+        errors.p50.push_back(relative(result.p50, exactQuantile(covered, 0.5f)));
+        errors.p95.push_back(relative(result.p95, exactQuantile(covered, 0.95f)));
+    }
+}
+
+int main(int argc, char** argv) {
+    double days = 2;
+    int seeds = 3;
+    uint32_t checkEveryMs = 300000;
+    for (int i = 1; i < argc; i++) {
+        const char* name = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "missing value for %s\n", name);
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (strcmp(name, "--days") == 0) days = atof(value);
+        else if (strcmp(name, "--seeds") == 0) seeds = atoi(value);
+        else if (strcmp(name, "--check-every") == 0) checkEveryMs = (uint32_t)(atof(value) * 1000);
+        else {
+            fprintf(stderr, "unknown option %s\n", name);
+            return 2;
+        }
+    }
+
+    Errors errors[WINDOW_COUNT] = {};
+    uint32_t durationMs = (uint32_t)(days * 86400000.0);
+    for (int seed = 1; seed <= seeds; seed++) {
+        SyntheticAqi source(SyntheticAqi::defaults(seed));
+        static RollingStats stats[WINDOW_COUNT];
+        std::deque<Sample> samples[WINDOW_COUNT];
+        for (size_t w = 0; w < WINDOW_COUNT; w++) {
+            stats[w].configure(windows[w].windowMs);
+        }
+        for (uint32_t now = 0; now < durationMs; now += SAMPLE_MS) {
+            Sample sample = {now, source.sample(now)};
+            for (size_t w = 0; w < WINDOW_COUNT; w++) {
+                stats[w].add(sample.value, now);
+                samples[w].push_back(sample);
+                while (now - samples[w].front().timeMs > windows[w].windowMs + SAMPLE_MS) {
+                    samples[w].pop_front();
+                }
+                if (now % checkEveryMs == 0) {
+                    check(stats[w], windows[w], samples[w], now, errors[w]);
+                }
+            }
+        }
+    }
+
+    bool pass = true;
+    printf("%d seeds x %.1f days, checked every %u s\n\n", seeds, days, checkEveryMs / 1000);
+    printf("window  checks  exact  mean err      p50 mean/p90/worst        p95 mean/p90/worst    limits\n");
+    for (size_t w = 0; w < WINDOW_COUNT; w++) {
+        Errors& e = errors[w];
+        Spread p50 = spread(e.p50);
+        Spread p95 = spread(e.p95);
+        const Window& window = windows[w];
+        bool ok = e.exactFailures == 0 && p50.mean <= window.meanLimit && p95.mean <= window.meanLimit &&
+                  p50.p90 <= window.p90Limit && p95.p90 <= window.p90Limit;
+        pass = pass && ok;
+        printf("%-6s  %6u  %5s  %8.1e   %5.1f%% %5.1f%% %5.1f%%   %5.1f%% %5.1f%% %5.1f%%   %2.0f%%/%2.0f%%  %s\n",
+               window.name, e.checks, e.exactFailures ? "FAIL" : "ok", e.worstMean, 100 * p50.mean,
+               100 * p50.p90, 100 * p50.worst, 100 * p95.mean, 100 * p95.p90, 100 * p95.worst,
+               100 * window.meanLimit, 100 * window.p90Limit, ok ? "" : "FAIL");
+    }
+    printf("\n%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}
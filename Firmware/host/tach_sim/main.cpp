@@ -0,0 +1,67 @@
+// Host stand-in for the fan tachometer: a simulated fan produces tach pulses
+// on a virtual clock and FanTach turns them into RPM and alerts, exactly as
+// the firmware does with the PCNT counter.
+//
+//   pio run -e host_tach_sim && .pio/build/host_tach_sim/program
+
+#include <stdio.h>
+#include "FanTach.h"
+
+struct Scenario {
+    const char* name;
+    float nominalRpm;  // What the firmware is configured to expect
+    float actualRpm;   // What the simulated fan really does when driven
+    TachAlert expected;
+};
+
+static bool runScenario(const Scenario& scenario) {
+    SimTachCounter counter(2);
+    FanTach tach;
+    FanTachConfig config = tach.config();
+    config.nominalRpm = scenario.nominalRpm;
+    tach.configure(config);
+    counter.begin();
+
+    printf("\n== %s (nominal %.0f rpm, fan %.0f rpm)\n",
+           scenario.name, scenario.nominalRpm, scenario.actualRpm);
+
+    TachAlert last = TACH_OK;
+    // 10 s off, then 60 s driven at full duty, sampled once a second
+    for (uint32_t now = 0; now <= 70000; now += 1000) {
+        float duty = now >= 10000 ? 1.0f : 0.0f;
+        counter.setTargetRpm(duty * scenario.actualRpm);
+        counter.advance(now);
+        tach.update(counter.pulses(), duty, now);
+
+        if (now % 10000 == 0 || tach.alert() != last) {
+            printf("  t=%5.1fs duty=%.1f rpm=%7.1f alert=%s\n", now / 1000.0,
+                   duty, tach.rpm(), FanTach::alertName(tach.alert()));
+        }
+        last = tach.alert();
+    }
+
+    bool pass = tach.alert() == scenario.expected;
+    printf("  -> %s (expected %s)\n", pass ? "ok" : "MISMATCH",
+           FanTach::alertName(scenario.expected));
+    return pass;
+}
+
+int main() {
+    const Scenario scenarios[] = {
+        {"healthy fan", 1800, 1800, TACH_OK},
+        {"stalled rotor", 1800, 0, TACH_STALL},
+        {"no nominal configured, fan running", 0, 1200, TACH_OK},
+        {"worn bearing", 1800, 1100, TACH_LOW_RPM},
+        {"blocked filter", 1800, 2400, TACH_FILTER_BLOCKED},
+    };
+
+    int failures = 0;
+    for (const Scenario& scenario : scenarios) {
+        if (!runScenario(scenario)) {
+            failures++;
+        }
+    }
+    printf("\n%d scenario(s), %d mismatch(es)\n",
+           (int)(sizeof(scenarios) / sizeof(scenarios[0])), failures);
+    return failures == 0 ? 0 : 1;
+}
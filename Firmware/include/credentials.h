@@ -14,7 +14,7 @@ const char* DEFAULT_SSID = "OpenFilter-AP";
 const char* DEFAULT_PASSWORD = "12345678";
 
 // EEPROM configuration addresses
-#define EEPROM_SIZE 512
+#define EEPROM_SIZE 1024
 #define WIFI_CONFIG_ADDR 0
 #define RESET_FLAG_ADDR 200
 
@@ -27,4 +27,48 @@ struct SensorConfig {
 
 #define SENSOR_CONFIG_ADDR 300
 
+// MQTT publishing; off until a broker is configured
+struct MqttConfig {
+    uint16_t magic;       // MQTT_CONFIG_MAGIC once saved
+    bool enabled;
+    bool discovery;       // Announce entities to Home Assistant
+    uint16_t port;
+    char host[64];
+    char username[32];
+    char password[32];
+    char topicPrefix[48]; // Empty: openair/<chip id>
+};
+
+#define MQTT_CONFIG_ADDR 320
+#define MQTT_CONFIG_MAGIC 0x4D51
+
+// Multicast telemetry beacon; on by default so a collector hears new units
+struct BeaconConfig {
+    uint16_t magic;       // BEACON_CONFIG_MAGIC once saved
+    bool enabled;
+    uint32_t intervalMs;
+};
+
+#define BEACON_CONFIG_ADDR 512
+#define BEACON_CONFIG_MAGIC 0x4243
+
+// PM sensor running time, kept across reboots to judge its wear
+struct SensorRuntime {
+    uint16_t magic;       // SENSOR_RUNTIME_MAGIC once saved
+    uint32_t seconds;
+};
+
+#define SENSOR_RUNTIME_ADDR 544
+#define SENSOR_RUNTIME_MAGIC 0x5352
+
+// Bearer token for firmware updates; empty (no updates) until set in
+// configuration mode
+struct OtaConfig {
+    uint16_t magic;       // OTA_CONFIG_MAGIC once saved
+    char token[48];
+};
+
+#define OTA_CONFIG_ADDR 560
+#define OTA_CONFIG_MAGIC 0x4F54
+
 #endif
\ No newline at end of file
@@ -0,0 +1,61 @@
+#include "AllocCounter.h"
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+#include <atomic>
+#include <stddef.h>
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* pointer);
+}
+
+static std::atomic<uint64_t> allocations(0);
+static thread_local bool counting = false;
+
+static inline void countAllocation() {
+    if (counting) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+extern "C" void* malloc(size_t size) {
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) {
+    countAllocation();
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* pointer, size_t size) {
+    countAllocation();
+    return __libc_realloc(pointer, size);
+}
+
+extern "C" void* memalign(size_t alignment, size_t size) {
+    countAllocation();
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void free(void* pointer) {
+    __libc_free(pointer);
+}
+
+void allocCounterEnable(bool enabled) {
+    counting = enabled;
+}
+
+uint64_t allocCount() {
+    return allocations.load(std::memory_order_relaxed);
+}
+
+void allocCounterReset() {
+    allocations.store(0, std::memory_order_relaxed);
+}
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <stdint.h>
+
+// Heap allocation counter for Linux host builds. Linking this in interposes
+// malloc/calloc/realloc (and so operator new); allocations are counted only
+// on threads that have enabled counting.
+void allocCounterEnable(bool enabled);
+uint64_t allocCount();
+void allocCounterReset();
+
+#endif
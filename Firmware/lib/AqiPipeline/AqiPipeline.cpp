@@ -0,0 +1,79 @@
+#include "AqiPipeline.h"
+
+#include <math.h>
+
+HourlyHistory::HourlyHistory() {
+    reset();
+}
+
+void HourlyHistory::reset() {
+    for (int i = 0; i < HISTORY_LENGTH; i++) {
+        means_[i] = NAN;
+    }
+    filled_ = 0;
+    hourStartMs_ = 0;
+    hourSum_ = 0;
+    hourPoints_ = 0;
+}
+
+// The open hour moves down a slot when it is up. Hours with no readings at
+// all (the sensor was off) get a slot of their own, left empty, so every
+// slot stays an hour further back than the one before it.
+void HourlyHistory::add(uint32_t timeMs, float aqi) {
+    if (filled_ == 0 || timeMs - hourStartMs_ >= HISTORY_BUCKET_MS) {
+        uint32_t hours = filled_ == 0 ? 1 : (timeMs - hourStartMs_) / HISTORY_BUCKET_MS;
+        hourStartMs_ = filled_ == 0 ? timeMs : hourStartMs_ + hours * HISTORY_BUCKET_MS;
+        int shift = hours < HISTORY_LENGTH ? (int)hours : HISTORY_LENGTH;
+        for (int i = HISTORY_LENGTH - 1; i >= shift; i--) {
+            means_[i] = means_[i - shift];
+        }
+        for (int i = 0; i < shift; i++) {
+            means_[i] = NAN;
+        }
+        filled_ = filled_ + shift < HISTORY_LENGTH ? filled_ + shift : HISTORY_LENGTH;
+        hourSum_ = 0;
+        hourPoints_ = 0;
+    }
+    hourSum_ += aqi;
+    hourPoints_++;
+    means_[0] = hourSum_ / hourPoints_;
+}
+
+AqiPipeline::AqiPipeline(SensorPower& power, AqiSampleQueue& samples, Resampler& grid,
+                         HoltForecaster& forecaster, FanController& controller)
+    : power_(power),
+      samples_(samples),
+      cursor_(samples.subscribe()),
+      grid_(grid),
+      forecaster_(forecaster),
+      controller_(controller),
+      forecastControl_(true),
+      aqi_(0),
+      aqiTimeMs_(0) {}
+
+bool AqiPipeline::consume(ResampleHandler onGridPoint) {
+    bool any = false;
+    AqiSample sample;
+    while (samples_.read(cursor_, sample)) {
+        aqi_ = sample.aqi;
+        aqiTimeMs_ = sample.timeMs;
+        grid_.add(sample.timeMs, sample.aqi, [this, &onGridPoint](uint32_t timeMs, float aqi) {
+            forecaster_.add(aqi, timeMs);
+            history_.add(timeMs, aqi);
+            if (onGridPoint) {
+                onGridPoint(timeMs, aqi);
+            }
+        });
+        any = true;
+    }
+    return any;
+}
+
+bool AqiPipeline::control(uint32_t nowMs) {
+    return controller_.update(aqi_, forecastControl_ ? forecaster_.forecast() : NAN, nowMs);
+}
+
+void AqiPipeline::configureControl(const FanControlConfig& config, float watchMargin) {
+    controller_.configure(config);
+    power_.setWatchBand(config.offThreshold - watchMargin, config.onThreshold + watchMargin);
+}
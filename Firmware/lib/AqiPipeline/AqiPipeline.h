@@ -0,0 +1,109 @@
+#ifndef AQI_PIPELINE_H
+#define AQI_PIPELINE_H
+
+#include <stdint.h>
+
+#include "FanControl.h"
+#include "Forecast.h"
+#include "Resample.h"
+#include "SampleQueue.h"
+#include "SensorPower.h"
+
+// The sensing and control path the firmware runs, shared with
+// host/replay_sim so the simulator can't drift from it. The sensor job asks
+// SensorPower whether a reading is due and publishes it into the sample
+// queue; the loop takes new samples, keeps the latest for control and
+// resamples them onto a fixed grid for the forecast and the hourly history;
+// the control job runs the FanController on the latest reading and the
+// forecast. Nothing here touches hardware or reads a clock: the caller
+// passes the time in, supplies the reading, drives the sensor's SET pin
+// from SensorPower::powered() and the relay from what control() returns.
+
+struct AqiSample {
+    uint32_t timeMs;
+    float aqi;
+    bool fanOn;    // Relay and mode when the reading was taken
+    bool fanAuto;
+};
+
+#define AQI_QUEUE_SIZE 32
+typedef SampleQueue<AqiSample, AQI_QUEUE_SIZE> AqiSampleQueue;
+
+#define HISTORY_LENGTH 24
+#define HISTORY_BUCKET_MS 3600000UL
+
+// Hourly means of the resampled series, newest (the open hour) first
+class HourlyHistory {
+public:
+    HourlyHistory();
+    void reset();
+
+    void add(uint32_t timeMs, float aqi);
+
+    // NaN for an hour without readings
+    const float* means() const { return means_; }
+    // Hours since the first reading; the rest have none yet
+    uint8_t filled() const { return filled_; }
+
+private:
+    float means_[HISTORY_LENGTH];
+    uint8_t filled_;
+    uint32_t hourStartMs_;
+    float hourSum_;
+    uint32_t hourPoints_;
+};
+
+class AqiPipeline {
+public:
+    AqiPipeline(SensorPower& power, AqiSampleQueue& samples, Resampler& grid, HoltForecaster& forecaster,
+                FanController& controller);
+
+    // Sensor job. Advances SensorPower to nowMs and, when a reading is due,
+    // publishes read() as a sample along with the fan's state; true if it did
+    template<typename Read>
+    bool sense(uint32_t nowMs, bool fanOn, bool fanAuto, Read read) {
+        if (!power_.update(nowMs)) {
+            return false;
+        }
+        AqiSample sample;
+        sample.timeMs = nowMs;
+        sample.aqi = read();
+        sample.fanOn = fanOn;
+        sample.fanAuto = fanAuto;
+        samples_.publish(sample);
+        power_.onReading(sample.aqi, nowMs);
+        return true;
+    }
+
+    // Takes the samples published since the last call: the newest becomes
+    // aqi(), and every grid point goes to the forecast, the history and then
+    // onGridPoint. True if there were any.
+    bool consume(ResampleHandler onGridPoint = nullptr);
+
+    // Control job: the fan state auto mode wants at nowMs
+    bool control(uint32_t nowMs);
+
+    // Thresholds for the controller; SensorPower reads fastest within
+    // watchMargin of them
+    void configureControl(const FanControlConfig& config, float watchMargin);
+    // Without, the controller sees the AQI alone (the forecast still runs)
+    void setForecastControl(bool enabled) { forecastControl_ = enabled; }
+
+    float aqi() const { return aqi_; }
+    uint32_t aqiTimeMs() const { return aqiTimeMs_; }
+    const HourlyHistory& history() const { return history_; }
+
+private:
+    SensorPower& power_;
+    AqiSampleQueue& samples_;
+    AqiSampleQueue::Cursor cursor_;
+    Resampler& grid_;
+    HoltForecaster& forecaster_;
+    FanController& controller_;
+    HourlyHistory history_;
+    bool forecastControl_;
+    float aqi_;
+    uint32_t aqiTimeMs_;
+};
+
+#endif
@@ -0,0 +1,227 @@
+#include "AqiSim.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MS_PER_DAY 86400000.0f
+
+SyntheticProfileConfig SyntheticAqi::defaults(uint32_t seed) {
+    SyntheticProfileConfig config;
+    config.seed = seed;
+    config.baseline = 45.0f;
+    config.diurnalAmplitude = 20.0f;
+    config.diurnalPeakHour = 18.0f;
+    config.noise = 8.0f;
+    config.noiseTauMs = 10UL * 60 * 1000;
+    config.eventsPerDay = 4.0f;
+    config.eventPeak = 120.0f;
+    config.eventDecayMs = 25UL * 60 * 1000;
+    return config;
+}
+
+SyntheticAqi::SyntheticAqi() {
+    configure(defaults(1));
+}
+
+SyntheticAqi::SyntheticAqi(const SyntheticProfileConfig& config) {
+    configure(config);
+}
+
+void SyntheticAqi::configure(const SyntheticProfileConfig& config) {
+    config_ = config;
+    rng_ = config.seed ? config.seed : 1;
+    lastMs_ = 0;
+    started_ = false;
+    noise_ = 0;
+    event_ = 0;
+    events_ = 0;
+}
+
+uint32_t SyntheticAqi::nextRandom() {
+    // xorshift32: deterministic for a given seed
+    rng_ ^= rng_ << 13;
+    rng_ ^= rng_ >> 17;
+    rng_ ^= rng_ << 5;
+    return rng_;
+}
+
+float SyntheticAqi::uniform() {
+    return (nextRandom() >> 8) * (1.0f / 16777216.0f);
+}
+
+float SyntheticAqi::gaussian() {
+    // Box-Muller; one value per call keeps the stream simple to reproduce
+    float u1 = uniform();
+    float u2 = uniform();
+    if (u1 < 1e-7f) {
+        u1 = 1e-7f;
+    }
+    return sqrtf(-2.0f * logf(u1)) * cosf(6.2831853f * u2);
+}
+
+float SyntheticAqi::sample(uint32_t nowMs) {
+    float dt = started_ ? (float)(nowMs - lastMs_) : 0.0f;
+    lastMs_ = nowMs;
+    started_ = true;
+
+    if (dt > 0) {
+        // Ornstein-Uhlenbeck noise: stationary deviation of config_.noise
+        // whatever the sample interval
+        float decay = expf(-dt / config_.noiseTauMs);
+        noise_ = noise_ * decay + config_.noise * sqrtf(1.0f - decay * decay) * gaussian();
+
+        event_ *= expf(-dt / config_.eventDecayMs);
+        float eventChance = config_.eventsPerDay * dt / MS_PER_DAY;
+        if (uniform() < eventChance) {
+            event_ += config_.eventPeak * (0.5f + uniform());
+            events_++;
+        }
+    }
+
+    float hour = fmodf(nowMs / 3600000.0f, 24.0f);
+    float diurnal = config_.diurnalAmplitude * cosf(6.2831853f * (hour - config_.diurnalPeakHour) / 24.0f);
+    float aqi = config_.baseline + diurnal + noise_ + event_;
+    if (aqi < 0) aqi = 0;
+    if (aqi > 500) aqi = 500;
+    return aqi;
+}
+
+size_t parseCsvTrace(const char* text, TracePoint* points, size_t maxPoints) {
+    size_t count = 0;
+    bool haveStart = false;
+    double startSeconds = 0;
+    const char* line = text;
+    while (line && *line && count < maxPoints) {
+        char* end;
+        double seconds = strtod(line, &end);
+        const char* comma = end;
+        while (*comma == ' ' || *comma == '\t') {
+            comma++;
+        }
+        // Anything that isn't "number,number" (header, blank line) is skipped
+        if (end != line && (*comma == ',' || *comma == ';')) {
+            char* valueEnd;
+            float aqi = strtof(comma + 1, &valueEnd);
+            if (valueEnd != comma + 1) {
+                if (!haveStart) {
+                    startSeconds = seconds;
+                    haveStart = true;
+                }
+                points[count].timeMs = (uint32_t)((seconds - startSeconds) * 1000.0 + 0.5);
+                points[count].aqi = aqi;
+                count++;
+            }
+        }
+        line = strchr(line, '\n');
+        if (line) {
+            line++;
+        }
+    }
+    return count;
+}
+
+static uint32_t readLe32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void writeLe32(uint8_t* p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+size_t binaryTraceSize(size_t count) {
+    return 8 + count * 8;
+}
+
+size_t parseBinaryTrace(const uint8_t* data, size_t length, TracePoint* points, size_t maxPoints) {
+    if (length < 8 || memcmp(data, AQI_TRACE_MAGIC, 4) != 0) {
+        return 0;
+    }
+    size_t count = readLe32(data + 4);
+    if (count > (length - 8) / 8) {
+        count = (length - 8) / 8;  // Truncated file: keep the whole records
+    }
+    if (count > maxPoints) {
+        count = maxPoints;
+    }
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t* record = data + 8 + i * 8;
+        uint32_t bits = readLe32(record + 4);
+        points[i].timeMs = readLe32(record);
+        memcpy(&points[i].aqi, &bits, sizeof(bits));
+    }
+    return count;
+}
+
+size_t writeBinaryTrace(const TracePoint* points, size_t count, uint8_t* out, size_t outSize) {
+    if (outSize < binaryTraceSize(count)) {
+        return 0;
+    }
+    memcpy(out, AQI_TRACE_MAGIC, 4);
+    writeLe32(out + 4, (uint32_t)count);
+    for (size_t i = 0; i < count; i++) {
+        uint8_t* record = out + 8 + i * 8;
+        uint32_t bits;
+        memcpy(&bits, &points[i].aqi, sizeof(bits));
+        writeLe32(record, points[i].timeMs);
+        writeLe32(record + 4, bits);
+    }
+    return binaryTraceSize(count);
+}
+
+TraceReplay::TraceReplay(const TracePoint* points, size_t count, bool loop)
+    : points_(points), count_(count), loop_(loop), cursor_(0) {
+}
+
+float TraceReplay::sample(uint32_t nowMs) {
+    if (count_ == 0) {
+        return 0;
+    }
+    uint32_t duration = durationMs();
+    if (loop_ && duration > 0) {
+        uint32_t t = nowMs % duration;
+        if (t < points_[cursor_].timeMs) {
+            cursor_ = 0;  // Wrapped around
+        }
+        nowMs = t;
+    }
+    if (nowMs >= duration) {
+        return points_[count_ - 1].aqi;
+    }
+    while (cursor_ + 1 < count_ && points_[cursor_ + 1].timeMs <= nowMs) {
+        cursor_++;
+    }
+    const TracePoint& a = points_[cursor_];
+    const TracePoint& b = points_[cursor_ + 1];
+    if (b.timeMs == a.timeMs) {
+        return b.aqi;
+    }
+    float f = (float)(nowMs - a.timeMs) / (float)(b.timeMs - a.timeMs);
+    return a.aqi + (b.aqi - a.aqi) * f;
+}
+
+RoomModel::RoomModel() : aqi_(0), lastMs_(0), started_(false) {
+    config_.mixingTauMs = 10UL * 60 * 1000;
+    config_.filterTauMs = 20UL * 60 * 1000;
+}
+
+float RoomModel::update(float source, bool fanOn, uint32_t nowMs) {
+    if (!started_) {
+        aqi_ = source;
+        lastMs_ = nowMs;
+        started_ = true;
+        return aqi_;
+    }
+    float dt = (float)(nowMs - lastMs_);
+    lastMs_ = nowMs;
+
+    // dC/dt = (source - C) / mixing - fan * C / filter, stepped exactly
+    // for the constant source and fan state over dt
+    float rate = 1.0f / config_.mixingTauMs + (fanOn ? 1.0f / config_.filterTauMs : 0.0f);
+    float target = source / config_.mixingTauMs / rate;
+    aqi_ = target + (aqi_ - target) * expf(-dt * rate);
+    return aqi_;
+}
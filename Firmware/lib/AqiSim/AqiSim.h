@@ -0,0 +1,119 @@
+#ifndef AQI_SIM_H
+#define AQI_SIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Reproducible AQI inputs for the simulation mode and the host simulator.
+// Everything is driven by the caller's (possibly virtual) clock and, for
+// the synthetic profile, a seed, so the same inputs give the same run.
+
+// Something that yields an AQI for a point in time. Times must not go
+// backwards between calls.
+class AqiSource {
+public:
+    virtual ~AqiSource() {}
+    virtual float sample(uint32_t nowMs) = 0;
+};
+
+// Seeded synthetic day: a baseline with a daily swing, mean-reverting noise
+// and occasional pollution events (cooking, smoke) that jump up and decay
+struct SyntheticProfileConfig {
+    uint32_t seed;
+    float baseline;          // AQI the noise reverts to
+    float diurnalAmplitude;  // Peak-to-baseline of the daily swing
+    float diurnalPeakHour;   // Hour of day the swing peaks
+    float noise;             // Noise standard deviation (AQI)
+    uint32_t noiseTauMs;     // Noise correlation time
+    float eventsPerDay;
+    float eventPeak;         // AQI added at the start of an event
+    uint32_t eventDecayMs;   // Time constant of an event's decay
+};
+
+class SyntheticAqi : public AqiSource {
+public:
+    SyntheticAqi();
+    explicit SyntheticAqi(const SyntheticProfileConfig& config);
+
+    static SyntheticProfileConfig defaults(uint32_t seed);
+
+    // Restart the profile from its seed
+    void configure(const SyntheticProfileConfig& config);
+    const SyntheticProfileConfig& config() const { return config_; }
+
+    float sample(uint32_t nowMs) override;
+    uint32_t eventCount() const { return events_; }
+
+private:
+    uint32_t nextRandom();
+    float uniform();   // [0, 1)
+    float gaussian();  // Standard normal
+
+    SyntheticProfileConfig config_;
+    uint32_t rng_;
+    uint32_t lastMs_;
+    bool started_;
+    float noise_;
+    float event_;
+    uint32_t events_;
+};
+
+// Recorded traces. Times are relative to the first point.
+struct TracePoint {
+    uint32_t timeMs;
+    float aqi;
+};
+
+// CSV: one "seconds,aqi" pair per line (a header line and blank lines are
+// skipped; times are rebased to start at 0). Returns the points parsed.
+size_t parseCsvTrace(const char* text, TracePoint* points, size_t maxPoints);
+
+// Binary: "AQT1", a little-endian uint32 count, then count records of
+// { uint32 timeMs, float32 aqi }, also little-endian.
+#define AQI_TRACE_MAGIC "AQT1"
+size_t parseBinaryTrace(const uint8_t* data, size_t length, TracePoint* points, size_t maxPoints);
+size_t binaryTraceSize(size_t count);
+size_t writeBinaryTrace(const TracePoint* points, size_t count, uint8_t* out, size_t outSize);
+
+// Plays a trace back, interpolating between points. Past the end it holds
+// the last value, or wraps around if looping.
+class TraceReplay : public AqiSource {
+public:
+    TraceReplay(const TracePoint* points, size_t count, bool loop = false);
+
+    float sample(uint32_t nowMs) override;
+    uint32_t durationMs() const { return count_ ? points_[count_ - 1].timeMs : 0; }
+
+private:
+    const TracePoint* points_;
+    size_t count_;
+    bool loop_;
+    size_t cursor_;
+};
+
+// Well-mixed room with the filter in it: indoor AQI follows the source
+// with a lag and is pulled down while the fan runs. Closes the loop so the
+// controller's decisions show up in what the sensor reads.
+struct RoomModelConfig {
+    uint32_t mixingTauMs;   // How quickly indoor air follows the source
+    uint32_t filterTauMs;   // Time constant of removal with the fan on
+};
+
+class RoomModel {
+public:
+    RoomModel();
+    void configure(const RoomModelConfig& config) { config_ = config; }
+    const RoomModelConfig& config() const { return config_; }
+
+    // Advance to nowMs with the fan state held since the previous call
+    float update(float source, bool fanOn, uint32_t nowMs);
+    float aqi() const { return aqi_; }
+
+private:
+    RoomModelConfig config_;
+    float aqi_;
+    uint32_t lastMs_;
+    bool started_;
+};
+
+#endif
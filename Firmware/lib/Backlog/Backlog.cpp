@@ -0,0 +1,196 @@
+#include "Backlog.h"
+
+#include <string.h>
+
+static size_t putVarint(uint8_t* out, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+static uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static void putU16(uint8_t* out, uint16_t value) {
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+}
+
+static void putU32(uint8_t* out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint16_t getU16(const uint8_t* in) {
+    return in[0] | in[1] << 8;
+}
+
+static uint32_t getU32(const uint8_t* in) {
+    return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+void BacklogEncoder::start(BacklogBlock& block, uint32_t sequence) {
+    block.firstSequence = sequence;
+    block.firstTimeMs = 0;
+    block.count = 0;
+    block.length = 0;
+}
+
+bool BacklogEncoder::add(BacklogBlock& block, uint32_t timeMs, int32_t value, uint8_t flags) {
+    uint8_t sample[BACKLOG_SAMPLE_MAX];
+    size_t n = 0;
+    int32_t delta = 0;
+    if (block.count == 0) {
+        sample[n++] = flags;
+        n += putVarint(sample + n, zigzag(value));
+    } else {
+        delta = (int32_t)(timeMs - lastTimeMs_);
+        bool changed = flags != lastFlags_;
+        n += putVarint(sample + n, zigzag((int64_t)delta - lastDelta_) << 1 | (changed ? 1 : 0));
+        if (changed) {
+            sample[n++] = flags;
+        }
+        n += putVarint(sample + n, zigzag((int64_t)value - lastValue_));
+    }
+    if (block.length + n > BACKLOG_BLOCK_SIZE || block.count == UINT16_MAX) {
+        return false;
+    }
+    if (block.count == 0) {
+        block.firstTimeMs = timeMs;
+    }
+    memcpy(block.data + block.length, sample, n);
+    block.length += n;
+    block.count++;
+    lastTimeMs_ = timeMs;
+    lastDelta_ = delta;
+    lastValue_ = value;
+    lastFlags_ = flags;
+    return true;
+}
+
+size_t encodeSyncHeader(const BacklogSyncHeader& header, uint8_t out[BACKLOG_SYNC_HEADER]) {
+    memcpy(out, BACKLOG_MAGIC, 4);
+    out[4] = BACKLOG_VERSION;
+    out[5] = header.more ? 1 : 0;
+    putU32(out + 6, header.boot);
+    putU32(out + 10, header.nowMs);
+    putU32(out + 14, header.next);
+    putU32(out + 18, header.oldest);
+    return BACKLOG_SYNC_HEADER;
+}
+
+bool decodeSyncHeader(const uint8_t* data, size_t length, BacklogSyncHeader& header) {
+    if (length < BACKLOG_SYNC_HEADER || memcmp(data, BACKLOG_MAGIC, 4) != 0 || data[4] != BACKLOG_VERSION) {
+        return false;
+    }
+    header.more = data[5] != 0;
+    header.boot = getU32(data + 6);
+    header.nowMs = getU32(data + 10);
+    header.next = getU32(data + 14);
+    header.oldest = getU32(data + 18);
+    return true;
+}
+
+size_t encodeBlockHeader(const BacklogBlock& block, uint8_t out[BACKLOG_BLOCK_HEADER]) {
+    putU32(out, block.firstSequence);
+    putU32(out + 4, block.firstTimeMs);
+    putU16(out + 8, block.count);
+    putU16(out + 10, block.length);
+    return BACKLOG_BLOCK_HEADER;
+}
+
+// Bounds-checked reader over a block's payload
+class BlockReader {
+public:
+    BlockReader(const uint8_t* data, size_t length) : p_(data), end_(data + length), ok_(true) {}
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (p_ >= end_) {
+                ok_ = false;
+                return 0;
+            }
+            uint8_t byte = *p_++;
+            value |= (uint64_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        ok_ = false;
+        return 0;
+    }
+
+    uint8_t byte() {
+        if (p_ >= end_) {
+            ok_ = false;
+            return 0;
+        }
+        return *p_++;
+    }
+
+    bool ok() const { return ok_; }
+    bool done() const { return p_ == end_; }
+
+private:
+    const uint8_t* p_;
+    const uint8_t* end_;
+    bool ok_;
+};
+
+size_t decodeBacklogBlock(const uint8_t* data, size_t length, BacklogSampleHandler onSample) {
+    if (length < BACKLOG_BLOCK_HEADER) {
+        return 0;
+    }
+    uint32_t sequence = getU32(data);
+    uint32_t time = getU32(data + 4);
+    uint16_t count = getU16(data + 8);
+    uint16_t payloadLength = getU16(data + 10);
+    if (count == 0 || payloadLength > BACKLOG_BLOCK_SIZE || length - BACKLOG_BLOCK_HEADER < payloadLength) {
+        return 0;
+    }
+
+    // Decode the whole block before handing any of it on
+    BacklogSample samples[BACKLOG_BLOCK_SIZE / 2];
+    if (count > sizeof(samples) / sizeof(samples[0])) {
+        return 0;  // Every sample after the first takes at least two bytes
+    }
+    BlockReader reader(data + BACKLOG_BLOCK_HEADER, payloadLength);
+    uint8_t flags = reader.byte();
+    int64_t value = unzigzag(reader.varint());
+    int64_t delta = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        if (i > 0) {
+            uint64_t token = reader.varint();
+            delta += unzigzag(token >> 1);
+            time += (uint32_t)delta;
+            if (token & 1) {
+                flags = reader.byte();
+            }
+            value += unzigzag(reader.varint());
+        }
+        samples[i].sequence = sequence + i;
+        samples[i].timeMs = time;
+        samples[i].value = (int32_t)value;
+        samples[i].flags = flags;
+    }
+    if (!reader.ok() || !reader.done()) {
+        return 0;
+    }
+    if (onSample) {
+        for (uint16_t i = 0; i < count; i++) {
+            onSample(samples[i]);
+        }
+    }
+    return BACKLOG_BLOCK_HEADER + payloadLength;
+}
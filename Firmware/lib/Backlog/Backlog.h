@@ -0,0 +1,176 @@
+#ifndef BACKLOG_H
+#define BACKLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+
+// Bounded on-device log of recent samples, so a collector can backfill what
+// it missed while a unit was unreachable. Samples get consecutive sequence
+// numbers (from 0 each boot; a random boot id tells boots apart) and are
+// packed into fixed-size blocks: a time delta-of-delta, a value delta and
+// the flags only when they change, all as varints, which comes to about two
+// bytes per steady sample. A full block is sealed and the next one started;
+// once the ring is full the oldest block is dropped.
+//
+// A collector asks for whatever follows the last sequence number it holds
+// and gets whole blocks, a few per request, starting with the block that
+// holds the next sample. Blocks are self-contained, so an interrupted sync
+// loses at most the block in flight and the next request starts there.
+//
+// On the wire (little-endian) a sync response is
+//
+//   "OASY", u8 version, u8 more (further blocks after these), u32 boot,
+//   u32 now (ms), u32 next sequence, u32 oldest sequence held
+//
+// followed by blocks, each
+//
+//   u32 first sequence, u32 first time (ms), u16 samples, u16 payload
+//   length, payload
+//
+// The payload's first sample is u8 flags, zigzag value; every further one
+// is varint (zigzag time delta-of-delta << 1 | flags changed), u8 flags if
+// they changed, zigzag value delta. Times are the unit's millis().
+
+#define BACKLOG_MAGIC "OASY"
+#define BACKLOG_VERSION 1
+#define BACKLOG_BLOCK_SIZE 256    // Payload bytes per block
+#define BACKLOG_SYNC_HEADER 22
+#define BACKLOG_BLOCK_HEADER 12
+#define BACKLOG_SAMPLE_MAX 11     // Largest encoded sample
+
+// Same bits as the fleet collector's series file
+#define BACKLOG_FAN_ON 0x01
+#define BACKLOG_AUTO 0x02
+#define BACKLOG_GAP 0x04  // Samples were lost just before this one
+
+struct BacklogBlock {
+    uint32_t firstSequence;
+    uint32_t firstTimeMs;
+    uint16_t count;
+    uint16_t length;
+    uint8_t data[BACKLOG_BLOCK_SIZE];
+};
+
+struct BacklogSample {
+    uint32_t sequence;
+    uint32_t timeMs;
+    int32_t value;
+    uint8_t flags;
+};
+
+struct BacklogSyncHeader {
+    bool more;
+    uint32_t boot;
+    uint32_t nowMs;
+    uint32_t next;    // Sequence number the next sample will get
+    uint32_t oldest;  // Oldest sequence number still held
+};
+
+// Appends samples to the open block
+class BacklogEncoder {
+public:
+    void start(BacklogBlock& block, uint32_t sequence);
+    // False if the sample doesn't fit; the block is then left as it was
+    bool add(BacklogBlock& block, uint32_t timeMs, int32_t value, uint8_t flags);
+
+private:
+    uint32_t lastTimeMs_;
+    int32_t lastDelta_;
+    int32_t lastValue_;
+    uint8_t lastFlags_;
+};
+
+size_t encodeSyncHeader(const BacklogSyncHeader& header, uint8_t out[BACKLOG_SYNC_HEADER]);
+bool decodeSyncHeader(const uint8_t* data, size_t length, BacklogSyncHeader& header);
+size_t encodeBlockHeader(const BacklogBlock& block, uint8_t out[BACKLOG_BLOCK_HEADER]);
+
+typedef std::function<void(const BacklogSample& sample)> BacklogSampleHandler;
+
+// Decodes one block from a sync response. Returns the bytes it took, or 0
+// if the block is cut short or malformed.
+size_t decodeBacklogBlock(const uint8_t* data, size_t length, BacklogSampleHandler onSample);
+
+template<size_t Blocks>
+class SampleBacklog {
+    static_assert(Blocks >= 2, "SampleBacklog needs at least two blocks");
+
+public:
+    // What to send for a sync request
+    struct Range {
+        size_t first;  // Block index, 0 = oldest
+        size_t count;
+        bool more;
+        size_t bytes;  // Whole response, header included
+    };
+
+    SampleBacklog() { begin(0); }
+
+    void begin(uint32_t boot) {
+        boot_ = boot;
+        first_ = 0;
+        used_ = 1;
+        next_ = 0;
+        encoder_.start(blocks_[0], 0);
+    }
+
+    // Returns the sample's sequence number
+    uint32_t add(uint32_t timeMs, int32_t value, uint8_t flags) {
+        BacklogBlock* block = &blocks_[(first_ + used_ - 1) % Blocks];
+        if (!encoder_.add(*block, timeMs, value, flags)) {
+            if (used_ == Blocks) {
+                first_ = (first_ + 1) % Blocks;
+                used_--;
+            }
+            used_++;
+            block = &blocks_[(first_ + used_ - 1) % Blocks];
+            encoder_.start(*block, next_);
+            encoder_.add(*block, timeMs, value, flags);
+        }
+        return next_++;
+    }
+
+    uint32_t boot() const { return boot_; }
+    uint32_t next() const { return next_; }
+    uint32_t oldest() const { return blocks_[first_].firstSequence; }
+    size_t blockCount() const { return used_; }
+    const BacklogBlock& block(size_t i) const { return blocks_[(first_ + i) % Blocks]; }
+
+    // Up to maxBlocks for a client holding everything up to `since` from
+    // boot `boot`. Without a cursor from this boot (a new client, or the
+    // unit restarted) that's everything held, from the oldest block.
+    Range plan(bool haveCursor, uint32_t boot, uint32_t since, size_t maxBlocks) const {
+        Range range = {0, 0, false, BACKLOG_SYNC_HEADER};
+        if (haveCursor && boot == boot_ && since < next_) {
+            uint32_t from = since + 1;
+            while (range.first < used_ && block(range.first).firstSequence + block(range.first).count <= from) {
+                range.first++;
+            }
+        }
+        size_t available = used_ - range.first;
+        if (available > 0 && block(used_ - 1).count == 0) {
+            available--;  // Open block with nothing in it yet
+        }
+        range.count = available < maxBlocks ? available : maxBlocks;
+        range.more = available > range.count;
+        for (size_t i = 0; i < range.count; i++) {
+            range.bytes += BACKLOG_BLOCK_HEADER + block(range.first + i).length;
+        }
+        return range;
+    }
+
+    BacklogSyncHeader header(const Range& range, uint32_t nowMs) const {
+        BacklogSyncHeader header = {range.more, boot_, nowMs, next_, oldest()};
+        return header;
+    }
+
+private:
+    BacklogBlock blocks_[Blocks];
+    BacklogEncoder encoder_;
+    uint32_t boot_;
+    size_t first_;  // Oldest block
+    size_t used_;   // Blocks in use; the last is open
+    uint32_t next_;
+};
+
+#endif
@@ -0,0 +1,170 @@
+#include "Beacon.h"
+#include "Units.h"
+
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef ESP32
+#include <lwip/sockets.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+static void setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void put16(uint8_t* p, uint16_t value) {
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+static uint16_t get16(const uint8_t* p) {
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+uint16_t beaconCrc(const uint8_t* data, size_t length) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+size_t encodeBeacon(const BeaconPacket& packet, uint8_t* out) {
+    out[0] = BEACON_VERSION;
+    out[1] = packet.flags;
+    memcpy(out + 2, packet.deviceId, 6);
+    put16(out + 8, packet.bootId);
+    put16(out + 10, packet.sequence >> 16);
+    put16(out + 12, packet.sequence & 0xFFFF);
+    put16(out + 14, encodeTenths(packet.aqi));
+    put16(out + 16, encodeTenths(packet.pm25));
+    put16(out + 18, encodeTenths(packet.pm10));
+    put16(out + 20, encodeTenths(packet.threshold));
+    uint32_t interval = (packet.intervalMs + 50) / 100;
+    put16(out + 22, interval > 0xFFFF ? 0xFFFF : interval);
+    put16(out + 24, beaconCrc(out, 24));
+    return BEACON_SIZE;
+}
+
+bool decodeBeacon(const uint8_t* data, size_t length, BeaconPacket& packet) {
+    if (length != BEACON_SIZE || data[0] != BEACON_VERSION || get16(data + 24) != beaconCrc(data, 24)) {
+        return false;
+    }
+    packet.flags = data[1];
+    memcpy(packet.deviceId, data + 2, 6);
+    packet.bootId = get16(data + 8);
+    packet.sequence = (uint32_t)get16(data + 10) << 16 | get16(data + 12);
+    packet.aqi = decodeTenths(get16(data + 14));
+    packet.pm25 = decodeTenths(get16(data + 16));
+    packet.pm10 = decodeTenths(get16(data + 18));
+    packet.threshold = decodeTenths(get16(data + 20));
+    packet.intervalMs = get16(data + 22) * 100UL;
+    return true;
+}
+
+BeaconSender::BeaconSender() : fd_(-1), sent_(0), failed_(0) {
+    memset(address_, 0, sizeof(address_));
+}
+
+BeaconSender::~BeaconSender() {
+    stop();
+}
+
+bool BeaconSender::begin(const char* group, uint16_t port, uint8_t ttl) {
+    stop();
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (inet_pton(AF_INET, group, &address.sin_addr) != 1) {
+        return false;
+    }
+    fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd_ < 0) {
+        return false;
+    }
+    setsockopt(fd_, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    setNonBlocking(fd_);
+    memcpy(address_, &address, sizeof(address));
+    return true;
+}
+
+void BeaconSender::stop() {
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool BeaconSender::send(const BeaconPacket& packet) {
+    if (fd_ < 0) {
+        return false;
+    }
+    uint8_t datagram[BEACON_SIZE];
+    encodeBeacon(packet, datagram);
+    if (sendto(fd_, datagram, sizeof(datagram), 0, (const struct sockaddr*)address_, sizeof(struct sockaddr_in)) !=
+        (ssize_t)sizeof(datagram)) {
+        failed_++;
+        return false;
+    }
+    sent_++;
+    return true;
+}
+
+BeaconWindow::BeaconWindow()
+    : started_(false), bootId_(0), first_(0), highest_(0), seen_(0), received_(0), receivedBoot_(0),
+      missingBefore_(0), duplicates_(0), restarts_(0) {}
+
+bool BeaconWindow::accept(uint16_t bootId, uint32_t sequence) {
+    if (!started_ || bootId != bootId_) {
+        if (started_) {
+            missingBefore_ = missing();
+            restarts_++;
+        }
+        started_ = true;
+        bootId_ = bootId;
+        first_ = sequence;
+        highest_ = sequence;
+        seen_ = 1;
+        receivedBoot_ = 1;
+        received_++;
+        return true;
+    }
+
+    if (sequence > highest_) {
+        uint32_t shift = sequence - highest_;
+        seen_ = shift >= BEACON_WINDOW ? 0 : seen_ << shift;
+        seen_ |= 1;
+        highest_ = sequence;
+    } else {
+        uint32_t age = highest_ - sequence;
+        if (age >= BEACON_WINDOW || (seen_ >> age) & 1) {
+            duplicates_++;
+            return false;
+        }
+        seen_ |= (uint64_t)1 << age;
+        if (sequence < first_) {
+            first_ = sequence;  // Reordered ahead of the first one we saw
+        }
+    }
+    receivedBoot_++;
+    received_++;
+    return true;
+}
+
+uint32_t BeaconWindow::missing() const {
+    if (!started_) {
+        return 0;
+    }
+    return missingBefore_ + (highest_ - first_ + 1 - receivedBoot_);
+}
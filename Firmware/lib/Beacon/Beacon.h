@@ -0,0 +1,111 @@
+#ifndef BEACON_H
+#define BEACON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Multicast telemetry beacon: every unit periodically sends one small
+// datagram to a well-known group, so a collector on the LAN hears the whole
+// fleet without knowing any addresses. Fields are big-endian and scaled as
+// in Units.h.
+//
+//   0  u8   version (BEACON_VERSION)
+//   1  u8   flags: bit 0 fan on, bit 1 auto mode, bit 2 fan alert
+//   2  u8   device id (6 bytes, the MAC)
+//   8  u16  boot id, random per boot
+//  10  u32  sequence, from 0 at boot
+//  14  u16  AQI x10
+//  16  u16  PM2.5 (ug/m3) x10
+//  18  u16  PM10 (ug/m3) x10
+//  20  u16  fan threshold (AQI) x10
+//  22  u16  beacon interval, 100 ms units
+//  24  u16  CRC-16/CCITT-FALSE of bytes 0-23
+//
+// A receiver drops anything of another version or with a bad CRC, and runs
+// each unit's (boot id, sequence) through a BeaconWindow to drop copies.
+
+#define BEACON_VERSION 1
+#define BEACON_SIZE 26
+#define BEACON_GROUP "239.255.42.42"
+#define BEACON_PORT 4242
+
+#define BEACON_FAN_ON 0x01
+#define BEACON_AUTO 0x02
+#define BEACON_ALERT 0x04
+
+struct BeaconPacket {
+    uint8_t deviceId[6];
+    uint16_t bootId;
+    uint32_t sequence;
+    float aqi;
+    float pm25;       // NaN when not measured
+    float pm10;
+    float threshold;
+    uint8_t flags;
+    uint32_t intervalMs;
+};
+
+uint16_t beaconCrc(const uint8_t* data, size_t length);
+
+// Returns BEACON_SIZE
+size_t encodeBeacon(const BeaconPacket& packet, uint8_t* out);
+
+// False for a datagram of the wrong size or version, or with a bad CRC
+bool decodeBeacon(const uint8_t* data, size_t length, BeaconPacket& packet);
+
+// Sends beacons from a UDP socket. Doesn't block: a beacon the socket
+// can't take right now is simply not sent, the next one will be.
+class BeaconSender {
+public:
+    BeaconSender();
+    ~BeaconSender();
+
+    // group may also be a unicast address (a collector, or 127.0.0.1)
+    bool begin(const char* group = BEACON_GROUP, uint16_t port = BEACON_PORT, uint8_t ttl = 1);
+    void stop();
+
+    bool send(const BeaconPacket& packet);
+
+    uint32_t sentCount() const { return sent_; }
+    uint32_t failedCount() const { return failed_; }
+
+private:
+    int fd_;
+    uint8_t address_[16];  // sockaddr_in
+    uint32_t sent_;
+    uint32_t failed_;
+};
+
+// Duplicate suppression for one unit: accepts each (boot id, sequence) at
+// most once, tolerating reordering within the last BEACON_WINDOW sequence
+// numbers. Anything older than the window is dropped as a duplicate, since
+// it can't be told apart from one. A new boot id restarts the window.
+#define BEACON_WINDOW 64
+
+class BeaconWindow {
+public:
+    BeaconWindow();
+
+    // True if the beacon is new and should be used
+    bool accept(uint16_t bootId, uint32_t sequence);
+
+    uint32_t received() const { return received_; }
+    uint32_t duplicates() const { return duplicates_; }
+    uint32_t restarts() const { return restarts_; }
+    // Sequence numbers never seen, across boots
+    uint32_t missing() const;
+
+private:
+    bool started_;
+    uint16_t bootId_;
+    uint32_t first_;    // First sequence seen this boot
+    uint32_t highest_;
+    uint64_t seen_;     // Bit i: highest_ - i was received
+    uint32_t received_;
+    uint32_t receivedBoot_;
+    uint32_t missingBefore_;  // From earlier boots
+    uint32_t duplicates_;
+    uint32_t restarts_;
+};
+
+#endif
@@ -0,0 +1,589 @@
+#include "CoapServer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef ESP32
+#include <Arduino.h>
+#include <lwip/sockets.h>
+#else
+#include <arpa/inet.h>
+#include <chrono>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#define COAP_VERSION 1
+#define COAP_CON 0
+#define COAP_NON 1
+#define COAP_ACK 2
+#define COAP_RST 3
+
+#define OPTION_URI_HOST 3
+#define OPTION_OBSERVE 6
+#define OPTION_URI_PORT 7
+#define OPTION_URI_PATH 11
+#define OPTION_CONTENT_FORMAT 12
+#define OPTION_MAX_AGE 14
+#define OPTION_URI_QUERY 15
+#define OPTION_ACCEPT 17
+#define OPTION_BLOCK2 23
+#define OPTION_SIZE2 28
+#define OPTION_SIZE1 60
+
+#define OBSERVE_REGISTER 0
+#define OBSERVE_DEREGISTER 1
+#define OBSERVE_SEQUENCE_MASK 0xFFFFFF
+
+#define MAX_MESSAGES_PER_POLL 8
+
+static uint32_t nowMs() {
+#ifdef ESP32
+    return millis();
+#else
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static void setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static uint32_t fnv1a(const uint8_t* data, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t readUint(const uint8_t* p, size_t length) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < length; i++) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+// Options we act on or can safely ignore; any other critical (odd) option
+// gets 4.02
+static bool optionKnown(uint16_t number) {
+    switch (number) {
+        case OPTION_URI_HOST:
+        case OPTION_OBSERVE:
+        case OPTION_URI_PORT:
+        case OPTION_URI_PATH:
+        case OPTION_CONTENT_FORMAT:
+        case OPTION_MAX_AGE:
+        case OPTION_URI_QUERY:
+        case OPTION_ACCEPT:
+        case OPTION_BLOCK2:  // Every representation fits in one block
+        case OPTION_SIZE2:
+        case OPTION_SIZE1:
+            return true;
+        default:
+            return (number & 1) == 0;
+    }
+}
+
+// Appends an option, delta-encoded against previous; returns the new end
+static uint8_t* writeOption(uint8_t* p, uint16_t& previous, uint16_t number, const uint8_t* value, size_t length) {
+    uint16_t delta = number - previous;
+    previous = number;
+    uint8_t* header = p++;
+    uint8_t deltaNibble = delta < 13 ? delta : 13;
+    uint8_t lengthNibble = length < 13 ? length : 13;
+    if (deltaNibble == 13) {
+        *p++ = delta - 13;
+    }
+    if (lengthNibble == 13) {
+        *p++ = length - 13;
+    }
+    *header = deltaNibble << 4 | lengthNibble;
+    memcpy(p, value, length);
+    return p + length;
+}
+
+// Unsigned options use as few bytes as the value needs (none for 0)
+static uint8_t* writeUintOption(uint8_t* p, uint16_t& previous, uint16_t number, uint32_t value) {
+    uint8_t bytes[4];
+    size_t length = 0;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        if (length > 0 || (value >> shift) & 0xFF) {
+            bytes[length++] = (value >> shift) & 0xFF;
+        }
+    }
+    return writeOption(p, previous, number, bytes, length);
+}
+
+CoapServer::CoapServer(uint16_t port)
+    : port_(port), fd_(-1), resourceCount_(0), messageId_(0), requests_(0), notifications_(0) {
+    for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+        observers_[i].active = false;
+    }
+}
+
+CoapServer::~CoapServer() {
+    stop();
+}
+
+bool CoapServer::begin() {
+    fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd_ < 0) {
+        return false;
+    }
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port_);
+    if (bind(fd_, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    setNonBlocking(fd_);
+    // Message ids should not repeat across restarts within EXCHANGE_LIFETIME
+    messageId_ = (uint16_t)(nowMs() * 2654435761u >> 16);
+    return true;
+}
+
+void CoapServer::stop() {
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+        observers_[i].active = false;
+    }
+}
+
+bool CoapServer::on(const char* path, uint16_t contentFormat, bool observable, THandlerFunction handler) {
+    if (resourceCount_ >= COAP_MAX_RESOURCES) {
+        return false;
+    }
+    Resource& resource = resources_[resourceCount_++];
+    resource.path = path;
+    resource.contentFormat = contentFormat;
+    resource.observable = observable;
+    resource.handler = handler;
+    return true;
+}
+
+uint16_t CoapServer::nextMessageId() {
+    if (++messageId_ == 0) {
+        messageId_ = 1;  // 0 marks "no pending CON"
+    }
+    return messageId_;
+}
+
+size_t CoapServer::observerCount() const {
+    size_t count = 0;
+    for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+        count += observers_[i].active;
+    }
+    return count;
+}
+
+int CoapServer::findResource(const char* path) const {
+    for (int i = 0; i < resourceCount_; i++) {
+        if (strcmp(resources_[i].path, path) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+CoapServer::Observer* CoapServer::findObserver(const void* from, size_t fromLength, const uint8_t* token,
+                                              size_t tokenLength) {
+    for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+        Observer& observer = observers_[i];
+        if (observer.active && observer.addressLength == fromLength &&
+            memcmp(observer.address, from, fromLength) == 0 && observer.tokenLength == tokenLength &&
+            memcmp(observer.token, token, tokenLength) == 0) {
+            return &observer;
+        }
+    }
+    return nullptr;
+}
+
+CoapServer::Observer* CoapServer::addObserver(const void* from, size_t fromLength, const uint8_t* token,
+                                              size_t tokenLength, int resource) {
+    // A repeated registration (same endpoint and token) replaces the old one
+    Observer* observer = findObserver(from, fromLength, token, tokenLength);
+    for (int i = 0; !observer && i < COAP_MAX_OBSERVERS; i++) {
+        if (!observers_[i].active) {
+            observer = &observers_[i];
+        }
+    }
+    if (!observer || fromLength > sizeof(observer->address)) {
+        return nullptr;
+    }
+    observer->active = true;
+    memcpy(observer->address, from, fromLength);
+    observer->addressLength = fromLength;
+    memcpy(observer->token, token, tokenLength);
+    observer->tokenLength = tokenLength;
+    observer->resource = resource;
+    observer->sequence = 1;
+    observer->lastId = 0;
+    observer->pendingId = 0;
+    observer->retries = 0;
+    return observer;
+}
+
+size_t CoapServer::wellKnownCore(uint8_t* out, size_t size) const {
+    size_t length = 0;
+    for (int i = 0; i < resourceCount_; i++) {
+        const Resource& resource = resources_[i];
+        char link[COAP_PATH_MAX + 24];
+        int linkLength = snprintf(link, sizeof(link), "%s</%s>%s", i ? "," : "", resource.path,
+                                  resource.observable ? ";obs" : "");
+        if (resource.contentFormat != COAP_FORMAT_NONE && linkLength > 0 && (size_t)linkLength < sizeof(link)) {
+            linkLength += snprintf(link + linkLength, sizeof(link) - linkLength, ";ct=%u", resource.contentFormat);
+        }
+        if (linkLength <= 0 || length + linkLength > size) {
+            break;
+        }
+        memcpy(out + length, link, linkLength);
+        length += linkLength;
+    }
+    return length;
+}
+
+size_t CoapServer::handleMessage(const uint8_t* message, size_t length, uint8_t* response, const void* from,
+                                 size_t fromLength) {
+    if (length < 4 || message[0] >> 6 != COAP_VERSION) {
+        return 0;
+    }
+    uint8_t type = (message[0] >> 4) & 0x03;
+    uint8_t tokenLength = message[0] & 0x0F;
+    uint8_t code = message[1];
+    uint16_t messageId = (uint16_t)message[2] << 8 | message[3];
+
+    // Empty messages: a CON is a ping and gets a reset; ACK and RST answer
+    // our notifications
+    if (code == 0) {
+        if (type == COAP_CON) {
+            response[0] = COAP_VERSION << 6 | COAP_RST << 4;
+            response[1] = 0;
+            response[2] = message[2];
+            response[3] = message[3];
+            return 4;
+        }
+        handleReply(type, messageId, from, fromLength);
+        return 0;
+    }
+    if (type == COAP_RST && tokenLength == 0) {
+        handleReply(type, messageId, from, fromLength);
+        return 0;
+    }
+    // Only requests from here on; responses and malformed messages are
+    // rejected with a reset if confirmable, otherwise ignored
+    bool malformed = tokenLength > 8 || 4 + (size_t)tokenLength > length;
+    if (code >> 5 != 0 || malformed || type == COAP_ACK || type == COAP_RST) {
+        if (type == COAP_CON) {
+            response[0] = COAP_VERSION << 6 | COAP_RST << 4;
+            response[1] = 0;
+            response[2] = message[2];
+            response[3] = message[3];
+            return 4;
+        }
+        return 0;
+    }
+    requests_++;
+    const uint8_t* token = message + 4;
+
+    // Options
+    char path[COAP_PATH_MAX];
+    size_t pathLength = 0;
+    bool pathTooLong = false;
+    bool badOption = false;
+    bool hasObserve = false;
+    uint32_t observe = 0;
+    bool hasAccept = false;
+    uint16_t accept = 0;
+    uint16_t contentFormat = COAP_FORMAT_NONE;
+    const uint8_t* payload = nullptr;
+    size_t payloadLength = 0;
+
+    const uint8_t* p = token + tokenLength;
+    const uint8_t* end = message + length;
+    uint16_t number = 0;
+    while (p < end) {
+        if (*p == 0xFF) {
+            payload = p + 1;
+            payloadLength = end - payload;
+            if (payloadLength == 0) {
+                malformed = true;
+            }
+            break;
+        }
+        uint16_t delta = *p >> 4;
+        uint16_t optionLength = *p & 0x0F;
+        p++;
+        if (delta == 15 || optionLength == 15) {
+            malformed = true;
+            break;
+        }
+        if (delta == 13 && p < end) {
+            delta = 13 + *p++;
+        } else if (delta == 14 && p + 1 < end) {
+            delta = 269 + ((uint16_t)p[0] << 8 | p[1]);
+            p += 2;
+        }
+        if (optionLength == 13 && p < end) {
+            optionLength = 13 + *p++;
+        } else if (optionLength == 14 && p + 1 < end) {
+            optionLength = 269 + ((uint16_t)p[0] << 8 | p[1]);
+            p += 2;
+        }
+        if (p + optionLength > end) {
+            malformed = true;
+            break;
+        }
+        number += delta;
+        if (number == OPTION_URI_PATH) {
+            if (pathLength + (pathLength > 0) + optionLength >= sizeof(path)) {
+                pathTooLong = true;
+            } else {
+                if (pathLength > 0) {
+                    path[pathLength++] = '/';
+                }
+                memcpy(path + pathLength, p, optionLength);
+                pathLength += optionLength;
+            }
+        } else if (number == OPTION_OBSERVE && optionLength <= 3) {
+            hasObserve = true;
+            observe = readUint(p, optionLength);
+        } else if (number == OPTION_ACCEPT && optionLength <= 2) {
+            hasAccept = true;
+            accept = readUint(p, optionLength);
+        } else if (number == OPTION_CONTENT_FORMAT && optionLength <= 2) {
+            contentFormat = readUint(p, optionLength);
+        } else if (!optionKnown(number)) {
+            badOption = true;
+        }
+        p += optionLength;
+    }
+    path[pathLength] = '\0';
+
+    // Response header: piggybacked ACK for CON, a NON of our own for NON
+    uint8_t* out = response;
+    *out++ = COAP_VERSION << 6 | (type == COAP_CON ? COAP_ACK : COAP_NON) << 4 | tokenLength;
+    uint8_t* responseCode = out++;
+    uint16_t responseId = type == COAP_CON ? messageId : nextMessageId();
+    *out++ = responseId >> 8;
+    *out++ = responseId & 0xFF;
+    memcpy(out, token, tokenLength);
+    out += tokenLength;
+
+    uint8_t body[COAP_PAYLOAD_MAX];
+    size_t bodyLength = 0;
+    uint16_t bodyFormat = COAP_FORMAT_NONE;
+    Observer* registered = nullptr;
+
+    int index = pathTooLong ? -1 : findResource(path);
+    if (malformed) {
+        *responseCode = COAP_BAD_REQUEST;
+    } else if (badOption) {
+        *responseCode = COAP_BAD_OPTION;
+    } else if (strcmp(path, ".well-known/core") == 0) {
+        if (code != COAP_GET) {
+            *responseCode = COAP_METHOD_NOT_ALLOWED;
+        } else if (hasAccept && accept != COAP_FORMAT_LINK) {
+            *responseCode = COAP_NOT_ACCEPTABLE;
+        } else {
+            *responseCode = COAP_CONTENT;
+            bodyLength = wellKnownCore(body, sizeof(body));
+            bodyFormat = COAP_FORMAT_LINK;
+        }
+    } else if (index < 0) {
+        *responseCode = COAP_NOT_FOUND;
+    } else {
+        Resource& resource = resources_[index];
+        if (hasAccept && accept != resource.contentFormat) {
+            *responseCode = COAP_NOT_ACCEPTABLE;
+        } else if (payload && contentFormat != COAP_FORMAT_NONE && contentFormat != resource.contentFormat) {
+            *responseCode = COAP_UNSUPPORTED_FORMAT;
+        } else {
+            *responseCode = resource.handler(code, payload, payloadLength, body, bodyLength);
+            if (bodyLength > sizeof(body)) {
+                bodyLength = sizeof(body);
+            }
+            bodyFormat = resource.contentFormat;
+
+            // A GET with Observe 0 registers (if there's room; otherwise
+            // it's answered as a plain GET); Observe 1, or a GET without
+            // Observe on the same token, deregisters
+            if (code == COAP_GET) {
+                Observer* existing = findObserver(from, fromLength, token, tokenLength);
+                if (existing && (!hasObserve || observe == OBSERVE_DEREGISTER)) {
+                    existing->active = false;
+                }
+                if (resource.observable && hasObserve && observe == OBSERVE_REGISTER &&
+                    *responseCode == COAP_CONTENT) {
+                    registered = addObserver(from, fromLength, token, tokenLength, index);
+                    if (registered) {
+                        registered->lastHash = fnv1a(body, bodyLength);
+                    }
+                }
+            }
+        }
+    }
+
+    uint16_t previous = 0;
+    if (registered) {
+        out = writeUintOption(out, previous, OPTION_OBSERVE, registered->sequence);
+    }
+    if (*responseCode >> 5 == 2 && bodyFormat != COAP_FORMAT_NONE && bodyLength > 0) {
+        out = writeUintOption(out, previous, OPTION_CONTENT_FORMAT, bodyFormat);
+    }
+    if (bodyLength > 0) {
+        *out++ = 0xFF;
+        memcpy(out, body, bodyLength);
+        out += bodyLength;
+    }
+    return out - response;
+}
+
+void CoapServer::handleReply(uint8_t type, uint16_t messageId, const void* from, size_t fromLength) {
+    for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+        Observer& observer = observers_[i];
+        if (!observer.active || observer.addressLength != fromLength ||
+            memcmp(observer.address, from, fromLength) != 0) {
+            continue;
+        }
+        if (type == COAP_RST && (messageId == observer.lastId || messageId == observer.pendingId)) {
+            observer.active = false;  // The client has forgotten this observation
+        } else if (type == COAP_ACK && messageId == observer.pendingId) {
+            observer.pendingId = 0;
+            observer.retries = 0;
+        }
+    }
+}
+
+void CoapServer::notify(const char* path) {
+    int index = findResource(path);
+    if (index < 0 || fd_ < 0) {
+        return;
+    }
+    bool observed = false;
+    for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+        observed |= observers_[i].active && observers_[i].resource == index;
+    }
+    if (!observed) {
+        return;
+    }
+
+    size_t length = 0;
+    if (resources_[index].handler(COAP_GET, nullptr, 0, payload_, length) != COAP_CONTENT) {
+        return;
+    }
+    if (length > sizeof(payload_)) {
+        length = sizeof(payload_);
+    }
+    uint32_t hash = fnv1a(payload_, length);
+    for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+        Observer& observer = observers_[i];
+        if (observer.active && observer.resource == index && observer.lastHash != hash) {
+            sendNotification(observer, payload_, length, hash);
+        }
+    }
+}
+
+void CoapServer::sendNotification(Observer& observer, const uint8_t* payload, size_t length, uint32_t hash) {
+    observer.sequence = (observer.sequence + 1) & OBSERVE_SEQUENCE_MASK;
+    // A notification replaces an unacknowledged CON one rather than
+    // queueing behind it, carrying on its retransmission count
+    bool confirmable = observer.pendingId != 0 || observer.sequence % COAP_CON_EVERY == 0;
+    uint16_t messageId = nextMessageId();
+
+    uint8_t message[COAP_MESSAGE_MAX];
+    uint8_t* out = message;
+    *out++ = COAP_VERSION << 6 | (confirmable ? COAP_CON : COAP_NON) << 4 | observer.tokenLength;
+    *out++ = COAP_CONTENT;
+    *out++ = messageId >> 8;
+    *out++ = messageId & 0xFF;
+    memcpy(out, observer.token, observer.tokenLength);
+    out += observer.tokenLength;
+    uint16_t previous = 0;
+    out = writeUintOption(out, previous, OPTION_OBSERVE, observer.sequence);
+    uint16_t contentFormat = resources_[observer.resource].contentFormat;
+    if (contentFormat != COAP_FORMAT_NONE && length > 0) {
+        out = writeUintOption(out, previous, OPTION_CONTENT_FORMAT, contentFormat);
+    }
+    if (length > 0) {
+        *out++ = 0xFF;
+        memcpy(out, payload, length);
+        out += length;
+    }
+
+    sendto(fd_, message, out - message, 0, (const struct sockaddr*)observer.address, observer.addressLength);
+    notifications_++;
+    observer.lastHash = hash;
+    observer.lastId = messageId;
+    if (confirmable) {
+        if (observer.pendingId == 0) {
+            observer.retries = 0;
+            // ACK_TIMEOUT scaled by a random factor between 1 and 1.5
+            observer.timeoutMs = COAP_ACK_TIMEOUT_MS + messageId % (COAP_ACK_TIMEOUT_MS / 2);
+            observer.pendingSinceMs = nowMs();
+        }
+        observer.pendingId = messageId;
+    }
+}
+
+void CoapServer::poll() {
+    if (fd_ < 0) {
+        return;
+    }
+    uint8_t request[COAP_MESSAGE_MAX];
+    uint8_t response[COAP_MESSAGE_MAX];
+    for (int i = 0; i < MAX_MESSAGES_PER_POLL; i++) {
+        struct sockaddr_in from;
+        socklen_t fromLength = sizeof(from);
+        memset(&from, 0, sizeof(from));
+        ssize_t received = recvfrom(fd_, request, sizeof(request), 0, (struct sockaddr*)&from, &fromLength);
+        if (received < 0) {
+            break;
+        }
+        size_t length = handleMessage(request, received, response, &from, fromLength);
+        if (length > 0) {
+            sendto(fd_, response, length, 0, (struct sockaddr*)&from, fromLength);
+        }
+    }
+
+    // Retransmit overdue CON notifications with the current representation
+    // (under a new message id, as a newer notification); give up on the
+    // observer after COAP_MAX_RETRANSMIT
+    uint32_t now = nowMs();
+    for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+        Observer& observer = observers_[i];
+        if (!observer.active || observer.pendingId == 0 || now - observer.pendingSinceMs < observer.timeoutMs) {
+            continue;
+        }
+        if (observer.retries >= COAP_MAX_RETRANSMIT) {
+            observer.active = false;
+            continue;
+        }
+        observer.retries++;
+        observer.timeoutMs *= 2;
+        observer.pendingSinceMs = now;
+        size_t length = 0;
+        if (resources_[observer.resource].handler(COAP_GET, nullptr, 0, payload_, length) != COAP_CONTENT) {
+            observer.active = false;
+            continue;
+        }
+        if (length > sizeof(payload_)) {
+            length = sizeof(payload_);
+        }
+        sendNotification(observer, payload_, length, fnv1a(payload_, length));
+    }
+}
@@ -0,0 +1,136 @@
+#ifndef COAP_SERVER_H
+#define COAP_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+
+// CoAP (RFC 7252) server over a UDP socket, polled from loop() like
+// HttpServer. Resources are registered by path with a handler that writes
+// the representation; GET, PUT and POST reach the handler, and observable
+// resources accept Observe (RFC 7641) registrations. notify() sends the
+// current representation to every observer of a resource, unless it is
+// byte-for-byte what they were last sent. Notifications are NON except
+// every COAP_CON_EVERY-th, which is CON so observers that have gone away
+// get dropped. Requests are answered by re-running the handler, so every
+// resource must be idempotent; there is no block-wise transfer, so
+// representations must fit in COAP_PAYLOAD_MAX. /.well-known/core lists
+// the resources in CoRE link format.
+
+#ifndef COAP_MAX_RESOURCES
+#define COAP_MAX_RESOURCES 8
+#endif
+#ifndef COAP_MAX_OBSERVERS
+#define COAP_MAX_OBSERVERS 8
+#endif
+#define COAP_MESSAGE_MAX 256
+#define COAP_PAYLOAD_MAX 192
+#define COAP_PATH_MAX 48
+#define COAP_CON_EVERY 16
+#define COAP_ACK_TIMEOUT_MS 2000
+#define COAP_MAX_RETRANSMIT 4
+
+// Method codes
+#define COAP_GET 0x01
+#define COAP_POST 0x02
+#define COAP_PUT 0x03
+#define COAP_DELETE 0x04
+
+// Response codes (class << 5 | detail) a handler can return
+#define COAP_CREATED 0x41
+#define COAP_CHANGED 0x44
+#define COAP_CONTENT 0x45
+#define COAP_BAD_REQUEST 0x80
+#define COAP_BAD_OPTION 0x82
+#define COAP_NOT_FOUND 0x84
+#define COAP_METHOD_NOT_ALLOWED 0x85
+#define COAP_NOT_ACCEPTABLE 0x86
+#define COAP_UNSUPPORTED_FORMAT 0x8F
+#define COAP_INTERNAL_ERROR 0xA0
+#define COAP_SERVICE_UNAVAILABLE 0xA3
+
+// Content formats
+#define COAP_FORMAT_NONE 0xFFFF
+#define COAP_FORMAT_TEXT 0
+#define COAP_FORMAT_LINK 40
+#define COAP_FORMAT_OCTET_STREAM 42
+#define COAP_FORMAT_JSON 50
+
+class CoapServer {
+public:
+    // Fill out with up to COAP_PAYLOAD_MAX bytes and set length; return a
+    // response code. payload holds the request body (PUT/POST).
+    typedef std::function<uint8_t(uint8_t method, const uint8_t* payload, size_t length, uint8_t* out,
+                                  size_t& outLength)>
+        THandlerFunction;
+
+    explicit CoapServer(uint16_t port = 5683);
+    ~CoapServer();
+
+    bool begin();
+    void stop();
+
+    // path has no leading slash ("aqi", "sensors/temp"); it isn't copied
+    bool on(const char* path, uint16_t contentFormat, bool observable, THandlerFunction handler);
+
+    // Read and answer whatever is ready and retransmit overdue CON
+    // notifications; never blocks
+    void poll();
+
+    // Send observers of path the current representation if it changed
+    void notify(const char* path);
+
+    size_t observerCount() const;
+    uint32_t requestCount() const { return requests_; }
+    uint32_t notificationCount() const { return notifications_; }
+
+    // Answers one request message; returns the response length (0 for no
+    // response). from identifies the endpoint for Observe.
+    size_t handleMessage(const uint8_t* message, size_t length, uint8_t* response, const void* from,
+                         size_t fromLength);
+
+private:
+    struct Resource {
+        const char* path;
+        uint16_t contentFormat;
+        bool observable;
+        THandlerFunction handler;
+    };
+
+    struct Observer {
+        bool active;
+        uint8_t address[16];  // sockaddr_in
+        uint8_t addressLength;
+        uint8_t token[8];
+        uint8_t tokenLength;
+        uint8_t resource;
+        uint32_t sequence;   // Observe option value of the last notification
+        uint32_t lastHash;   // Of the last representation sent
+        uint16_t lastId;     // Message id of the last notification
+        uint16_t pendingId;  // Message id of an unacknowledged CON, or 0
+        uint32_t pendingSinceMs;
+        uint32_t timeoutMs;
+        uint8_t retries;
+    };
+
+    int findResource(const char* path) const;
+    Observer* findObserver(const void* from, size_t fromLength, const uint8_t* token, size_t tokenLength);
+    Observer* addObserver(const void* from, size_t fromLength, const uint8_t* token, size_t tokenLength,
+                          int resource);
+    void handleReply(uint8_t type, uint16_t messageId, const void* from, size_t fromLength);
+    void sendNotification(Observer& observer, const uint8_t* payload, size_t length, uint32_t hash);
+    size_t wellKnownCore(uint8_t* out, size_t size) const;
+    uint16_t nextMessageId();
+
+    uint16_t port_;
+    int fd_;
+    Resource resources_[COAP_MAX_RESOURCES];
+    int resourceCount_;
+    Observer observers_[COAP_MAX_OBSERVERS];
+    uint8_t payload_[COAP_PAYLOAD_MAX];
+    uint16_t messageId_;
+    uint32_t requests_;
+    uint32_t notifications_;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef OPENAIR_COAP_H
+#define OPENAIR_COAP_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Units.h"
+
+// Binary representations of the filter's CoAP resources, all served as
+// application/octet-stream (42). Fields are big-endian and scaled as in
+// Units.h; in a settings update, SCALED_NOT_AVAILABLE marks a field to
+// leave alone.
+//
+//   /aqi       GET, observable (4 bytes)
+//     0  u16  AQI x10
+//     2  u8   flags: bit 0 fan on, bit 1 auto mode, bit 2 fan alert
+//     3  u8   fan alert: 0 none, 1 stalled, 2 low RPM, 3 filter blocked
+//
+//   /history   GET, observable (1 + 2n bytes)
+//     0  u8   n
+//     1  u16  AQI x10, n of them, newest first
+//
+//   /settings  GET, observable; PUT/POST the same layout (10 bytes)
+//     0  u16  threshold (AQI) x10
+//     2  u16  hysteresis (AQI) x10
+//     4  u16  minimum on time (s)
+//     6  u16  minimum off time (s)
+//     8  u16  nominal fan speed (RPM)
+
+#define COAP_AQI_SIZE 4
+#define COAP_SETTINGS_SIZE 10
+#define COAP_AQI_FAN_ON 0x01
+#define COAP_AQI_AUTO 0x02
+#define COAP_AQI_ALERT 0x04
+
+struct CoapAqi {
+    float aqi;
+    bool fanOn;
+    bool autoMode;
+    uint8_t fanAlert;
+};
+
+// NaN fields are unavailable (GET) or unchanged (PUT)
+struct CoapSettings {
+    float threshold;
+    float hysteresis;
+    float minOnMs;
+    float minOffMs;
+    float nominalRpm;
+};
+
+inline void coapPut16(uint8_t* p, uint16_t value) {
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+inline uint16_t coapGet16(const uint8_t* p) {
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+inline size_t encodeCoapAqi(const CoapAqi& value, uint8_t* out) {
+    coapPut16(out, encodeTenths(value.aqi));
+    out[2] = (value.fanOn ? COAP_AQI_FAN_ON : 0) | (value.autoMode ? COAP_AQI_AUTO : 0) |
+             (value.fanAlert ? COAP_AQI_ALERT : 0);
+    out[3] = value.fanAlert;
+    return COAP_AQI_SIZE;
+}
+
+inline bool decodeCoapAqi(const uint8_t* data, size_t length, CoapAqi& value) {
+    if (length != COAP_AQI_SIZE) return false;
+    value.aqi = decodeTenths(coapGet16(data));
+    value.fanOn = data[2] & COAP_AQI_FAN_ON;
+    value.autoMode = data[2] & COAP_AQI_AUTO;
+    value.fanAlert = data[3];
+    return true;
+}
+
+inline size_t encodeCoapHistory(const float* values, size_t count, uint8_t* out, size_t size) {
+    if (count > 255) count = 255;
+    if (1 + count * 2 > size) count = (size - 1) / 2;
+    out[0] = count;
+    for (size_t i = 0; i < count; i++) {
+        coapPut16(out + 1 + i * 2, encodeTenths(values[i]));
+    }
+    return 1 + count * 2;
+}
+
+inline size_t encodeCoapSettings(const CoapSettings& value, uint8_t* out) {
+    coapPut16(out, encodeTenths(value.threshold));
+    coapPut16(out + 2, encodeTenths(value.hysteresis));
+    coapPut16(out + 4, encodeScaled(value.minOnMs, 0.001f));
+    coapPut16(out + 6, encodeScaled(value.minOffMs, 0.001f));
+    coapPut16(out + 8, encodeScaled(value.nominalRpm, 1));
+    return COAP_SETTINGS_SIZE;
+}
+
+inline bool decodeCoapSettings(const uint8_t* data, size_t length, CoapSettings& value) {
+    if (length != COAP_SETTINGS_SIZE) return false;
+    value.threshold = decodeTenths(coapGet16(data));
+    value.hysteresis = decodeTenths(coapGet16(data + 2));
+    value.minOnMs = decodeScaled(coapGet16(data + 4), 0.001f);
+    value.minOffMs = decodeScaled(coapGet16(data + 6), 0.001f);
+    value.nominalRpm = decodeScaled(coapGet16(data + 8), 1);
+    return true;
+}
+
+#endif
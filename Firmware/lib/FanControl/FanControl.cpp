@@ -0,0 +1,59 @@
+#include "FanControl.h"
+
+#include <math.h>
+
+FanController::FanController()
+    : on_(false), switched_(false), lastChangeMs_(0), cycles_(0), earlyStarts_(0) {
+    config_.onThreshold = 100.0f;
+    config_.offThreshold = 90.0f;
+    config_.minOnMs = 60000;
+    config_.minOffMs = 30000;
+}
+
+void FanController::configure(const FanControlConfig& config) {
+    config_ = config;
+    // Off threshold above the on threshold would make the fan oscillate
+    if (config_.offThreshold > config_.onThreshold) {
+        config_.offThreshold = config_.onThreshold;
+    }
+}
+
+bool FanController::update(float aqi, uint32_t nowMs) {
+    return update(aqi, NAN, nowMs);
+}
+
+bool FanController::update(float aqi, float forecast, uint32_t nowMs) {
+    // Dwell times only apply once the controller has switched at least once,
+    // so the fan can react immediately after boot
+    uint32_t dwell = on_ ? config_.minOnMs : config_.minOffMs;
+    if (switched_ && nowMs - lastChangeMs_ < dwell) {
+        return on_;
+    }
+
+    bool haveForecast = !isnan(forecast);
+    if (!on_ && (aqi > config_.onThreshold || (haveForecast && forecast > config_.onThreshold))) {
+        if (aqi <= config_.onThreshold) {
+            earlyStarts_++;
+        }
+        setState(true, nowMs);
+    } else if (on_ && aqi < config_.offThreshold && (!haveForecast || forecast < config_.offThreshold)) {
+        setState(false, nowMs);
+    }
+    return on_;
+}
+
+void FanController::force(bool on, uint32_t nowMs) {
+    if (on != on_) {
+        setState(on, nowMs);
+    }
+}
+
+void FanController::setState(bool on, uint32_t nowMs) {
+    on_ = on;
+    switched_ = true;
+    lastChangeMs_ = nowMs;
+    // One relay cycle per off -> on transition
+    if (on) {
+        cycles_++;
+    }
+}
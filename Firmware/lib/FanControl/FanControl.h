@@ -0,0 +1,61 @@
+#ifndef FAN_CONTROL_H
+#define FAN_CONTROL_H
+
+#include <stdint.h>
+
+// On/off (bang-bang) fan controller settings
+struct FanControlConfig {
+    float onThreshold;   // Turn on when AQI rises above this
+    float offThreshold;  // Turn off when AQI falls below this
+    uint32_t minOnMs;    // Minimum time the fan stays on once started
+    uint32_t minOffMs;   // Minimum time the fan stays off once stopped
+};
+
+// Limits on the user-facing settings; every path that changes them (HTTP,
+// MQTT, Modbus) rejects values outside these. NaN fails every check.
+#define FAN_THRESHOLD_MAX 500.0f
+#define FAN_HYSTERESIS_MAX 100.0f
+#define FAN_DWELL_MAX_MS 3600000UL
+
+inline bool validThreshold(float aqi) { return aqi >= 0 && aqi <= FAN_THRESHOLD_MAX; }
+inline bool validHysteresis(float aqi) { return aqi >= 0 && aqi <= FAN_HYSTERESIS_MAX; }
+inline bool validDwellMs(float ms) { return ms >= 0 && ms <= FAN_DWELL_MAX_MS; }
+
+// Hysteresis controller for relay-driven fans. Separate on/off thresholds
+// and minimum dwell times keep a noisy AQI from chattering the relay.
+class FanController {
+public:
+    FanController();
+
+    void configure(const FanControlConfig& config);
+    const FanControlConfig& config() const { return config_; }
+
+    // Evaluate the AQI at time nowMs and return the desired fan state
+    bool update(float aqi, uint32_t nowMs);
+
+    // As above, with a forecast of the AQI a few minutes out (NaN if there
+    // is none yet). The fan starts as soon as either crosses the on
+    // threshold, and stops only once both are below the off threshold.
+    bool update(float aqi, float forecast, uint32_t nowMs);
+
+    // Set the state directly (manual control), bypassing dwell times
+    void force(bool on, uint32_t nowMs);
+
+    bool isOn() const { return on_; }
+    uint32_t cycleCount() const { return cycles_; }
+    // Starts made on the forecast alone, before the AQI itself crossed
+    uint32_t earlyStarts() const { return earlyStarts_; }
+    uint32_t msInState(uint32_t nowMs) const { return nowMs - lastChangeMs_; }
+
+private:
+    void setState(bool on, uint32_t nowMs);
+
+    FanControlConfig config_;
+    bool on_;
+    bool switched_;
+    uint32_t lastChangeMs_;
+    uint32_t cycles_;
+    uint32_t earlyStarts_;
+};
+
+#endif
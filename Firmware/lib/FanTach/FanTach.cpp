@@ -0,0 +1,164 @@
+#include "FanTach.h"
+
+#ifdef ESP32
+#include <driver/pcnt.h>
+
+// The hardware counter is 16 bits; it wraps to 0 at this limit
+#define PCNT_HIGH_LIMIT 32767
+
+PcntTachCounter::PcntTachCounter(int pin, int unit)
+    : pin_(pin), unit_(unit), lastRaw_(0), total_(0) {}
+
+bool PcntTachCounter::begin() {
+    pcnt_config_t config = {};
+    config.pulse_gpio_num = pin_;
+    config.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+    config.channel = PCNT_CHANNEL_0;
+    config.unit = (pcnt_unit_t)unit_;
+    config.pos_mode = PCNT_COUNT_INC;
+    config.neg_mode = PCNT_COUNT_DIS;
+    config.lctrl_mode = PCNT_MODE_KEEP;
+    config.hctrl_mode = PCNT_MODE_KEEP;
+    config.counter_h_lim = PCNT_HIGH_LIMIT;
+    config.counter_l_lim = 0;
+
+    if (pcnt_unit_config(&config) != ESP_OK) {
+        return false;
+    }
+    // Tach lines are open collector and pick up switching noise from the
+    // motor; ignore pulses shorter than ~12.5 us (1000 APB cycles)
+    pcnt_set_filter_value((pcnt_unit_t)unit_, 1000);
+    pcnt_filter_enable((pcnt_unit_t)unit_);
+    gpio_pullup_en((gpio_num_t)pin_);
+
+    pcnt_counter_pause((pcnt_unit_t)unit_);
+    pcnt_counter_clear((pcnt_unit_t)unit_);
+    pcnt_counter_resume((pcnt_unit_t)unit_);
+    lastRaw_ = 0;
+    total_ = 0;
+    return true;
+}
+
+uint32_t PcntTachCounter::pulses() {
+    int16_t raw = 0;
+    pcnt_get_counter_value((pcnt_unit_t)unit_, &raw);
+    // Extend to 32 bits; valid as long as we poll before the counter wraps
+    // twice (over five minutes at typical tach frequencies)
+    int32_t delta = raw - lastRaw_;
+    if (delta < 0) {
+        delta += PCNT_HIGH_LIMIT;
+    }
+    lastRaw_ = raw;
+    total_ += delta;
+    return total_;
+}
+#endif
+
+SimTachCounter::SimTachCounter(uint8_t pulsesPerRev)
+    : pulsesPerRev_(pulsesPerRev), targetRpm_(0), rpm_(0), fraction_(0),
+      spinUpMs_(2000), lastMs_(0), started_(false), total_(0) {}
+
+void SimTachCounter::advance(uint32_t nowMs) {
+    if (!started_) {
+        started_ = true;
+        lastMs_ = nowMs;
+        return;
+    }
+    // Step in 10 ms slices so the spin-up curve is independent of call rate
+    while (lastMs_ != nowMs) {
+        uint32_t step = nowMs - lastMs_;
+        if (step > 10) step = 10;
+        if (spinUpMs_ > 0) {
+            rpm_ += (targetRpm_ - rpm_) * step / (float)spinUpMs_;
+        } else {
+            rpm_ = targetRpm_;
+        }
+        float edges = rpm_ * pulsesPerRev_ * step / 60000.0f + fraction_;
+        uint32_t whole = (uint32_t)edges;
+        fraction_ = edges - whole;
+        total_ += whole;
+        lastMs_ += step;
+    }
+}
+
+FanTach::FanTach()
+    : started_(false), lastPulses_(0), lastMs_(0), duty_(0), dutyChangeMs_(0),
+      rpm_(0), pending_(TACH_OK), pendingSinceMs_(0), alert_(TACH_OK),
+      alertCount_(0) {
+    config_.pulsesPerRev = 2;
+    config_.nominalRpm = 0;
+    config_.stallRpm = 200;
+    config_.tolerance = 0.25f;
+    config_.spinUpMs = 5000;
+    config_.alertDelayMs = 10000;
+}
+
+void FanTach::update(uint32_t pulses, float duty, uint32_t nowMs) {
+    if (!started_) {
+        started_ = true;
+        lastPulses_ = pulses;
+        lastMs_ = nowMs;
+        duty_ = duty;
+        dutyChangeMs_ = nowMs;
+        return;
+    }
+
+    uint32_t elapsed = nowMs - lastMs_;
+    if (elapsed == 0) {
+        return;
+    }
+    uint32_t counted = pulses - lastPulses_;
+    rpm_ = counted * 60000.0f / ((float)config_.pulsesPerRev * elapsed);
+    lastPulses_ = pulses;
+    lastMs_ = nowMs;
+
+    if (duty != duty_) {
+        duty_ = duty;
+        dutyChangeMs_ = nowMs;
+    }
+
+    // Don't judge the fan while it is still spinning up or down
+    TachAlert observed = TACH_OK;
+    if (nowMs - dutyChangeMs_ >= config_.spinUpMs) {
+        observed = classify(duty);
+    }
+
+    if (observed != pending_) {
+        pending_ = observed;
+        pendingSinceMs_ = nowMs;
+    }
+    if (pending_ == TACH_OK) {
+        alert_ = TACH_OK;
+    } else if (pending_ != alert_ && nowMs - pendingSinceMs_ >= config_.alertDelayMs) {
+        alert_ = pending_;
+        alertCount_++;
+    }
+}
+
+TachAlert FanTach::classify(float duty) const {
+    if (duty <= 0) {
+        return TACH_OK;
+    }
+    if (rpm_ < config_.stallRpm) {
+        return TACH_STALL;
+    }
+    if (config_.nominalRpm > 0) {
+        float expected = config_.nominalRpm * duty;
+        if (rpm_ < expected * (1.0f - config_.tolerance)) {
+            return TACH_LOW_RPM;
+        }
+        if (rpm_ > expected * (1.0f + config_.tolerance)) {
+            return TACH_FILTER_BLOCKED;
+        }
+    }
+    return TACH_OK;
+}
+
+const char* FanTach::alertName(TachAlert alert) {
+    switch (alert) {
+        case TACH_STALL: return "stall";
+        case TACH_LOW_RPM: return "low_rpm";
+        case TACH_FILTER_BLOCKED: return "filter_blocked";
+        default: return "ok";
+    }
+}
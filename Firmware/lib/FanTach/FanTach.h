@@ -0,0 +1,109 @@
+#ifndef FAN_TACH_H
+#define FAN_TACH_H
+
+#include <stdint.h>
+
+// Source of cumulative tachometer pulses. Implementations count in hardware
+// (or simulate), so reading the count is the only CPU work.
+class TachCounter {
+public:
+    virtual ~TachCounter() {}
+    virtual bool begin() = 0;
+    // Pulses counted since begin(); wraps at 2^32
+    virtual uint32_t pulses() = 0;
+};
+
+#ifdef ESP32
+// Counts rising edges on a GPIO with the ESP32 pulse counter (PCNT) peripheral
+class PcntTachCounter : public TachCounter {
+public:
+    PcntTachCounter(int pin, int unit = 0);
+    bool begin() override;
+    uint32_t pulses() override;
+
+private:
+    int pin_;
+    int unit_;
+    int16_t lastRaw_;
+    uint32_t total_;
+};
+#endif
+
+// Host stand-in: integrates a simulated fan speed over (virtual) time and
+// produces the pulses a real tach output would
+class SimTachCounter : public TachCounter {
+public:
+    SimTachCounter(uint8_t pulsesPerRev = 2);
+    bool begin() override { return true; }
+    uint32_t pulses() override { return total_; }
+
+    // Speed the rotor settles towards, and how quickly (first-order lag)
+    void setTargetRpm(float rpm) { targetRpm_ = rpm; }
+    void setSpinUpMs(uint32_t ms) { spinUpMs_ = ms; }
+    float rpm() const { return rpm_; }
+
+    // Advance simulated time to nowMs
+    void advance(uint32_t nowMs);
+
+private:
+    uint8_t pulsesPerRev_;
+    float targetRpm_;
+    float rpm_;
+    float fraction_;
+    uint32_t spinUpMs_;
+    uint32_t lastMs_;
+    bool started_;
+    uint32_t total_;
+};
+
+// Fan health derived from measured RPM versus commanded duty
+enum TachAlert {
+    TACH_OK = 0,
+    TACH_STALL,        // Driven but not turning
+    TACH_LOW_RPM,      // Turning well below nominal: obstructed rotor or worn bearing
+    TACH_FILTER_BLOCKED // Turning well above nominal: restricted airflow unloads the fan
+};
+
+struct FanTachConfig {
+    uint8_t pulsesPerRev;
+    float nominalRpm;      // RPM at full duty with a clean filter, 0 disables deviation checks
+    float stallRpm;        // Below this the fan counts as stopped
+    float tolerance;       // Allowed deviation from nominal, as a fraction
+    uint32_t spinUpMs;     // Grace period after a duty change
+    uint32_t alertDelayMs; // How long a fault must persist before it is raised
+};
+
+class FanTach {
+public:
+    FanTach();
+
+    void configure(const FanTachConfig& config) { config_ = config; }
+    const FanTachConfig& config() const { return config_; }
+
+    // Feed the cumulative pulse count and the commanded duty (0.0 - 1.0)
+    void update(uint32_t pulses, float duty, uint32_t nowMs);
+
+    float rpm() const { return rpm_; }
+    TachAlert alert() const { return alert_; }
+    bool hasAlert() const { return alert_ != TACH_OK; }
+    uint32_t alertCount() const { return alertCount_; }
+
+    static const char* alertName(TachAlert alert);
+
+private:
+    TachAlert classify(float duty) const;
+
+    FanTachConfig config_;
+    bool started_;
+    uint32_t lastPulses_;
+    uint32_t lastMs_;
+    float duty_;
+    uint32_t dutyChangeMs_;
+    float rpm_;
+    TachAlert pending_;
+    uint32_t pendingSinceMs_;
+    TachAlert alert_;
+    uint32_t alertCount_;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#include "Forecast.h"
+
+#include <math.h>
+
+HoltForecaster::HoltForecaster() {
+    ForecastConfig config;
+    config.stepMs = 2000;
+    config.horizonMs = 180000;
+    config.alpha = 0.3f;
+    config.beta = 0.02f;
+    config.warmUp = 30;
+    configure(config);
+}
+
+void HoltForecaster::configure(const ForecastConfig& config) {
+    config_ = config;
+    if (config_.stepMs == 0) {
+        config_.stepMs = 1;
+    }
+    uint32_t steps = config_.horizonMs / config_.stepMs;
+    steps_ = steps < 1 ? 1 : steps > FORECAST_MAX_STEPS ? FORECAST_MAX_STEPS : steps;
+    scored_ = 0;
+    absSum_ = 0;
+    squareSum_ = 0;
+    biasSum_ = 0;
+    reset();
+}
+
+void HoltForecaster::reset() {
+    points_ = 0;
+    lastTimeMs_ = 0;
+    level_ = 0;
+    trend_ = 0;
+}
+
+void HoltForecaster::add(float value, uint32_t timeMs) {
+    if (points_ > 0 && timeMs - lastTimeMs_ > 2 * config_.stepMs) {
+        reset();
+    }
+
+    // Score the forecast made steps_ points ago for this one
+    float& slot = pending_[points_ % steps_];
+    if (points_ >= steps_ && !isnan(slot)) {
+        float error = slot - value;
+        scored_++;
+        absSum_ += fabsf(error);
+        squareSum_ += (double)error * error;
+        biasSum_ += error;
+    }
+
+    if (points_ == 0) {
+        level_ = value;
+        trend_ = 0;
+    } else {
+        float previous = level_;
+        level_ = config_.alpha * value + (1 - config_.alpha) * (level_ + trend_);
+        trend_ = config_.beta * (level_ - previous) + (1 - config_.beta) * trend_;
+    }
+    points_++;
+    lastTimeMs_ = timeMs;
+    slot = forecast();
+}
+
+float HoltForecaster::forecast() const {
+    if (!ready()) {
+        return NAN;
+    }
+    float ahead = level_ + trend_ * steps_;
+    return ahead > 0 ? ahead : 0;
+}
+
+ForecastErrors HoltForecaster::errors() const {
+    ForecastErrors errors = {scored_, NAN, NAN, NAN};
+    if (scored_ > 0) {
+        errors.mae = absSum_ / scored_;
+        errors.rmse = sqrt(squareSum_ / scored_);
+        errors.bias = biasSum_ / scored_;
+    }
+    return errors;
+}
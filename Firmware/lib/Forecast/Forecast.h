@@ -0,0 +1,67 @@
+#ifndef FORECAST_H
+#define FORECAST_H
+
+#include <stdint.h>
+
+// Short-horizon AQI forecast with Holt's linear trend method: exponentially
+// smoothed level and trend, updated in O(1) per point, forecast as
+// level + trend * steps ahead. Points must come on a fixed step (the
+// resampled series, not raw readings); a gap of more than two steps starts
+// the model over.
+//
+// Every forecast is kept until the time it was made for comes round, then
+// scored against the value that actually arrived, so the error figures are
+// for the horizon the fan controller acts on rather than one step ahead.
+
+#define FORECAST_MAX_STEPS 256  // Longest horizon, in steps
+
+struct ForecastConfig {
+    uint32_t stepMs;     // Spacing of the input points
+    uint32_t horizonMs;  // How far ahead forecast() looks
+    float alpha;         // Level smoothing, 0..1
+    float beta;          // Trend smoothing, 0..1
+    uint16_t warmUp;     // Points before forecasts are trusted
+};
+
+struct ForecastErrors {
+    uint32_t count;  // Forecasts scored
+    float mae;       // Mean absolute error
+    float rmse;
+    float bias;      // Mean of forecast - actual
+};
+
+class HoltForecaster {
+public:
+    HoltForecaster();
+
+    // Clears the model and its error figures
+    void configure(const ForecastConfig& config);
+    const ForecastConfig& config() const { return config_; }
+    void reset();
+
+    void add(float value, uint32_t timeMs);
+
+    bool ready() const { return points_ >= config_.warmUp; }
+    // AQI expected horizonMs after the latest point; NaN until ready()
+    float forecast() const;
+    float level() const { return level_; }
+    float trendPerMinute() const { return trend_ * 60000.0f / config_.stepMs; }
+
+    ForecastErrors errors() const;
+
+private:
+    ForecastConfig config_;
+    uint16_t steps_;  // Horizon in steps
+    uint32_t points_;
+    uint32_t lastTimeMs_;
+    float level_;
+    float trend_;
+
+    float pending_[FORECAST_MAX_STEPS];  // Forecast for each of the next steps_ points
+    uint32_t scored_;
+    double absSum_;
+    double squareSum_;
+    double biasSum_;
+};
+
+#endif
@@ -0,0 +1,102 @@
+#include "HaDiscovery.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "FanControl.h"
+
+struct HaEntity {
+    const char* component;
+    const char* object;
+    const char* name;
+    const char* fields;  // Entity-specific JSON members; "~" is the topic prefix
+};
+
+// Home Assistant expands a leading "~" in topics. Switches read "on"/"off"
+// out of the state JSON and send the same back.
+static const HaEntity entities[HA_ENTITY_COUNT] = {
+    {"sensor", "aqi", "Air quality",
+     "\"state_topic\":\"~/state\",\"value_template\":\"{{ value_json.aqi }}\","
+     "\"device_class\":\"aqi\",\"state_class\":\"measurement\""},
+    {"switch", "fan", "Fan",
+     "\"state_topic\":\"~/state\",\"value_template\":\"{{ value_json.fan }}\","
+     "\"command_topic\":\"~/fan/set\",\"state_on\":\"on\",\"state_off\":\"off\","
+     "\"payload_on\":\"on\",\"payload_off\":\"off\",\"icon\":\"mdi:fan\""},
+    {"switch", "auto", "Auto mode",
+     "\"state_topic\":\"~/state\",\"value_template\":\"{{ 'on' if value_json.auto else 'off' }}\","
+     "\"command_topic\":\"~/auto/set\",\"state_on\":\"on\",\"state_off\":\"off\","
+     "\"payload_on\":\"on\",\"payload_off\":\"off\",\"icon\":\"mdi:fan-auto\""},
+    {"number", "threshold", "Fan threshold",
+     "\"state_topic\":\"~/state\",\"value_template\":\"{{ value_json.threshold }}\","
+     "\"command_topic\":\"~/threshold/set\",\"min\":0,\"max\":500,\"step\":1,\"mode\":\"box\","
+     "\"icon\":\"mdi:gauge\""},
+};
+
+static size_t checked(int length, size_t size) {
+    return length > 0 && (size_t)length < size ? (size_t)length : 0;
+}
+
+size_t haConfigTopic(int index, const HaDevice& device, char* out, size_t size) {
+    if (index < 0 || index >= HA_ENTITY_COUNT) {
+        return 0;
+    }
+    const HaEntity& entity = entities[index];
+    return checked(snprintf(out, size, "%s/%s/%s/%s/config", HA_DISCOVERY_PREFIX, entity.component, device.id,
+                            entity.object),
+                   size);
+}
+
+size_t haConfigPayload(int index, const HaDevice& device, char* out, size_t size) {
+    if (index < 0 || index >= HA_ENTITY_COUNT) {
+        return 0;
+    }
+    const HaEntity& entity = entities[index];
+    int length = snprintf(out, size,
+                          "{\"~\":\"%s\",\"name\":\"%s\",\"unique_id\":\"%s_%s\",\"availability_topic\":\"~/status\","
+                          "\"device\":{\"identifiers\":[\"%s\"],\"name\":\"%s\",\"manufacturer\":\"OpenFilter\","
+                          "\"model\":\"OpenFilter ESP32\"},%s}",
+                          device.topicPrefix, entity.name, device.id, entity.object, device.id, device.name,
+                          entity.fields);
+    return checked(length, size);
+}
+
+size_t haCommandFilter(const HaDevice& device, char* out, size_t size) {
+    return checked(snprintf(out, size, "%s/+/set", device.topicPrefix), size);
+}
+
+HaCommand haParseCommand(const HaDevice& device, const char* topic, const uint8_t* payload, size_t length) {
+    HaCommand command = {HA_COMMAND_NONE, false, 0};
+    size_t prefixLength = strlen(device.topicPrefix);
+    if (strncmp(topic, device.topicPrefix, prefixLength) != 0 || topic[prefixLength] != '/') {
+        return command;
+    }
+    const char* object = topic + prefixLength + 1;
+
+    // Payloads aren't terminated; anything longer than a number is bogus
+    char text[16];
+    if (length == 0 || length >= sizeof(text)) {
+        return command;
+    }
+    memcpy(text, payload, length);
+    text[length] = '\0';
+
+    if (strcmp(object, "fan/set") == 0 || strcmp(object, "auto/set") == 0) {
+        if (strcasecmp(text, "on") == 0) {
+            command.on = true;
+        } else if (strcasecmp(text, "off") != 0) {
+            return command;
+        }
+        command.type = object[0] == 'f' ? HA_COMMAND_FAN : HA_COMMAND_AUTO;
+    } else if (strcmp(object, "threshold/set") == 0) {
+        char* end;
+        float value = strtof(text, &end);
+        if (end == text || *end != '\0' || !validThreshold(value)) {
+            return command;
+        }
+        command.type = HA_COMMAND_THRESHOLD;
+        command.value = value;
+    }
+    return command;
+}
@@ -0,0 +1,46 @@
+#ifndef HA_DISCOVERY_H
+#define HA_DISCOVERY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Home Assistant MQTT discovery for the filter: an AQI sensor, a fan
+// switch, an auto-mode switch and a threshold number. Their states come
+// from the retained <prefix>/state JSON the MqttPublisher keeps current,
+// not from <prefix>/samples, which replays old readings while the outbox
+// drains, and availability from <prefix>/status. Commands arrive on
+// <prefix>/<object>/set and are parsed here; applying them is up to the
+// caller.
+
+#define HA_DISCOVERY_PREFIX "homeassistant"
+#define HA_ENTITY_COUNT 4
+
+struct HaDevice {
+    const char* id;          // Unique, used in unique_id and the config topics
+    const char* name;
+    const char* topicPrefix; // The publisher's prefix
+};
+
+enum HaCommandType {
+    HA_COMMAND_NONE,      // Not one of ours, or a payload we can't use
+    HA_COMMAND_FAN,       // on: manual fan on/off
+    HA_COMMAND_AUTO,      // on: auto mode on/off
+    HA_COMMAND_THRESHOLD  // value
+};
+
+struct HaCommand {
+    HaCommandType type;
+    bool on;
+    float value;
+};
+
+// Retained config topic and payload of entity index (0..HA_ENTITY_COUNT-1);
+// both return the length written, or 0 if it didn't fit
+size_t haConfigTopic(int index, const HaDevice& device, char* out, size_t size);
+size_t haConfigPayload(int index, const HaDevice& device, char* out, size_t size);
+
+// Command topic filter to subscribe to: <prefix>/+/set
+size_t haCommandFilter(const HaDevice& device, char* out, size_t size);
+HaCommand haParseCommand(const HaDevice& device, const char* topic, const uint8_t* payload, size_t length);
+
+#endif
@@ -0,0 +1,749 @@
+#include "HttpServer.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <fcntl.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#ifdef ESP32
+#include <Arduino.h>
+#include <lwip/sockets.h>
+#else
+#include <arpa/inet.h>
+#include <chrono>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+// A write to a connection the client has closed must fail with EPIPE, not
+// raise SIGPIPE and kill the host build's process (lwIP has no signals but
+// accepts the flag)
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+static uint32_t nowMs() {
+#ifdef ESP32
+    return millis();
+#else
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static void setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static const char* statusText(int code) {
+    switch (code) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 408: return "Request Timeout";
+        case 409: return "Conflict";
+        case 413: return "Payload Too Large";
+        case 422: return "Unprocessable Content";
+        case 429: return "Too Many Requests";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        default: return "";
+    }
+}
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool parseMethod(const char* name, size_t length, HTTPMethod* method) {
+    static const struct {
+        const char* name;
+        HTTPMethod method;
+    } methods[] = {{"GET", HTTP_GET},       {"POST", HTTP_POST}, {"PUT", HTTP_PUT},
+                   {"DELETE", HTTP_DELETE}, {"HEAD", HTTP_HEAD}, {"OPTIONS", HTTP_OPTIONS}};
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        if (strlen(methods[i].name) == length && strncmp(methods[i].name, name, length) == 0) {
+            *method = methods[i].method;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Decodes %XX and '+' in place
+static void urlDecode(char* text) {
+    char* out = text;
+    for (char* in = text; *in; in++) {
+        if (*in == '+') {
+            *out++ = ' ';
+        } else if (*in == '%' && hexValue(in[1]) >= 0 && hexValue(in[2]) >= 0) {
+            *out++ = (char)(hexValue(in[1]) * 16 + hexValue(in[2]));
+            in += 2;
+        } else {
+            *out++ = *in;
+        }
+    }
+    *out = '\0';
+}
+
+HttpServer::HttpServer(uint16_t port)
+    : listenFd_(-1), port_(port), routeCount_(0), current_(nullptr),
+      extraHeadersUsed_(0), contentLength_(CONTENT_LENGTH_NOT_SET),
+      headersSent_(false), chunked_(false), failed_(false), sendProgressMs_(0), stream_(nullptr), streamRoute_(nullptr),
+      streamRemaining_(0), streamed_(0), served_(0), rejected_(0), cut_(0) {
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+        connections_[i].fd = -1;
+        connections_[i].deferred = false;
+        connections_[i].streaming = false;
+    }
+    memset(&request_, 0, sizeof(request_));
+    memset(&streamRequest_, 0, sizeof(streamRequest_));
+}
+
+HttpServer::~HttpServer() {
+    close();
+}
+
+bool HttpServer::begin() {
+    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd_ < 0) {
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port_);
+    if (bind(listenFd_, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+        listen(listenFd_, HTTP_MAX_CONNECTIONS) < 0) {
+        ::close(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+
+    socklen_t length = sizeof(address);
+    if (getsockname(listenFd_, (struct sockaddr*)&address, &length) == 0) {
+        port_ = ntohs(address.sin_port);
+    }
+    setNonBlocking(listenFd_);
+    return true;
+}
+
+void HttpServer::close() {
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+        closeConnection(connections_[i]);
+    }
+    if (listenFd_ >= 0) {
+        ::close(listenFd_);
+        listenFd_ = -1;
+    }
+}
+
+void HttpServer::on(const char* uri, HTTPMethod method, THandlerFunction handler) {
+    on(uri, method, handler, TBodyFunction());
+}
+
+void HttpServer::on(const char* uri, HTTPMethod method, THandlerFunction handler, TBodyFunction body) {
+    if (routeCount_ >= HTTP_MAX_ROUTES) {
+        return;
+    }
+    Route& route = routes_[routeCount_++];
+    route.uri = uri;
+    route.method = method;
+    route.handler = handler;
+    route.body = body;
+}
+
+void HttpServer::onNotFound(THandlerFunction handler) {
+    notFound_ = handler;
+}
+
+void HttpServer::onDeferred(TDeferredFunction handler) {
+    deferred_ = handler;
+}
+
+void HttpServer::handleClient() {
+    if (listenFd_ < 0) {
+        return;
+    }
+    acceptConnections();
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+        if (connections_[i].fd < 0) {
+            continue;
+        }
+        if (connections_[i].deferred) {
+            serviceDeferred(connections_[i]);
+        } else if (connections_[i].streaming) {
+            serviceStream(connections_[i]);
+        } else {
+            serviceConnection(connections_[i]);
+        }
+    }
+}
+
+void HttpServer::acceptConnections() {
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+        Connection& connection = connections_[i];
+        if (connection.fd >= 0) {
+            continue;
+        }
+        // Connections beyond the free slots wait in the listen backlog
+        int fd = accept(listenFd_, nullptr, nullptr);
+        if (fd < 0) {
+            return;
+        }
+        setNonBlocking(fd);
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        connection.fd = fd;
+        connection.startMs = nowMs();
+        connection.used = 0;
+    }
+}
+
+void HttpServer::serviceConnection(Connection& connection) {
+    while (connection.used < HTTP_REQUEST_BUFFER) {
+        ssize_t received = recv(connection.fd, connection.buffer + connection.used,
+                                HTTP_REQUEST_BUFFER - connection.used, 0);
+        if (received > 0) {
+            connection.used += received;
+            continue;
+        }
+        if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            closeConnection(connection);  // Client went away
+            return;
+        }
+        break;
+    }
+
+    size_t headerEnd = 0;
+    size_t bodyLength = 0;
+    size_t total = 0;
+    RequestState state = checkRequest(connection, &headerEnd, &bodyLength, &total);
+    if (state == REQUEST_MALFORMED) {
+        reject(connection, 400);
+        return;
+    }
+    if (headerEnd > 0) {
+        const Route* route = findStreamRoute(connection);
+        if (route) {
+            beginStream(connection, *route, headerEnd, bodyLength);
+            return;
+        }
+    }
+    if (state == REQUEST_COMPLETE) {
+        if (parseRequest(connection, headerEnd, total)) {
+            dispatch(connection);
+        } else {
+            reject(connection, 400);
+        }
+    } else if (state == REQUEST_TOO_LARGE || connection.used >= HTTP_REQUEST_BUFFER) {
+        reject(connection, 413);
+    } else if (nowMs() - connection.startMs > HTTP_READ_TIMEOUT_MS) {
+        reject(connection, 408);
+    }
+}
+
+// Content-Length value: digits only, with optional whitespace around them
+// and nothing else before the end of the line. No sign, no overflow.
+static bool parseContentLength(const char* text, size_t* length) {
+    while (*text == ' ' || *text == '\t') {
+        text++;
+    }
+    if (!isdigit((unsigned char)*text)) {
+        return false;
+    }
+    char* end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (errno == ERANGE || value > (size_t)-1) {
+        return false;
+    }
+    while (*end == ' ' || *end == '\t') {
+        end++;
+    }
+    if (*end != '\r') {
+        return false;
+    }
+    *length = (size_t)value;
+    return true;
+}
+
+HttpServer::RequestState HttpServer::checkRequest(Connection& connection, size_t* headerEnd, size_t* bodyLength,
+                                                  size_t* total) {
+    connection.buffer[connection.used] = '\0';
+    char* end = strstr(connection.buffer, "\r\n\r\n");
+    if (!end) {
+        return REQUEST_INCOMPLETE;
+    }
+    *headerEnd = end - connection.buffer;
+
+    // Content-Length is found before the headers are split up in place
+    *bodyLength = 0;
+    for (char* line = strstr(connection.buffer, "\r\n"); line && line < end; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Content-Length:", 15) == 0) {
+            if (!parseContentLength(line + 17, bodyLength)) {
+                return REQUEST_MALFORMED;
+            }
+            break;
+        }
+    }
+    // Compared before adding, so a huge length can't wrap the total around
+    if (*bodyLength > HTTP_REQUEST_BUFFER - *headerEnd - 4) {
+        *total = 0;
+        return REQUEST_TOO_LARGE;
+    }
+    *total = *headerEnd + 4 + *bodyLength;
+    return connection.used >= *total ? REQUEST_COMPLETE : REQUEST_INCOMPLETE;
+}
+
+bool HttpServer::parseRequest(Connection& connection, size_t headerEnd, size_t total) {
+    char* buffer = connection.buffer;
+    memset(&request_, 0, sizeof(request_));
+
+    // Body follows the blank line; terminate it so it can be parsed as text
+    request_.body = buffer + headerEnd + 4;
+    request_.bodyLength = total - headerEnd - 4;
+    buffer[total] = '\0';
+    buffer[headerEnd + 2] = '\0';
+
+    // Request line: METHOD SP URI SP VERSION
+    char* line = buffer;
+    char* next = strstr(line, "\r\n");
+    if (!next) {
+        return false;
+    }
+    *next = '\0';
+    char* uri = strchr(line, ' ');
+    if (!uri) {
+        return false;
+    }
+    *uri++ = '\0';
+    char* version = strchr(uri, ' ');
+    if (version) {
+        *version = '\0';
+    }
+
+    if (!parseMethod(line, strlen(line), &request_.method)) {
+        return false;
+    }
+
+    // Query string arguments
+    request_.uri = uri;
+    char* query = strchr(uri, '?');
+    if (query) {
+        *query++ = '\0';
+        while (query && *query && request_.argCount < HTTP_MAX_ARGS) {
+            char* pair = query;
+            query = strchr(query, '&');
+            if (query) {
+                *query++ = '\0';
+            }
+            char* value = strchr(pair, '=');
+            if (value) {
+                *value++ = '\0';
+            } else {
+                value = pair + strlen(pair);
+            }
+            urlDecode(pair);
+            urlDecode(value);
+            request_.argNames[request_.argCount] = pair;
+            request_.argValues[request_.argCount] = value;
+            request_.argCount++;
+        }
+    }
+
+    // Headers: "Name: value" lines up to the blank line
+    line = next + 2;
+    while (*line && request_.headerCount < HTTP_MAX_HEADERS) {
+        next = strstr(line, "\r\n");
+        if (next) {
+            *next = '\0';
+        }
+        char* value = strchr(line, ':');
+        if (value) {
+            *value++ = '\0';
+            while (*value == ' ' || *value == '\t') {
+                value++;
+            }
+            request_.headerNames[request_.headerCount] = line;
+            request_.headerValues[request_.headerCount] = value;
+            request_.headerCount++;
+        }
+        if (!next) {
+            break;
+        }
+        line = next + 2;
+    }
+    return true;
+}
+
+void HttpServer::dispatch(Connection& connection) {
+    beginResponse(connection);
+
+    THandlerFunction* handler = nullptr;
+    for (int i = 0; i < routeCount_ && !handler; i++) {
+        Route& route = routes_[i];
+        if ((route.method == HTTP_ANY || route.method == request_.method) &&
+            strcmp(route.uri, request_.uri) == 0) {
+            handler = &route.handler;
+        }
+    }
+
+    if (handler) {
+        (*handler)();
+    } else if (notFound_) {
+        notFound_();
+    } else {
+        send(404, "text/plain", "Not Found");
+    }
+
+    if (connection.deferred) {
+        current_ = nullptr;  // Answered later by serviceDeferred()
+        return;
+    }
+    finishResponse(connection);
+}
+
+// Matches the request line against routes that stream their body, without
+// touching the buffer (the request may not be parsed yet)
+const HttpServer::Route* HttpServer::findStreamRoute(const Connection& connection) const {
+    const char* space = strchr(connection.buffer, ' ');
+    HTTPMethod method;
+    if (!space || !parseMethod(connection.buffer, space - connection.buffer, &method)) {
+        return nullptr;
+    }
+    const char* uri = space + 1;
+    size_t uriLength = strcspn(uri, " ?\r");
+    for (int i = 0; i < routeCount_; i++) {
+        const Route& route = routes_[i];
+        if (route.body && (route.method == HTTP_ANY || route.method == method) &&
+            strlen(route.uri) == uriLength && strncmp(route.uri, uri, uriLength) == 0) {
+            return &route;
+        }
+    }
+    return nullptr;
+}
+
+void HttpServer::beginStream(Connection& connection, const Route& route, size_t headerEnd, size_t bodyLength) {
+    if (stream_) {
+        reject(connection, 503);
+        return;
+    }
+    // Parse the headers alone; parsing terminates them at the first body byte
+    size_t bodyStart = headerEnd + 4;
+    char first = connection.buffer[bodyStart];
+    if (!parseRequest(connection, headerEnd, bodyStart)) {
+        reject(connection, 400);
+        return;
+    }
+    connection.buffer[bodyStart] = first;
+
+    streamRequest_ = request_;
+    stream_ = &connection;
+    streamRoute_ = &route;
+    streamRemaining_ = bodyLength;
+    streamed_ = 0;
+    connection.streaming = true;
+    connection.bodyStart = bodyStart;
+    connection.startMs = nowMs();
+
+    const char* expect = header("Expect");
+    if (expect && strcasecmp(expect, "100-continue") == 0) {
+        static const char interim[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        ::send(connection.fd, interim, sizeof(interim) - 1, SEND_FLAGS);
+    }
+
+    // Whatever of the body came in with the headers
+    size_t buffered = connection.used - bodyStart;
+    if (buffered > bodyLength) {
+        buffered = bodyLength;
+    }
+    connection.used = bodyStart;
+    if (bodyLength == 0) {
+        connection.streaming = false;
+        dispatch(connection);
+    } else if (buffered > 0) {
+        feedStream(connection, connection.buffer + bodyStart, buffered);
+    }
+}
+
+void HttpServer::serviceStream(Connection& connection) {
+    size_t taken = 0;
+    while (taken < HTTP_STREAM_BUDGET) {
+        size_t room = HTTP_REQUEST_BUFFER - connection.bodyStart;
+        if (room > streamRemaining_) {
+            room = streamRemaining_;
+        }
+        ssize_t received = recv(connection.fd, connection.buffer + connection.bodyStart, room, 0);
+        if (received > 0) {
+            connection.startMs = nowMs();
+            taken += received;
+            if (!feedStream(connection, connection.buffer + connection.bodyStart, received)) {
+                return;
+            }
+            continue;
+        }
+        if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            closeConnection(connection);  // Client went away mid-body
+            return;
+        }
+        break;
+    }
+    if (nowMs() - connection.startMs > HTTP_READ_TIMEOUT_MS) {
+        reject(connection, 408);
+    }
+}
+
+// Hands a piece to the body handler. Once the body is done, or the handler
+// declines more, the route's handler answers; false from then on.
+bool HttpServer::feedStream(Connection& connection, const char* data, size_t length) {
+    request_ = streamRequest_;
+    bool more = streamRoute_->body((const uint8_t*)data, length);
+    streamed_ += length;
+    streamRemaining_ -= length;
+    if (more && streamRemaining_ > 0) {
+        return true;
+    }
+    connection.streaming = false;
+    request_ = streamRequest_;
+    dispatch(connection);
+    return false;
+}
+
+void HttpServer::serviceDeferred(Connection& connection) {
+    // Nothing more is expected from the client; a read of 0 means it left
+    char discard[64];
+    ssize_t received = recv(connection.fd, discard, sizeof(discard), 0);
+    if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        closeConnection(connection);
+        return;
+    }
+
+    bool timedOut = nowMs() - connection.startMs >= connection.deferTimeoutMs;
+    beginResponse(connection);
+    memset(&request_, 0, sizeof(request_));  // The parsed request is gone
+    if (deferred_) {
+        deferred_(connection.deferTag, timedOut);
+    }
+    if (!headersSent_ && !timedOut) {
+        current_ = nullptr;  // Still waiting
+        return;
+    }
+    finishResponse(connection);
+}
+
+void HttpServer::finishResponse(Connection& connection) {
+    if (!headersSent_) {
+        send(500, "text/plain", "No response");
+    } else if (chunked_) {
+        sendContent("", 0);
+    }
+    served_++;
+    current_ = nullptr;
+    closeConnection(connection);
+}
+
+void HttpServer::reject(Connection& connection, int code) {
+    beginResponse(connection);
+    send(code, "text/plain", statusText(code));
+    rejected_++;
+    current_ = nullptr;
+    closeConnection(connection);
+}
+
+void HttpServer::closeConnection(Connection& connection) {
+    if (connection.fd >= 0) {
+        ::close(connection.fd);
+        connection.fd = -1;
+    }
+    connection.used = 0;
+    connection.deferred = false;
+    connection.streaming = false;
+    if (stream_ == &connection) {
+        stream_ = nullptr;
+    }
+}
+
+bool HttpServer::defer(uint32_t timeoutMs, uint32_t tag) {
+    if (!current_ || headersSent_ || deferredCount() >= HTTP_MAX_DEFERRED) {
+        return false;
+    }
+    current_->deferred = true;
+    current_->deferTag = tag;
+    current_->deferTimeoutMs = timeoutMs;
+    current_->startMs = nowMs();
+    return true;
+}
+
+int HttpServer::deferredCount() const {
+    int count = 0;
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+        if (connections_[i].fd >= 0 && connections_[i].deferred) {
+            count++;
+        }
+    }
+    return count;
+}
+
+bool HttpServer::hasArg(const char* name) const {
+    for (int i = 0; i < request_.argCount; i++) {
+        if (strcmp(request_.argNames[i], name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* HttpServer::arg(const char* name) const {
+    for (int i = 0; i < request_.argCount; i++) {
+        if (strcmp(request_.argNames[i], name) == 0) {
+            return request_.argValues[i];
+        }
+    }
+    return "";
+}
+
+const char* HttpServer::header(const char* name) const {
+    for (int i = 0; i < request_.headerCount; i++) {
+        if (strcasecmp(request_.headerNames[i], name) == 0) {
+            return request_.headerValues[i];
+        }
+    }
+    return nullptr;
+}
+
+void HttpServer::beginResponse(Connection& connection) {
+    current_ = &connection;
+    extraHeadersUsed_ = 0;
+    extraHeaders_[0] = '\0';
+    contentLength_ = CONTENT_LENGTH_NOT_SET;
+    headersSent_ = false;
+    chunked_ = false;
+    failed_ = false;
+}
+
+void HttpServer::sendHeader(const char* name, const char* value) {
+    int length = snprintf(extraHeaders_ + extraHeadersUsed_, sizeof(extraHeaders_) - extraHeadersUsed_,
+                          "%s: %s\r\n", name, value);
+    if (length > 0 && extraHeadersUsed_ + length < sizeof(extraHeaders_)) {
+        extraHeadersUsed_ += length;
+    } else {
+        extraHeaders_[extraHeadersUsed_] = '\0';  // Didn't fit; drop it
+    }
+}
+
+void HttpServer::writeHeaders(int code, const char* contentType, size_t length) {
+    char head[160 + HTTP_EXTRA_HEADERS];
+    int used = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\n", code, statusText(code));
+    if (contentType && contentType[0]) {
+        used += snprintf(head + used, sizeof(head) - used, "Content-Type: %s\r\n", contentType);
+    }
+    if (length == CONTENT_LENGTH_UNKNOWN) {
+        chunked_ = true;
+        used += snprintf(head + used, sizeof(head) - used, "Transfer-Encoding: chunked\r\n");
+    } else {
+        used += snprintf(head + used, sizeof(head) - used, "Content-Length: %lu\r\n", (unsigned long)length);
+    }
+    snprintf(head + used, sizeof(head) - used, "%sConnection: close\r\n\r\n", extraHeaders_);
+    headersSent_ = true;
+    sendProgressMs_ = nowMs();
+    writeAll(head, strlen(head));
+}
+
+void HttpServer::send(int code, const char* contentType, const char* content) {
+    send(code, contentType, content, content ? strlen(content) : 0);
+}
+
+void HttpServer::send(int code, const char* contentType, const char* content, size_t length) {
+    if (!current_ || headersSent_) {
+        return;
+    }
+    // A preset length means the body follows through sendContent()
+    bool bodyFollows = contentLength_ != CONTENT_LENGTH_NOT_SET;
+    writeHeaders(code, contentType, bodyFollows ? contentLength_ : length);
+    if (!bodyFollows && request_.method != HTTP_HEAD) {
+        writeAll(content, length);
+    }
+}
+
+void HttpServer::sendContent(const char* content) {
+    sendContent(content, strlen(content));
+}
+
+void HttpServer::sendContent(const char* content, size_t length) {
+    if (!current_ || !headersSent_) {
+        return;
+    }
+    if (!chunked_) {
+        writeAll(content, length);
+        return;
+    }
+    char size[12];
+    int sizeLength = snprintf(size, sizeof(size), "%lx\r\n", (unsigned long)length);
+    writeAll(size, sizeLength);
+    if (length == 0) {
+        writeAll("\r\n", 2);
+        chunked_ = false;  // Final chunk written
+        return;
+    }
+    writeAll(content, length);
+    writeAll("\r\n", 2);
+}
+
+bool HttpServer::writeAll(const char* data, size_t length) {
+    if (failed_ || !current_) {
+        return false;
+    }
+    while (length > 0) {
+        ssize_t sent = ::send(current_->fd, data, length, SEND_FLAGS);
+        if (sent > 0) {
+            data += sent;
+            length -= sent;
+            sendProgressMs_ = nowMs();
+            continue;
+        }
+        if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            failed_ = true;
+            return false;
+        }
+        // Socket buffer full: wait for the client to take some. If it has
+        // taken nothing for HTTP_SEND_STALL_MS the rest is dropped and the
+        // connection closes when the response finishes.
+        uint32_t elapsed = nowMs() - sendProgressMs_;
+        if (elapsed >= HTTP_SEND_STALL_MS) {
+            failed_ = true;
+            cut_++;
+            return false;
+        }
+        fd_set writable;
+        FD_ZERO(&writable);
+        FD_SET(current_->fd, &writable);
+        struct timeval timeout;
+        timeout.tv_sec = (HTTP_SEND_STALL_MS - elapsed) / 1000;
+        timeout.tv_usec = (HTTP_SEND_STALL_MS - elapsed) % 1000 * 1000;
+        select(current_->fd + 1, nullptr, &writable, nullptr, &timeout);
+    }
+    return true;
+}
@@ -0,0 +1,205 @@
+#ifndef HTTP_SERVER_H
+#define HTTP_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+
+// Small HTTP/1.1 server over BSD sockets (lwIP on the ESP32, POSIX on the
+// host) with the same shape as the Arduino WebServer: on(), handleClient(),
+// send(), sendContent(). Unlike WebServer it never touches the heap once
+// routes are registered: each connection owns a fixed request buffer that is
+// parsed in place, and responses are written straight from the caller's
+// buffers. Connections are read without blocking. Sending waits for socket
+// buffer space as long as the client keeps taking bytes, so a large page
+// goes out over several round trips; a client that takes nothing for
+// HTTP_SEND_STALL_MS has its response cut off and its connection closed,
+// so a dead one holds up loop() for no longer than that. A handler can
+// also defer() its request (long polling): the connection stays open and
+// the deferred handler answers it from a later handleClient() once it is
+// ready or the timeout expires. A route can take its body as a stream
+// instead (uploads larger than the buffer): the body handler is fed each
+// piece as it arrives and the route's handler answers once it is done.
+//
+// Do not include alongside <WebServer.h>; both define HTTP_GET and friends.
+
+#ifndef HTTP_MAX_CONNECTIONS
+#define HTTP_MAX_CONNECTIONS 6
+#endif
+#ifndef HTTP_MAX_DEFERRED
+#define HTTP_MAX_DEFERRED 4       // Leaves connections free for ordinary requests
+#endif
+#ifndef HTTP_REQUEST_BUFFER
+#define HTTP_REQUEST_BUFFER 2048  // Request line, headers and body
+#endif
+#ifndef HTTP_MAX_ROUTES
+#define HTTP_MAX_ROUTES 32
+#endif
+#define HTTP_MAX_ARGS 8
+#define HTTP_MAX_HEADERS 16
+#define HTTP_EXTRA_HEADERS 256    // Space for sendHeader() per response
+#define HTTP_READ_TIMEOUT_MS 3000  // Whole request; for a stream, between pieces
+#define HTTP_STREAM_BUDGET 8192    // Body bytes taken per handleClient()
+#define HTTP_SEND_STALL_MS 300     // Waiting for a client to take any more of a response
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+#define CONTENT_LENGTH_NOT_SET ((size_t)-2)
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_DELETE, HTTP_OPTIONS };
+
+class HttpServer {
+public:
+    typedef std::function<void(void)> THandlerFunction;
+    // Called for each deferred request on every handleClient(); sends a
+    // response when ready and must send one once timedOut is set
+    typedef std::function<void(uint32_t tag, bool timedOut)> TDeferredFunction;
+    // Called with each piece of a streamed body; request accessors are
+    // valid. Returning false stops reading and the route answers at once.
+    typedef std::function<bool(const uint8_t* data, size_t length)> TBodyFunction;
+
+    explicit HttpServer(uint16_t port);
+    ~HttpServer();
+
+    // Port 0 picks a free port (see port())
+    bool begin();
+    void close();
+    uint16_t port() const { return port_; }
+
+    void on(const char* uri, HTTPMethod method, THandlerFunction handler);
+    // Streams the request body through body(); one such request at a time,
+    // others get a 503 meanwhile. If the client goes away mid-body the
+    // handler is not called.
+    void on(const char* uri, HTTPMethod method, THandlerFunction handler, TBodyFunction body);
+    void onNotFound(THandlerFunction handler);
+    void onDeferred(TDeferredFunction handler);
+
+    // Accept, read and serve whatever is ready; never waits for a client
+    void handleClient();
+
+    // Request accessors, valid inside a handler. Strings point into the
+    // connection's request buffer.
+    HTTPMethod method() const { return request_.method; }
+    const char* uri() const { return request_.uri; }
+    int args() const { return request_.argCount; }
+    const char* argName(int i) const { return request_.argNames[i]; }
+    const char* arg(int i) const { return request_.argValues[i]; }
+    bool hasArg(const char* name) const;
+    const char* arg(const char* name) const;     // "" if missing
+    const char* header(const char* name) const;  // nullptr if missing
+    bool hasBody() const { return request_.bodyLength > 0; }  // Buffered bodies only
+    char* body() { return request_.body; }       // Mutable, nul-terminated
+    size_t bodyLength() const { return request_.bodyLength; }
+
+    // Responses. With setContentLength(CONTENT_LENGTH_UNKNOWN) send() only
+    // writes the headers and sendContent() writes chunks; an empty
+    // sendContent("") ends the response.
+    void sendHeader(const char* name, const char* value);
+    void setContentLength(size_t length) { contentLength_ = length; }
+    void send(int code, const char* contentType = nullptr, const char* content = "");
+    void send(int code, const char* contentType, const char* content, size_t length);
+    void sendContent(const char* content);
+    void sendContent(const char* content, size_t length);
+
+    // Inside a handler: keep the connection open instead of responding now.
+    // The tag is handed back to the deferred handler; request accessors are
+    // not available there. False if a response was already started or all
+    // deferral slots are taken; the handler should then respond itself.
+    bool defer(uint32_t timeoutMs, uint32_t tag);
+    int deferredCount() const;
+
+    // Inside a streamed route's handler: bytes taken and whether that was
+    // all of them (false if the body handler stopped early)
+    size_t streamedLength() const { return streamed_; }
+    bool streamComplete() const { return streamRemaining_ == 0; }
+
+    uint32_t requestsServed() const { return served_; }
+    uint32_t requestsRejected() const { return rejected_; }
+    // Responses cut off because the client stopped taking them
+    uint32_t responsesCut() const { return cut_; }
+
+private:
+    struct Connection {
+        int fd;
+        uint32_t startMs;
+        size_t used;
+        bool deferred;
+        bool streaming;
+        size_t bodyStart;  // Where streamed pieces are read to
+        uint32_t deferTag;
+        uint32_t deferTimeoutMs;
+        char buffer[HTTP_REQUEST_BUFFER + 1];
+    };
+
+    struct Request {
+        HTTPMethod method;
+        char* uri;
+        int argCount;
+        char* argNames[HTTP_MAX_ARGS];
+        char* argValues[HTTP_MAX_ARGS];
+        int headerCount;
+        char* headerNames[HTTP_MAX_HEADERS];
+        char* headerValues[HTTP_MAX_HEADERS];
+        char* body;
+        size_t bodyLength;
+    };
+
+    struct Route {
+        const char* uri;
+        HTTPMethod method;
+        THandlerFunction handler;
+        TBodyFunction body;
+    };
+
+    enum RequestState { REQUEST_INCOMPLETE, REQUEST_COMPLETE, REQUEST_TOO_LARGE, REQUEST_MALFORMED };
+
+    void acceptConnections();
+    void serviceConnection(Connection& connection);
+    RequestState checkRequest(Connection& connection, size_t* headerEnd, size_t* bodyLength, size_t* total);
+    bool parseRequest(Connection& connection, size_t headerEnd, size_t total);
+    void dispatch(Connection& connection);
+    const Route* findStreamRoute(const Connection& connection) const;
+    void beginStream(Connection& connection, const Route& route, size_t headerEnd, size_t bodyLength);
+    void serviceStream(Connection& connection);
+    bool feedStream(Connection& connection, const char* data, size_t length);
+    void serviceDeferred(Connection& connection);
+    void finishResponse(Connection& connection);
+    void reject(Connection& connection, int code);
+    void closeConnection(Connection& connection);
+
+    void beginResponse(Connection& connection);
+    void writeHeaders(int code, const char* contentType, size_t length);
+    bool writeAll(const char* data, size_t length);
+
+    int listenFd_;
+    uint16_t port_;
+    Connection connections_[HTTP_MAX_CONNECTIONS];
+    Route routes_[HTTP_MAX_ROUTES];
+    int routeCount_;
+    THandlerFunction notFound_;
+    TDeferredFunction deferred_;
+
+    // Current response
+    Request request_;
+    Connection* current_;
+    char extraHeaders_[HTTP_EXTRA_HEADERS];
+    size_t extraHeadersUsed_;
+    size_t contentLength_;
+    bool headersSent_;
+    bool chunked_;
+    bool failed_;
+    uint32_t sendProgressMs_;  // When the client last took some of the response
+
+    // The streamed request; its parsed headers are kept aside so other
+    // connections can be served between pieces
+    Connection* stream_;
+    const Route* streamRoute_;
+    Request streamRequest_;
+    size_t streamRemaining_;
+    size_t streamed_;
+
+    uint32_t served_;
+    uint32_t rejected_;
+    uint32_t cut_;
+};
+
+#endif
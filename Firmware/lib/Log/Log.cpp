@@ -0,0 +1,216 @@
+#include "Log.h"
+
+#include <atomic>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <chrono>
+#endif
+
+#define LOG_QUEUE_MASK (LOG_QUEUE_SIZE - 1)
+static_assert((LOG_QUEUE_SIZE & LOG_QUEUE_MASK) == 0, "LOG_QUEUE_SIZE must be a power of two");
+
+// Bounded multi-producer queue (Vyukov). Each slot's sequence number says
+// whether it is free for the producer at position pos (seq == pos) or holds
+// a message for the consumer (seq == pos + 1). Sequences are stored minus
+// the slot index so zero-initialised memory is a valid empty queue and
+// logging works before any setup code has run.
+struct LogSlot {
+    std::atomic<uint32_t> seq;
+    uint32_t timeMs;
+    uint8_t level;
+    char text[LOG_LINE_LENGTH];
+};
+
+static LogSlot slots[LOG_QUEUE_SIZE];
+static std::atomic<uint32_t> enqueuePos(0);
+static uint32_t dequeuePos = 0;
+static std::atomic<uint32_t> written(0);
+static std::atomic<uint32_t> dropped(0);
+static uint32_t droppedReported = 0;
+
+#if LOG_TAIL_LINES > 0
+// Tail lines are written by the drain task only; readers retry if a line
+// changed while they copied it (odd seq = being written)
+struct TailLine {
+    std::atomic<uint32_t> seq;
+    char text[LOG_LINE_LENGTH + 16];
+};
+static TailLine tail[LOG_TAIL_LINES];
+static std::atomic<uint32_t> tailCount(0);
+#endif
+
+static uint32_t defaultClock() {
+#ifdef ARDUINO
+    return millis();
+#else
+    using namespace std::chrono;
+    static const steady_clock::time_point start = steady_clock::now();
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now() - start).count();
+#endif
+}
+
+static LogClock logClock = defaultClock;
+
+void logSetClock(LogClock clock) {
+    logClock = clock ? clock : defaultClock;
+}
+
+bool logWrite(uint8_t level, const char* format, ...) {
+    uint32_t pos = enqueuePos.load(std::memory_order_relaxed);
+    LogSlot* slot;
+    for (;;) {
+        uint32_t index = pos & LOG_QUEUE_MASK;
+        slot = &slots[index];
+        int32_t diff = (int32_t)(slot->seq.load(std::memory_order_acquire) + index - pos);
+        if (diff == 0) {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Full: drop rather than make the caller wait for the UART
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->timeMs = logClock();
+    slot->level = level;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(slot->text, sizeof(slot->text), format, args);
+    va_end(args);
+
+    slot->seq.store(pos + 1 - (pos & LOG_QUEUE_MASK), std::memory_order_release);
+    written.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+static size_t formatLine(char* out, size_t size, uint32_t timeMs, uint8_t level, const char* text) {
+    static const char levels[] = "-EWID";
+    char tag = level < sizeof(levels) - 1 ? levels[level] : '?';
+    int length = snprintf(out, size, "[%5lu.%03lu] %c %s\n", (unsigned long)(timeMs / 1000),
+                          (unsigned long)(timeMs % 1000), tag, text);
+    if (length < 0) {
+        return 0;
+    }
+    return (size_t)length < size ? (size_t)length : size - 1;
+}
+
+static void emit(LogSink sink, const char* line, size_t length) {
+    if (sink) {
+        sink(line, length);
+    }
+#if LOG_TAIL_LINES > 0
+    uint32_t count = tailCount.load(std::memory_order_relaxed);
+    TailLine& entry = tail[count % LOG_TAIL_LINES];
+    uint32_t seq = entry.seq.load(std::memory_order_relaxed);
+    entry.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(entry.text, line, length + 1);
+    entry.seq.store(seq + 2, std::memory_order_release);
+    tailCount.store(count + 1, std::memory_order_release);
+#endif
+}
+
+size_t logDrain(LogSink sink, size_t maxLines) {
+    char line[LOG_LINE_LENGTH + 16];
+    size_t drained = 0;
+
+    uint32_t lost = dropped.load(std::memory_order_relaxed);
+    if (lost != droppedReported) {
+        char text[48];
+        snprintf(text, sizeof(text), "log: %lu message(s) dropped",
+                 (unsigned long)(lost - droppedReported));
+        droppedReported = lost;
+        emit(sink, line, formatLine(line, sizeof(line), logClock(), LOG_LEVEL_WARN, text));
+    }
+
+    while (drained < maxLines) {
+        uint32_t index = dequeuePos & LOG_QUEUE_MASK;
+        LogSlot& slot = slots[index];
+        int32_t diff = (int32_t)(slot.seq.load(std::memory_order_acquire) + index - (dequeuePos + 1));
+        if (diff < 0) {
+            break;  // Empty
+        }
+        size_t length = formatLine(line, sizeof(line), slot.timeMs, slot.level, slot.text);
+        slot.seq.store(dequeuePos + LOG_QUEUE_SIZE - index, std::memory_order_release);
+        dequeuePos++;
+
+        emit(sink, line, length);
+        drained++;
+    }
+    return drained;
+}
+
+size_t logTail(char* buffer, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    size_t used = 0;
+#if LOG_TAIL_LINES > 0
+    uint32_t count = tailCount.load(std::memory_order_acquire);
+    uint32_t first = count > LOG_TAIL_LINES ? count - LOG_TAIL_LINES : 0;
+
+    for (uint32_t i = first; i < count; i++) {
+        TailLine& entry = tail[i % LOG_TAIL_LINES];
+        char copy[sizeof(entry.text)];
+        uint32_t before;
+        uint32_t after;
+        int attempts = 0;
+        do {
+            before = entry.seq.load(std::memory_order_acquire);
+            memcpy(copy, entry.text, sizeof(copy));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = entry.seq.load(std::memory_order_relaxed);
+        } while ((before != after || (before & 1)) && ++attempts < 4);
+        if (before != after || (before & 1)) {
+            continue;  // Line is being overwritten by a newer one
+        }
+        copy[sizeof(copy) - 1] = '\0';
+
+        size_t length = strlen(copy);
+        if (used + length >= size) {
+            break;
+        }
+        memcpy(buffer + used, copy, length);
+        used += length;
+    }
+#endif
+    buffer[used] = '\0';
+    return used;
+}
+
+uint32_t logWritten() {
+    return written.load(std::memory_order_relaxed);
+}
+
+uint32_t logDropped() {
+    return dropped.load(std::memory_order_relaxed);
+}
+
+#ifdef ARDUINO
+static void serialSink(const char* line, size_t length) {
+    Serial.write((const uint8_t*)line, length);
+}
+
+static void drainTask(void*) {
+    for (;;) {
+        if (logDrain(serialSink) == 0) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+    }
+}
+
+bool logStartTask(uint8_t priority) {
+    return xTaskCreate(drainTask, "log", 3072, nullptr, priority, nullptr) == pdPASS;
+}
+#endif
@@ -0,0 +1,80 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Log levels. Messages above LOG_LEVEL are removed at compile time, including
+// the evaluation of their arguments.
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Messages waiting to be drained (power of two) and their maximum length
+#ifndef LOG_QUEUE_SIZE
+#define LOG_QUEUE_SIZE 64
+#endif
+#ifndef LOG_LINE_LENGTH
+#define LOG_LINE_LENGTH 96
+#endif
+
+// Recently drained lines kept for /api/logs; 0 disables the tail
+#ifndef LOG_TAIL_LINES
+#define LOG_TAIL_LINES 20
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logWrite(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) logWrite(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) logWrite(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logWrite(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+
+typedef uint32_t (*LogClock)();                          // Milliseconds
+typedef void (*LogSink)(const char* line, size_t length);
+
+// Format a message into the ring buffer. Never blocks: if the buffer is full
+// the message is dropped and counted. Safe from any task.
+bool logWrite(uint8_t level, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// Pass drained lines ("[seconds.millis] L message\n") to sink, at most
+// maxLines of them. Single consumer only. Returns the number drained.
+size_t logDrain(LogSink sink, size_t maxLines = LOG_QUEUE_SIZE);
+
+// Copy the most recent drained lines into buffer, oldest first
+size_t logTail(char* buffer, size_t size);
+
+void logSetClock(LogClock clock);
+uint32_t logWritten();
+uint32_t logDropped();
+
+#ifdef ARDUINO
+// Start a low-priority task that drains the buffer to Serial
+bool logStartTask(uint8_t priority = 1);
+#endif
+
+#endif
@@ -0,0 +1,150 @@
+#include "Metrics.h"
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+const uint32_t histogramBoundsUs[HISTOGRAM_BUCKETS] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+    100000, 250000, 500000, 1000000,
+};
+
+Histogram::Histogram() : count_(0), sumUs_(0) {
+    memset(counts_, 0, sizeof(counts_));
+}
+
+void Histogram::observe(uint32_t us) {
+    int bucket = 0;
+    while (bucket < HISTOGRAM_BUCKETS && us > histogramBoundsUs[bucket]) {
+        bucket++;
+    }
+    counts_[bucket]++;
+    count_++;
+    sumUs_ += us;
+}
+
+MetricsRegistry::MetricsRegistry() : count_(0) {}
+
+bool MetricsRegistry::add(const char* name, const char* help, Counter* counter, const char* labels) {
+    return addEntry(name, help, TYPE_COUNTER, counter, labels);
+}
+
+bool MetricsRegistry::add(const char* name, const char* help, Gauge* gauge, const char* labels) {
+    return addEntry(name, help, TYPE_GAUGE, gauge, labels);
+}
+
+bool MetricsRegistry::add(const char* name, const char* help, Histogram* histogram, const char* labels) {
+    return addEntry(name, help, TYPE_HISTOGRAM, histogram, labels);
+}
+
+bool MetricsRegistry::addEntry(const char* name, const char* help, Type type, void* metric, const char* labels) {
+    if (count_ >= METRICS_MAX_ENTRIES) {
+        return false;
+    }
+    Entry& entry = entries_[count_++];
+    entry.name = name;
+    entry.help = help;
+    entry.labels = labels;
+    entry.type = type;
+    entry.metric = metric;
+    return true;
+}
+
+// Line-at-a-time output through the caller's writer
+struct LineWriter {
+    MetricsWriter writer;
+    void* context;
+    char line[192];
+
+    void printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+void LineWriter::printf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length > 0) {
+        writer(line, (size_t)length < sizeof(line) ? (size_t)length : sizeof(line) - 1, context);
+    }
+}
+
+// Joins the entry's labels with an extra one (for histogram "le")
+static const char* joinLabels(char* out, size_t size, const char* labels, const char* extra) {
+    bool hasLabels = labels && labels[0];
+    bool hasExtra = extra && extra[0];
+    if (!hasLabels && !hasExtra) {
+        return "";
+    }
+    snprintf(out, size, "{%s%s%s}", hasLabels ? labels : "",
+             hasLabels && hasExtra ? "," : "", hasExtra ? extra : "");
+    return out;
+}
+
+void MetricsRegistry::render(MetricsWriter writer, void* context) const {
+    static const char* typeNames[] = {"counter", "gauge", "histogram"};
+    LineWriter out = {writer, context, {0}};
+    char labels[96];
+
+    // Series of the same family must be contiguous, so group by name in
+    // order of first registration
+    for (int i = 0; i < count_; i++) {
+        bool seen = false;
+        for (int j = 0; j < i && !seen; j++) {
+            seen = strcmp(entries_[j].name, entries_[i].name) == 0;
+        }
+        if (seen) {
+            continue;
+        }
+
+        const char* name = entries_[i].name;
+        out.printf("# HELP %s %s\n# TYPE %s %s\n", name, entries_[i].help, name,
+                   typeNames[entries_[i].type]);
+
+        for (int j = i; j < count_; j++) {
+            const Entry& entry = entries_[j];
+            if (strcmp(entry.name, name) != 0) {
+                continue;
+            }
+
+            switch (entry.type) {
+                case TYPE_COUNTER:
+                    out.printf("%s%s %lu\n", name, joinLabels(labels, sizeof(labels), entry.labels, nullptr),
+                               (unsigned long)static_cast<Counter*>(entry.metric)->value());
+                    break;
+
+                case TYPE_GAUGE: {
+                    float value = static_cast<Gauge*>(entry.metric)->value();
+                    const char* plain = joinLabels(labels, sizeof(labels), entry.labels, nullptr);
+                    if (isnan(value)) {
+                        out.printf("%s%s NaN\n", name, plain);
+                    } else {
+                        out.printf("%s%s %g\n", name, plain, (double)value);
+                    }
+                    break;
+                }
+
+                case TYPE_HISTOGRAM: {
+                    const Histogram* histogram = static_cast<Histogram*>(entry.metric);
+                    char le[24];
+                    uint32_t cumulative = 0;
+                    for (int b = 0; b <= HISTOGRAM_BUCKETS; b++) {
+                        cumulative += histogram->bucketCount(b);
+                        if (b < HISTOGRAM_BUCKETS) {
+                            snprintf(le, sizeof(le), "le=\"%g\"", histogramBoundsUs[b] / 1e6);
+                        } else {
+                            snprintf(le, sizeof(le), "le=\"+Inf\"");
+                        }
+                        out.printf("%s_bucket%s %lu\n", name, joinLabels(labels, sizeof(labels), entry.labels, le),
+                                   (unsigned long)cumulative);
+                    }
+                    const char* plain = joinLabels(labels, sizeof(labels), entry.labels, nullptr);
+                    out.printf("%s_sum%s %.6f\n", name, plain, histogram->sumUs() / 1e6);
+                    out.printf("%s_count%s %lu\n", name, plain, (unsigned long)histogram->count());
+                    break;
+                }
+            }
+        }
+    }
+}
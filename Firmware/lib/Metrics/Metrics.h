@@ -0,0 +1,89 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+#ifndef METRICS_MAX_ENTRIES
+#define METRICS_MAX_ENTRIES 96
+#endif
+
+// Monotonic counter, safe to increment from any task
+class Counter {
+public:
+    Counter() : value_(0) {}
+    void inc(uint32_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+    // For counters maintained elsewhere and copied in at scrape time
+    void set(uint32_t value) { value_.store(value, std::memory_order_relaxed); }
+    uint32_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint32_t> value_;
+};
+
+class Gauge {
+public:
+    Gauge() : value_(0) {}
+    void set(float value) { value_.store(value, std::memory_order_relaxed); }
+    float value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<float> value_;
+};
+
+// Bucket upper bounds in microseconds, shared by all histograms
+#define HISTOGRAM_BUCKETS 14
+extern const uint32_t histogramBoundsUs[HISTOGRAM_BUCKETS];
+
+// Fixed-bucket latency histogram. observe() is a short linear scan and a
+// few increments. Each histogram is meant to have a single writer.
+class Histogram {
+public:
+    Histogram();
+    void observe(uint32_t us);
+
+    uint32_t bucketCount(int bucket) const { return counts_[bucket]; }  // Non-cumulative
+    uint32_t count() const { return count_; }
+    uint64_t sumUs() const { return sumUs_; }
+
+private:
+    uint32_t counts_[HISTOGRAM_BUCKETS + 1];  // Last bucket is +Inf
+    uint32_t count_;
+    uint64_t sumUs_;
+};
+
+typedef void (*MetricsWriter)(const char* data, size_t length, void* context);
+
+// Registry of named metrics, rendered in the Prometheus text format. The
+// name, help and label strings must outlive the registry (literals or
+// static buffers). Labels are given preformatted, e.g. route="/api/aqi".
+class MetricsRegistry {
+public:
+    MetricsRegistry();
+
+    bool add(const char* name, const char* help, Counter* counter, const char* labels = nullptr);
+    bool add(const char* name, const char* help, Gauge* gauge, const char* labels = nullptr);
+    bool add(const char* name, const char* help, Histogram* histogram, const char* labels = nullptr);
+
+    // Writes the exposition text in small pieces, so no response-sized
+    // buffer is needed. Histogram durations are exported in seconds.
+    void render(MetricsWriter writer, void* context) const;
+
+private:
+    enum Type { TYPE_COUNTER, TYPE_GAUGE, TYPE_HISTOGRAM };
+    struct Entry {
+        const char* name;
+        const char* help;
+        const char* labels;
+        Type type;
+        void* metric;
+    };
+
+    bool addEntry(const char* name, const char* help, Type type, void* metric, const char* labels);
+
+    Entry entries_[METRICS_MAX_ENTRIES];
+    int count_;
+};
+
+#endif
@@ -0,0 +1,255 @@
+#include "ModbusTcp.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef ESP32
+#include <Arduino.h>
+#include <lwip/sockets.h>
+#else
+#include <arpa/inet.h>
+#include <chrono>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+#define MBAP_LENGTH 7
+
+static uint32_t nowMs() {
+#ifdef ESP32
+    return millis();
+#else
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static void setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static uint16_t readBe16(const uint8_t* p) {
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static void writeBe16(uint8_t* p, uint16_t value) {
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+ModbusTcpServer::ModbusTcpServer(uint16_t port) : port_(port), listenFd_(-1), requests_(0), exceptions_(0) {
+    for (int i = 0; i < MODBUS_MAX_CONNECTIONS; i++) {
+        connections_[i].fd = -1;
+    }
+}
+
+ModbusTcpServer::~ModbusTcpServer() {
+    stop();
+}
+
+bool ModbusTcpServer::begin() {
+    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd_ < 0) {
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port_);
+    if (bind(listenFd_, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+        listen(listenFd_, MODBUS_MAX_CONNECTIONS) < 0) {
+        close(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+    setNonBlocking(listenFd_);
+    return true;
+}
+
+void ModbusTcpServer::stop() {
+    for (int i = 0; i < MODBUS_MAX_CONNECTIONS; i++) {
+        closeConnection(connections_[i]);
+    }
+    if (listenFd_ >= 0) {
+        close(listenFd_);
+        listenFd_ = -1;
+    }
+}
+
+void ModbusTcpServer::poll() {
+    if (listenFd_ < 0) {
+        return;
+    }
+    acceptConnections();
+    for (int i = 0; i < MODBUS_MAX_CONNECTIONS; i++) {
+        if (connections_[i].fd >= 0) {
+            serviceConnection(connections_[i]);
+        }
+    }
+}
+
+void ModbusTcpServer::acceptConnections() {
+    for (int i = 0; i < MODBUS_MAX_CONNECTIONS; i++) {
+        Connection& connection = connections_[i];
+        if (connection.fd >= 0) {
+            continue;
+        }
+        int fd = accept(listenFd_, nullptr, nullptr);
+        if (fd < 0) {
+            return;
+        }
+        setNonBlocking(fd);
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        connection.fd = fd;
+        connection.lastActivityMs = nowMs();
+        connection.used = 0;
+    }
+}
+
+void ModbusTcpServer::closeConnection(Connection& connection) {
+    if (connection.fd >= 0) {
+        close(connection.fd);
+        connection.fd = -1;
+    }
+}
+
+void ModbusTcpServer::serviceConnection(Connection& connection) {
+    ssize_t received = recv(connection.fd, connection.buffer + connection.used,
+                            sizeof(connection.buffer) - connection.used, 0);
+    if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        closeConnection(connection);
+        return;
+    }
+    if (received < 0) {
+        // BMS masters usually hold their connection open and poll; only
+        // drop one that has gone quiet for a long time
+        if (nowMs() - connection.lastActivityMs > MODBUS_IDLE_TIMEOUT_MS) {
+            closeConnection(connection);
+        }
+        return;
+    }
+    connection.used += received;
+    connection.lastActivityMs = nowMs();
+
+    // Answer every complete frame; a client may pipeline several
+    size_t offset = 0;
+    while (connection.used - offset >= MBAP_LENGTH) {
+        const uint8_t* frame = connection.buffer + offset;
+        uint16_t length = readBe16(frame + 4);  // Unit id + PDU
+        if (readBe16(frame + 2) != 0 || length < 2 || length > MODBUS_ADU_MAX - 6) {
+            closeConnection(connection);  // Not Modbus; there's no resyncing a TCP stream
+            return;
+        }
+        if (connection.used - offset < 6 + (size_t)length) {
+            break;
+        }
+
+        uint8_t response[MODBUS_ADU_MAX];
+        size_t pduLength = handlePdu(frame + MBAP_LENGTH, length - 1, response + MBAP_LENGTH);
+        memcpy(response, frame, 4);  // Transaction and protocol id
+        writeBe16(response + 4, pduLength + 1);
+        response[6] = frame[6];      // Unit id
+        size_t total = MBAP_LENGTH + pduLength;
+        // A response this small fits in any socket buffer; if it doesn't
+        // go out whole the client isn't reading and can go
+        if (send(connection.fd, response, total, 0) != (ssize_t)total) {
+            closeConnection(connection);
+            return;
+        }
+        offset += 6 + length;
+    }
+    if (offset > 0) {
+        memmove(connection.buffer, connection.buffer + offset, connection.used - offset);
+        connection.used -= offset;
+    }
+}
+
+size_t ModbusTcpServer::exception(uint8_t function, uint8_t code, uint8_t* response) {
+    exceptions_++;
+    response[0] = function | 0x80;
+    response[1] = code;
+    return 2;
+}
+
+size_t ModbusTcpServer::handlePdu(const uint8_t* request, size_t length, uint8_t* response) {
+    requests_++;
+    uint8_t function = request[0];
+    uint16_t values[MODBUS_MAX_READ];
+
+    switch (function) {
+        case 0x03:
+        case 0x04: {
+            if (length != 5) {
+                return exception(function, MODBUS_ILLEGAL_VALUE, response);
+            }
+            uint16_t address = readBe16(request + 1);
+            uint16_t count = readBe16(request + 3);
+            if (count < 1 || count > MODBUS_MAX_READ) {
+                return exception(function, MODBUS_ILLEGAL_VALUE, response);
+            }
+            if ((uint32_t)address + count > 0x10000 || !onRead_) {
+                return exception(function, MODBUS_ILLEGAL_ADDRESS, response);
+            }
+            uint8_t code = onRead_(function == 0x04, address, count, values);
+            if (code != MODBUS_OK) {
+                return exception(function, code, response);
+            }
+            response[0] = function;
+            response[1] = count * 2;
+            for (uint16_t i = 0; i < count; i++) {
+                writeBe16(response + 2 + i * 2, values[i]);
+            }
+            return 2 + count * 2;
+        }
+        case 0x06: {
+            if (length != 5) {
+                return exception(function, MODBUS_ILLEGAL_VALUE, response);
+            }
+            if (!onWrite_) {
+                return exception(function, MODBUS_ILLEGAL_ADDRESS, response);
+            }
+            values[0] = readBe16(request + 3);
+            uint8_t code = onWrite_(readBe16(request + 1), 1, values);
+            if (code != MODBUS_OK) {
+                return exception(function, code, response);
+            }
+            memcpy(response, request, 5);  // Echo of the request
+            return 5;
+        }
+        case 0x10: {
+            if (length < 6) {
+                return exception(function, MODBUS_ILLEGAL_VALUE, response);
+            }
+            uint16_t address = readBe16(request + 1);
+            uint16_t count = readBe16(request + 3);
+            uint8_t bytes = request[5];
+            if (count < 1 || count > MODBUS_MAX_WRITE || bytes != count * 2 || length != 6 + (size_t)bytes) {
+                return exception(function, MODBUS_ILLEGAL_VALUE, response);
+            }
+            if ((uint32_t)address + count > 0x10000 || !onWrite_) {
+                return exception(function, MODBUS_ILLEGAL_ADDRESS, response);
+            }
+            for (uint16_t i = 0; i < count; i++) {
+                values[i] = readBe16(request + 6 + i * 2);
+            }
+            uint8_t code = onWrite_(address, count, values);
+            if (code != MODBUS_OK) {
+                return exception(function, code, response);
+            }
+            memcpy(response, request, 5);  // Function, address, count
+            return 5;
+        }
+        default:
+            return exception(function, MODBUS_ILLEGAL_FUNCTION, response);
+    }
+}
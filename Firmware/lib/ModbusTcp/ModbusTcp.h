@@ -0,0 +1,77 @@
+#ifndef MODBUS_TCP_H
+#define MODBUS_TCP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+
+// Modbus TCP server (slave) over BSD sockets, polled from loop() like
+// HttpServer. Supports reading holding and input registers (0x03, 0x04)
+// and writing single and multiple registers (0x06, 0x10); the register
+// contents are entirely up to the read and write handlers. Connections are
+// read without blocking into fixed buffers, requests may be pipelined, and
+// the unit id is echoed but otherwise ignored.
+
+#ifndef MODBUS_MAX_CONNECTIONS
+#define MODBUS_MAX_CONNECTIONS 4
+#endif
+#define MODBUS_IDLE_TIMEOUT_MS 60000
+#define MODBUS_ADU_MAX 260        // MBAP header (7) + PDU (253)
+#define MODBUS_MAX_READ 125       // Registers per read, per the spec
+#define MODBUS_MAX_WRITE 123      // Registers per write
+
+// Exception codes a handler can return (0 for success)
+#define MODBUS_OK 0x00
+#define MODBUS_ILLEGAL_FUNCTION 0x01
+#define MODBUS_ILLEGAL_ADDRESS 0x02
+#define MODBUS_ILLEGAL_VALUE 0x03
+#define MODBUS_SERVER_FAILURE 0x04
+#define MODBUS_SERVER_BUSY 0x06
+
+class ModbusTcpServer {
+public:
+    // input is true for function 0x04 (input registers), false for 0x03
+    typedef std::function<uint8_t(bool input, uint16_t address, uint16_t count, uint16_t* values)> TReadFunction;
+    typedef std::function<uint8_t(uint16_t address, uint16_t count, const uint16_t* values)> TWriteFunction;
+
+    explicit ModbusTcpServer(uint16_t port = 502);
+    ~ModbusTcpServer();
+
+    bool begin();
+    void stop();
+    void onRead(TReadFunction handler) { onRead_ = handler; }
+    void onWrite(TWriteFunction handler) { onWrite_ = handler; }
+
+    // Accept, read and answer whatever is ready; never blocks
+    void poll();
+
+    // Answers one request PDU (function code onwards); returns the length
+    // of the response PDU written to response (at most 253 bytes)
+    size_t handlePdu(const uint8_t* request, size_t length, uint8_t* response);
+
+    uint32_t requestCount() const { return requests_; }
+    uint32_t exceptionCount() const { return exceptions_; }
+
+private:
+    struct Connection {
+        int fd;
+        uint32_t lastActivityMs;
+        size_t used;
+        uint8_t buffer[MODBUS_ADU_MAX];
+    };
+
+    void acceptConnections();
+    void serviceConnection(Connection& connection);
+    void closeConnection(Connection& connection);
+    size_t exception(uint8_t function, uint8_t code, uint8_t* response);
+
+    uint16_t port_;
+    int listenFd_;
+    Connection connections_[MODBUS_MAX_CONNECTIONS];
+    TReadFunction onRead_;
+    TWriteFunction onWrite_;
+    uint32_t requests_;
+    uint32_t exceptions_;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef OPENAIR_REGISTERS_H
+#define OPENAIR_REGISTERS_H
+
+#include <math.h>
+#include <stdint.h>
+
+#include "Units.h"
+
+// The filter's fixed Modbus register map. The same registers answer reads
+// of holding registers (0x03) and input registers (0x04); the writable ones
+// take 0x06 and 0x10. Addresses are zero-based (add 40001 for the
+// traditional holding register numbers). Scaled values are as in Units.h.
+//
+//   0  AQI                 x10
+//   1  PM2.5 (ug/m3)       x10, 0xFFFF without a PM sensor
+//   2  PM10 (ug/m3)        x10, 0xFFFF without a PM sensor
+//   3  Fan on              0/1, writable: manual on/off (turns auto mode off)
+//   4  Fan duty (%)        0 or 100, the fan is relay-switched
+//   5  Fan speed (RPM)     from the tachometer
+//   6  Auto mode           0/1, writable
+//   7  Threshold (AQI)     x10, writable
+//   8  Hysteresis (AQI)    x10, writable
+//   9  Uptime (s)          high word
+//  10  Uptime (s)          low word
+//  11  Fan alert           0 none, 1 stalled, 2 low RPM, 3 filter blocked
+
+enum OpenAirRegister {
+    REG_AQI = 0,
+    REG_PM25,
+    REG_PM10,
+    REG_FAN_ON,
+    REG_FAN_DUTY,
+    REG_FAN_RPM,
+    REG_AUTO_MODE,
+    REG_THRESHOLD,
+    REG_HYSTERESIS,
+    REG_UPTIME_HIGH,
+    REG_UPTIME_LOW,
+    REG_FAN_ALERT,
+    REG_COUNT
+};
+
+struct OpenAirValues {
+    float aqi;
+    float pm25;        // NaN when not measured
+    float pm10;
+    bool fanOn;
+    float fanRpm;
+    bool autoMode;
+    float threshold;
+    float hysteresis;
+    uint32_t uptimeS;
+    uint8_t fanAlert;
+};
+
+// The registers that move without a state change; refreshed on every read
+inline void encodeLiveRegisters(float fanRpm, uint32_t uptimeS, uint8_t fanAlert, uint16_t* registers) {
+    registers[REG_FAN_RPM] = fanRpm > 65534 ? 65534 : (uint16_t)(fanRpm + 0.5f);
+    registers[REG_UPTIME_HIGH] = uptimeS >> 16;
+    registers[REG_UPTIME_LOW] = uptimeS & 0xFFFF;
+    registers[REG_FAN_ALERT] = fanAlert;
+}
+
+inline void encodeRegisters(const OpenAirValues& values, uint16_t* registers) {
+    registers[REG_AQI] = encodeTenths(values.aqi);
+    registers[REG_PM25] = encodeTenths(values.pm25);
+    registers[REG_PM10] = encodeTenths(values.pm10);
+    registers[REG_FAN_ON] = values.fanOn ? 1 : 0;
+    registers[REG_FAN_DUTY] = values.fanOn ? 100 : 0;
+    registers[REG_AUTO_MODE] = values.autoMode ? 1 : 0;
+    registers[REG_THRESHOLD] = encodeTenths(values.threshold);
+    registers[REG_HYSTERESIS] = encodeTenths(values.hysteresis);
+    encodeLiveRegisters(values.fanRpm, values.uptimeS, values.fanAlert, registers);
+}
+
+inline bool registerWritable(uint16_t address) {
+    return address == REG_FAN_ON || address == REG_AUTO_MODE || address == REG_THRESHOLD ||
+           address == REG_HYSTERESIS;
+}
+
+#endif
@@ -0,0 +1,438 @@
+#include "MqttClient.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#ifdef ESP32
+#include <Arduino.h>
+#include <lwip/netdb.h>
+#include <lwip/sockets.h>
+#else
+#include <arpa/inet.h>
+#include <chrono>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+// Control packet types (high nibble of the fixed header)
+#define MQTT_CONNECT 1
+#define MQTT_CONNACK 2
+#define MQTT_PUBLISH 3
+#define MQTT_PUBACK 4
+#define MQTT_SUBSCRIBE 8
+#define MQTT_SUBACK 9
+#define MQTT_PINGREQ 12
+#define MQTT_PINGRESP 13
+#define MQTT_DISCONNECT 14
+
+static uint32_t nowMs() {
+#ifdef ESP32
+    return millis();
+#else
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static void setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Waits until fd is readable (or writable), returns false on timeout
+static bool waitFor(int fd, bool write, uint32_t ms) {
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(fd, &set);
+    struct timeval timeout;
+    timeout.tv_sec = ms / 1000;
+    timeout.tv_usec = (ms % 1000) * 1000;
+    return select(fd + 1, write ? nullptr : &set, write ? &set : nullptr, nullptr, &timeout) > 0;
+}
+
+MqttClient::MqttClient()
+    : fd_(-1), keepAliveS_(0), packetId_(0), lastSentMs_(0), lastReceivedMs_(0), pingSentMs_(0),
+      pingOutstanding_(false), lastError_(0), txUsed_(0), txOverflow_(false), rxUsed_(0), rxBody_(0),
+      rxNeeded_(0), rxDiscard_(0), sent_(0), received_(0) {
+}
+
+MqttClient::~MqttClient() {
+    closeSocket();
+}
+
+bool MqttClient::connect(const char* host, uint16_t port, const MqttConnectOptions& options) {
+    closeSocket();
+    lastError_ = -1;
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    struct addrinfo* address = nullptr;
+    if (getaddrinfo(host, service, &hints, &address) != 0 || !address) {
+        return false;
+    }
+    int fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (fd < 0) {
+        freeaddrinfo(address);
+        return false;
+    }
+    setNonBlocking(fd);
+    int rc = ::connect(fd, address->ai_addr, address->ai_addrlen);
+    freeaddrinfo(address);
+    if (rc != 0) {
+        int error = errno;
+        socklen_t length = sizeof(error);
+        if (error == EINPROGRESS) {
+            if (!waitFor(fd, true, MQTT_CONNECT_TIMEOUT_MS) ||
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0) {
+                error = ETIMEDOUT;
+            }
+        }
+        if (error != 0) {
+            close(fd);
+            return false;
+        }
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    fd_ = fd;
+    keepAliveS_ = options.keepAliveS;
+    pingOutstanding_ = false;
+    rxUsed_ = 0;
+    rxNeeded_ = 0;
+    rxDiscard_ = 0;
+    lastReceivedMs_ = nowMs();
+
+    // Clean session: anything unacknowledged is resent from the caller's
+    // own queue, not by the broker
+    uint8_t flags = 0x02;
+    size_t remaining = 10 + 2 + strlen(options.clientId);
+    if (options.willTopic) {
+        flags |= 0x04 | (options.willRetain ? 0x20 : 0);
+        remaining += 4 + strlen(options.willTopic) + strlen(options.willMessage);
+    }
+    bool hasUser = options.username && *options.username;
+    bool hasPassword = hasUser && options.password && *options.password;
+    if (hasUser) {
+        flags |= 0x80;
+        remaining += 2 + strlen(options.username);
+    }
+    if (hasPassword) {
+        flags |= 0x40;
+        remaining += 2 + strlen(options.password);
+    }
+    if (!beginPacket(MQTT_CONNECT << 4, remaining)) {
+        closeSocket();
+        return false;
+    }
+    putString("MQTT");
+    putByte(4);  // Protocol level 3.1.1
+    putByte(flags);
+    putShort(options.keepAliveS);
+    putString(options.clientId);
+    if (options.willTopic) {
+        putString(options.willTopic);
+        putString(options.willMessage);
+    }
+    if (hasUser) putString(options.username);
+    if (hasPassword) putString(options.password);
+    if (!sendPacket()) {
+        closeSocket();
+        return false;
+    }
+
+    if (!readPacket(MQTT_CONNECT_TIMEOUT_MS) || (rx_[0] >> 4) != MQTT_CONNACK || rxNeeded_ - rxBody_ < 2) {
+        closeSocket();
+        return false;
+    }
+    uint8_t code = rx_[rxBody_ + 1];
+    rxUsed_ = 0;
+    rxNeeded_ = 0;
+    if (code != 0) {
+        lastError_ = code;
+        closeSocket();
+        return false;
+    }
+    lastError_ = 0;
+    return true;
+}
+
+void MqttClient::disconnect() {
+    if (fd_ >= 0 && beginPacket(MQTT_DISCONNECT << 4, 0)) {
+        sendPacket();
+    }
+    closeSocket();
+}
+
+void MqttClient::closeSocket() {
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+uint16_t MqttClient::nextPacketId() {
+    packetId_++;
+    if (packetId_ == 0) {
+        packetId_ = 1;
+    }
+    return packetId_;
+}
+
+bool MqttClient::publish(const char* topic, const uint8_t* payload, size_t length, uint8_t qos, bool retain,
+                         uint16_t* packetId) {
+    if (fd_ < 0) {
+        return false;
+    }
+    qos = qos > 0 ? 1 : 0;
+    size_t remaining = 2 + strlen(topic) + (qos ? 2 : 0) + length;
+    if (!beginPacket((MQTT_PUBLISH << 4) | (qos << 1) | (retain ? 1 : 0), remaining)) {
+        return false;
+    }
+    putString(topic);
+    if (qos) {
+        uint16_t id = nextPacketId();
+        putShort(id);
+        if (packetId) {
+            *packetId = id;
+        }
+    }
+    putBytes(payload, length);
+    if (!sendPacket()) {
+        return false;
+    }
+    sent_++;
+    return true;
+}
+
+bool MqttClient::publish(const char* topic, const char* payload, uint8_t qos, bool retain) {
+    return publish(topic, (const uint8_t*)payload, strlen(payload), qos, retain);
+}
+
+bool MqttClient::subscribe(const char* topic, uint8_t qos) {
+    if (fd_ < 0 || !beginPacket((MQTT_SUBSCRIBE << 4) | 0x02, 2 + 2 + strlen(topic) + 1)) {
+        return false;
+    }
+    putShort(nextPacketId());
+    putString(topic);
+    putByte(qos > 0 ? 1 : 0);
+    return sendPacket();
+}
+
+bool MqttClient::loop() {
+    while (readPacket(0)) {
+        handlePacket();
+    }
+    if (fd_ < 0) {
+        return false;
+    }
+
+    // Ping when the link has been quiet, give up when the ping goes
+    // unanswered for a whole keep-alive period
+    uint32_t keepAliveMs = keepAliveS_ * 1000UL;
+    if (keepAliveMs > 0) {
+        uint32_t now = nowMs();
+        if (pingOutstanding_) {
+            if (now - pingSentMs_ > keepAliveMs) {
+                closeSocket();
+                return false;
+            }
+        } else if (now - lastSentMs_ >= keepAliveMs * 3 / 4 || now - lastReceivedMs_ >= keepAliveMs) {
+            if (beginPacket(MQTT_PINGREQ << 4, 0) && sendPacket()) {
+                pingOutstanding_ = true;
+                pingSentMs_ = now;
+            }
+        }
+    }
+    return fd_ >= 0;
+}
+
+bool MqttClient::readPacket(uint32_t timeoutMs) {
+    uint32_t start = nowMs();
+    while (fd_ >= 0) {
+        uint8_t scratch[64];
+        uint8_t* target;
+        size_t want;
+        if (rxDiscard_ > 0) {
+            target = scratch;
+            want = rxDiscard_ < sizeof(scratch) ? rxDiscard_ : sizeof(scratch);
+        } else if (rxNeeded_ == 0) {
+            // Header bytes one at a time until the remaining length is known,
+            // then exactly the rest, so nothing of the next packet is read
+            target = rx_ + rxUsed_;
+            want = 1;
+        } else {
+            target = rx_ + rxUsed_;
+            want = rxNeeded_ - rxUsed_;
+        }
+
+        ssize_t got = recv(fd_, target, want, 0);
+        if (got > 0) {
+            lastReceivedMs_ = nowMs();
+            if (rxDiscard_ > 0) {
+                rxDiscard_ -= got;
+                continue;
+            }
+            rxUsed_ += got;
+            if (rxNeeded_ == 0 && rxUsed_ >= 2) {
+                if (rx_[rxUsed_ - 1] & 0x80) {
+                    if (rxUsed_ == 5) {
+                        closeSocket();  // Remaining length is at most four bytes
+                        return false;
+                    }
+                    continue;
+                }
+                size_t remaining = 0;
+                for (size_t i = rxUsed_ - 1; i >= 1; i--) {
+                    remaining = remaining * 128 + (rx_[i] & 0x7F);
+                }
+                if (rxUsed_ + remaining > MQTT_RX_BUFFER) {
+                    rxDiscard_ = remaining;  // Too big for us: skip it
+                    rxUsed_ = 0;
+                    continue;
+                }
+                rxBody_ = rxUsed_;
+                rxNeeded_ = rxUsed_ + remaining;
+            }
+            if (rxNeeded_ > 0 && rxUsed_ == rxNeeded_) {
+                return true;
+            }
+            continue;
+        }
+        if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            closeSocket();
+            return false;
+        }
+        uint32_t elapsed = nowMs() - start;
+        if (elapsed >= timeoutMs) {
+            return false;
+        }
+        uint32_t wait = timeoutMs - elapsed;
+        waitFor(fd_, false, wait < 100 ? wait : 100);
+    }
+    return false;
+}
+
+void MqttClient::handlePacket() {
+    uint8_t type = rx_[0] >> 4;
+    uint8_t* body = rx_ + rxBody_;
+    size_t length = rxNeeded_ - rxBody_;
+    rxUsed_ = 0;
+    rxNeeded_ = 0;
+
+    switch (type) {
+        case MQTT_PUBLISH: {
+            uint8_t qos = (rx_[0] >> 1) & 0x03;
+            if (length < 2) {
+                return;
+            }
+            size_t topicLength = ((size_t)body[0] << 8) | body[1];
+            size_t offset = 2 + topicLength + (qos ? 2 : 0);
+            if (offset > length) {
+                return;
+            }
+            uint16_t id = qos ? (((uint16_t)body[2 + topicLength] << 8) | body[3 + topicLength]) : 0;
+            // Slide the topic over its length prefix to terminate it in place
+            memmove(body, body + 2, topicLength);
+            body[topicLength] = '\0';
+            received_++;
+            if (onMessage_) {
+                onMessage_((const char*)body, body + offset, length - offset);
+            }
+            if (qos == 1 && beginPacket(MQTT_PUBACK << 4, 2)) {
+                putShort(id);
+                sendPacket();
+            }
+            break;
+        }
+        case MQTT_PUBACK:
+            if (length >= 2 && onAck_) {
+                onAck_(((uint16_t)body[0] << 8) | body[1]);
+            }
+            break;
+        case MQTT_PINGRESP:
+            pingOutstanding_ = false;
+            break;
+        default:
+            break;  // SUBACK and anything unexpected
+    }
+}
+
+bool MqttClient::beginPacket(uint8_t header, size_t remaining) {
+    txUsed_ = 0;
+    txOverflow_ = false;
+    putByte(header);
+    do {
+        uint8_t digit = remaining % 128;
+        remaining /= 128;
+        putByte(remaining > 0 ? digit | 0x80 : digit);
+    } while (remaining > 0);
+    return !txOverflow_;
+}
+
+void MqttClient::putByte(uint8_t value) {
+    putBytes(&value, 1);
+}
+
+void MqttClient::putShort(uint16_t value) {
+    putByte(value >> 8);
+    putByte(value & 0xFF);
+}
+
+void MqttClient::putString(const char* text) {
+    size_t length = strlen(text);
+    putShort(length);
+    putBytes((const uint8_t*)text, length);
+}
+
+void MqttClient::putBytes(const uint8_t* data, size_t length) {
+    if (txOverflow_ || txUsed_ + length > sizeof(tx_)) {
+        txOverflow_ = true;
+        return;
+    }
+    memcpy(tx_ + txUsed_, data, length);
+    txUsed_ += length;
+}
+
+bool MqttClient::sendPacket() {
+    if (txOverflow_) {
+        return false;
+    }
+    if (!writeAll(tx_, txUsed_)) {
+        closeSocket();
+        return false;
+    }
+    lastSentMs_ = nowMs();
+    return true;
+}
+
+bool MqttClient::writeAll(const uint8_t* data, size_t length) {
+    uint32_t start = nowMs();
+    while (length > 0) {
+        ssize_t sent = ::send(fd_, data, length, 0);
+        if (sent > 0) {
+            data += sent;
+            length -= sent;
+            continue;
+        }
+        if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            return false;
+        }
+        if (nowMs() - start >= MQTT_SEND_TIMEOUT_MS) {
+            return false;
+        }
+        waitFor(fd_, true, 100);
+    }
+    return true;
+}
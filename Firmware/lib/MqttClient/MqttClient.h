@@ -0,0 +1,104 @@
+#ifndef MQTT_CLIENT_H
+#define MQTT_CLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+
+// Minimal MQTT 3.1.1 client over BSD sockets (lwIP on the ESP32, POSIX on
+// the host), with fixed buffers and no heap use after construction.
+// Publishes at QoS 0 or 1, subscribes, answers incoming QoS 1 publishes and
+// keeps the session alive. connect() blocks for up to the connect timeout,
+// so the client is meant to run in its own task, not in loop().
+
+#ifndef MQTT_TX_BUFFER
+#define MQTT_TX_BUFFER 1024
+#endif
+#ifndef MQTT_RX_BUFFER
+#define MQTT_RX_BUFFER 512
+#endif
+#define MQTT_CONNECT_TIMEOUT_MS 5000
+#define MQTT_SEND_TIMEOUT_MS 5000
+
+struct MqttConnectOptions {
+    const char* clientId;
+    const char* username;     // nullptr for none
+    const char* password;
+    uint16_t keepAliveS;
+    const char* willTopic;    // nullptr for no last will
+    const char* willMessage;
+    bool willRetain;
+};
+
+class MqttClient {
+public:
+    typedef std::function<void(const char* topic, const uint8_t* payload, size_t length)> TMessageFunction;
+    typedef std::function<void(uint16_t packetId)> TAckFunction;
+
+    MqttClient();
+    ~MqttClient();
+
+    // Resolves host, opens the TCP connection and waits for CONNACK
+    bool connect(const char* host, uint16_t port, const MqttConnectOptions& options);
+    void disconnect();
+    bool connected() const { return fd_ >= 0; }
+
+    // QoS 1 publishes get a packet id (returned through packetId) that is
+    // reported to onAck() when the broker acknowledges it
+    bool publish(const char* topic, const uint8_t* payload, size_t length, uint8_t qos = 0,
+                 bool retain = false, uint16_t* packetId = nullptr);
+    bool publish(const char* topic, const char* payload, uint8_t qos = 0, bool retain = false);
+    bool subscribe(const char* topic, uint8_t qos = 0);
+
+    void onMessage(TMessageFunction handler) { onMessage_ = handler; }
+    void onAck(TAckFunction handler) { onAck_ = handler; }
+
+    // Read and handle whatever has arrived, send keep-alives. Never waits
+    // for data. Returns false once the connection is gone.
+    bool loop();
+
+    // CONNACK return code of the last failed connect (or -1 for network)
+    int lastError() const { return lastError_; }
+    uint32_t messagesSent() const { return sent_; }
+    uint32_t messagesReceived() const { return received_; }
+
+private:
+    bool beginPacket(uint8_t header, size_t remaining);
+    void putByte(uint8_t value);
+    void putString(const char* text);
+    void putBytes(const uint8_t* data, size_t length);
+    void putShort(uint16_t value);
+    bool sendPacket();
+    bool writeAll(const uint8_t* data, size_t length);
+    bool readPacket(uint32_t timeoutMs);
+    void handlePacket();
+    uint16_t nextPacketId();
+    void closeSocket();
+
+    int fd_;
+    uint16_t keepAliveS_;
+    uint16_t packetId_;
+    uint32_t lastSentMs_;
+    uint32_t lastReceivedMs_;
+    uint32_t pingSentMs_;
+    bool pingOutstanding_;
+    int lastError_;
+
+    uint8_t tx_[MQTT_TX_BUFFER];
+    size_t txUsed_;
+    bool txOverflow_;
+
+    // Incoming packet being assembled
+    uint8_t rx_[MQTT_RX_BUFFER];
+    size_t rxUsed_;
+    size_t rxBody_;     // Offset of the variable header
+    size_t rxNeeded_;   // Total packet size once the length is known
+    size_t rxDiscard_;  // Bytes of an oversized packet still to skip
+
+    TMessageFunction onMessage_;
+    TAckFunction onAck_;
+    uint32_t sent_;
+    uint32_t received_;
+};
+
+#endif
@@ -0,0 +1,237 @@
+#include "MqttPublisher.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// True once now has reached deadline, across uint32 wrap
+static bool reached(uint32_t now, uint32_t deadline) {
+    return (int32_t)(now - deadline) >= 0;
+}
+
+MqttPublisherConfig MqttPublisher::defaults() {
+    MqttPublisherConfig config;
+    config.qos = 1;
+    config.maxBatch = 30;
+    config.batchDelayMs = 0;  // Live samples go out at once; slow acks do the batching
+    config.drainRate = 5.0f;
+    config.drainBurst = 10;
+    config.ackTimeoutMs = 10000;
+    config.reconnectMinMs = 1000;
+    config.reconnectMaxMs = 60000;
+    config.keepAliveS = 30;
+    return config;
+}
+
+MqttPublisher::MqttPublisher(MqttClient& client)
+    : client_(client), host_(nullptr), port_(1883), clientId_(""), username_(nullptr), password_(nullptr),
+      head_(0), count_(0), inFlight_(0), inFlightId_(0), inFlightSinceMs_(0), stateDirty_(false),
+      tokens_(0), lastRefillMs_(0), nextConnectMs_(0), backoffMs_(0), random_(1), dropped_(0),
+      samplesSent_(0), batchesSent_(0), connects_(0), connectFailures_(0), ackTimeouts_(0) {
+    sampleTopic_[0] = '\0';
+    stateTopic_[0] = '\0';
+    statusTopic_[0] = '\0';
+    state_[0] = '\0';
+    configure(defaults());
+    client_.onAck([this](uint16_t packetId) { handleAck(packetId); });
+}
+
+void MqttPublisher::configure(const MqttPublisherConfig& config) {
+    config_ = config;
+    if (config_.maxBatch == 0) {
+        config_.maxBatch = 1;
+    }
+    if (config_.drainBurst == 0) {
+        config_.drainBurst = 1;
+    }
+    tokens_ = config_.drainBurst;
+    backoffMs_ = config_.reconnectMinMs;
+}
+
+void MqttPublisher::setServer(const char* host, uint16_t port, const char* clientId, const char* username,
+                              const char* password, const char* topicPrefix) {
+    if (client_.connected()) {
+        stop();
+    }
+    host_ = host;
+    port_ = port;
+    clientId_ = clientId;
+    username_ = username;
+    password_ = password;
+    snprintf(sampleTopic_, sizeof(sampleTopic_), "%s/samples", topicPrefix);
+    snprintf(stateTopic_, sizeof(stateTopic_), "%s/state", topicPrefix);
+    snprintf(statusTopic_, sizeof(statusTopic_), "%s/status", topicPrefix);
+
+    // Seed the backoff jitter from the client id so a fleet spreads out
+    random_ = 2166136261u;
+    for (const char* c = clientId; *c; c++) {
+        random_ = (random_ ^ (uint8_t)*c) * 16777619u;
+    }
+    if (random_ == 0) {
+        random_ = 1;
+    }
+    backoffMs_ = config_.reconnectMinMs;
+    nextConnectMs_ = 0;
+    inFlight_ = 0;
+}
+
+void MqttPublisher::add(uint32_t timeMs, float aqi) {
+    if (count_ == MQTT_OUTBOX_SIZE) {
+        head_ = (head_ + 1) % MQTT_OUTBOX_SIZE;
+        count_--;
+        dropped_++;
+        if (inFlight_ > 0) {
+            inFlight_--;  // The ack will now cover one sample fewer
+        }
+    }
+    MqttSample& sample = outbox_[(head_ + count_) % MQTT_OUTBOX_SIZE];
+    sample.timeMs = timeMs;
+    sample.aqi = aqi;
+    count_++;
+}
+
+void MqttPublisher::setState(const char* json) {
+    if (strncmp(json, state_, sizeof(state_) - 1) == 0) {
+        return;
+    }
+    strncpy(state_, json, sizeof(state_) - 1);
+    state_[sizeof(state_) - 1] = '\0';
+    stateDirty_ = true;
+}
+
+void MqttPublisher::stop() {
+    if (client_.connected()) {
+        client_.publish(statusTopic_, "offline", 0, true);
+        client_.disconnect();
+    }
+    inFlight_ = 0;
+}
+
+uint32_t MqttPublisher::jitter(uint32_t ms) {
+    random_ ^= random_ << 13;
+    random_ ^= random_ >> 17;
+    random_ ^= random_ << 5;
+    // 75% to 125% of ms
+    return ms / 4 * 3 + (uint32_t)((uint64_t)(random_ >> 8) * (ms / 2) >> 24);
+}
+
+void MqttPublisher::tryConnect(uint32_t nowMs) {
+    MqttConnectOptions options;
+    options.clientId = clientId_;
+    options.username = username_;
+    options.password = password_;
+    options.keepAliveS = config_.keepAliveS;
+    options.willTopic = statusTopic_;
+    options.willMessage = "offline";
+    options.willRetain = true;
+
+    if (!client_.connect(host_, port_, options)) {
+        connectFailures_++;
+        nextConnectMs_ = nowMs + jitter(backoffMs_);
+        backoffMs_ = backoffMs_ * 2 < config_.reconnectMaxMs ? backoffMs_ * 2 : config_.reconnectMaxMs;
+        return;
+    }
+    connects_++;
+    backoffMs_ = config_.reconnectMinMs;
+    inFlight_ = 0;
+    lastRefillMs_ = nowMs;
+    client_.publish(statusTopic_, "online", 0, true);
+    if (onConnect_) {
+        onConnect_();
+    }
+    // The broker may have restarted without its retained messages
+    stateDirty_ = state_[0] != '\0';
+}
+
+void MqttPublisher::loop(uint32_t nowMs) {
+    if (!host_ || !*host_) {
+        return;
+    }
+    if (!client_.connected()) {
+        if (!reached(nowMs, nextConnectMs_)) {
+            return;
+        }
+        tryConnect(nowMs);
+        if (!client_.connected()) {
+            return;
+        }
+    }
+    if (!client_.loop()) {
+        // Whatever was in flight stays queued and goes out again
+        inFlight_ = 0;
+        nextConnectMs_ = nowMs + jitter(backoffMs_);
+        return;
+    }
+
+    if (inFlight_ > 0 && nowMs - inFlightSinceMs_ >= config_.ackTimeoutMs) {
+        ackTimeouts_++;
+        client_.disconnect();
+        inFlight_ = 0;
+        nextConnectMs_ = nowMs + jitter(backoffMs_);
+        return;
+    }
+
+    if (stateDirty_ && client_.publish(stateTopic_, state_, 0, true)) {
+        stateDirty_ = false;
+    }
+
+    tokens_ += (nowMs - lastRefillMs_) * config_.drainRate / 1000.0f;
+    if (tokens_ > config_.drainBurst) {
+        tokens_ = config_.drainBurst;
+    }
+    lastRefillMs_ = nowMs;
+
+    while (inFlight_ == 0 && count_ > 0 && tokens_ >= 1.0f) {
+        bool full = count_ >= config_.maxBatch;
+        bool due = nowMs - outbox_[head_].timeMs >= config_.batchDelayMs;
+        if ((!full && !due) || !sendBatch(nowMs)) {
+            break;
+        }
+        tokens_ -= 1.0f;
+    }
+}
+
+bool MqttPublisher::sendBatch(uint32_t nowMs) {
+    size_t length = snprintf(payload_, sizeof(payload_), "{\"now\":%lu,\"samples\":[", (unsigned long)nowMs);
+    size_t taken = 0;
+    while (taken < count_ && taken < config_.maxBatch) {
+        const MqttSample& sample = outbox_[(head_ + taken) % MQTT_OUTBOX_SIZE];
+        char item[32];
+        size_t itemLength = snprintf(item, sizeof(item), "%s[%lu,%.1f]", taken ? "," : "",
+                                     (unsigned long)sample.timeMs, sample.aqi);
+        if (length + itemLength + 3 > sizeof(payload_)) {
+            break;
+        }
+        memcpy(payload_ + length, item, itemLength);
+        length += itemLength;
+        taken++;
+    }
+    memcpy(payload_ + length, "]}", 3);
+    length += 2;
+
+    uint16_t packetId = 0;
+    if (!client_.publish(sampleTopic_, (const uint8_t*)payload_, length, config_.qos, false, &packetId)) {
+        return false;
+    }
+    batchesSent_++;
+    samplesSent_ += taken;
+    if (config_.qos > 0) {
+        inFlight_ = taken;
+        inFlightId_ = packetId;
+        inFlightSinceMs_ = nowMs;
+    } else {
+        release(taken);
+    }
+    return true;
+}
+
+void MqttPublisher::handleAck(uint16_t packetId) {
+    if (inFlight_ > 0 && packetId == inFlightId_) {
+        release(inFlight_);
+        inFlight_ = 0;
+    }
+}
+
+void MqttPublisher::release(size_t samples) {
+    head_ = (head_ + samples) % MQTT_OUTBOX_SIZE;
+    count_ -= samples;
+}
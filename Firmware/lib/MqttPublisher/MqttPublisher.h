@@ -0,0 +1,127 @@
+#ifndef MQTT_PUBLISHER_H
+#define MQTT_PUBLISHER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+
+#include "MqttClient.h"
+
+// Pushes AQI samples and fan state to an MQTT broker.
+//
+// Samples wait in a bounded RAM outbox until the broker has acknowledged
+// them, so nothing is lost over a broker outage shorter than the outbox
+// (MQTT_OUTBOX_SIZE samples; past that the oldest are dropped and counted).
+// At most one QoS 1 batch is in flight: while its PUBACK is outstanding new
+// samples queue up and go out together in the next message, so batches grow
+// by themselves on a slow link. After a reconnect the backlog drains in full
+// batches, limited by a token bucket so a fleet coming back at once doesn't
+// flood the broker. Reconnects back off exponentially with jitter.
+//
+// Topics, under the configured prefix:
+//   <prefix>/samples  {"now":<uptime ms>,"samples":[[<uptime ms>,<aqi>],...]}
+//   <prefix>/state    retained, published when it changes
+//   <prefix>/status   retained "online", last will "offline"
+
+#ifndef MQTT_OUTBOX_SIZE
+#define MQTT_OUTBOX_SIZE 1024
+#endif
+#define MQTT_TOPIC_MAX 64
+#define MQTT_STATE_MAX 256
+
+struct MqttPublisherConfig {
+    uint8_t qos;              // 1: samples leave the outbox on PUBACK; 0: once sent
+    uint16_t maxBatch;        // Samples per message
+    uint32_t batchDelayMs;    // Hold a partial batch this long for company
+    float drainRate;          // Sample messages per second
+    uint16_t drainBurst;      // Messages that may go out back to back
+    uint32_t ackTimeoutMs;    // Unacknowledged this long: reconnect and resend
+    uint32_t reconnectMinMs;
+    uint32_t reconnectMaxMs;
+    uint16_t keepAliveS;
+};
+
+struct MqttSample {
+    uint32_t timeMs;
+    float aqi;
+};
+
+class MqttPublisher {
+public:
+    typedef std::function<void()> TConnectFunction;
+
+    explicit MqttPublisher(MqttClient& client);
+
+    static MqttPublisherConfig defaults();
+    void configure(const MqttPublisherConfig& config);
+    const MqttPublisherConfig& config() const { return config_; }
+
+    // The strings must outlive the publisher (or the next setServer call)
+    void setServer(const char* host, uint16_t port, const char* clientId, const char* username,
+                   const char* password, const char* topicPrefix);
+
+    // Queue a sample; when the outbox is full the oldest one is dropped
+    void add(uint32_t timeMs, float aqi);
+    // Publish as retained state if it differs from what was last sent
+    void setState(const char* json);
+    // Called after every (re)connect, e.g. to subscribe; sessions are clean
+    void onConnect(TConnectFunction handler) { onConnect_ = handler; }
+
+    // Connects, reconnects and sends; call often from the publisher's task
+    void loop(uint32_t nowMs);
+    void stop();
+
+    bool connected() const { return client_.connected(); }
+    size_t queued() const { return count_; }
+    uint32_t dropped() const { return dropped_; }
+    uint32_t samplesSent() const { return samplesSent_; }
+    uint32_t batchesSent() const { return batchesSent_; }
+    uint32_t connects() const { return connects_; }
+    uint32_t connectFailures() const { return connectFailures_; }
+    uint32_t ackTimeouts() const { return ackTimeouts_; }
+
+private:
+    void tryConnect(uint32_t nowMs);
+    void handleAck(uint16_t packetId);
+    bool sendBatch(uint32_t nowMs);
+    void release(size_t samples);
+    uint32_t jitter(uint32_t ms);
+
+    MqttClient& client_;
+    MqttPublisherConfig config_;
+    TConnectFunction onConnect_;
+    const char* host_;
+    uint16_t port_;
+    const char* clientId_;
+    const char* username_;
+    const char* password_;
+    char sampleTopic_[MQTT_TOPIC_MAX];
+    char stateTopic_[MQTT_TOPIC_MAX];
+    char statusTopic_[MQTT_TOPIC_MAX];
+
+    MqttSample outbox_[MQTT_OUTBOX_SIZE];
+    size_t head_;           // Oldest sample
+    size_t count_;
+    size_t inFlight_;       // Samples at the head covered by the pending PUBACK
+    uint16_t inFlightId_;
+    uint32_t inFlightSinceMs_;
+
+    char payload_[MQTT_TX_BUFFER - MQTT_TOPIC_MAX - 8];
+    char state_[MQTT_STATE_MAX];
+    bool stateDirty_;
+
+    float tokens_;
+    uint32_t lastRefillMs_;
+    uint32_t nextConnectMs_;
+    uint32_t backoffMs_;
+    uint32_t random_;
+
+    uint32_t dropped_;
+    uint32_t samplesSent_;
+    uint32_t batchesSent_;
+    uint32_t connects_;
+    uint32_t connectFailures_;
+    uint32_t ackTimeouts_;
+};
+
+#endif
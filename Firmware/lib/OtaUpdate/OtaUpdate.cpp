@@ -0,0 +1,242 @@
+#include "OtaUpdate.h"
+
+#include <string.h>
+
+#ifdef ESP32
+#include <esp_ota_ops.h>
+#endif
+
+#ifdef ESP32
+EspOtaTarget::EspOtaTarget() : partition_(nullptr), handle_(0), open_(false) {}
+
+size_t EspOtaTarget::capacity() {
+    const esp_partition_t* partition = esp_ota_get_next_update_partition(nullptr);
+    return partition ? partition->size : 0;
+}
+
+bool EspOtaTarget::begin(size_t size) {
+    abort();
+    const esp_partition_t* partition = esp_ota_get_next_update_partition(nullptr);
+    if (!partition || size > partition->size) {
+        return false;
+    }
+#ifdef OTA_WITH_SEQUENTIAL_WRITES
+    size_t eraseSize = OTA_WITH_SEQUENTIAL_WRITES;
+#else
+    size_t eraseSize = size;
+#endif
+    esp_ota_handle_t handle;
+    if (esp_ota_begin(partition, eraseSize, &handle) != ESP_OK) {
+        return false;
+    }
+    partition_ = partition;
+    handle_ = handle;
+    open_ = true;
+    return true;
+}
+
+bool EspOtaTarget::write(const uint8_t* data, size_t length) {
+    return open_ && esp_ota_write(handle_, data, length) == ESP_OK;
+}
+
+bool EspOtaTarget::finish() {
+    if (!open_) {
+        return false;
+    }
+    open_ = false;
+    // esp_ota_end() checks the image before it may be booted
+    return esp_ota_end(handle_) == ESP_OK &&
+           esp_ota_set_boot_partition((const esp_partition_t*)partition_) == ESP_OK;
+}
+
+void EspOtaTarget::abort() {
+    if (open_) {
+        esp_ota_abort(handle_);
+        open_ = false;
+    }
+}
+#endif
+
+FileOtaTarget::FileOtaTarget(const char* path, size_t capacity)
+    : path_(path), capacity_(capacity), file_(nullptr), finished_(false) {}
+
+FileOtaTarget::~FileOtaTarget() {
+    abort();
+}
+
+bool FileOtaTarget::begin(size_t size) {
+    abort();
+    finished_ = false;
+    if (size > capacity_) {
+        return false;
+    }
+    file_ = fopen(path_, "wb");
+    return file_ != nullptr;
+}
+
+bool FileOtaTarget::write(const uint8_t* data, size_t length) {
+    return file_ && fwrite(data, 1, length, file_) == length;
+}
+
+bool FileOtaTarget::finish() {
+    if (!file_) {
+        return false;
+    }
+    bool ok = fclose(file_) == 0;
+    file_ = nullptr;
+    finished_ = ok;
+    return ok;
+}
+
+void FileOtaTarget::abort() {
+    if (file_) {
+        fclose(file_);
+        file_ = nullptr;
+    }
+}
+
+OtaUpdate::OtaUpdate(OtaTarget& target)
+    : target_(target), state_(OTA_IDLE), error_(OTA_OK), size_(0), received_(0), chunkUsed_(0) {
+    memset(expected_, 0, sizeof(expected_));
+    digestHex_[0] = '\0';
+}
+
+OtaResult OtaUpdate::begin(size_t size, const char* sha256Hex) {
+    uint8_t digest[SHA256_SIZE];
+    if (size == 0 || !Sha256::parseHex(sha256Hex, digest)) {
+        return OTA_BAD_REQUEST;
+    }
+    bool sameImage = size == size_ && memcmp(digest, expected_, sizeof(digest)) == 0;
+    if (sameImage && (state_ == OTA_RECEIVING || state_ == OTA_READY)) {
+        return OTA_OK;  // Resume (or already done)
+    }
+    if (size > target_.capacity()) {
+        return OTA_TOO_LARGE;
+    }
+
+    if (state_ == OTA_RECEIVING) {
+        target_.abort();
+    }
+    size_ = size;
+    received_ = 0;
+    chunkUsed_ = 0;
+    memcpy(expected_, digest, sizeof(expected_));
+    Sha256::toHex(expected_, digestHex_);
+    sha_.begin();
+    error_ = OTA_OK;
+    if (!target_.begin(size)) {
+        return fail(OTA_WRITE_FAILED);
+    }
+    state_ = OTA_RECEIVING;
+    return OTA_OK;
+}
+
+OtaResult OtaUpdate::write(const uint8_t* data, size_t length) {
+    if (state_ != OTA_RECEIVING) {
+        return OTA_NOT_RECEIVING;
+    }
+    if (length > size_ - received_) {
+        return fail(OTA_TOO_LARGE);
+    }
+    sha_.update(data, length);
+    received_ += length;
+    while (length > 0) {
+        size_t take = OTA_CHUNK_SIZE - chunkUsed_ < length ? OTA_CHUNK_SIZE - chunkUsed_ : length;
+        memcpy(chunk_ + chunkUsed_, data, take);
+        chunkUsed_ += take;
+        data += take;
+        length -= take;
+        if (chunkUsed_ == OTA_CHUNK_SIZE && !flushChunk()) {
+            return fail(OTA_WRITE_FAILED);
+        }
+    }
+    if (received_ < size_) {
+        return OTA_OK;
+    }
+
+    // Everything is in: the tail, then the digest, then the switch
+    if (!flushChunk()) {
+        return fail(OTA_WRITE_FAILED);
+    }
+    uint8_t digest[SHA256_SIZE];
+    sha_.finish(digest);
+    if (memcmp(digest, expected_, sizeof(digest)) != 0) {
+        return fail(OTA_DIGEST_MISMATCH);
+    }
+    if (!target_.finish()) {
+        state_ = OTA_FAILED;
+        error_ = OTA_INVALID_IMAGE;
+        return error_;
+    }
+    state_ = OTA_READY;
+    return OTA_OK;
+}
+
+void OtaUpdate::abort() {
+    if (state_ == OTA_RECEIVING) {
+        target_.abort();
+    }
+    state_ = OTA_IDLE;
+    error_ = OTA_OK;
+    size_ = 0;
+    received_ = 0;
+    chunkUsed_ = 0;
+    memset(expected_, 0, sizeof(expected_));
+    digestHex_[0] = '\0';
+}
+
+bool OtaUpdate::flushChunk() {
+    bool ok = chunkUsed_ == 0 || target_.write(chunk_, chunkUsed_);
+    chunkUsed_ = 0;
+    return ok;
+}
+
+OtaResult OtaUpdate::fail(OtaResult result) {
+    target_.abort();
+    state_ = OTA_FAILED;
+    error_ = result;
+    return result;
+}
+
+const char* OtaUpdate::stateName(OtaState state) {
+    switch (state) {
+        case OTA_IDLE: return "idle";
+        case OTA_RECEIVING: return "receiving";
+        case OTA_READY: return "ready";
+        case OTA_FAILED: return "failed";
+    }
+    return "unknown";
+}
+
+const char* OtaUpdate::resultName(OtaResult result) {
+    switch (result) {
+        case OTA_OK: return "none";
+        case OTA_BAD_REQUEST: return "bad request";
+        case OTA_TOO_LARGE: return "too large";
+        case OTA_WRONG_OFFSET: return "wrong offset";
+        case OTA_NOT_RECEIVING: return "not receiving";
+        case OTA_WRITE_FAILED: return "write failed";
+        case OTA_DIGEST_MISMATCH: return "digest mismatch";
+        case OTA_INVALID_IMAGE: return "invalid image";
+        case OTA_UNAUTHORIZED: return "unauthorized";
+        case OTA_DISABLED: return "updates disabled";
+    }
+    return "unknown";
+}
+
+OtaResult otaAuthorize(const char* authorization, const char* token) {
+    size_t tokenLength = strlen(token);
+    if (tokenLength == 0) {
+        return OTA_DISABLED;
+    }
+    if (!authorization || strncmp(authorization, "Bearer ", 7) != 0) {
+        return OTA_UNAUTHORIZED;
+    }
+    const char* given = authorization + 7;
+    size_t givenLength = strlen(given);
+    uint8_t difference = givenLength != tokenLength;
+    for (size_t i = 0; i < tokenLength; i++) {
+        difference |= (uint8_t)(token[i] ^ given[i < givenLength ? i : 0]);
+    }
+    return difference == 0 ? OTA_OK : OTA_UNAUTHORIZED;
+}
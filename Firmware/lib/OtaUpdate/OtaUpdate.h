@@ -0,0 +1,136 @@
+#ifndef OTA_UPDATE_H
+#define OTA_UPDATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "Sha256.h"
+
+// Firmware update from an image that arrives in pieces, possibly over
+// several connections. The client names the image by size and SHA-256 up
+// front; pieces are hashed as they come and staged in one flash-sector
+// buffer, so the image is written a sector at a time and never held in RAM.
+// An upload cut off part way stays open: starting the same image again
+// resumes at received(). Only when every byte is in and the digest matches
+// is the target asked to make the image boot next.
+//
+// The digest only shows the image arrived intact, not who sent it; the
+// requests that change anything are authorized separately with a token
+// the unit keeps (see otaAuthorized()).
+
+#define OTA_CHUNK_SIZE 4096  // One flash sector
+#define OTA_TOKEN_MIN 16     // Shortest token the unit accepts
+#define OTA_TOKEN_MAX 47
+
+// Where the image goes: the inactive app partition on the ESP32, a file on
+// the host. Writes are sequential from the start of the image.
+class OtaTarget {
+public:
+    virtual ~OtaTarget() {}
+    // Largest image that fits (0 if updates aren't possible)
+    virtual size_t capacity() = 0;
+    virtual bool begin(size_t size) = 0;
+    virtual bool write(const uint8_t* data, size_t length) = 0;
+    // All written and the digest checked: validate and switch to it
+    virtual bool finish() = 0;
+    virtual void abort() = 0;
+};
+
+#ifdef ESP32
+// The next OTA app partition, through esp_ota_ops. Sectors are erased as
+// they are written, so no single call stalls for the whole partition.
+class EspOtaTarget : public OtaTarget {
+public:
+    EspOtaTarget();
+    size_t capacity() override;
+    bool begin(size_t size) override;
+    bool write(const uint8_t* data, size_t length) override;
+    bool finish() override;
+    void abort() override;
+
+private:
+    const void* partition_;  // esp_partition_t
+    uint32_t handle_;        // esp_ota_handle_t
+    bool open_;
+};
+#endif
+
+// Host stand-in: writes the image to a file
+class FileOtaTarget : public OtaTarget {
+public:
+    FileOtaTarget(const char* path, size_t capacity);
+    ~FileOtaTarget();
+    size_t capacity() override { return capacity_; }
+    bool begin(size_t size) override;
+    bool write(const uint8_t* data, size_t length) override;
+    bool finish() override;
+    void abort() override;
+
+    bool finished() const { return finished_; }
+
+private:
+    const char* path_;
+    size_t capacity_;
+    FILE* file_;
+    bool finished_;
+};
+
+enum OtaState { OTA_IDLE, OTA_RECEIVING, OTA_READY, OTA_FAILED };
+
+enum OtaResult {
+    OTA_OK,
+    OTA_BAD_REQUEST,      // Missing size or malformed digest
+    OTA_TOO_LARGE,        // Doesn't fit the target, or more bytes than announced
+    OTA_WRONG_OFFSET,     // The client isn't continuing where the upload stands
+    OTA_NOT_RECEIVING,
+    OTA_WRITE_FAILED,
+    OTA_DIGEST_MISMATCH,
+    OTA_INVALID_IMAGE,    // Target refused it (bad header, checksum...)
+    OTA_UNAUTHORIZED,     // Missing or wrong token
+    OTA_DISABLED          // The unit has no token, so takes no updates
+};
+
+// Checks a request's Authorization header ("Bearer <token>") against the
+// unit's token: OTA_OK, OTA_UNAUTHORIZED, or OTA_DISABLED if token is
+// empty. The comparison takes the same time wherever the tokens differ.
+OtaResult otaAuthorize(const char* authorization, const char* token);
+
+class OtaUpdate {
+public:
+    explicit OtaUpdate(OtaTarget& target);
+
+    // Starts receiving an image, or carries on with the current upload if
+    // it's the same image. A different image replaces an unfinished one.
+    OtaResult begin(size_t size, const char* sha256Hex);
+    // Appends the next bytes; finishes the update with the last of them
+    OtaResult write(const uint8_t* data, size_t length);
+    void abort();
+
+    OtaState state() const { return state_; }
+    OtaResult error() const { return error_; }  // Why it failed
+    size_t size() const { return size_; }
+    size_t received() const { return received_; }
+    // Announced digest in hex, empty when idle
+    const char* digest() const { return digestHex_; }
+
+    static const char* stateName(OtaState state);
+    static const char* resultName(OtaResult result);
+
+private:
+    OtaResult fail(OtaResult result);
+    bool flushChunk();
+
+    OtaTarget& target_;
+    OtaState state_;
+    OtaResult error_;
+    size_t size_;
+    size_t received_;
+    uint8_t expected_[SHA256_SIZE];
+    char digestHex_[SHA256_SIZE * 2 + 1];
+    Sha256 sha_;
+    uint8_t chunk_[OTA_CHUNK_SIZE];
+    size_t chunkUsed_;
+};
+
+#endif
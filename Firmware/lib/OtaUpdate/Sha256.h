@@ -0,0 +1,33 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_SIZE 32
+
+// Incremental SHA-256 (FIPS 180-4), so an image can be hashed piece by
+// piece as it streams in
+class Sha256 {
+public:
+    Sha256() { begin(); }
+
+    void begin();
+    void update(const uint8_t* data, size_t length);
+    void finish(uint8_t digest[SHA256_SIZE]);
+
+    // 64 hex digits (either case) to bytes; false if malformed
+    static bool parseHex(const char* hex, uint8_t digest[SHA256_SIZE]);
+    // out must hold 2 * SHA256_SIZE + 1 characters
+    static void toHex(const uint8_t digest[SHA256_SIZE], char* out);
+
+private:
+    void transform(const uint8_t* block);
+
+    uint32_t state_[8];
+    uint64_t length_;
+    uint8_t block_[64];
+    size_t used_;
+};
+
+#endif
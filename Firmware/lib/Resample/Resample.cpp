@@ -0,0 +1,38 @@
+#include "Resample.h"
+
+Resampler::Resampler() : periodMs_(2000), maxGapMs_(600000) {
+    reset();
+}
+
+void Resampler::configure(uint32_t periodMs, uint32_t maxGapMs) {
+    periodMs_ = periodMs > 0 ? periodMs : 1;
+    maxGapMs_ = maxGapMs;
+    reset();
+}
+
+void Resampler::reset() {
+    started_ = false;
+    lastTimeMs_ = 0;
+    lastValue_ = 0;
+    nextMs_ = 0;
+}
+
+void Resampler::add(uint32_t timeMs, float value, ResampleHandler onPoint) {
+    uint32_t elapsed = timeMs - lastTimeMs_;
+    if (!started_ || elapsed > maxGapMs_) {
+        started_ = true;
+        nextMs_ = timeMs;
+    } else {
+        while ((int32_t)(timeMs - nextMs_) > 0) {
+            float t = (float)(nextMs_ - lastTimeMs_) / elapsed;
+            onPoint(nextMs_, lastValue_ + (value - lastValue_) * t);
+            nextMs_ += periodMs_;
+        }
+    }
+    if (nextMs_ == timeMs) {
+        onPoint(timeMs, value);
+        nextMs_ += periodMs_;
+    }
+    lastTimeMs_ = timeMs;
+    lastValue_ = value;
+}
@@ -0,0 +1,41 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stdint.h>
+#include <functional>
+
+// Turns readings that arrive at irregular times (the PM sensor's sampling
+// interval adapts from under a second to minutes) into a series on a fixed
+// grid, for consumers that weigh every sample alike: rolling statistics and
+// the hourly history. Grid points between two readings are interpolated
+// linearly, so a burst of fast readings counts for the time it covered
+// rather than for how many readings it took. Gaps longer than maxGapMs
+// (readings lost, sensor stopped) aren't bridged; the grid restarts at the
+// reading after one.
+
+typedef std::function<void(uint32_t timeMs, float value)> ResampleHandler;
+
+class Resampler {
+public:
+    Resampler();
+
+    // Clears the series
+    void configure(uint32_t periodMs, uint32_t maxGapMs);
+    void reset();
+
+    // Times must not go backwards. Calls onPoint for each grid point up to
+    // and including timeMs.
+    void add(uint32_t timeMs, float value, ResampleHandler onPoint);
+
+    uint32_t periodMs() const { return periodMs_; }
+
+private:
+    uint32_t periodMs_;
+    uint32_t maxGapMs_;
+    bool started_;
+    uint32_t lastTimeMs_;
+    float lastValue_;
+    uint32_t nextMs_;  // Next grid point
+};
+
+#endif
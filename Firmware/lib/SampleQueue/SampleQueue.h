@@ -0,0 +1,125 @@
+#ifndef SAMPLE_QUEUE_H
+#define SAMPLE_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+// Single-producer ring that any number of consumers read through their own
+// cursor. publish() is wait-free and never looks at the consumers, so it is
+// safe from an ISR and a slow consumer can't hold up acquisition: it just
+// gets overwritten and its cursor skips ahead, counting what it missed.
+// Readers never spin either; read() returns false when nothing is new.
+template<typename T, size_t Size>
+class SampleQueue {
+    static_assert((Size & (Size - 1)) == 0, "SampleQueue size must be a power of two");
+    static_assert(std::is_trivially_copyable<T>::value, "SampleQueue needs a trivially copyable type");
+
+public:
+    struct Cursor {
+        uint32_t position;  // Next sample to read
+        uint32_t received;
+        uint32_t missed;    // Overwritten before this consumer got to them
+    };
+
+    SampleQueue() : head_(0) {
+        for (size_t i = 0; i < Size; i++) {
+            slots_[i].begin.store(0, std::memory_order_relaxed);
+            slots_[i].end.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Producer only
+    void publish(const T& sample) {
+        uint32_t position = head_.load(std::memory_order_relaxed);
+        Slot& slot = slots_[position & (Size - 1)];
+        // Stamps are position + 1 so zero means never written
+        slot.begin.store(position + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        uint32_t words[WORDS] = {};
+        memcpy(words, &sample, sizeof(T));
+        for (size_t i = 0; i < WORDS; i++) {
+            slot.words[i].store(words[i], std::memory_order_relaxed);
+        }
+        slot.end.store(position + 1, std::memory_order_release);
+        head_.store(position + 1, std::memory_order_release);
+    }
+
+    // Samples published so far
+    uint32_t head() const { return head_.load(std::memory_order_acquire); }
+
+    // A cursor that sees samples published from now on, or as many of the
+    // retained ones as possible with fromOldest
+    Cursor subscribe(bool fromOldest = false) const {
+        Cursor cursor = {head(), 0, 0};
+        if (fromOldest) {
+            cursor.position = cursor.position > Size ? cursor.position - Size : 0;
+        }
+        return cursor;
+    }
+
+    // Copy the next sample for this cursor; false if it is up to date
+    bool read(Cursor& cursor, T& sample) const {
+        for (;;) {
+            uint32_t head = head_.load(std::memory_order_acquire);
+            if (head == cursor.position) {
+                return false;
+            }
+            if (head - cursor.position > Size) {
+                skipTo(cursor, head - Size);
+                continue;
+            }
+            const Slot& slot = slots_[cursor.position & (Size - 1)];
+            uint32_t stamp = cursor.position + 1;
+            uint32_t end = slot.end.load(std::memory_order_acquire);
+            if (end != stamp) {
+                // Overwritten since head was loaded; skip past what the
+                // producer has reached without waiting for head to move
+                skipTo(cursor, end - Size);
+                continue;
+            }
+            uint32_t words[WORDS];
+            for (size_t i = 0; i < WORDS; i++) {
+                words[i] = slot.words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint32_t begin = slot.begin.load(std::memory_order_relaxed);
+            if (begin != stamp) {
+                skipTo(cursor, begin - Size);  // Producer lapped us while copying
+                continue;
+            }
+            memcpy(&sample, words, sizeof(T));
+            cursor.position++;
+            cursor.received++;
+            return true;
+        }
+    }
+
+    // Samples waiting for this cursor (may exceed Size if it has fallen behind)
+    uint32_t pending(const Cursor& cursor) const { return head() - cursor.position; }
+
+    size_t capacity() const { return Size; }
+
+private:
+    static const size_t WORDS = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+    struct Slot {
+        std::atomic<uint32_t> begin;
+        std::atomic<uint32_t> end;
+        std::atomic<uint32_t> words[WORDS];
+    };
+
+    static void skipTo(Cursor& cursor, uint32_t position) {
+        if ((int32_t)(position - cursor.position) > 0) {
+            cursor.missed += position - cursor.position;
+            cursor.position = position;
+        }
+    }
+
+    Slot slots_[Size];
+    std::atomic<uint32_t> head_;
+};
+
+#endif
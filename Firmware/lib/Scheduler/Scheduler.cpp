@@ -0,0 +1,179 @@
+#include "Scheduler.h"
+
+uint64_t VirtualClock::nowUs_ = 0;
+
+Scheduler::Scheduler(ClockFunction clock)
+    : clock_(clock), jobCount_(0), started_(false) {
+#ifdef ESP32
+    timer_ = nullptr;
+#endif
+}
+
+int Scheduler::addJob(const char* name, uint32_t periodMs, JobFunction fn, uint32_t offsetMs) {
+    if (jobCount_ >= SCHEDULER_MAX_JOBS || periodMs == 0) {
+        return -1;
+    }
+    Job& job = jobs_[jobCount_];
+    job.name = name;
+    job.fn = fn;
+    job.periodUs.store(periodMs * 1000UL);
+    job.periodChanged.store(false);
+    job.offsetUs = offsetMs * 1000ULL;
+    job.nextReleaseUs = job.offsetUs;
+    job.releasedAtUs = 0;
+    job.pending.store(false);
+    job.overruns.store(0);
+    job.stats = JobStats();
+    return jobCount_++;
+}
+
+void Scheduler::start() {
+    uint64_t now = clock_();
+    for (int i = 0; i < jobCount_; i++) {
+        jobs_[i].nextReleaseUs = now + jobs_[i].offsetUs;
+        jobs_[i].periodChanged.store(false);
+    }
+    started_ = true;
+
+#ifdef ESP32
+    if (timer_ == nullptr) {
+        esp_timer_create_args_t args = {};
+        args.callback = &Scheduler::onTimer;
+        args.arg = this;
+        args.name = "scheduler";
+        esp_timer_create(&args, &timer_);
+    }
+    armTimer();
+#endif
+}
+
+void Scheduler::release() {
+    if (!started_) {
+        return;
+    }
+    uint64_t now = clock_();
+
+    for (int i = 0; i < jobCount_; i++) {
+        Job& job = jobs_[i];
+        if (job.periodChanged.exchange(false)) {
+            uint64_t sooner = now + job.periodUs.load();
+            if (sooner < job.nextReleaseUs) {
+                job.nextReleaseUs = sooner;
+            }
+        }
+        if (now < job.nextReleaseUs) {
+            continue;
+        }
+
+        // Find the latest release slot that has passed; any slots skipped
+        // over (e.g. a delayed timer) are lost releases
+        uint32_t period = job.periodUs.load();
+        uint64_t slot = job.nextReleaseUs;
+        uint32_t missed = 0;
+        while (now >= slot + period) {
+            slot += period;
+            missed++;
+        }
+        job.nextReleaseUs = slot + period;
+
+        if (job.pending.load(std::memory_order_acquire)) {
+            // Previous release hasn't run yet; this one folds into it
+            missed++;
+        } else {
+            job.releasedAtUs = slot;
+            job.pending.store(true, std::memory_order_release);
+        }
+        if (missed > 0) {
+            job.overruns.fetch_add(missed);
+        }
+    }
+}
+
+int Scheduler::runPending() {
+    int ran = 0;
+    for (int i = 0; i < jobCount_; i++) {
+        Job& job = jobs_[i];
+        if (!job.pending.load(std::memory_order_acquire)) {
+            continue;
+        }
+
+        uint64_t start = clock_();
+        uint32_t jitter = (uint32_t)(start - job.releasedAtUs);
+        job.fn();
+        uint32_t runTime = (uint32_t)(clock_() - start);
+
+        JobStats& stats = job.stats;
+        stats.runs++;
+        stats.lastJitterUs = jitter;
+        stats.totalJitterUs += jitter;
+        if (jitter > stats.maxJitterUs) stats.maxJitterUs = jitter;
+        stats.lastRunUs = runTime;
+        if (runTime > stats.maxRunUs) stats.maxRunUs = runTime;
+
+        job.pending.store(false, std::memory_order_release);
+        ran++;
+    }
+    return ran;
+}
+
+void Scheduler::setPeriod(int job, uint32_t periodMs) {
+    if (job < 0 || job >= jobCount_ || periodMs == 0) {
+        return;
+    }
+    jobs_[job].periodUs.store(periodMs * 1000UL);
+    jobs_[job].periodChanged.store(true);
+#ifdef ESP32
+    // Wake release() now rather than at the old release time
+    if (started_) {
+        armTimer();
+    }
+#endif
+}
+
+uint64_t Scheduler::nextReleaseUs() const {
+    uint64_t next = UINT64_MAX;
+    for (int i = 0; i < jobCount_; i++) {
+        // release() has to reschedule it, so it's due now
+        if (jobs_[i].periodChanged.load()) {
+            return 0;
+        }
+        if (jobs_[i].nextReleaseUs < next) {
+            next = jobs_[i].nextReleaseUs;
+        }
+    }
+    return next;
+}
+
+JobStats Scheduler::stats(int job) const {
+    JobStats stats = jobs_[job].stats;
+    stats.overruns = jobs_[job].overruns.load();
+    return stats;
+}
+
+void Scheduler::resetStats() {
+    for (int i = 0; i < jobCount_; i++) {
+        jobs_[i].stats = JobStats();
+        jobs_[i].overruns.store(0);
+    }
+}
+
+#ifdef ESP32
+void Scheduler::onTimer(void* arg) {
+    Scheduler* scheduler = static_cast<Scheduler*>(arg);
+    scheduler->release();
+    scheduler->armTimer();
+}
+
+void Scheduler::armTimer() {
+    // One-shot timer re-armed for the next release keeps the timer task idle
+    // between releases
+    uint64_t now = clock_();
+    uint64_t next = nextReleaseUs();
+    uint64_t delay = next > now ? next - now : 0;
+    if (delay < 100) {
+        delay = 100;
+    }
+    esp_timer_stop(timer_);
+    esp_timer_start_once(timer_, delay);
+}
+#endif
@@ -0,0 +1,106 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <atomic>
+
+#ifdef ESP32
+#include <esp_timer.h>
+#endif
+
+#define SCHEDULER_MAX_JOBS 8
+
+typedef void (*JobFunction)();
+typedef uint64_t (*ClockFunction)();  // Monotonic time in microseconds
+
+// Per-job timing statistics. Jitter is the delay between a job's scheduled
+// release time and the moment it actually started running.
+struct JobStats {
+    uint32_t runs;
+    uint32_t overruns;      // Releases lost because the job was still pending
+    uint32_t lastJitterUs;
+    uint32_t maxJitterUs;
+    uint64_t totalJitterUs;
+    uint32_t lastRunUs;
+    uint32_t maxRunUs;
+};
+
+// Periodic job scheduler with an absolute (drift-free) timeline: release
+// times advance by exactly one period no matter how late a job runs.
+//
+// release() marks due jobs and can be driven from a timer; runPending()
+// executes them from the main task. On ESP32, start() arms an esp_timer that
+// calls release() at each release time. On the host, poll() does both under
+// whatever clock was passed in (e.g. VirtualClock::now).
+class Scheduler {
+public:
+    explicit Scheduler(ClockFunction clock);
+
+    // Returns the job id, or -1 if the table is full
+    int addJob(const char* name, uint32_t periodMs, JobFunction fn, uint32_t offsetMs = 0);
+
+    // Anchor the timeline at the current time (and arm the timer on ESP32)
+    void start();
+
+    // Timer context: release every job whose release time has passed
+    void release();
+
+    // Task context: run released jobs in registration order
+    int runPending();
+
+    // Release and run in one step, for builds without a hardware timer
+    int poll() {
+        release();
+        return runPending();
+    }
+
+    // The next release comes at most one new period from now: shortening an
+    // hour-long period doesn't wait out the hour. Later releases follow the
+    // new period from there.
+    void setPeriod(int job, uint32_t periodMs);
+
+    uint64_t nextReleaseUs() const;
+    int jobCount() const { return jobCount_; }
+    const char* jobName(int job) const { return jobs_[job].name; }
+    uint32_t jobPeriodMs(int job) const { return jobs_[job].periodUs.load() / 1000; }
+    JobStats stats(int job) const;
+    void resetStats();
+
+private:
+    struct Job {
+        const char* name;
+        JobFunction fn;
+        std::atomic<uint32_t> periodUs;
+        std::atomic<bool> periodChanged;  // Set by setPeriod(), taken by release()
+        uint64_t offsetUs;
+        uint64_t nextReleaseUs;  // Owned by release()
+        uint64_t releasedAtUs;   // Written by release() before pending is set
+        std::atomic<bool> pending;
+        std::atomic<uint32_t> overruns;
+        JobStats stats;          // Owned by runPending(), except overruns
+    };
+
+    ClockFunction clock_;
+    Job jobs_[SCHEDULER_MAX_JOBS];
+    int jobCount_;
+    bool started_;
+
+#ifdef ESP32
+    static void onTimer(void* arg);
+    void armTimer();
+    esp_timer_handle_t timer_;
+#endif
+};
+
+// Manually advanced clock for deterministic host runs
+class VirtualClock {
+public:
+    static uint64_t now() { return nowUs_; }
+    static void set(uint64_t us) { nowUs_ = us; }
+    static void advance(uint64_t us) { nowUs_ += us; }
+
+private:
+    static uint64_t nowUs_;
+};
+
+#endif
@@ -0,0 +1,145 @@
+#include "SensorPower.h"
+
+#include <math.h>
+
+SensorPower::SensorPower()
+    : state_(SENSOR_SLEEPING),
+      bandLow_(0),
+      bandHigh_(0),
+      haveReading_(false),
+      lastAqi_(0),
+      lastReadingMs_(0),
+      slope_(0),
+      slopeVariance_(0),
+      intervalMs_(0),
+      nextReadingMs_(0),
+      stateSinceMs_(0),
+      runtimeMs_(0),
+      wakes_(0),
+      readings_(0) {
+    config_.warmUpMs = 30000;
+    config_.minIntervalMs = 500;
+    config_.maxIntervalMs = 300000;
+    config_.watchIntervalMs = 2000;
+    config_.minSleepMs = 10000;
+    config_.changeAqi = 5;
+    config_.smoothingMs = 10000;
+    intervalMs_ = config_.minIntervalMs;
+}
+
+void SensorPower::configure(const SensorPowerConfig& config) {
+    config_ = config;
+    if (config_.maxIntervalMs < config_.minIntervalMs) {
+        config_.maxIntervalMs = config_.minIntervalMs;
+    }
+    if (intervalMs_ < config_.minIntervalMs) {
+        intervalMs_ = config_.minIntervalMs;
+    }
+    if (intervalMs_ > config_.maxIntervalMs) {
+        intervalMs_ = config_.maxIntervalMs;
+    }
+}
+
+void SensorPower::setWatchBand(float low, float high) {
+    bandLow_ = low;
+    bandHigh_ = high;
+}
+
+void SensorPower::begin(uint32_t nowMs) {
+    haveReading_ = false;
+    slope_ = 0;
+    slopeVariance_ = 0;
+    intervalMs_ = config_.minIntervalMs;
+    nextReadingMs_ = nowMs + config_.warmUpMs;
+    if (!powered()) {
+        wake(nowMs);
+    }
+}
+
+bool SensorPower::update(uint32_t nowMs) {
+    switch (state_) {
+        case SENSOR_SLEEPING:
+            // Wake early enough for the warm-up to end as the reading is due
+            if ((int32_t)(nowMs - (nextReadingMs_ - config_.warmUpMs)) >= 0) {
+                wake(nowMs);
+            }
+            return false;
+        case SENSOR_WARMING:
+            if (nowMs - stateSinceMs_ < config_.warmUpMs) {
+                return false;
+            }
+            state_ = SENSOR_MEASURING;
+            // A warm-up that started late pushes the reading back with it
+            return (int32_t)(nowMs - nextReadingMs_) >= 0;
+        case SENSOR_MEASURING:
+            return (int32_t)(nowMs - nextReadingMs_) >= 0;
+    }
+    return false;
+}
+
+void SensorPower::onReading(float aqi, uint32_t nowMs) {
+    readings_++;
+    uint32_t elapsedMs = nowMs - lastReadingMs_;
+    float target = config_.minIntervalMs;
+    if (haveReading_ && elapsedMs > 0 && fabsf(aqi - lastAqi_) < config_.changeAqi) {
+        // Exponentially weighted mean and variance of the derivative, with
+        // the weight set by the time since the last reading
+        float derivative = (aqi - lastAqi_) * 1000.0f / elapsedMs;
+        float alpha = 1 - expf(-(float)elapsedMs / config_.smoothingMs);
+        float diff = derivative - slope_;
+        slope_ += alpha * diff;
+        slopeVariance_ = (1 - alpha) * (slopeVariance_ + alpha * diff * diff);
+        float rate = sqrtf(slope_ * slope_ + slopeVariance_);
+        target = rate > 0 ? config_.changeAqi * 1000.0f / rate : (float)config_.maxIntervalMs;
+        if (target > 2.0f * intervalMs_) {
+            target = 2.0f * intervalMs_;
+        }
+    } else if (haveReading_ && elapsedMs > 0) {
+        // A step: start the estimate over from it
+        slope_ = (aqi - lastAqi_) * 1000.0f / elapsedMs;
+        slopeVariance_ = 0;
+    }
+    if (aqi >= bandLow_ && aqi <= bandHigh_ && target > config_.watchIntervalMs) {
+        target = config_.watchIntervalMs;
+    }
+    if (target < config_.minIntervalMs) {
+        target = config_.minIntervalMs;
+    }
+    intervalMs_ = target > config_.maxIntervalMs ? config_.maxIntervalMs : (uint32_t)target;
+    haveReading_ = true;
+    lastAqi_ = aqi;
+    lastReadingMs_ = nowMs;
+    nextReadingMs_ = nowMs + intervalMs_;
+    if (intervalMs_ >= config_.warmUpMs + config_.minSleepMs) {
+        sleep(nowMs);
+    }
+}
+
+float SensorPower::slopeDeviation() const {
+    return sqrtf(slopeVariance_);
+}
+
+uint64_t SensorPower::runtimeMs(uint32_t nowMs) const {
+    return runtimeMs_ + (powered() ? nowMs - stateSinceMs_ : 0);
+}
+
+void SensorPower::wake(uint32_t nowMs) {
+    state_ = SENSOR_WARMING;
+    stateSinceMs_ = nowMs;
+    wakes_++;
+}
+
+void SensorPower::sleep(uint32_t nowMs) {
+    runtimeMs_ += nowMs - stateSinceMs_;
+    state_ = SENSOR_SLEEPING;
+    stateSinceMs_ = nowMs;
+}
+
+const char* SensorPower::stateName(SensorPowerState state) {
+    switch (state) {
+        case SENSOR_SLEEPING: return "sleeping";
+        case SENSOR_WARMING: return "warming";
+        case SENSOR_MEASURING: return "measuring";
+    }
+    return "unknown";
+}
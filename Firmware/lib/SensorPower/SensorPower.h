@@ -0,0 +1,95 @@
+#ifndef SENSOR_POWER_H
+#define SENSOR_POWER_H
+
+#include <stdint.h>
+
+// Duty-cycling for laser PM sensors (PMS5003 and the like), whose laser and
+// fan wear out after roughly 8000 hours of running. The sensor is put to
+// sleep between readings when the gap is long enough to be worth it, woken
+// ahead of the next reading so its fan has moved air through the chamber for
+// the warm-up time, and only then read.
+//
+// The gap between readings follows how fast the AQI is changing. Each
+// reading gives a derivative (AQI/s) against the previous one; exponentially
+// weighted, time-based averages track its mean (the trend) and variance
+// (how jumpy it is), and together they give the RMS rate of change. The next
+// reading is due when the AQI is expected to have moved by changeAqi at that
+// rate: sub-second during a smoke spike, minutes once the air has settled.
+// A jump of changeAqi or more between readings goes straight back to the
+// fastest rate; readings inside the watch band around the fan thresholds
+// come at least every watchIntervalMs; and the gap grows at most twofold per
+// reading, so one quiet pair of readings can't stretch it to the maximum.
+//
+// Nothing here touches hardware; the caller drives the sensor's SET pin from
+// powered() and takes a reading whenever update() says so.
+
+struct SensorPowerConfig {
+    uint32_t warmUpMs;       // From waking until readings are trusted (PMS5003: 30 s)
+    uint32_t minIntervalMs;    // Shortest gap between readings, during transients
+    uint32_t maxIntervalMs;    // Longest gap, once steady
+    uint32_t watchIntervalMs;  // Longest gap while inside the watch band
+    uint32_t minSleepMs;       // Shorter sleeps aren't worth a warm-up; stay on instead
+    float changeAqi;           // Change the AQI may make between readings
+    uint32_t smoothingMs;      // Time constant of the derivative's mean and variance
+};
+
+enum SensorPowerState { SENSOR_SLEEPING, SENSOR_WARMING, SENSOR_MEASURING };
+
+class SensorPower {
+public:
+    SensorPower();
+
+    void configure(const SensorPowerConfig& config);
+    const SensorPowerConfig& config() const { return config_; }
+
+    // Readings inside [low, high] are taken at the fastest rate
+    void setWatchBand(float low, float high);
+
+    // Wakes the sensor; the first reading follows the warm-up
+    void begin(uint32_t nowMs);
+
+    // Advance to nowMs; true when a reading should be taken now
+    bool update(uint32_t nowMs);
+
+    // Report the reading just taken; schedules the next one and puts the
+    // sensor to sleep until then if the gap allows
+    void onReading(float aqi, uint32_t nowMs);
+
+    SensorPowerState state() const { return state_; }
+    bool powered() const { return state_ != SENSOR_SLEEPING; }
+    uint32_t intervalMs() const { return intervalMs_; }
+    uint32_t nextReadingMs() const { return nextReadingMs_; }
+    uint32_t wakeCount() const { return wakes_; }
+    uint32_t readingCount() const { return readings_; }
+    // Smoothed derivative and its standard deviation, AQI/s
+    float slope() const { return slope_; }
+    float slopeDeviation() const;
+
+    // Total time powered, including what restoreRuntime() brought forward
+    uint64_t runtimeMs(uint32_t nowMs) const;
+    void restoreRuntime(uint64_t ms) { runtimeMs_ = ms; }
+
+    static const char* stateName(SensorPowerState state);
+
+private:
+    void wake(uint32_t nowMs);
+    void sleep(uint32_t nowMs);
+
+    SensorPowerConfig config_;
+    SensorPowerState state_;
+    float bandLow_;
+    float bandHigh_;
+    bool haveReading_;
+    float lastAqi_;
+    uint32_t lastReadingMs_;
+    float slope_;
+    float slopeVariance_;
+    uint32_t intervalMs_;
+    uint32_t nextReadingMs_;
+    uint32_t stateSinceMs_;
+    uint64_t runtimeMs_;  // Closed powered periods
+    uint32_t wakes_;
+    uint32_t readings_;
+};
+
+#endif
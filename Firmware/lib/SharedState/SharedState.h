@@ -0,0 +1,142 @@
+#ifndef SHARED_STATE_H
+#define SHARED_STATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+// Single-writer, multi-reader value. The writer bumps the sequence to odd,
+// copies the value in and bumps it back to even; readers copy the value out
+// and retry if the sequence was odd or changed meanwhile. Readers never
+// block the writer, so a reader task can't hold up the control loop the way
+// a mutex would. The value is copied word by word through relaxed atomics,
+// which keeps a torn copy (always discarded) well-defined.
+template<typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock needs a trivially copyable type");
+
+public:
+    SeqLock() : seq_(0) {
+        T value;
+        memset(&value, 0, sizeof(value));
+        store(value);
+    }
+
+    // Only ever called from the one writer context
+    void write(const T& value) {
+        uint32_t seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        store(value);
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    T read() const {
+        T value;
+        for (;;) {
+            uint32_t before = seq_.load(std::memory_order_acquire);
+            if (before & 1) {
+                continue;  // Write in progress
+            }
+            load(value);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq_.load(std::memory_order_relaxed) == before) {
+                return value;
+            }
+        }
+    }
+
+    // Number of completed writes
+    uint32_t version() const { return seq_.load(std::memory_order_acquire) / 2; }
+
+private:
+    static const size_t WORDS = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+    void store(const T& value) {
+        uint32_t words[WORDS] = {};
+        memcpy(words, &value, sizeof(T));
+        for (size_t i = 0; i < WORDS; i++) {
+            words_[i].store(words[i], std::memory_order_relaxed);
+        }
+    }
+
+    void load(T& value) const {
+        uint32_t words[WORDS];
+        for (size_t i = 0; i < WORDS; i++) {
+            words[i] = words_[i].load(std::memory_order_relaxed);
+        }
+        memcpy(&value, words, sizeof(T));
+    }
+
+    std::atomic<uint32_t> seq_;
+    std::atomic<uint32_t> words_[WORDS];
+};
+
+// Bounded multi-producer, single-consumer queue of write requests for the
+// owner of a SeqLock (Vyukov, as in the logger). push() never blocks: a
+// full queue is reported to the caller, who can reject the request.
+template<typename T, size_t Size>
+class CommandQueue {
+    static_assert((Size & (Size - 1)) == 0, "CommandQueue size must be a power of two");
+
+public:
+    CommandQueue() : enqueuePos_(0), dequeuePos_(0), pushed_(0), rejected_(0) {
+        for (size_t i = 0; i < Size; i++) {
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool push(const T& command) {
+        uint32_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &slots_[pos & (Size - 1)];
+            int32_t diff = (int32_t)(slot->seq.load(std::memory_order_acquire) - pos);
+            if (diff == 0) {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                rejected_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        slot->command = command;
+        slot->seq.store(pos + 1, std::memory_order_release);
+        pushed_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Consumer only
+    bool pop(T& command) {
+        Slot* slot = &slots_[dequeuePos_ & (Size - 1)];
+        if (slot->seq.load(std::memory_order_acquire) != dequeuePos_ + 1) {
+            return false;
+        }
+        command = slot->command;
+        slot->seq.store(dequeuePos_ + Size, std::memory_order_release);
+        dequeuePos_++;
+        return true;
+    }
+
+    uint32_t pushed() const { return pushed_.load(std::memory_order_relaxed); }
+    uint32_t rejected() const { return rejected_.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> seq;
+        T command;
+    };
+
+    Slot slots_[Size];
+    std::atomic<uint32_t> enqueuePos_;
+    uint32_t dequeuePos_;
+    std::atomic<uint32_t> pushed_;
+    std::atomic<uint32_t> rejected_;
+};
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+
+// Pre-serialized response bytes with a version number. The writer builds
+// each new version in the inactive buffer and then flips it in, so readers
+// always see a complete document. Read endpoints send data() as is and
+// answer If-None-Match with 304 when the ETag still matches. Versions
+// restart with every boot, so the ETag also carries a boot id: a tag a
+// browser cached before a restart never matches the new boot's documents.
+template<size_t Capacity>
+class Snapshot {
+public:
+    Snapshot() : active_(0), version_(0), boot_(0) {
+        for (int i = 0; i < 2; i++) {
+            buffers_[i].length = 0;
+            buffers_[i].data[0] = '\0';
+        }
+        setEtag(0);
+    }
+
+    // Once, before the first commit(), with an id that differs between boots
+    // (a random number)
+    void begin(uint32_t boot) {
+        boot_ = boot;
+        setEtag(version_.load(std::memory_order_relaxed));
+    }
+
+    // Version the next commit() will publish, for embedding in the document
+    uint32_t nextVersion() const { return version_.load(std::memory_order_relaxed) + 1; }
+
+    // Writer: fill the returned buffer (capacity() bytes), then commit
+    char* beginPublish() { return buffers_[1 - active_.load(std::memory_order_relaxed)].data; }
+    size_t capacity() const { return Capacity; }
+
+    void commit(size_t length) {
+        int next = 1 - active_.load(std::memory_order_relaxed);
+        if (length >= Capacity) {
+            length = Capacity - 1;
+        }
+        buffers_[next].data[length] = '\0';
+        buffers_[next].length = length;
+        uint32_t version = version_.load(std::memory_order_relaxed) + 1;
+        setEtagFor(next, version);
+        active_.store(next, std::memory_order_release);
+        version_.store(version, std::memory_order_release);
+    }
+
+    uint32_t version() const { return version_.load(std::memory_order_acquire); }
+    const char* data() const { return buffers_[active_.load(std::memory_order_acquire)].data; }
+    size_t length() const { return buffers_[active_.load(std::memory_order_acquire)].length; }
+    const char* etag() const { return buffers_[active_.load(std::memory_order_acquire)].etag; }
+
+    // True if an If-None-Match header value names the current version
+    bool matches(const char* ifNoneMatch) const {
+        if (!ifNoneMatch) {
+            return false;
+        }
+        if (strcmp(ifNoneMatch, "*") == 0) {
+            return version() > 0;
+        }
+        // A list of (possibly weak) tags: "3", W/"4"
+        const char* tag = etag();
+        size_t tagLength = strlen(tag);
+        for (const char* p = strstr(ifNoneMatch, tag); p; p = strstr(p + 1, tag)) {
+            char after = p[tagLength];
+            if (after == '\0' || after == ',' || after == ' ') {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct Buffer {
+        char data[Capacity];
+        size_t length;
+        char etag[24];  // "<boot id>-<version>"
+    };
+
+    void setEtag(uint32_t version) {
+        setEtagFor(0, version);
+        setEtagFor(1, version);
+    }
+
+    void setEtagFor(int buffer, uint32_t version) {
+        snprintf(buffers_[buffer].etag, sizeof(buffers_[buffer].etag), "\"%08lx-%lu\"", (unsigned long)boot_,
+                 (unsigned long)version);
+    }
+
+    Buffer buffers_[2];
+    std::atomic<int> active_;
+    std::atomic<uint32_t> version_;
+    uint32_t boot_;
+};
+
+#endif
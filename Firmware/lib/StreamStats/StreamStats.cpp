@@ -0,0 +1,263 @@
+#include "StreamStats.h"
+
+#include <math.h>
+
+P2Quantile::P2Quantile(float quantile) : quantile_(quantile) {
+    reset();
+}
+
+void P2Quantile::reset() {
+    count_ = 0;
+}
+
+void P2Quantile::add(float x) {
+    if (count_ < 5) {
+        // Insertion sort of the first five samples; they seed the markers
+        int i = count_++;
+        while (i > 0 && heights_[i - 1] > x) {
+            heights_[i] = heights_[i - 1];
+            i--;
+        }
+        heights_[i] = x;
+        if (count_ == 5) {
+            float p = quantile_;
+            for (int j = 0; j < 5; j++) {
+                positions_[j] = j + 1;
+            }
+            desired_[0] = 1;
+            desired_[1] = 1 + 2 * p;
+            desired_[2] = 1 + 4 * p;
+            desired_[3] = 3 + 2 * p;
+            desired_[4] = 5;
+            increments_[0] = 0;
+            increments_[1] = p / 2;
+            increments_[2] = p;
+            increments_[3] = (1 + p) / 2;
+            increments_[4] = 1;
+        }
+        return;
+    }
+    count_++;
+
+    // Find the cell x falls in, widening the extremes if needed
+    int cell;
+    if (x < heights_[0]) {
+        heights_[0] = x;
+        cell = 0;
+    } else if (x >= heights_[4]) {
+        heights_[4] = x;
+        cell = 3;
+    } else {
+        cell = 0;
+        while (cell < 3 && x >= heights_[cell + 1]) {
+            cell++;
+        }
+    }
+    for (int i = cell + 1; i < 5; i++) {
+        positions_[i]++;
+    }
+    for (int i = 0; i < 5; i++) {
+        desired_[i] += increments_[i];
+    }
+
+    // Nudge the middle markers towards their desired positions
+    for (int i = 1; i <= 3; i++) {
+        float d = desired_[i] - positions_[i];
+        if ((d >= 1 && positions_[i + 1] - positions_[i] > 1) ||
+            (d <= -1 && positions_[i - 1] - positions_[i] < -1)) {
+            int step = d > 0 ? 1 : -1;
+            float n0 = positions_[i - 1], n1 = positions_[i], n2 = positions_[i + 1];
+            float q0 = heights_[i - 1], q1 = heights_[i], q2 = heights_[i + 1];
+            // Piecewise-parabolic prediction, falling back to linear
+            float q = q1 + step / (n2 - n0) *
+                ((n1 - n0 + step) * (q2 - q1) / (n2 - n1) + (n2 - n1 - step) * (q1 - q0) / (n1 - n0));
+            if (q <= q0 || q >= q2) {
+                float qn = heights_[i + step];
+                float nn = positions_[i + step];
+                q = q1 + step * (qn - q1) / (nn - n1);
+            }
+            heights_[i] = q;
+            positions_[i] += step;
+        }
+    }
+}
+
+float P2Quantile::value() const {
+    if (count_ == 0) {
+        return NAN;
+    }
+    if (count_ < 5) {
+        int index = (int)(quantile_ * (count_ - 1) + 0.5f);
+        return heights_[index];
+    }
+    return heights_[2];
+}
+
+RollingStats::RollingStats() {
+    for (int k = 0; k < STATS_STAGGER; k++) {
+        p50_[k] = P2Quantile(0.5f);
+        p95_[k] = P2Quantile(0.95f);
+    }
+    configure(3600000);
+}
+
+void RollingStats::configure(uint32_t windowMs) {
+    windowMs_ = windowMs;
+    bucketMs_ = windowMs / STATS_BUCKETS;
+    if (bucketMs_ == 0) {
+        bucketMs_ = 1;
+    }
+    started_ = false;
+    bucket_ = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        bucketSum_[i] = 0;
+        bucketCount_[i] = 0;
+    }
+    sum_ = 0;
+    count_ = 0;
+    openHasSamples_ = false;
+    minima_.clear();
+    maxima_.clear();
+    for (int k = 0; k < STATS_STAGGER; k++) {
+        p50_[k].reset();
+        p95_[k].reset();
+        estimatorStart_[k] = 0;
+    }
+}
+
+void RollingStats::add(float value, uint32_t timeMs) {
+    uint32_t bucket = timeMs / bucketMs_;
+    if (!started_) {
+        started_ = true;
+        bucket_ = bucket;
+        for (int k = 0; k < STATS_STAGGER; k++) {
+            estimatorStart_[k] = bucket;
+        }
+    } else if (bucket > bucket_) {
+        advanceTo(bucket);
+    }
+
+    int slot = bucket_ % STATS_BUCKETS;
+    bucketSum_[slot] += value;
+    bucketCount_[slot]++;
+    sum_ += value;
+    count_++;
+
+    if (!openHasSamples_ || value < openMin_) openMin_ = value;
+    if (!openHasSamples_ || value > openMax_) openMax_ = value;
+    openHasSamples_ = true;
+
+    for (int k = 0; k < STATS_STAGGER; k++) {
+        p50_[k].add(value);
+        p95_[k].add(value);
+    }
+}
+
+void RollingStats::closeBucket() {
+    if (!openHasSamples_) {
+        return;
+    }
+    Extreme extreme = {bucket_, openMin_};
+    while (minima_.size && minima_.back().value >= openMin_) {
+        minima_.popBack();
+    }
+    minima_.pushBack(extreme);
+    extreme.value = openMax_;
+    while (maxima_.size && maxima_.back().value <= openMax_) {
+        maxima_.popBack();
+    }
+    maxima_.pushBack(extreme);
+    openHasSamples_ = false;
+}
+
+void RollingStats::expire(uint32_t bucket) {
+    while (minima_.size && bucket - minima_.front().bucket >= STATS_BUCKETS) {
+        minima_.popFront();
+    }
+    while (maxima_.size && bucket - maxima_.front().bucket >= STATS_BUCKETS) {
+        maxima_.popFront();
+    }
+}
+
+void RollingStats::advanceTo(uint32_t bucket) {
+    closeBucket();
+
+    // Entering bucket i reuses the slot of bucket i - STATS_BUCKETS, which
+    // has just left the window. After a long gap only the last lap matters.
+    uint32_t first = bucket_ + 1;
+    if (bucket - bucket_ > STATS_BUCKETS) {
+        first = bucket - STATS_BUCKETS + 1;
+        for (int i = 0; i < STATS_BUCKETS; i++) {
+            bucketSum_[i] = 0;
+            bucketCount_[i] = 0;
+        }
+        sum_ = 0;
+        count_ = 0;
+    }
+    for (uint32_t i = first; i <= bucket; i++) {
+        int slot = i % STATS_BUCKETS;
+        sum_ -= bucketSum_[slot];
+        count_ -= bucketCount_[slot];
+        bucketSum_[slot] = 0;
+        bucketCount_[slot] = 0;
+
+        // Estimator k restarts once per window, offset by k/STATS_STAGGER
+        for (int k = 0; k < STATS_STAGGER; k++) {
+            if (slot == k * (STATS_BUCKETS / STATS_STAGGER)) {
+                p50_[k].reset();
+                p95_[k].reset();
+                estimatorStart_[k] = i;
+            }
+        }
+    }
+    if (count_ == 0) {
+        sum_ = 0;  // Drop accumulated rounding once the window is empty
+    }
+    bucket_ = bucket;
+    expire(bucket);
+}
+
+WindowStats RollingStats::stats(uint32_t nowMs) {
+    if (started_ && nowMs / bucketMs_ > bucket_) {
+        advanceTo(nowMs / bucketMs_);
+    }
+
+    WindowStats stats;
+    stats.windowMs = windowMs_;
+    stats.count = count_;
+    stats.min = NAN;
+    stats.max = NAN;
+    stats.mean = NAN;
+    stats.p50 = NAN;
+    stats.p95 = NAN;
+    stats.quantileMs = 0;
+    if (count_ == 0) {
+        return stats;
+    }
+
+    stats.mean = (float)(sum_ / count_);
+    stats.min = openHasSamples_ ? openMin_ : INFINITY;
+    stats.max = openHasSamples_ ? openMax_ : -INFINITY;
+    if (minima_.size && minima_.front().value < stats.min) stats.min = minima_.front().value;
+    if (maxima_.size && maxima_.front().value > stats.max) stats.max = maxima_.front().value;
+
+    // The estimator that has been running longest covers the most (one that
+    // restarted during a gap in the samples may have nothing yet)
+    int oldest = -1;
+    for (int k = 0; k < STATS_STAGGER; k++) {
+        if (p50_[k].count() > 0 &&
+            (oldest < 0 || bucket_ - estimatorStart_[k] > bucket_ - estimatorStart_[oldest])) {
+            oldest = k;
+        }
+    }
+    if (oldest < 0) {
+        return stats;
+    }
+    stats.p50 = p50_[oldest].value();
+    stats.p95 = p95_[oldest].value();
+    stats.quantileMs = (bucket_ - estimatorStart_[oldest] + 1) * bucketMs_;
+    if (stats.quantileMs > windowMs_) {
+        stats.quantileMs = windowMs_;
+    }
+    return stats;
+}
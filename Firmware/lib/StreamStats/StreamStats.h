@@ -0,0 +1,114 @@
+#ifndef STREAM_STATS_H
+#define STREAM_STATS_H
+
+#include <stdint.h>
+
+// Rolling-window statistics in O(1) per sample and fixed memory.
+//
+// The window is split into STATS_BUCKETS time buckets. Bucket sums give
+// the mean, and monotonic deques of bucket minima and maxima give min/max
+// once a bucket ages out. Quantiles use P-squared estimators (Jain and
+// Chlamtac), which can't forget samples. Instead STATS_STAGGER estimators
+// per quantile are restarted in turn, each one window apart and staggered
+// by window/STATS_STAGGER. Queries read the one that has run longest, so
+// the quantiles cover the most recent (1 - 1/STATS_STAGGER) to 1 window.
+// They are typically within a few percent on the 5m and 1h windows and
+// ~10% on 24h, but lag pollution events; host/stats_check measures this.
+
+#ifndef STATS_BUCKETS
+#define STATS_BUCKETS 60
+#endif
+#ifndef STATS_STAGGER
+#define STATS_STAGGER 4
+#endif
+
+// Streaming estimate of one quantile from five markers
+class P2Quantile {
+public:
+    explicit P2Quantile(float quantile = 0.5f);
+
+    void reset();
+    void add(float x);
+    // Exact while fewer than five samples have been seen; NaN if none
+    float value() const;
+    uint32_t count() const { return count_; }
+
+private:
+    float quantile_;
+    uint32_t count_;
+    float heights_[5];
+    int32_t positions_[5];
+    float desired_[5];
+    float increments_[5];
+};
+
+struct WindowStats {
+    uint32_t windowMs;
+    uint32_t count;      // Samples in the window
+    float min;
+    float max;
+    float mean;
+    float p50;
+    float p95;
+    uint32_t quantileMs; // Span the quantile estimates actually cover
+};
+
+class RollingStats {
+public:
+    RollingStats();
+
+    // Clears everything; windowMs should be a multiple of STATS_BUCKETS ms
+    void configure(uint32_t windowMs);
+    uint32_t windowMs() const { return windowMs_; }
+
+    // Times must not go backwards
+    void add(float value, uint32_t timeMs);
+    WindowStats stats(uint32_t nowMs);
+
+private:
+    struct Extreme {
+        uint32_t bucket;
+        float value;
+    };
+
+    // Fixed-size double-ended queue of bucket extremes, kept monotonic
+    struct ExtremeDeque {
+        Extreme items[STATS_BUCKETS + 1];
+        uint8_t head;
+        uint8_t size;
+        void clear() { head = 0; size = 0; }
+        Extreme& at(int i) { return items[(head + i) % (STATS_BUCKETS + 1)]; }
+        Extreme& front() { return at(0); }
+        Extreme& back() { return at(size - 1); }
+        void popFront() { head = (head + 1) % (STATS_BUCKETS + 1); size--; }
+        void popBack() { size--; }
+        void pushBack(const Extreme& e) { size++; back() = e; }
+    };
+
+    void advanceTo(uint32_t bucket);
+    void closeBucket();
+    void expire(uint32_t bucket);
+
+    uint32_t windowMs_;
+    uint32_t bucketMs_;
+    bool started_;
+    uint32_t bucket_;         // Bucket the latest sample fell in
+
+    float bucketSum_[STATS_BUCKETS];
+    uint32_t bucketCount_[STATS_BUCKETS];
+    double sum_;
+    uint32_t count_;
+
+    // The open bucket's extremes; closed buckets go to the deques
+    float openMin_;
+    float openMax_;
+    bool openHasSamples_;
+    ExtremeDeque minima_;
+    ExtremeDeque maxima_;
+
+    P2Quantile p50_[STATS_STAGGER];
+    P2Quantile p95_[STATS_STAGGER];
+    uint32_t estimatorStart_[STATS_STAGGER];  // Bucket each estimator restarted at
+};
+
+#endif
@@ -0,0 +1,99 @@
+#include "Trace.h"
+
+#ifdef OPENAIR_TRACE
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+struct TraceEvent {
+    const char* name;
+    uint64_t start;
+    uint32_t duration;
+};
+
+static TraceEvent events[TRACE_BUFFER_EVENTS];
+static uint32_t recorded = 0;
+
+static uint32_t readCounter() {
+#ifdef ARDUINO
+    return ESP.getCycleCount();
+#else
+    // Host builds count nanoseconds instead of cycles
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static uint32_t countsPerUs() {
+#ifdef ARDUINO
+    return getCpuFrequencyMhz();
+#else
+    return 1000;
+#endif
+}
+
+uint64_t traceNow() {
+    // The 32-bit counter wraps every ~18 s at 240 MHz; loop() runs far more
+    // often than that, so counting wraps here is enough to extend it
+    static uint32_t high = 0;
+    static uint32_t last = 0;
+    uint32_t now = readCounter();
+    if (now < last) {
+        high++;
+    }
+    last = now;
+    return ((uint64_t)high << 32) | now;
+}
+
+void traceRecord(const char* name, uint64_t start, uint64_t end) {
+    TraceEvent& event = events[recorded % TRACE_BUFFER_EVENTS];
+    event.name = name;
+    event.start = start;
+    event.duration = (uint32_t)(end - start);
+    recorded++;
+}
+
+void traceClear() {
+    recorded = 0;
+}
+
+uint32_t traceRecorded() {
+    return recorded;
+}
+
+static void writef(TraceWriter writer, void* context, const char* format, ...) {
+    char line[128];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length > 0) {
+        writer(line, (size_t)length < sizeof(line) ? (size_t)length : sizeof(line) - 1, context);
+    }
+}
+
+void traceExport(TraceWriter writer, void* context) {
+    // Events recorded while exporting (the export itself runs inside traced
+    // scopes) are left for the next dump
+    uint32_t end = recorded;
+    uint32_t begin = end > TRACE_BUFFER_EVENTS ? end - TRACE_BUFFER_EVENTS : 0;
+    double perUs = countsPerUs();
+
+    writef(writer, context, "{\"traceEvents\":[");
+    for (uint32_t i = begin; i < end; i++) {
+        const TraceEvent& event = events[i % TRACE_BUFFER_EVENTS];
+        writef(writer, context,
+               "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+               i == begin ? "" : ",", event.name, event.start / perUs, event.duration / perUs);
+    }
+    writef(writer, context, "],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":%lu}}",
+           (unsigned long)begin);
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Scoped phase markers recorded into a fixed in-RAM buffer and exported as
+// Chrome trace-event JSON (open in Perfetto or chrome://tracing).
+//
+// Build with -DOPENAIR_TRACE to enable. Without it TRACE_SCOPE expands to
+// nothing and none of this is compiled in.
+//
+// Timestamps come from the CPU cycle counter. Recording is meant for one
+// task (the Arduino loop task); scopes from other tasks are not supported.
+
+#ifndef TRACE_BUFFER_EVENTS
+#define TRACE_BUFFER_EVENTS 512
+#endif
+
+#ifdef OPENAIR_TRACE
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// name must be a string literal (or otherwise outlive the buffer)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope_, __LINE__)(name)
+
+typedef void (*TraceWriter)(const char* data, size_t length, void* context);
+
+uint64_t traceNow();  // Cycle counter extended to 64 bits
+void traceRecord(const char* name, uint64_t start, uint64_t end);
+
+// Writes the buffered events, oldest first, as {"traceEvents":[...]}
+void traceExport(TraceWriter writer, void* context);
+void traceClear();
+uint32_t traceRecorded();  // Events recorded since the last clear
+
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : name_(name), start_(traceNow()) {}
+    ~TraceScope() { traceRecord(name_, start_, traceNow()); }
+
+private:
+    const char* name_;
+    uint64_t start_;
+};
+
+#else
+
+#define TRACE_SCOPE(name) do {} while (0)
+
+#endif
+
+#endif
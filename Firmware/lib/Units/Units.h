@@ -0,0 +1,29 @@
+#ifndef UNITS_H
+#define UNITS_H
+
+#include <math.h>
+#include <stdint.h>
+
+// Fixed-point encoding shared by the wire formats (beacon, Modbus
+// registers, CoAP payloads): unsigned value * scale, rounded, with 0xFFFF
+// for a value the unit can't measure. Negative values clamp to 0 and large
+// ones to just below the marker.
+
+#define SCALED_NOT_AVAILABLE 0xFFFF
+
+inline uint16_t encodeScaled(float value, float scale) {
+    if (isnan(value)) return SCALED_NOT_AVAILABLE;
+    if (value <= 0) return 0;
+    float scaled = value * scale + 0.5f;
+    return scaled >= SCALED_NOT_AVAILABLE ? SCALED_NOT_AVAILABLE - 1 : (uint16_t)scaled;
+}
+
+inline float decodeScaled(uint16_t value, float scale) {
+    return value == SCALED_NOT_AVAILABLE ? NAN : value / scale;
+}
+
+// AQI, PM and thresholds travel as tenths
+inline uint16_t encodeTenths(float value) { return encodeScaled(value, 10); }
+inline float decodeTenths(uint16_t value) { return decodeScaled(value, 10); }
+
+#endif
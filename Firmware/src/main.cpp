@@ -1,11 +1,39 @@
 #include <WiFi.h>
-#include <WebServer.h>
+#include <ESPmDNS.h>
+#include <mdns.h>
+#include <esp_ota_ops.h>
 #include <EEPROM.h>
 #include <ArduinoJson.h>
 #include <Wire.h>
 #include <Adafruit_GFX.h>
 #include <Adafruit_SSD1306.h>
 #include "credentials.h"
+#include "HttpServer.h"
+#include "FanControl.h"
+#include "FanTach.h"
+#include "Scheduler.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Snapshot.h"
+#include "SharedState.h"
+#include "SampleQueue.h"
+#include "AqiSim.h"
+#include "StreamStats.h"
+#include "MqttClient.h"
+#include "MqttPublisher.h"
+#include "HaDiscovery.h"
+#include "ModbusTcp.h"
+#include "OpenAirRegisters.h"
+#include "CoapServer.h"
+#include "OpenAirCoap.h"
+#include "Beacon.h"
+#include "OtaUpdate.h"
+#include "Backlog.h"
+#include "SensorPower.h"
+#include "Resample.h"
+#include "Forecast.h"
+#include "AqiPipeline.h"
 
 // Pin definitions
 #define BOOT_BUTTON 0
@@ -13,6 +41,8 @@
 #define ROTARY_CLK 13
 #define ROTARY_DT 12
 #define ROTARY_SW 14
+#define TACH_PIN 27
+#define SENSOR_SET_PIN 25 // PM sensor SET: high runs, low sleeps
 
 // I2C Display
 #define SCREEN_WIDTH 128
@@ -21,7 +51,7 @@
 Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET);
 
 // Global variables
-WebServer server(80);
+HttpServer server(80);
 WiFiConfig wifiConfig;  
 SensorConfig sensorConfig;
 bool isConfigMode = false;
@@ -36,32 +66,375 @@ unsigned long encoderButtonTime = 0;
 int currentMenu = 0; // 0: Main, 1: Settings, 2: WiFi Config
 int menuItem = 0;
 
-// AQI variables
+// AQI variables; the hourly history is kept by the pipeline
 float currentAQI = 50.0;
-float aqiHistory[24]; // Last 24 hours data
-unsigned long lastAQIUpdate = 0;
+uint32_t currentAQITimeMs = 0;
 unsigned long lastSensorRead = 0;
 bool fanAutoMode = true;
 float fanThreshold = 100.0;
 
+// Fan relay control (hysteresis and minimum dwell times)
+FanController fanController;
+float fanHysteresis = 10.0;
+unsigned long fanMinOnTime = 60000;
+unsigned long fanMinOffTime = 30000;
+
+// Fan tachometer (counted by the PCNT peripheral)
+PcntTachCounter tachCounter(TACH_PIN);
+FanTach fanTach;
+float fanNominalRpm = 0; // 0 = only detect stalls
+
+// Simulation mode input: a seeded synthetic day seen through a room model,
+// the same inputs host/replay_sim uses, so runs are reproducible
+#define SIM_SEED 1
+SyntheticAqi syntheticAqi(SyntheticAqi::defaults(SIM_SEED));
+RoomModel simulatedRoom;
+
+// PM sensor duty cycle: readings as often as every 500 ms while the AQI
+// changes fast, at least every 2 s near the fan thresholds, as rarely as
+// every 5 minutes once it's steady, with the sensor asleep between them
+// when the gap covers its warm-up
+#define SENSOR_WARM_UP_MS 30000
+#define SENSOR_MIN_INTERVAL_MS 500
+#define SENSOR_MAX_INTERVAL_MS 300000
+#define SENSOR_WATCH_INTERVAL_MS 2000
+#define SENSOR_MIN_SLEEP_MS 10000
+#define SENSOR_CHANGE_AQI 5.0f
+#define SENSOR_SMOOTHING_MS 10000
+#define SENSOR_WATCH_AQI 15.0f        // Around the fan's on/off thresholds
+#define SENSOR_RATED_HOURS 8000
+#define SENSOR_RUNTIME_SAVE_MS 3600000 // Flash wear: save the runtime hourly
+SensorPower sensorPower;
+SensorRuntime sensorRuntime;
+
+// Periodic jobs, released by esp_timer on a drift-free timeline
+uint64_t schedulerClock() { return esp_timer_get_time(); }
+Scheduler scheduler(schedulerClock);
+#define SENSOR_TICK_MS 250 // Sensor power and reading checks; readings follow sensorPower
+#define CONTROL_PERIOD_MS 250
+#define TACH_PERIOD_MS 1000
+#define DISPLAY_PERIOD_MS 1000
+
+// Metrics served at /metrics
+MetricsRegistry metrics;
+Histogram loopDuration;
+Histogram handleClientDuration;
+Histogram displayDuration;
+Histogram eepromCommitDuration;
+Gauge heapFree;
+Gauge heapMinFree;
+Gauge heapLargestBlock;
+Gauge wifiRssi;
+Gauge uptimeSeconds;
+Gauge sensorRuntimeSeconds;
+Gauge sensorPowered;
+Gauge sensorIntervalSeconds;
+Counter sensorWakesTotal;
+Counter relayCyclesTotal;
+Counter httpResponsesCut;
+Counter fanEarlyStartsTotal;
+Gauge aqiForecastGauge;
+Gauge forecastMae;
+Gauge forecastRmse;
+Gauge forecastBias;
+Counter logDroppedTotal;
+Gauge mqttConnected;
+Gauge mqttQueuedSamples;
+Counter mqttDroppedTotal;
+Counter mqttMessagesTotal;
+Counter beaconsSentTotal;
+Counter syncThrottledTotal;
+
+// Per-route request counts and latency
+#define MAX_ROUTES 28
+struct RouteMetrics {
+    char labels[64];
+    HttpServer::THandlerFunction handler;
+    Counter requests;
+    Histogram latency;
+};
+RouteMetrics routeMetrics[MAX_ROUTES];
+int routeCount = 0;
+
+// Response bodies are serialized here; nothing on the request path uses the heap
+char responseBuffer[1024];
+
+// Samples go from acquisition to each consumer through its own cursor, so a
+// slow consumer only misses samples and never holds up the sensor job
+AqiSampleQueue sampleQueue;
+AqiSampleQueue::Cursor backlogSampleCursor = sampleQueue.subscribe();
+
+// Readings come at whatever rate the sensor policy picks; statistics and
+// history see them resampled onto a fixed grid so each counts for its time
+#define SAMPLE_GRID_MS 2000
+#define SAMPLE_GRID_MAX_GAP_MS 600000 // Longer than the slowest sensor interval
+Resampler sampleGrid;
+
+// Holt forecast of the AQI a few minutes out, from the resampled series;
+// auto mode starts the fan when it crosses the threshold, ahead of the AQI
+#define FORECAST_HORIZON_MS 180000
+#define FORECAST_ALPHA 0.3f
+#define FORECAST_BETA 0.02f
+#define FORECAST_WARM_UP 30 // Grid points, one minute
+HoltForecaster aqiForecaster;
+
+// Sensor job, resampling, forecast and control, as host/replay_sim runs them
+AqiPipeline pipeline(sensorPower, sampleQueue, sampleGrid, aqiForecaster, fanController);
+
+// Recent samples kept for collectors to backfill after an outage (/api/sync).
+// Syncs are answered a few blocks at a time and rate limited, so a fleet's
+// worth of collectors reconnecting at once can't monopolize loop().
+#define BACKLOG_BLOCKS 64       // ~17 KB; about 4 hours of 2 s samples, days once readings slow
+#define SYNC_MAX_BLOCKS 8       // Per response; the client asks again for more
+#define SYNC_RATE 4.0f          // Requests per second, sustained
+#define SYNC_BURST 8.0f
+SampleBacklog<BACKLOG_BLOCKS> backlog;
+float syncTokens = SYNC_BURST;
+uint32_t syncRefillMs = 0;
+
+// Rolling statistics served at /api/stats, updated per sample
+struct StatsWindow {
+    const char* name;
+    uint32_t windowMs;
+    RollingStats stats;
+    Snapshot<256> snapshot;
+};
+StatsWindow statsWindows[] = {
+    {"5m", 5UL * 60 * 1000},
+    {"1h", 60UL * 60 * 1000},
+    {"24h", 24UL * 60 * 60 * 1000},
+};
+#define STATS_WINDOW_COUNT (sizeof(statsWindows) / sizeof(statsWindows[0]))
+Snapshot<768> statsSnapshot; // All windows
+
+// State shared with other contexts. The loop task owns the globals above and
+// is the only writer: it applies queued commands and republishes this copy
+// after every change. Everything else reads the copy and queues its writes.
+struct ControlState {
+    float aqi;
+    bool fanAuto;
+    bool fanOn;
+    float threshold;
+    float hysteresis;
+    uint32_t minOnMs;
+    uint32_t minOffMs;
+    float nominalRpm;
+    SensorConfig sensor;
+};
+
+enum StateCommandType {
+    CMD_SET_FAN_AUTO,
+    CMD_SET_FAN_STATE,
+    CMD_SET_THRESHOLD,
+    CMD_SET_HYSTERESIS,
+    CMD_SET_MIN_ON_TIME,   // ms
+    CMD_SET_MIN_OFF_TIME,  // ms
+    CMD_SET_FAN_NOMINAL_RPM,
+    CMD_SET_SENSOR_CONFIG
+};
+
+// Which fields of StateCommand::sensor a CMD_SET_SENSOR_CONFIG sets; the
+// rest keep whatever value they have when the command is applied
+enum SensorConfigField {
+    SENSOR_FIELD_USE_REAL = 1,
+    SENSOR_FIELD_OFFSET = 2,
+    SENSOR_FIELD_MULTIPLIER = 4
+};
+
+struct StateCommand {
+    StateCommandType type;
+    float value;
+    SensorConfig sensor;
+    uint8_t sensorFields; // SensorConfigField bits
+    bool persist; // Also save fan mode / threshold to EEPROM
+};
+
+SeqLock<ControlState> sharedState;
+CommandQueue<StateCommand, 16> stateCommands;
+
+// MQTT publishing runs in its own task, since connecting blocks. It reads
+// samples through its own cursor and the state through sharedState; broker
+// settings reach it through mqttSettings and its counters come back through
+// mqttStatus.
+struct MqttStatus {
+    bool connected;
+    uint32_t queued;
+    uint32_t dropped;
+    uint32_t samplesSent;
+    uint32_t messagesSent;
+    uint32_t connects;
+    uint32_t connectFailures;
+};
+MqttConfig mqttConfig; // Loop task's copy, as saved in EEPROM
+SeqLock<MqttConfig> mqttSettings;
+SeqLock<MqttStatus> mqttStatus;
+AqiSampleQueue::Cursor mqttSampleCursor = sampleQueue.subscribe();
+MqttClient mqttClient;
+MqttPublisher mqttPublisher(mqttClient);
+HaDevice haDevice;
+#define MQTT_TASK_PERIOD_MS 20
+
+// Modbus TCP for building management systems, polled from loop(). Reads are
+// served from this copy, refreshed along with the state snapshot; uptime,
+// fan RPM and the fan alert are brought up to date on each read.
+#define MODBUS_PORT 502
+ModbusTcpServer modbus(MODBUS_PORT);
+uint16_t modbusRegisters[REG_COUNT];
+
+// CoAP for gateways on congested networks: a few bytes per update instead
+// of a TCP connection per poll. Also polled from loop(), so its handlers
+// read the loop task's state directly.
+#define COAP_PORT 5683
+CoapServer coap(COAP_PORT);
+
+// Multicast telemetry beacon, sent by a scheduler job whose period is the
+// configured interval
+#define BEACON_INTERVAL_DEFAULT_MS 10000
+#define BEACON_INTERVAL_MIN_MS 500
+#define BEACON_INTERVAL_MAX_MS 3600000UL
+BeaconConfig beaconConfig;
+BeaconSender beaconSender;
+BeaconPacket beaconPacket; // Identity filled in once at boot
+int beaconJobId = -1;
+
+// mDNS: this unit is advertised as _http._tcp with the _openair subtype, and
+// a task browses for the others so /fleet can show them all. The task hands
+// each result over through peerList; the loop task publishes peersSnapshot.
+#define FLEET_MAX_PEERS 24
+#define FLEET_BROWSE_PERIOD_MS 60000
+char hostName[24]; // openair-<last 3 MAC bytes>
+struct PeerList {
+    uint8_t count;
+    struct {
+        char name[24];  // As hostName
+        char host[22];  // a.b.c.d:port
+    } peers[FLEET_MAX_PEERS];
+};
+SeqLock<PeerList> peerList;
+uint32_t peerListPublished = 0; // peerList.version() in peersSnapshot
+
+// Firmware updates: PUT /api/ota streams the image into the inactive app
+// partition as it arrives and the unit reboots into it once it checks out.
+// An interrupted upload resumes from GET /api/ota's "received".
+//
+// PUT and DELETE need "Authorization: Bearer <token>". The token lives in
+// EEPROM and can only be set from configuration mode (the unit's own
+// setup access point), as "otaToken" in the POST /api/wifi body; until
+// one is set the unit refuses updates. The SHA-256 the client sends only
+// proves the image arrived intact, and app signing isn't enabled in this
+// build, so the token is what stops anyone on the LAN from flashing it.
+EspOtaTarget otaTarget;
+OtaConfig otaConfig;
+OtaUpdate ota(otaTarget);
+OtaResult otaRequestResult = OTA_OK; // Of the upload request being served
+
+// Read endpoints are served from snapshots republished when the state changes
+Snapshot<384> stateSnapshot;
+Snapshot<512> historySnapshot;
+Snapshot<160> sensorConfigSnapshot;
+Snapshot<160> summarySnapshot;
+Snapshot<1536> peersSnapshot;
+bool stateChanged = false;
+float snapshotFanRpm = 0;
+#define SNAPSHOT_RPM_STEP 20 // Smaller RPM changes don't republish
+#define LONG_POLL_MAX_MS 30000  // Cap on /api/aqi?wait=, below common proxy timeouts
+
 // Function declarations
 void checkResetButton();
 void checkBootButton();
 void loadWiFiConfig();
 void loadSensorConfig();
+void loadSensorRuntime();
+void setupForecast();
+void handleGetForecast();
+void saveSensorRuntime();
+void setupSensorPower();
+void handleGetSensor();
 void startConfigMode();
 void setupWebServer();
-void updateAQIFromSensor();
-void updateAQISimulation();
+float readAQIFromSensor();
+float simulateAQI();
+void consumeSamples();
+void addGridPoint(uint32_t timeMs, float aqi);
 void handleGetAQI();
+void completeLongPoll(uint32_t since, bool timedOut);
 void handleGetHistory();
+void handleSync();
 void handleFanControl();
 void handleSettings();
 void handleWiFiConfig();
 void handleSensorConfig();
 void handleNotFound();
+void sendBusy();
 void handleRoot();
 void handleGetSensorConfig();
+void handleGetStats();
+void setupStats();
+void publishStatsSnapshots(uint32_t nowMs);
+void configureFanController();
+void setFanState(bool on);
+void configureFanTach();
+void updateFanTach();
+void setupScheduler();
+void sensorJob();
+void controlJob();
+void displayJob();
+void handleGetScheduler();
+void handleGetLogs();
+void setupMetrics();
+void handleMetrics();
+void onRoute(const char* uri, HTTPMethod method, HttpServer::THandlerFunction handler);
+void onRoute(const char* uri, HTTPMethod method, HttpServer::THandlerFunction handler, HttpServer::TBodyFunction body);
+const char* methodName(HTTPMethod method);
+HttpServer::THandlerFunction instrumentRoute(const char* route, const char* method, HttpServer::THandlerFunction handler);
+void commitEEPROM();
+template<typename TDocument> void sendJson(int code, const TDocument& doc);
+template<size_t N> void sendSnapshot(const Snapshot<N>& snapshot);
+void markStateChanged();
+void publishSharedState();
+bool queueStateCommand(StateCommandType type, float value, bool persist = false);
+void applyStateCommands();
+void applyStateCommand(const StateCommand& command);
+void publishStateSnapshot();
+void publishHistorySnapshot();
+void publishSensorConfigSnapshot(const SensorConfig& config);
+void handleGetTrace();
+void loadMqttConfig();
+void startMqtt();
+void mqttTask(void*);
+void handleGetMqtt();
+void handleMqttConfig();
+bool queueFanControl(bool autoMode, bool setState, bool state);
+void announceMqttEntities();
+bool settingValid(StateCommandType type, float value);
+void setupModbus();
+void publishModbusRegisters();
+uint8_t readModbusRegisters(bool input, uint16_t address, uint16_t count, uint16_t* values);
+uint8_t writeModbusRegisters(uint16_t address, uint16_t count, const uint16_t* values);
+void setupCoap();
+uint8_t handleCoapAqi(uint8_t method, const uint8_t* payload, size_t length, uint8_t* out, size_t& outLength);
+uint8_t handleCoapHistory(uint8_t method, const uint8_t* payload, size_t length, uint8_t* out, size_t& outLength);
+uint8_t handleCoapSettings(uint8_t method, const uint8_t* payload, size_t length, uint8_t* out, size_t& outLength);
+void handleMqttCommand(const char* topic, const uint8_t* payload, size_t length);
+void loadBeaconConfig();
+void setupBeacon();
+void sendBeacon();
+void handleGetBeacon();
+void handleBeaconConfig();
+void setupMdns();
+void mdnsTask(void*);
+void publishPeersSnapshot();
+void publishSummarySnapshot();
+void handleGetSummary();
+void handleGetPeers();
+void handleFleet();
+OtaResult startOtaUpload();
+bool receiveOtaPiece(const uint8_t* data, size_t length);
+void handleOtaUpload();
+void handleGetOta();
+void handleOtaAbort();
+void loadOtaConfig();
+void sendOtaStatus(int code, OtaResult result);
 
 // Rotary encoder functions
 void initRotaryEncoder();
@@ -464,7 +837,7 @@ const char* INDEX_HTML = R"rawliteral(
     <div class="container">
         <div class="header">
             <h1>OpenFilter</h1>
-            <p>Air Quality Monitoring System</p>
+            <p>Air Quality Monitoring System · <a href="/fleet" style="color: var(--accent);">All rooms</a></p>
         </div>
         
         <div class="status-bar">
@@ -638,11 +1011,8 @@ const char* INDEX_HTML = R"rawliteral(
             aqiChart = new Chart(ctx, {
                 type: 'line',
                 data: {
-                    labels: Array.from({length: 24}, (_, i) => {
-                        const hour = i === 0 ? 12 : i > 12 ? i - 12 : i;
-                        const period = i < 12 ? 'AM' : 'PM';
-                        return `${hour}${period}`;
-                    }),
+                    // Hourly means, newest first
+                    labels: Array.from({length: 24}, (_, i) => i === 0 ? 'now' : `-${i}h`),
                     datasets: [{
                         label: 'AQI',
                         data: [],
@@ -777,6 +1147,12 @@ const char* INDEX_HTML = R"rawliteral(
                 
                 document.getElementById('fanStatus').textContent = data.fanState ? 'ON' : 'OFF';
                 document.getElementById('fanStatus').className = 'status-value ' + (data.fanState ? 'fan-on' : 'fan-off');
+                document.getElementById('fanStatus').title = Math.round(data.fanRpm) + ' RPM';
+                if (data.fanAlert) {
+                    document.getElementById('fanStatus').textContent = 'CHECK';
+                    document.getElementById('fanStatus').className = 'status-value aqi-very-poor';
+                    document.getElementById('fanStatus').title = 'Fan alert: ' + data.fanAlertReason;
+                }
                 document.getElementById('autoStatus').textContent = data.fanAuto ? 'AUTO' : 'MANUAL';
                 document.getElementById('autoStatus').className = 'status-value ' + (data.fanAuto ? 'mode-auto' : 'mode-manual');
                 document.getElementById('thresholdValue').textContent = data.threshold;
@@ -978,31 +1354,207 @@ const char* INDEX_HTML = R"rawliteral(
 </html>
 )rawliteral";
 
+// Fleet view: every OpenFilter this unit has found over mDNS, one tile each.
+// Tiles are refreshed from each unit's /api/summary with a bounded number of
+// requests in flight, so a large fleet doesn't flood the browser or the LAN.
+const char* FLEET_HTML = R"rawliteral(
+<!DOCTYPE html>
+<html lang="en">
+<head>
+    <meta charset="UTF-8">
+    <meta name="viewport" content="width=device-width, initial-scale=1.0">
+    <title>OpenFilter Fleet</title>
+    <style>
+        :root {
+            --primary: #1d1d1f;
+            --card-bg: rgba(28, 28, 30, 0.8);
+            --text-primary: #ffffff;
+            --text-secondary: #98989d;
+            --accent: #0a84ff;
+            --success: #30d158;
+            --warning: #ff9f0a;
+            --danger: #ff453a;
+        }
+        
+        * {
+            margin: 0;
+            padding: 0;
+            box-sizing: border-box;
+        }
+        
+        body {
+            font-family: -apple-system, BlinkMacSystemFont, 'Segoe UI', Roboto, sans-serif;
+            background: var(--primary);
+            color: var(--text-primary);
+            min-height: 100vh;
+            padding: 20px;
+        }
+        
+        .header {
+            display: flex;
+            justify-content: space-between;
+            align-items: baseline;
+            max-width: 1200px;
+            margin: 0 auto 20px;
+        }
+        
+        .header h1 { font-size: 1.6rem; font-weight: 600; }
+        .header span { color: var(--text-secondary); font-size: 0.9rem; }
+        a { color: var(--accent); text-decoration: none; }
+        
+        .grid {
+            display: grid;
+            grid-template-columns: repeat(auto-fill, minmax(180px, 1fr));
+            gap: 12px;
+            max-width: 1200px;
+            margin: 0 auto;
+        }
+        
+        .tile {
+            background: var(--card-bg);
+            border-radius: 14px;
+            padding: 16px;
+            border-top: 4px solid var(--text-secondary);
+        }
+        
+        .tile.offline { opacity: 0.5; }
+        .tile .name { font-weight: 600; margin-bottom: 8px; }
+        .tile .aqi { font-size: 2.2rem; font-weight: 700; }
+        .tile .detail { color: var(--text-secondary); font-size: 0.85rem; margin-top: 6px; }
+        .good { border-top-color: var(--success); }
+        .moderate { border-top-color: var(--warning); }
+        .poor { border-top-color: var(--danger); }
+        .alert { color: var(--danger); }
+    </style>
+</head>
+<body>
+    <div class="header">
+        <h1>OpenFilter Fleet</h1>
+        <span id="summary">Discovering...</span>
+    </div>
+    <div class="grid" id="grid"></div>
+    
+    <script>
+        const MAX_IN_FLIGHT = 4;       // Concurrent /api/summary requests
+        const REQUEST_TIMEOUT_MS = 3000;
+        const POLL_INTERVAL_MS = 5000; // Pause between sweeps of the fleet
+        const PEERS_INTERVAL_MS = 60000;
+        
+        let hosts = [location.host];
+        const tiles = new Map();
+        
+        function tileFor(host) {
+            if (!tiles.has(host)) {
+                const tile = document.createElement('a');
+                tile.className = 'tile offline';
+                tile.href = 'http://' + host + '/';
+                tile.innerHTML = '<div class="name"></div><div class="aqi">--</div><div class="detail">Waiting...</div>';
+                tile.querySelector('.name').textContent = host;
+                document.getElementById('grid').appendChild(tile);
+                tiles.set(host, tile);
+            }
+            return tiles.get(host);
+        }
+        
+        function aqiClass(aqi) {
+            if (aqi <= 50) return 'good';
+            if (aqi <= 100) return 'moderate';
+            return 'poor';
+        }
+        
+        async function fetchPeers() {
+            try {
+                const response = await fetch('/api/peers');
+                if (!response.ok) throw new Error('Network response was not ok');
+                const data = await response.json();
+                hosts = [location.host, ...data.peers.map(peer => peer.host).filter(host => host !== location.host)];
+                hosts.forEach(tileFor);
+            } catch (error) {
+                console.error('Error fetching peers:', error);
+            }
+        }
+        
+        async function fetchSummary(host) {
+            const tile = tileFor(host);
+            const controller = new AbortController();
+            const timer = setTimeout(() => controller.abort(), REQUEST_TIMEOUT_MS);
+            try {
+                // no-cache revalidates with the ETag, so an unchanged unit answers 304
+                const response = await fetch('http://' + host + '/api/summary', { signal: controller.signal, cache: 'no-cache' });
+                if (!response.ok) throw new Error('HTTP ' + response.status);
+                const data = await response.json();
+                tile.className = 'tile ' + aqiClass(data.aqi);
+                tile.querySelector('.name').textContent = data.name;
+                tile.querySelector('.aqi').textContent = Math.round(data.aqi);
+                const detail = tile.querySelector('.detail');
+                detail.textContent = 'Fan ' + (data.fan ? 'ON' : 'OFF') + (data.auto ? ' (auto)' : ' (manual)') + ' · threshold ' + data.threshold;
+                detail.classList.toggle('alert', data.alert);
+                if (data.alert) detail.textContent += ' · check fan';
+                return true;
+            } catch (error) {
+                tile.className = 'tile offline';
+                tile.querySelector('.detail').textContent = 'Unreachable';
+                return false;
+            } finally {
+                clearTimeout(timer);
+            }
+        }
+        
+        // Workers take hosts off a shared queue, so at most MAX_IN_FLIGHT
+        // requests are outstanding however many units there are
+        async function sweep() {
+            const queue = hosts.slice();
+            let online = 0;
+            const worker = async () => {
+                while (queue.length > 0) {
+                    if (await fetchSummary(queue.shift())) online++;
+                }
+            };
+            await Promise.all(Array.from({ length: Math.min(MAX_IN_FLIGHT, queue.length) }, worker));
+            document.getElementById('summary').textContent = online + ' of ' + hosts.length + ' online · ' + new Date().toLocaleTimeString();
+        }
+        
+        // A sweep starts only after the previous one finished
+        async function run() {
+            await sweep();
+            setTimeout(run, POLL_INTERVAL_MS);
+        }
+        
+        fetchPeers().then(run);
+        setInterval(fetchPeers, PEERS_INTERVAL_MS);
+    </script>
+</body>
+</html>
+)rawliteral";
+
 void setup() {
     Serial.begin(115200);
+    logStartTask();
     
     // Initialize pins
     pinMode(BOOT_BUTTON, INPUT_PULLUP);
     pinMode(FAN_PIN, OUTPUT);
     digitalWrite(FAN_PIN, LOW);
+    pinMode(SENSOR_SET_PIN, OUTPUT);
+    digitalWrite(SENSOR_SET_PIN, LOW);
     
     // Initialize EEPROM
     EEPROM.begin(EEPROM_SIZE);
     
     // Initialize OLED display with better error handling
-    Serial.println("Initializing OLED display...");
+    LOG_INFO("Initializing OLED display...");
     
     // Try different I2C addresses - common ones are 0x3C and 0x3D
     if(!display.begin(SSD1306_SWITCHCAPVCC, 0x3C)) {
-        Serial.println("SSD1306 allocation failed at address 0x3C, trying 0x3D...");
+        LOG_WARN("SSD1306 allocation failed at address 0x3C, trying 0x3D...");
         if(!display.begin(SSD1306_SWITCHCAPVCC, 0x3D)) {
-            Serial.println(F("SSD1306 allocation failed! Check wiring."));
+            LOG_ERROR("SSD1306 allocation failed! Check wiring.");
             // Don't return - continue without display
         } else {
-            Serial.println("OLED found at address 0x3D");
+            LOG_INFO("OLED found at address 0x3D");
         }
     } else {
-        Serial.println("OLED found at address 0x3C");
+        LOG_INFO("OLED found at address 0x3C");
     }
     
     // Clear and setup display
@@ -1018,71 +1570,254 @@ void setup() {
     // Initialize rotary encoder
     initRotaryEncoder();
     
-    // Initialize AQI history
-    for(int i = 0; i < 24; i++) {
-        aqiHistory[i] = 50.0 + random(-10, 10);
+    // Initialize fan controller and tachometer
+    configureFanController();
+    configureFanTach();
+    if(!tachCounter.begin()) {
+        LOG_ERROR("Fan tachometer (PCNT) init failed");
+    }
+    
+    // Sequence numbers and snapshot versions restart each boot; the boot id
+    // tells collectors and HTTP caches so
+    uint32_t bootId = esp_random();
+    backlog.begin(bootId);
+    statsSnapshot.begin(bootId);
+    for(size_t i = 0; i < STATS_WINDOW_COUNT; i++) {
+        statsWindows[i].snapshot.begin(bootId);
     }
+    stateSnapshot.begin(bootId);
+    historySnapshot.begin(bootId);
+    sensorConfigSnapshot.begin(bootId);
+    summarySnapshot.begin(bootId);
+    peersSnapshot.begin(bootId);
+    
+    sampleGrid.configure(SAMPLE_GRID_MS, SAMPLE_GRID_MAX_GAP_MS);
+    setupForecast();
     
     // Load configurations
     loadWiFiConfig();
     loadSensorConfig();
+    loadMqttConfig();
+    loadBeaconConfig();
+    loadSensorRuntime();
+    loadOtaConfig();
     
     // Check for reset button press
     checkResetButton();
     
-    // Setup web server routes
+    // Setup metrics, snapshots and web server routes
+    setupMetrics();
+    publishSharedState();
+    publishStateSnapshot();
+    publishModbusRegisters();
+    publishHistorySnapshot();
+    publishSensorConfigSnapshot(sensorConfig);
+    setupStats();
     setupWebServer();
+    setupModbus();
+    setupCoap();
+    setupBeacon();
+    setupMdns();
+    startMqtt();
     
-    Serial.println("OpenFilter System Started");
+    LOG_INFO("OpenFilter System Started");
     
     // Show initial display
     updateDisplay();
+    
+    // Start periodic sensing, control and display jobs
+    setupSensorPower();
+    setupScheduler();
+    
+    // Getting this far means an updated image works; keep it (does nothing
+    // unless the bootloader has rollback enabled)
+    esp_ota_mark_app_valid_cancel_rollback();
 }
 
 void loop() {
-    server.handleClient();
+    TRACE_SCOPE("loop");
+    uint32_t loopStart = micros();
+    
+    {
+        TRACE_SCOPE("handleClient");
+        server.handleClient();
+    }
+    handleClientDuration.observe(micros() - loopStart);
+    {
+        TRACE_SCOPE("modbus");
+        modbus.poll();
+    }
+    {
+        TRACE_SCOPE("coap");
+        coap.poll();
+    }
+    
+    // Apply settings and fan commands queued by handlers
+    applyStateCommands();
     
     // Check boot button for reset
     checkBootButton();
     
     // Read rotary encoder
-    readRotaryEncoder();
-    handleEncoderButton();
+    {
+        TRACE_SCOPE("encoder");
+        readRotaryEncoder();
+        handleEncoderButton();
+    }
     
-    // Update AQI data every 2 seconds
-    if(millis() - lastAQIUpdate > 2000) {
-        if(sensorConfig.useRealSensor) {
-            updateAQIFromSensor();
-        } else {
-            updateAQISimulation();
-        }
-        lastAQIUpdate = millis();
-        updateDisplay();
-        
-        // Debug output
-        Serial.print("AQI: ");
-        Serial.print(currentAQI);
-        Serial.print(" | Threshold: ");
-        Serial.print(fanThreshold);
-        Serial.print(" | Fan Auto: ");
-        Serial.print(fanAutoMode);
-        Serial.print(" | Fan State: ");
-        Serial.println(digitalRead(FAN_PIN) ? "ON" : "OFF");
+    // Run sensing, control and display jobs released by the timer
+    scheduler.runPending();
+    consumeSamples();
+    
+    if(peerList.version() != peerListPublished) {
+        publishPeersSnapshot();
+    }
+    
+    if(stateChanged) {
+        publishSharedState();
+        publishStateSnapshot();
+        publishModbusRegisters();
+        coap.notify("aqi");
+        coap.notify("settings");
+    }
+    
+    loopDuration.observe(micros() - loopStart);
+}
+
+void setupScheduler() {
+    // Offsets stagger the jobs so they are not all released together
+    scheduler.addJob("sensor", SENSOR_TICK_MS, sensorJob);
+    scheduler.addJob("control", CONTROL_PERIOD_MS, controlJob, 50);
+    scheduler.addJob("tach", TACH_PERIOD_MS, updateFanTach, 100);
+    scheduler.addJob("display", DISPLAY_PERIOD_MS, displayJob, 150);
+    beaconJobId = scheduler.addJob("beacon", beaconConfig.intervalMs, sendBeacon, 200);
+    scheduler.start();
+}
+
+void sensorJob() {
+    TRACE_SCOPE("sensor");
+    uint32_t now = millis();
+    // The simulated room keeps evolving whether or not the sensor looks
+    float simulated = simulateAQI();
+    bool read = pipeline.sense(now, digitalRead(FAN_PIN), fanAutoMode, [simulated]() {
+        return sensorConfig.useRealSensor ? readAQIFromSensor() : simulated;
+    });
+    digitalWrite(SENSOR_SET_PIN, sensorPower.powered() ? HIGH : LOW);
+    if(!read) {
+        return;
+    }
+    
+    if(sensorPower.runtimeMs(now) / 1000 >= sensorRuntime.seconds + SENSOR_RUNTIME_SAVE_MS / 1000) {
+        saveSensorRuntime();
+    }
+    
+    LOG_DEBUG("AQI: %.1f | Threshold: %.1f | Fan Auto: %d | Fan State: %s | Next reading in %lu s",
+              pipeline.aqi(), fanThreshold, fanAutoMode, digitalRead(FAN_PIN) ? "ON" : "OFF",
+              (unsigned long)(sensorPower.intervalMs() / 1000));
+}
+
+void setupSensorPower() {
+    SensorPowerConfig config;
+    config.warmUpMs = SENSOR_WARM_UP_MS;
+    config.minIntervalMs = SENSOR_MIN_INTERVAL_MS;
+    config.maxIntervalMs = SENSOR_MAX_INTERVAL_MS;
+    config.watchIntervalMs = SENSOR_WATCH_INTERVAL_MS;
+    config.minSleepMs = SENSOR_MIN_SLEEP_MS;
+    config.changeAqi = SENSOR_CHANGE_AQI;
+    config.smoothingMs = SENSOR_SMOOTHING_MS;
+    sensorPower.configure(config);
+    sensorPower.restoreRuntime((uint64_t)sensorRuntime.seconds * 1000);
+    sensorPower.begin(millis());
+    digitalWrite(SENSOR_SET_PIN, HIGH);
+}
+
+void consumeSamples() {
+    if(pipeline.consume(addGridPoint)) {
+        currentAQI = pipeline.aqi();
+        currentAQITimeMs = pipeline.aqiTimeMs();
+        markStateChanged();
+        publishHistorySnapshot();
+        coap.notify("history");
+        publishStatsSnapshots(millis());
     }
     
+    AqiSample sample;
+    uint32_t missed = backlogSampleCursor.missed;
+    while(sampleQueue.read(backlogSampleCursor, sample)) {
+        uint8_t flags = (sample.fanOn ? BACKLOG_FAN_ON : 0) | (sample.fanAuto ? BACKLOG_AUTO : 0);
+        if(backlogSampleCursor.missed != missed) {
+            flags |= BACKLOG_GAP;
+            missed = backlogSampleCursor.missed;
+        }
+        backlog.add(sample.timeMs, (int32_t)lroundf(sample.aqi * 10), flags);
+    }
+}
+
+// The pipeline has given a grid point to the forecast and the history
+void addGridPoint(uint32_t timeMs, float aqi) {
+    for(size_t i = 0; i < STATS_WINDOW_COUNT; i++) {
+        statsWindows[i].stats.add(aqi, timeMs);
+    }
+}
+
+void displayJob() {
+    updateDisplay();
+}
+
+void controlJob() {
+    TRACE_SCOPE("control");
     // Auto control fan with debugging
     if(fanAutoMode) {
-        bool shouldTurnOn = currentAQI > fanThreshold;
+        bool shouldTurnOn = pipeline.control(millis());
         bool currentState = digitalRead(FAN_PIN);
         
         if(shouldTurnOn != currentState) {
             digitalWrite(FAN_PIN, shouldTurnOn ? HIGH : LOW);
-            Serial.print("Auto fan control: ");
-            Serial.println(shouldTurnOn ? "TURNING ON" : "TURNING OFF");
+            markStateChanged();
+            LOG_INFO("Auto fan control: %s | AQI %.1f, forecast %.1f | Relay cycles: %lu",
+                     shouldTurnOn ? "TURNING ON" : "TURNING OFF", currentAQI, aqiForecaster.forecast(),
+                     (unsigned long)fanController.cycleCount());
         }
     }
 }
 
+void configureFanController() {
+    FanControlConfig config;
+    config.onThreshold = fanThreshold;
+    config.offThreshold = fanThreshold - fanHysteresis;
+    config.minOnMs = fanMinOnTime;
+    config.minOffMs = fanMinOffTime;
+    pipeline.configureControl(config, SENSOR_WATCH_AQI);
+}
+
+void configureFanTach() {
+    FanTachConfig config = fanTach.config();
+    config.nominalRpm = fanNominalRpm;
+    fanTach.configure(config);
+}
+
+void updateFanTach() {
+    TRACE_SCOPE("tach");
+    TachAlert previous = fanTach.alert();
+    float duty = digitalRead(FAN_PIN) ? 1.0f : 0.0f;
+    fanTach.update(tachCounter.pulses(), duty, millis());
+    
+    if(fanTach.alert() != previous) {
+        LOG_WARN("Fan tach alert: %s | RPM: %.0f", FanTach::alertName(fanTach.alert()), fanTach.rpm());
+        markStateChanged();
+    }
+    if(fabsf(fanTach.rpm() - snapshotFanRpm) >= SNAPSHOT_RPM_STEP) {
+        markStateChanged();
+    }
+}
+
+void setFanState(bool on) {
+    // Manual control goes through the controller so relay cycles are counted
+    fanController.force(on, millis());
+    digitalWrite(FAN_PIN, on ? HIGH : LOW);
+    markStateChanged();
+}
+
 void initRotaryEncoder() {
     pinMode(ROTARY_CLK, INPUT_PULLUP);
     pinMode(ROTARY_DT, INPUT_PULLUP);
@@ -1116,19 +1851,17 @@ void handleEncoderButton() {
                     break;
                 case 1: // Settings menu
                     if (menuItem == 0) {
-                        fanAutoMode = !fanAutoMode;
-                        EEPROM.put(100, fanAutoMode);
-                        EEPROM.commit();
+                        queueStateCommand(CMD_SET_FAN_AUTO, !fanAutoMode, true);
                     } else if (menuItem == 1) {
                         // Fix: Use proper min/max with same data types
                         float newThreshold = fanThreshold + (encoderValue > 0 ? 10.0f : -10.0f);
                         if (newThreshold < 0) newThreshold = 0;
                         if (newThreshold > 500) newThreshold = 500;
-                        fanThreshold = newThreshold;
-                        EEPROM.put(104, fanThreshold);
-                        EEPROM.commit();
+                        queueStateCommand(CMD_SET_THRESHOLD, newThreshold, true);
                         encoderValue = 0;
                     }
+                    // Same task as the writer, so apply before redrawing
+                    applyStateCommands();
                     break;
                 case 2: // WiFi config
                     // Implement WiFi config navigation
@@ -1142,6 +1875,9 @@ void handleEncoderButton() {
 }
 
 void updateDisplay() {
+    TRACE_SCOPE("display");
+    uint32_t start = micros();
+    
     // Clear the display
     display.clearDisplay();
     display.setTextSize(1);
@@ -1166,7 +1902,13 @@ void updateDisplay() {
             display.setTextSize(1);
             display.println();
             display.print("Fan: ");
-            display.println(digitalRead(FAN_PIN) ? "ON " : "OFF");
+            display.print(digitalRead(FAN_PIN) ? "ON  " : "OFF ");
+            if(fanTach.hasAlert()) {
+                display.println("CHECK FAN!");
+            } else {
+                display.print((int)fanTach.rpm());
+                display.println("rpm");
+            }
             display.print("Mode: ");
             display.println(fanAutoMode ? "AUTO" : "MANUAL");
             display.print("Thresh: ");
@@ -1207,10 +1949,11 @@ void updateDisplay() {
     
     // Update the display
     display.display();
+    displayDuration.observe(micros() - start);
 }
 
 void scanI2C() {
-    Serial.println("Scanning I2C bus...");
+    LOG_INFO("Scanning I2C bus...");
     byte error, address;
     int nDevices = 0;
     
@@ -1219,28 +1962,32 @@ void scanI2C() {
         error = Wire.endTransmission();
         
         if (error == 0) {
-            Serial.print("I2C device found at address 0x");
-            if (address < 16) Serial.print("0");
-            Serial.print(address, HEX);
-            Serial.println(" !");
+            LOG_INFO("I2C device found at address 0x%02X !", address);
             nDevices++;
         }
     }
     
     if (nDevices == 0) {
-        Serial.println("No I2C devices found. Check wiring!");
+        LOG_WARN("No I2C devices found. Check wiring!");
     } else {
-        Serial.println("I2C scan complete.");
+        LOG_INFO("I2C scan complete.");
     }
 }
 
+void commitEEPROM() {
+    TRACE_SCOPE("eepromCommit");
+    uint32_t start = micros();
+    EEPROM.commit();
+    eepromCommitDuration.observe(micros() - start);
+}
+
 void checkResetButton() {
     // Check if reset flag is set
     bool resetFlag;
     EEPROM.get(RESET_FLAG_ADDR, resetFlag);
     if(resetFlag) {
         EEPROM.put(RESET_FLAG_ADDR, false);
-        EEPROM.commit();
+        commitEEPROM();
         startConfigMode();
     }
 }
@@ -1254,8 +2001,8 @@ void checkBootButton() {
             // Button held for 5 seconds - enter config mode
             // Set reset flag and reboot
             EEPROM.put(RESET_FLAG_ADDR, true);
-            EEPROM.commit();
-            Serial.println("Reset flag set, rebooting...");
+            commitEEPROM();
+            LOG_WARN("Reset flag set, rebooting...");
             delay(1000);
             ESP.restart();
         }
@@ -1269,30 +2016,27 @@ void loadWiFiConfig() {
     
     // Check if configuration is valid
     if(wifiConfig.ssid[0] == '\0' || strlen(wifiConfig.ssid) == 0) {
-        Serial.println("No WiFi config found, starting config mode");
+        LOG_WARN("No WiFi config found, starting config mode");
         startConfigMode();
         return;
     }
     
-    Serial.print("Connecting to WiFi: ");
-    Serial.println(wifiConfig.ssid);
+    LOG_INFO("Connecting to WiFi: %s", wifiConfig.ssid);
     
     WiFi.begin(wifiConfig.ssid, wifiConfig.password);
     
     int attempts = 0;
     while(WiFi.status() != WL_CONNECTED && attempts < 20) {
         delay(1000);
-        Serial.print(".");
         attempts++;
+        LOG_DEBUG("Waiting for WiFi (%d)", attempts);
     }
     
     if(WiFi.status() == WL_CONNECTED) {
-        Serial.println("\nConnected to WiFi!");
-        Serial.print("IP Address: ");
-        Serial.println(WiFi.localIP());
+        LOG_INFO("Connected to WiFi! IP Address: %s", WiFi.localIP().toString().c_str());
         isConfigMode = false;
     } else {
-        Serial.println("\nFailed to connect to WiFi, starting config mode");
+        LOG_WARN("Failed to connect to WiFi, starting config mode");
         startConfigMode();
     }
 }
@@ -1306,25 +2050,36 @@ void loadSensorConfig() {
         sensorConfig.calibrationOffset = 0.0;
         sensorConfig.calibrationMultiplier = 1.0;
         EEPROM.put(SENSOR_CONFIG_ADDR, sensorConfig);
-        EEPROM.commit();
+        commitEEPROM();
     }
     
-    Serial.print("Sensor config - Real sensor: ");
-    Serial.print(sensorConfig.useRealSensor);
-    Serial.print(", Offset: ");
-    Serial.print(sensorConfig.calibrationOffset);
-    Serial.print(", Multiplier: ");
-    Serial.println(sensorConfig.calibrationMultiplier);
+    LOG_INFO("Sensor config - Real sensor: %d, Offset: %.2f, Multiplier: %.2f",
+             sensorConfig.useRealSensor, sensorConfig.calibrationOffset,
+             sensorConfig.calibrationMultiplier);
+}
+
+void loadSensorRuntime() {
+    EEPROM.get(SENSOR_RUNTIME_ADDR, sensorRuntime);
+    if(sensorRuntime.magic != SENSOR_RUNTIME_MAGIC) {
+        sensorRuntime.magic = SENSOR_RUNTIME_MAGIC;
+        sensorRuntime.seconds = 0;
+    }
+    LOG_INFO("PM sensor runtime: %.1f h", sensorRuntime.seconds / 3600.0f);
+}
+
+void saveSensorRuntime() {
+    sensorRuntime.seconds = sensorPower.runtimeMs(millis()) / 1000;
+    EEPROM.put(SENSOR_RUNTIME_ADDR, sensorRuntime);
+    commitEEPROM();
 }
 
 void startConfigMode() {
-    Serial.println("Starting Configuration Mode");
+    LOG_INFO("Starting Configuration Mode");
     
     WiFi.mode(WIFI_AP);
     WiFi.softAP(DEFAULT_SSID, DEFAULT_PASSWORD);
     
-    Serial.print("AP IP address: ");
-    Serial.println(WiFi.softAPIP());
+    LOG_INFO("AP IP address: %s", WiFi.softAPIP().toString().c_str());
     
     isConfigMode = true;
 }
@@ -1333,96 +2088,656 @@ void handleRoot() {
     server.send(200, "text/html", INDEX_HTML);
 }
 
+void handleFleet() {
+    server.send(200, "text/html", FLEET_HTML);
+}
+
 void setupWebServer() {
     // Serve main page
-    server.on("/", HTTP_GET, handleRoot);
+    onRoute("/", HTTP_GET, handleRoot);
+    onRoute("/fleet", HTTP_GET, handleFleet);
     
     // API endpoints
-    server.on("/api/aqi", HTTP_GET, handleGetAQI);
-    server.on("/api/history", HTTP_GET, handleGetHistory);
-    server.on("/api/fan", HTTP_POST, handleFanControl);
-    server.on("/api/settings", HTTP_POST, handleSettings);
-    server.on("/api/wifi", HTTP_POST, handleWiFiConfig);
-    server.on("/api/sensor-config", HTTP_GET, handleGetSensorConfig);
-    server.on("/api/sensor-config", HTTP_POST, handleSensorConfig);
+    onRoute("/api/aqi", HTTP_GET, handleGetAQI);
+    onRoute("/api/history", HTTP_GET, handleGetHistory);
+    onRoute("/api/sync", HTTP_GET, handleSync);
+    onRoute("/api/stats", HTTP_GET, handleGetStats);
+    onRoute("/api/forecast", HTTP_GET, handleGetForecast);
+    onRoute("/api/fan", HTTP_POST, handleFanControl);
+    onRoute("/api/settings", HTTP_POST, handleSettings);
+    onRoute("/api/wifi", HTTP_POST, handleWiFiConfig);
+    onRoute("/api/sensor", HTTP_GET, handleGetSensor);
+    onRoute("/api/sensor-config", HTTP_GET, handleGetSensorConfig);
+    onRoute("/api/sensor-config", HTTP_POST, handleSensorConfig);
+    onRoute("/api/scheduler", HTTP_GET, handleGetScheduler);
+    onRoute("/api/mqtt", HTTP_GET, handleGetMqtt);
+    onRoute("/api/mqtt", HTTP_POST, handleMqttConfig);
+    onRoute("/api/beacon", HTTP_GET, handleGetBeacon);
+    onRoute("/api/beacon", HTTP_POST, handleBeaconConfig);
+    onRoute("/api/summary", HTTP_GET, handleGetSummary);
+    onRoute("/api/peers", HTTP_GET, handleGetPeers);
+    onRoute("/api/ota", HTTP_GET, handleGetOta);
+    onRoute("/api/ota", HTTP_PUT, handleOtaUpload, receiveOtaPiece);
+    onRoute("/api/ota", HTTP_DELETE, handleOtaAbort);
+#if LOG_TAIL_LINES > 0
+    onRoute("/api/logs", HTTP_GET, handleGetLogs);
+#endif
+    onRoute("/metrics", HTTP_GET, handleMetrics);
+#ifdef OPENAIR_TRACE
+    onRoute("/api/trace", HTTP_GET, handleGetTrace);
+#endif
     
     // Handle not found routes
-    server.onNotFound(handleNotFound);
+    server.onNotFound(instrumentRoute("other", "ANY", handleNotFound));
+    server.onDeferred(completeLongPoll);
     
-    server.begin();
-    Serial.println("HTTP server started");
+    if(server.begin()) {
+        LOG_INFO("HTTP server started");
+    } else {
+        LOG_ERROR("HTTP server failed to start");
+    }
 }
 
-void handleGetAQI() {
-    StaticJsonDocument<300> doc;
-    doc["aqi"] = currentAQI;
-    doc["fanAuto"] = fanAutoMode;
-    doc["fanState"] = digitalRead(FAN_PIN);
-    doc["threshold"] = fanThreshold;
-    doc["useRealSensor"] = sensorConfig.useRealSensor;
+void onRoute(const char* uri, HTTPMethod method, HttpServer::THandlerFunction handler) {
+    server.on(uri, method, instrumentRoute(uri, methodName(method), handler));
+}
+
+// Route whose request body is streamed through body() as it arrives
+void onRoute(const char* uri, HTTPMethod method, HttpServer::THandlerFunction handler, HttpServer::TBodyFunction body) {
+    server.on(uri, method, instrumentRoute(uri, methodName(method), handler), body);
+}
+
+const char* methodName(HTTPMethod method) {
+    switch(method) {
+        case HTTP_GET: return "GET";
+        case HTTP_POST: return "POST";
+        case HTTP_PUT: return "PUT";
+        case HTTP_DELETE: return "DELETE";
+        default: return "ANY";
+    }
+}
+
+HttpServer::THandlerFunction instrumentRoute(const char* route, const char* method, HttpServer::THandlerFunction handler) {
+    if(routeCount >= MAX_ROUTES) {
+        return handler;
+    }
+    
+    RouteMetrics* metricsSlot = &routeMetrics[routeCount++];
+    snprintf(metricsSlot->labels, sizeof(metricsSlot->labels), "route=\"%s\",method=\"%s\"", route, method);
+    metricsSlot->handler = handler;
+    metrics.add("openair_http_requests_total", "HTTP requests served", &metricsSlot->requests, metricsSlot->labels);
+    metrics.add("openair_http_request_duration_seconds", "Time spent in the request handler", &metricsSlot->latency, metricsSlot->labels);
     
-    String response;
-    serializeJson(doc, response);
-    server.send(200, "application/json", response);
+    return [metricsSlot, route]() {
+#ifdef OPENAIR_TRACE
+        TraceScope trace(route);
+#endif
+        uint32_t start = micros();
+        metricsSlot->handler();
+        metricsSlot->latency.observe(micros() - start);
+        metricsSlot->requests.inc();
+    };
 }
 
-void handleGetHistory() {
+void setupMetrics() {
+    metrics.add("openair_loop_duration_seconds", "Duration of one loop() iteration", &loopDuration);
+    metrics.add("openair_handle_client_duration_seconds", "Time spent in server.handleClient()", &handleClientDuration);
+    metrics.add("openair_display_update_duration_seconds", "Time spent redrawing the OLED", &displayDuration);
+    metrics.add("openair_eeprom_commit_duration_seconds", "Time spent committing EEPROM to flash", &eepromCommitDuration);
+    metrics.add("openair_heap_free_bytes", "Free heap", &heapFree);
+    metrics.add("openair_heap_min_free_bytes", "Lowest free heap since boot", &heapMinFree);
+    metrics.add("openair_heap_largest_block_bytes", "Largest allocatable heap block", &heapLargestBlock);
+    metrics.add("openair_wifi_rssi_dbm", "WiFi signal strength", &wifiRssi);
+    metrics.add("openair_uptime_seconds", "Time since boot", &uptimeSeconds);
+    metrics.add("openair_sensor_runtime_seconds", "PM sensor running time over its life", &sensorRuntimeSeconds);
+    metrics.add("openair_sensor_powered", "PM sensor awake (1) or asleep (0)", &sensorPowered);
+    metrics.add("openair_sensor_interval_seconds", "Current time between PM sensor readings", &sensorIntervalSeconds);
+    metrics.add("openair_sensor_wakes_total", "PM sensor wake-ups since boot", &sensorWakesTotal);
+    metrics.add("openair_relay_cycles_total", "Fan relay off to on transitions", &relayCyclesTotal);
+    metrics.add("openair_http_responses_cut_total", "Responses cut off because the client stopped reading", &httpResponsesCut);
+    metrics.add("openair_fan_early_starts_total", "Fan starts on the forecast before the AQI crossed", &fanEarlyStartsTotal);
+    metrics.add("openair_aqi_forecast", "AQI forecast at the forecast horizon", &aqiForecastGauge);
+    metrics.add("openair_forecast_mae", "Mean absolute error of the AQI forecast", &forecastMae);
+    metrics.add("openair_forecast_rmse", "Root mean square error of the AQI forecast", &forecastRmse);
+    metrics.add("openair_forecast_bias", "Mean of forecast minus actual AQI", &forecastBias);
+    metrics.add("openair_log_dropped_total", "Log messages dropped because the buffer was full", &logDroppedTotal);
+    metrics.add("openair_mqtt_connected", "1 while connected to the MQTT broker", &mqttConnected);
+    metrics.add("openair_mqtt_queued_samples", "Samples waiting for the MQTT broker", &mqttQueuedSamples);
+    metrics.add("openair_mqtt_dropped_samples_total", "Samples dropped because the MQTT outbox was full", &mqttDroppedTotal);
+    metrics.add("openair_mqtt_messages_total", "Sample messages published to MQTT", &mqttMessagesTotal);
+    metrics.add("openair_beacons_sent_total", "Multicast telemetry beacons sent", &beaconsSentTotal);
+    metrics.add("openair_sync_throttled_total", "Backlog syncs turned away by the rate limit", &syncThrottledTotal);
+}
+
+// Collects streamed output (metrics, traces) into chunks for a chunked
+// HTTP response
+static char responseChunk[1024];
+static size_t responseChunkUsed = 0;
+
+static void flushResponseChunk() {
+    if(responseChunkUsed > 0) {
+        server.sendContent(responseChunk, responseChunkUsed);
+        responseChunkUsed = 0;
+    }
+}
+
+static void writeResponseChunk(const char* data, size_t length, void*) {
+    if(responseChunkUsed + length > sizeof(responseChunk)) {
+        flushResponseChunk();
+    }
+    memcpy(responseChunk + responseChunkUsed, data, length);
+    responseChunkUsed += length;
+}
+
+void handleMetrics() {
+    // Sampled values are refreshed at scrape time
+    heapFree.set(ESP.getFreeHeap());
+    heapMinFree.set(ESP.getMinFreeHeap());
+    heapLargestBlock.set(ESP.getMaxAllocHeap());
+    wifiRssi.set(WiFi.status() == WL_CONNECTED ? WiFi.RSSI() : NAN);
+    uptimeSeconds.set(millis() / 1000.0f);
+    sensorRuntimeSeconds.set(sensorPower.runtimeMs(millis()) / 1000.0f);
+    sensorPowered.set(sensorPower.powered() ? 1.0f : 0.0f);
+    sensorIntervalSeconds.set(sensorPower.intervalMs() / 1000.0f);
+    sensorWakesTotal.set(sensorPower.wakeCount());
+    relayCyclesTotal.set(fanController.cycleCount());
+    httpResponsesCut.set(server.responsesCut());
+    fanEarlyStartsTotal.set(fanController.earlyStarts());
+    ForecastErrors errors = aqiForecaster.errors();
+    aqiForecastGauge.set(aqiForecaster.forecast());
+    forecastMae.set(errors.mae);
+    forecastRmse.set(errors.rmse);
+    forecastBias.set(errors.bias);
+    logDroppedTotal.set(logDropped());
+    MqttStatus mqtt = mqttStatus.read();
+    mqttConnected.set(mqtt.connected ? 1.0f : 0.0f);
+    mqttQueuedSamples.set((float)mqtt.queued);
+    mqttDroppedTotal.set(mqtt.dropped);
+    mqttMessagesTotal.set(mqtt.messagesSent);
+    beaconsSentTotal.set(beaconSender.sentCount());
+    
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, "text/plain; version=0.0.4", "");
+    metrics.render(writeResponseChunk, nullptr);
+    flushResponseChunk();
+    server.sendContent("");
+}
+
+#ifdef OPENAIR_TRACE
+void handleGetTrace() {
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, "application/json", "");
+    traceExport(writeResponseChunk, nullptr);
+    flushResponseChunk();
+    server.sendContent("");
+    
+    if(server.hasArg("clear")) {
+        traceClear();
+    }
+}
+#endif
+
+template<typename TDocument> void sendJson(int code, const TDocument& doc) {
+    size_t length = serializeJson(doc, responseBuffer, sizeof(responseBuffer));
+    server.send(code, "application/json", responseBuffer, length);
+}
+
+template<size_t N> void sendSnapshot(const Snapshot<N>& snapshot) {
+    // no-cache makes browsers revalidate with If-None-Match on every poll
+    server.sendHeader("ETag", snapshot.etag());
+    server.sendHeader("Cache-Control", "no-cache");
+    if(snapshot.matches(server.header("If-None-Match"))) {
+        server.send(304, "", "");
+        return;
+    }
+    server.send(200, "application/json", snapshot.data(), snapshot.length());
+}
+
+template<size_t N, typename TDocument> void publishSnapshot(Snapshot<N>& snapshot, const TDocument& doc) {
+    size_t length = serializeJson(doc, snapshot.beginPublish(), snapshot.capacity());
+    snapshot.commit(length);
+}
+
+void markStateChanged() {
+    stateChanged = true;
+}
+
+void publishSharedState() {
+    ControlState state;
+    state.aqi = currentAQI;
+    state.fanAuto = fanAutoMode;
+    state.fanOn = digitalRead(FAN_PIN);
+    state.threshold = fanThreshold;
+    state.hysteresis = fanHysteresis;
+    state.minOnMs = fanMinOnTime;
+    state.minOffMs = fanMinOffTime;
+    state.nominalRpm = fanNominalRpm;
+    state.sensor = sensorConfig;
+    sharedState.write(state);
+}
+
+bool queueStateCommand(StateCommandType type, float value, bool persist) {
+    StateCommand command = {};
+    command.type = type;
+    command.value = value;
+    command.persist = persist;
+    return stateCommands.push(command);
+}
+
+void applyStateCommands() {
+    StateCommand command;
+    while(stateCommands.pop(command)) {
+        applyStateCommand(command);
+    }
+}
+
+void applyStateCommand(const StateCommand& command) {
+    switch(command.type) {
+        case CMD_SET_FAN_AUTO:
+            fanAutoMode = command.value != 0;
+            LOG_INFO("Fan auto mode set to: %d", fanAutoMode);
+            if(command.persist) {
+                EEPROM.put(100, fanAutoMode);
+                commitEEPROM();
+            }
+            break;
+        case CMD_SET_FAN_STATE:
+            setFanState(command.value != 0);
+            LOG_INFO("Manual fan control: %s", command.value != 0 ? "ON" : "OFF");
+            break;
+        case CMD_SET_THRESHOLD:
+            fanThreshold = command.value;
+            if(command.persist) {
+                EEPROM.put(104, fanThreshold);
+                commitEEPROM();
+            }
+            break;
+        case CMD_SET_HYSTERESIS:
+            fanHysteresis = command.value < 0 ? 0 : command.value;
+            break;
+        case CMD_SET_MIN_ON_TIME:
+            fanMinOnTime = (unsigned long)command.value;
+            break;
+        case CMD_SET_MIN_OFF_TIME:
+            fanMinOffTime = (unsigned long)command.value;
+            break;
+        case CMD_SET_FAN_NOMINAL_RPM:
+            fanNominalRpm = command.value;
+            configureFanTach();
+            break;
+        case CMD_SET_SENSOR_CONFIG:
+            if(command.sensorFields & SENSOR_FIELD_USE_REAL) {
+                sensorConfig.useRealSensor = command.sensor.useRealSensor;
+            }
+            if(command.sensorFields & SENSOR_FIELD_OFFSET) {
+                sensorConfig.calibrationOffset = command.sensor.calibrationOffset;
+            }
+            if(command.sensorFields & SENSOR_FIELD_MULTIPLIER) {
+                sensorConfig.calibrationMultiplier = command.sensor.calibrationMultiplier;
+            }
+            EEPROM.put(SENSOR_CONFIG_ADDR, sensorConfig);
+            commitEEPROM();
+            publishSensorConfigSnapshot(sensorConfig);
+            break;
+    }
+    configureFanController();
+    markStateChanged();
+}
+
+void publishStateSnapshot() {
+    ControlState state = sharedState.read();
+    StaticJsonDocument<384> doc;
+    doc["version"] = stateSnapshot.nextVersion();
+    doc["aqi"] = state.aqi;
+    doc["aqiTimeMs"] = currentAQITimeMs;
+    doc["sampleIntervalMs"] = sensorPower.intervalMs();
+    if(aqiForecaster.ready()) {
+        doc["aqiForecast"] = aqiForecaster.forecast();
+    }
+    doc["fanAuto"] = state.fanAuto;
+    doc["fanState"] = state.fanOn;
+    doc["threshold"] = state.threshold;
+    doc["hysteresis"] = state.hysteresis;
+    doc["relayCycles"] = fanController.cycleCount();
+    doc["fanRpm"] = fanTach.rpm();
+    doc["fanAlert"] = fanTach.hasAlert();
+    doc["fanAlertReason"] = FanTach::alertName(fanTach.alert());
+    doc["useRealSensor"] = state.sensor.useRealSensor;
+    
+    publishSnapshot(stateSnapshot, doc);
+    publishSummarySnapshot();
+    snapshotFanRpm = fanTach.rpm();
+    stateChanged = false;
+}
+
+void publishHistorySnapshot() {
     StaticJsonDocument<1024> doc;
+    doc["version"] = historySnapshot.nextVersion();
+    doc["bucketMs"] = HISTORY_BUCKET_MS;
     JsonArray history = doc.createNestedArray("history");
     
-    for(int i = 0; i < 24; i++) {
-        history.add(aqiHistory[i]);
+    const HourlyHistory& hours = pipeline.history();
+    for(int i = 0; i < HISTORY_LENGTH; i++) {
+        if(i < hours.filled() && !isnan(hours.means()[i])) {
+            history.add(hours.means()[i]);
+        } else {
+            history.add(nullptr);
+        }
     }
     
-    String response;
-    serializeJson(doc, response);
-    server.send(200, "application/json", response);
+    publishSnapshot(historySnapshot, doc);
 }
 
-void handleGetSensorConfig() {
+void publishSensorConfigSnapshot(const SensorConfig& config) {
     StaticJsonDocument<200> doc;
-    doc["useRealSensor"] = sensorConfig.useRealSensor;
-    doc["calibrationOffset"] = sensorConfig.calibrationOffset;
-    doc["calibrationMultiplier"] = sensorConfig.calibrationMultiplier;
+    doc["useRealSensor"] = config.useRealSensor;
+    doc["calibrationOffset"] = config.calibrationOffset;
+    doc["calibrationMultiplier"] = config.calibrationMultiplier;
+    
+    publishSnapshot(sensorConfigSnapshot, doc);
+}
+
+void setupForecast() {
+    ForecastConfig config;
+    config.stepMs = SAMPLE_GRID_MS;
+    config.horizonMs = FORECAST_HORIZON_MS;
+    config.alpha = FORECAST_ALPHA;
+    config.beta = FORECAST_BETA;
+    config.warmUp = FORECAST_WARM_UP;
+    aqiForecaster.configure(config);
+}
+
+void setupStats() {
+    for(size_t i = 0; i < STATS_WINDOW_COUNT; i++) {
+        statsWindows[i].stats.configure(statsWindows[i].windowMs);
+    }
+    publishStatsSnapshots(millis());
+}
+
+// Empty windows have no min/max/quantiles; JSON gets null rather than NaN
+static void setStat(JsonObject object, const char* key, float value) {
+    if(isnan(value)) {
+        object[key] = nullptr;
+    } else {
+        object[key] = value;
+    }
+}
+
+static void fillWindowStats(JsonObject object, const char* name, const WindowStats& stats) {
+    object["window"] = name;
+    object["windowSeconds"] = stats.windowMs / 1000;
+    object["count"] = stats.count;
+    setStat(object, "min", stats.min);
+    setStat(object, "max", stats.max);
+    setStat(object, "mean", stats.mean);
+    setStat(object, "p50", stats.p50);
+    setStat(object, "p95", stats.p95);
+    object["quantileSeconds"] = stats.quantileMs / 1000;
+}
+
+void publishStatsSnapshots(uint32_t nowMs) {
+    StaticJsonDocument<1024> all;
+    all["version"] = statsSnapshot.nextVersion();
+    JsonArray windows = all.createNestedArray("windows");
+    
+    for(size_t i = 0; i < STATS_WINDOW_COUNT; i++) {
+        StatsWindow& window = statsWindows[i];
+        WindowStats stats = window.stats.stats(nowMs);
+        
+        StaticJsonDocument<384> doc;
+        JsonObject object = doc.to<JsonObject>();
+        object["version"] = window.snapshot.nextVersion();
+        fillWindowStats(object, window.name, stats);
+        publishSnapshot(window.snapshot, doc);
+        fillWindowStats(windows.createNestedObject(), window.name, stats);
+    }
+    publishSnapshot(statsSnapshot, all);
+}
+
+void handleGetForecast() {
+    ForecastErrors errors = aqiForecaster.errors();
+    StaticJsonDocument<384> doc;
+    doc["horizonSeconds"] = aqiForecaster.config().horizonMs / 1000;
+    doc["ready"] = aqiForecaster.ready();
+    setStat(doc.as<JsonObject>(), "forecast", aqiForecaster.forecast());
+    doc["level"] = aqiForecaster.level();
+    doc["trendPerMinute"] = aqiForecaster.trendPerMinute();
+    doc["earlyStarts"] = fanController.earlyStarts();
+    JsonObject error = doc.createNestedObject("error");
+    error["count"] = errors.count;
+    setStat(error, "mae", errors.mae);
+    setStat(error, "rmse", errors.rmse);
+    setStat(error, "bias", errors.bias);
+    sendJson(200, doc);
+}
+
+void handleGetStats() {
+    // ?window=5m|1h|24h for one window, all of them otherwise
+    if(!server.hasArg("window")) {
+        sendSnapshot(statsSnapshot);
+        return;
+    }
+    for(size_t i = 0; i < STATS_WINDOW_COUNT; i++) {
+        if(strcmp(server.arg("window"), statsWindows[i].name) == 0) {
+            sendSnapshot(statsWindows[i].snapshot);
+            return;
+        }
+    }
+    server.send(400, "application/json", "{\"error\":\"window must be 5m, 1h or 24h\"}");
+}
+
+void handleGetAQI() {
+    // Long poll: ?wait=<seconds>[&since=<version>] holds the request until
+    // the state version moves on from since (default: the current version).
+    // A since ahead of the version is from before a reboot; answer at once.
+    if(server.hasArg("wait")) {
+        // Clamp the seconds, not the product, which can wrap
+        unsigned long waitS = strtoul(server.arg("wait"), nullptr, 10);
+        if(waitS > LONG_POLL_MAX_MS / 1000) waitS = LONG_POLL_MAX_MS / 1000;
+        uint32_t waitMs = waitS * 1000UL;
+        uint32_t since = server.hasArg("since") ? strtoul(server.arg("since"), nullptr, 10) : stateSnapshot.version();
+        
+        if(waitMs > 0 && stateSnapshot.version() == since && server.defer(waitMs, since)) {
+            return;
+        }
+    }
+    sendSnapshot(stateSnapshot);
+}
+
+void completeLongPoll(uint32_t since, bool timedOut) {
+    // On timeout the unchanged state is sent; the client just polls again
+    if(stateSnapshot.version() != since || timedOut) {
+        sendSnapshot(stateSnapshot);
+    }
+}
+
+void handleGetHistory() {
+    sendSnapshot(historySnapshot);
+}
+
+// Samples after ?since= (the last sequence number the client holds) from
+// boot ?boot=, as binary blocks (see Backlog.h); everything held if the
+// client has no cursor from this boot. Over the rate limit the client gets
+// a 429 with a randomized Retry-After so retries spread out.
+void handleSync() {
+    uint32_t now = millis();
+    syncTokens += (now - syncRefillMs) * SYNC_RATE / 1000.0f;
+    if(syncTokens > SYNC_BURST) {
+        syncTokens = SYNC_BURST;
+    }
+    syncRefillMs = now;
+    if(syncTokens < 1) {
+        char retryAfter[8];
+        snprintf(retryAfter, sizeof(retryAfter), "%lu", (unsigned long)(1 + esp_random() % 4));
+        server.sendHeader("Retry-After", retryAfter);
+        server.send(429, "text/plain", "Too Many Requests");
+        syncThrottledTotal.inc();
+        return;
+    }
+    syncTokens -= 1;
+    
+    uint32_t maxBlocks = SYNC_MAX_BLOCKS;
+    if(server.hasArg("max")) {
+        maxBlocks = constrain(strtoul(server.arg("max"), nullptr, 10), 1UL, (unsigned long)SYNC_MAX_BLOCKS);
+    }
+    SampleBacklog<BACKLOG_BLOCKS>::Range range = backlog.plan(server.hasArg("since"),
+                                                              strtoul(server.arg("boot"), nullptr, 10),
+                                                              strtoul(server.arg("since"), nullptr, 10), maxBlocks);
+    uint8_t header[BACKLOG_SYNC_HEADER];
+    encodeSyncHeader(backlog.header(range, now), header);
+    server.sendHeader("Cache-Control", "no-store");
+    server.setContentLength(range.bytes);
+    server.send(200, "application/octet-stream");
+    server.sendContent((const char*)header, sizeof(header));
+    for(size_t i = 0; i < range.count; i++) {
+        const BacklogBlock& block = backlog.block(range.first + i);
+        uint8_t blockHeader[BACKLOG_BLOCK_HEADER];
+        encodeBlockHeader(block, blockHeader);
+        server.sendContent((const char*)blockHeader, sizeof(blockHeader));
+        server.sendContent((const char*)block.data, block.length);
+    }
+}
+
+void handleGetSensorConfig() {
+    sendSnapshot(sensorConfigSnapshot);
+}
+
+void handleGetSensor() {
+    uint32_t now = millis();
+    float runtimeHours = sensorPower.runtimeMs(now) / 3600000.0f;
+    StaticJsonDocument<256> doc;
+    doc["state"] = SensorPower::stateName(sensorPower.state());
+    doc["powered"] = sensorPower.powered();
+    doc["intervalMs"] = sensorPower.intervalMs();
+    doc["nextReadingInMs"] = max((int32_t)(sensorPower.nextReadingMs() - now), (int32_t)0);
+    doc["warmUpMs"] = sensorPower.config().warmUpMs;
+    doc["slope"] = sensorPower.slope();
+    doc["slopeDeviation"] = sensorPower.slopeDeviation();
+    doc["runtimeHours"] = runtimeHours;
+    doc["ratedHours"] = SENSOR_RATED_HOURS;
+    doc["lifeUsedPercent"] = runtimeHours * 100 / SENSOR_RATED_HOURS;
+    doc["wakes"] = sensorPower.wakeCount();
+    doc["readings"] = sensorPower.readingCount();
+    sendJson(200, doc);
+}
+
+void handleGetScheduler() {
+    StaticJsonDocument<1024> doc;
+    JsonArray jobs = doc.createNestedArray("jobs");
     
-    String response;
-    serializeJson(doc, response);
-    server.send(200, "application/json", response);
+    for(int i = 0; i < scheduler.jobCount(); i++) {
+        JobStats stats = scheduler.stats(i);
+        JsonObject job = jobs.createNestedObject();
+        job["name"] = scheduler.jobName(i);
+        job["periodMs"] = scheduler.jobPeriodMs(i);
+        job["runs"] = stats.runs;
+        job["overruns"] = stats.overruns;
+        job["lastJitterUs"] = stats.lastJitterUs;
+        job["avgJitterUs"] = stats.runs ? (uint32_t)(stats.totalJitterUs / stats.runs) : 0;
+        job["maxJitterUs"] = stats.maxJitterUs;
+        job["maxRunUs"] = stats.maxRunUs;
+    }
+    
+    sendJson(200, doc);
+}
+
+void handleGetLogs() {
+    static char tail[LOG_TAIL_LINES * (LOG_LINE_LENGTH + 16) + 64];
+    int header = snprintf(tail, sizeof(tail), "# written: %lu, dropped: %lu\n",
+                          (unsigned long)logWritten(), (unsigned long)logDropped());
+    logTail(tail + header, sizeof(tail) - header);
+    server.send(200, "text/plain", tail);
+}
+
+void sendBusy() {
+    server.send(503, "application/json", "{\"error\":\"Busy, try again\"}");
 }
 
 void handleFanControl() {
-    if(server.hasArg("plain")) {
+    if(server.hasBody()) {
         StaticJsonDocument<200> doc;
-        deserializeJson(doc, server.arg("plain"));
+        deserializeJson(doc, server.body(), server.bodyLength());
         
+        bool queued = true;
         if(doc.containsKey("auto")) {
-            fanAutoMode = doc["auto"];
-            Serial.print("Fan auto mode set to: ");
-            Serial.println(fanAutoMode);
-            
-            if(!fanAutoMode && doc.containsKey("state")) {
-                bool newState = doc["state"];
-                digitalWrite(FAN_PIN, newState ? HIGH : LOW);
-                Serial.print("Manual fan control: ");
-                Serial.println(newState ? "ON" : "OFF");
-            }
+            queued = queueFanControl(doc["auto"], doc.containsKey("state"), doc["state"]);
         }
         
+        if(!queued) {
+            sendBusy();
+            return;
+        }
         server.send(200, "application/json", "{\"status\":\"success\"}");
     } else {
         server.send(400, "application/json", "{\"error\":\"Invalid request\"}");
     }
 }
 
+// Shared by /api/fan and MQTT: a manual fan state only applies with auto off
+bool queueFanControl(bool autoMode, bool setState, bool state) {
+    bool queued = queueStateCommand(CMD_SET_FAN_AUTO, autoMode);
+    if(queued && !autoMode && setState) {
+        queued = queueStateCommand(CMD_SET_FAN_STATE, state);
+    }
+    return queued;
+}
+
+// The checks every settings path (HTTP, MQTT, Modbus) applies before queueing
+bool settingValid(StateCommandType type, float value) {
+    switch(type) {
+        case CMD_SET_THRESHOLD:
+            return validThreshold(value);
+        case CMD_SET_HYSTERESIS:
+            return validHysteresis(value);
+        case CMD_SET_MIN_ON_TIME:
+        case CMD_SET_MIN_OFF_TIME:
+            return validDwellMs(value);
+        case CMD_SET_FAN_NOMINAL_RPM:
+            return value >= 0;
+        default:
+            return true;
+    }
+}
+
 void handleSettings() {
-    if(server.hasArg("plain")) {
+    if(server.hasBody()) {
         StaticJsonDocument<200> doc;
-        deserializeJson(doc, server.arg("plain"));
+        deserializeJson(doc, server.body(), server.bodyLength());
+        
+        // Dwell times are given in seconds
+        struct SettingField {
+            const char* key;
+            StateCommandType type;
+            float scale;
+        };
+        static const SettingField fields[] = {
+            {"threshold", CMD_SET_THRESHOLD, 1},
+            {"hysteresis", CMD_SET_HYSTERESIS, 1},
+            {"minOnTime", CMD_SET_MIN_ON_TIME, 1000},
+            {"minOffTime", CMD_SET_MIN_OFF_TIME, 1000},
+            {"fanNominalRpm", CMD_SET_FAN_NOMINAL_RPM, 1},
+        };
+        
+        // Check every field first so a bad one doesn't leave the rest applied
+        for(const SettingField& field : fields) {
+            if(doc.containsKey(field.key) && !settingValid(field.type, doc[field.key].as<float>() * field.scale)) {
+                int length = snprintf(responseBuffer, sizeof(responseBuffer), "{\"error\":\"Invalid %s\"}", field.key);
+                server.send(400, "application/json", responseBuffer, length);
+                return;
+            }
+        }
         
-        if(doc.containsKey("threshold")) {
-            fanThreshold = doc["threshold"];
+        bool queued = true;
+        for(const SettingField& field : fields) {
+            if(doc.containsKey(field.key)) {
+                queued &= queueStateCommand(field.type, doc[field.key].as<float>() * field.scale);
+            }
         }
         
+        if(!queued) {
+            sendBusy();
+            return;
+        }
         server.send(200, "application/json", "{\"status\":\"success\"}");
     } else {
         server.send(400, "application/json", "{\"error\":\"Invalid request\"}");
@@ -1430,23 +2745,31 @@ void handleSettings() {
 }
 
 void handleSensorConfig() {
-    if(server.hasArg("plain")) {
+    if(server.hasBody()) {
         StaticJsonDocument<200> doc;
-        deserializeJson(doc, server.arg("plain"));
+        deserializeJson(doc, server.body(), server.bodyLength());
         
+        // Only the fields in the request are set, on top of whatever is
+        // applied by then (including requests still in the queue)
+        StateCommand command = {};
+        command.type = CMD_SET_SENSOR_CONFIG;
         if(doc.containsKey("useRealSensor")) {
-            sensorConfig.useRealSensor = doc["useRealSensor"];
+            command.sensor.useRealSensor = doc["useRealSensor"];
+            command.sensorFields |= SENSOR_FIELD_USE_REAL;
         }
         if(doc.containsKey("calibrationOffset")) {
-            sensorConfig.calibrationOffset = doc["calibrationOffset"];
+            command.sensor.calibrationOffset = doc["calibrationOffset"];
+            command.sensorFields |= SENSOR_FIELD_OFFSET;
         }
         if(doc.containsKey("calibrationMultiplier")) {
-            sensorConfig.calibrationMultiplier = doc["calibrationMultiplier"];
+            command.sensor.calibrationMultiplier = doc["calibrationMultiplier"];
+            command.sensorFields |= SENSOR_FIELD_MULTIPLIER;
         }
         
-        EEPROM.put(SENSOR_CONFIG_ADDR, sensorConfig);
-        EEPROM.commit();
-        
+        if(!stateCommands.push(command)) {
+            sendBusy();
+            return;
+        }
         server.send(200, "application/json", "{\"status\":\"success\"}");
     } else {
         server.send(400, "application/json", "{\"error\":\"Invalid request\"}");
@@ -1454,19 +2777,36 @@ void handleSensorConfig() {
 }
 
 void handleWiFiConfig() {
-    if(server.hasArg("plain")) {
+    if(server.hasBody()) {
         StaticJsonDocument<200> doc;
-        deserializeJson(doc, server.arg("plain"));
+        deserializeJson(doc, server.body(), server.bodyLength());
         
-        String ssid = doc["ssid"];
-        String password = doc["password"];
+        const char* ssid = doc["ssid"] | "";
+        const char* password = doc["password"] | "";
         
-        // Save to EEPROM
-        strncpy(wifiConfig.ssid, ssid.c_str(), sizeof(wifiConfig.ssid));
-        strncpy(wifiConfig.password, password.c_str(), sizeof(wifiConfig.password));
+        // The OTA token only from the setup access point, never over the LAN
+        if(doc.containsKey("otaToken")) {
+            const char* token = doc["otaToken"] | "";
+            size_t length = strlen(token);
+            if(!isConfigMode) {
+                server.send(403, "application/json", "{\"error\":\"otaToken can only be set in configuration mode\"}");
+                return;
+            }
+            if(length > 0 && (length < OTA_TOKEN_MIN || length > OTA_TOKEN_MAX)) {
+                server.send(400, "application/json", "{\"error\":\"otaToken must be 16 to 47 characters, or empty\"}");
+                return;
+            }
+            strlcpy(otaConfig.token, token, sizeof(otaConfig.token));
+            EEPROM.put(OTA_CONFIG_ADDR, otaConfig);
+        }
         
-        EEPROM.put(WIFI_CONFIG_ADDR, wifiConfig);
-        EEPROM.commit();
+        // Save to EEPROM; a body with just the token leaves the WiFi alone
+        if(doc.containsKey("ssid") || !doc.containsKey("otaToken")) {
+            strlcpy(wifiConfig.ssid, ssid, sizeof(wifiConfig.ssid));
+            strlcpy(wifiConfig.password, password, sizeof(wifiConfig.password));
+            EEPROM.put(WIFI_CONFIG_ADDR, wifiConfig);
+        }
+        commitEEPROM();
         
         server.send(200, "application/json", "{\"status\":\"success\",\"message\":\"Configuration saved. Rebooting...\"}");
         
@@ -1477,29 +2817,665 @@ void handleWiFiConfig() {
     }
 }
 
+void loadMqttConfig() {
+    EEPROM.get(MQTT_CONFIG_ADDR, mqttConfig);
+    
+    if(mqttConfig.magic != MQTT_CONFIG_MAGIC) {
+        memset(&mqttConfig, 0, sizeof(mqttConfig));
+        mqttConfig.magic = MQTT_CONFIG_MAGIC;
+        mqttConfig.discovery = true;
+        mqttConfig.port = 1883;
+    }
+    // Never trust the terminators of what came out of flash
+    mqttConfig.host[sizeof(mqttConfig.host) - 1] = '\0';
+    mqttConfig.username[sizeof(mqttConfig.username) - 1] = '\0';
+    mqttConfig.password[sizeof(mqttConfig.password) - 1] = '\0';
+    mqttConfig.topicPrefix[sizeof(mqttConfig.topicPrefix) - 1] = '\0';
+    mqttSettings.write(mqttConfig);
+    
+    LOG_INFO("MQTT config - Enabled: %d, Broker: %s:%u", mqttConfig.enabled, mqttConfig.host, mqttConfig.port);
+}
+
+void startMqtt() {
+    if(xTaskCreate(mqttTask, "mqtt", 4096, nullptr, 1, nullptr) != pdPASS) {
+        LOG_ERROR("MQTT task could not be started");
+    }
+}
+
+void mqttTask(void*) {
+    // The publisher keeps pointers into these until the next setServer()
+    static MqttConfig config;
+    static char clientId[24];
+    static char topicPrefix[sizeof(config.topicPrefix)];
+    static char deviceName[24];
+    snprintf(clientId, sizeof(clientId), "openair-%06llx", (unsigned long long)(ESP.getEfuseMac() & 0xFFFFFF));
+    snprintf(deviceName, sizeof(deviceName), "OpenFilter %s", clientId + 8);
+    haDevice.id = clientId;
+    haDevice.name = deviceName;
+    haDevice.topicPrefix = topicPrefix;
+    mqttPublisher.onConnect(announceMqttEntities);
+    mqttClient.onMessage(handleMqttCommand);
+    uint32_t settingsVersion = 0;
+    uint32_t stateVersion = 0;
+    
+    for(;;) {
+        if(mqttSettings.version() != settingsVersion) {
+            settingsVersion = mqttSettings.version();
+            mqttPublisher.stop();
+            config = mqttSettings.read();
+            if(config.topicPrefix[0]) {
+                strlcpy(topicPrefix, config.topicPrefix, sizeof(topicPrefix));
+            } else {
+                snprintf(topicPrefix, sizeof(topicPrefix), "openair/%s", clientId + 8);
+            }
+            mqttPublisher.setServer(config.enabled ? config.host : "", config.port, clientId,
+                                    config.username, config.password, topicPrefix);
+        }
+        
+        // Keep queueing through WiFi and broker outages; the outbox is bounded
+        AqiSample sample;
+        while(sampleQueue.read(mqttSampleCursor, sample)) {
+            if(config.enabled) {
+                mqttPublisher.add(sample.timeMs, sample.aqi);
+            }
+        }
+        // The retained state is the current reading and settings; the
+        // samples topic carries the series, which lags while the outbox drains
+        if(sharedState.version() != stateVersion) {
+            stateVersion = sharedState.version();
+            ControlState state = sharedState.read();
+            char json[160];
+            snprintf(json, sizeof(json),
+                     "{\"aqi\":%.1f,\"fan\":\"%s\",\"auto\":%s,\"threshold\":%.1f,\"hysteresis\":%.1f}",
+                     state.aqi, state.fanOn ? "on" : "off", state.fanAuto ? "true" : "false", state.threshold,
+                     state.hysteresis);
+            mqttPublisher.setState(json);
+        }
+        if(config.enabled && WiFi.status() == WL_CONNECTED) {
+            mqttPublisher.loop(millis());
+        }
+        
+        MqttStatus status;
+        status.connected = mqttPublisher.connected();
+        status.queued = mqttPublisher.queued();
+        status.dropped = mqttPublisher.dropped();
+        status.samplesSent = mqttPublisher.samplesSent();
+        status.messagesSent = mqttPublisher.batchesSent();
+        status.connects = mqttPublisher.connects();
+        status.connectFailures = mqttPublisher.connectFailures();
+        mqttStatus.write(status);
+        
+        vTaskDelay(pdMS_TO_TICKS(MQTT_TASK_PERIOD_MS));
+    }
+}
+
+// Runs in the MQTT task after every connect: the session is clean, so the
+// subscription goes each time, and retained configs keep the broker current
+void announceMqttEntities() {
+    static char topic[96];
+    static char payload[768];
+    bool discovery = mqttSettings.read().discovery;
+    for(int i = 0; i < HA_ENTITY_COUNT; i++) {
+        size_t length = discovery ? haConfigPayload(i, haDevice, payload, sizeof(payload)) : 0;
+        // An empty retained config removes the entity again
+        if(haConfigTopic(i, haDevice, topic, sizeof(topic))) {
+            mqttClient.publish(topic, (const uint8_t*)payload, length, 1, true);
+        }
+    }
+    if(haCommandFilter(haDevice, topic, sizeof(topic))) {
+        mqttClient.subscribe(topic, 1);
+    }
+}
+
+// Commands map onto the same state commands as /api/fan and /api/settings;
+// the loop task applies them and the new state goes out retained
+void handleMqttCommand(const char* topic, const uint8_t* payload, size_t length) {
+    HaCommand command = haParseCommand(haDevice, topic, payload, length);
+    bool queued = true;
+    switch(command.type) {
+        case HA_COMMAND_FAN:
+            queued = queueFanControl(false, true, command.on);
+            break;
+        case HA_COMMAND_AUTO:
+            queued = queueFanControl(command.on, false, false);
+            break;
+        case HA_COMMAND_THRESHOLD:
+            queued = queueStateCommand(CMD_SET_THRESHOLD, command.value);
+            break;
+        case HA_COMMAND_NONE:
+            LOG_DEBUG("Ignoring MQTT message on %s", topic);
+            return;
+    }
+    if(!queued) {
+        LOG_WARN("State command queue full, dropped MQTT command on %s", topic);
+    }
+}
+
+void handleGetMqtt() {
+    StaticJsonDocument<512> doc;
+    doc["enabled"] = mqttConfig.enabled;
+    doc["discovery"] = mqttConfig.discovery;
+    doc["host"] = mqttConfig.host;
+    doc["port"] = mqttConfig.port;
+    doc["username"] = mqttConfig.username;
+    doc["hasPassword"] = mqttConfig.password[0] != '\0'; // Never sent back
+    doc["topicPrefix"] = mqttConfig.topicPrefix;
+    
+    MqttStatus status = mqttStatus.read();
+    JsonObject statusObject = doc.createNestedObject("status");
+    statusObject["connected"] = status.connected;
+    statusObject["queued"] = status.queued;
+    statusObject["dropped"] = status.dropped;
+    statusObject["samplesSent"] = status.samplesSent;
+    statusObject["messagesSent"] = status.messagesSent;
+    statusObject["connects"] = status.connects;
+    statusObject["connectFailures"] = status.connectFailures;
+    
+    sendJson(200, doc);
+}
+
+// Copies a JSON string field into a fixed buffer; false if it doesn't fit
+static bool copyField(JsonDocument& doc, const char* key, char* out, size_t size) {
+    if(!doc.containsKey(key)) {
+        return true;
+    }
+    const char* value = doc[key] | "";
+    if(strlen(value) >= size) {
+        return false;
+    }
+    strlcpy(out, value, size);
+    return true;
+}
+
+void handleMqttConfig() {
+    if(!server.hasBody()) {
+        server.send(400, "application/json", "{\"error\":\"Invalid request\"}");
+        return;
+    }
+    StaticJsonDocument<384> doc;
+    if(deserializeJson(doc, server.body(), server.bodyLength())) {
+        server.send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
+        return;
+    }
+    
+    // Fields not in the request keep their current values
+    MqttConfig config = mqttConfig;
+    if(doc.containsKey("enabled")) {
+        config.enabled = doc["enabled"];
+    }
+    if(doc.containsKey("discovery")) {
+        config.discovery = doc["discovery"];
+    }
+    if(doc.containsKey("port")) {
+        long port = doc["port"];
+        if(port < 1 || port > 65535) {
+            server.send(400, "application/json", "{\"error\":\"Invalid port\"}");
+            return;
+        }
+        config.port = port;
+    }
+    if(!copyField(doc, "host", config.host, sizeof(config.host)) ||
+       !copyField(doc, "username", config.username, sizeof(config.username)) ||
+       !copyField(doc, "password", config.password, sizeof(config.password)) ||
+       !copyField(doc, "topicPrefix", config.topicPrefix, sizeof(config.topicPrefix))) {
+        server.send(400, "application/json", "{\"error\":\"Value too long\"}");
+        return;
+    }
+    if(strpbrk(config.topicPrefix, "+#") || (config.enabled && !config.host[0])) {
+        server.send(400, "application/json", "{\"error\":\"Invalid broker or topic prefix\"}");
+        return;
+    }
+    
+    mqttConfig = config;
+    EEPROM.put(MQTT_CONFIG_ADDR, mqttConfig);
+    commitEEPROM();
+    mqttSettings.write(mqttConfig);
+    server.send(200, "application/json", "{\"status\":\"success\"}");
+}
+
+void setupModbus() {
+    modbus.onRead(readModbusRegisters);
+    modbus.onWrite(writeModbusRegisters);
+    if(modbus.begin()) {
+        LOG_INFO("Modbus TCP server started on port %d", MODBUS_PORT);
+    } else {
+        LOG_ERROR("Modbus TCP server failed to start");
+    }
+}
+
+void publishModbusRegisters() {
+    ControlState state = sharedState.read();
+    OpenAirValues values;
+    values.aqi = state.aqi;
+    values.pm25 = NAN; // No PM sensor fitted yet
+    values.pm10 = NAN;
+    values.fanOn = state.fanOn;
+    values.fanRpm = fanTach.rpm();
+    values.autoMode = state.fanAuto;
+    values.threshold = state.threshold;
+    values.hysteresis = state.hysteresis;
+    values.uptimeS = millis() / 1000;
+    values.fanAlert = fanTach.alert();
+    encodeRegisters(values, modbusRegisters);
+}
+
+uint8_t readModbusRegisters(bool input, uint16_t address, uint16_t count, uint16_t* values) {
+    if(address + count > REG_COUNT) {
+        return MODBUS_ILLEGAL_ADDRESS;
+    }
+    encodeLiveRegisters(fanTach.rpm(), millis() / 1000, fanTach.alert(), modbusRegisters);
+    memcpy(values, modbusRegisters + address, count * sizeof(uint16_t));
+    return MODBUS_OK;
+}
+
+// Writes become the same commands as /api/fan and /api/settings, after the
+// same checks. A multi-register write is checked whole before any of it is
+// queued.
+uint8_t writeModbusRegisters(uint16_t address, uint16_t count, const uint16_t* values) {
+    for(uint16_t i = 0; i < count; i++) {
+        uint16_t reg = address + i;
+        if(!registerWritable(reg)) {
+            return MODBUS_ILLEGAL_ADDRESS;
+        }
+        bool valid = true;
+        if(reg == REG_FAN_ON || reg == REG_AUTO_MODE) {
+            valid = values[i] <= 1;
+        } else if(reg == REG_THRESHOLD) {
+            valid = settingValid(CMD_SET_THRESHOLD, values[i] / 10.0f);
+        } else if(reg == REG_HYSTERESIS) {
+            valid = settingValid(CMD_SET_HYSTERESIS, values[i] / 10.0f);
+        }
+        if(!valid) {
+            return MODBUS_ILLEGAL_VALUE;
+        }
+    }
+    
+    bool queued = true;
+    for(uint16_t i = 0; i < count; i++) {
+        uint16_t reg = address + i;
+        if(reg == REG_FAN_ON) {
+            queued &= queueFanControl(false, true, values[i] != 0);
+        } else if(reg == REG_AUTO_MODE) {
+            queued &= queueFanControl(values[i] != 0, false, false);
+        } else if(reg == REG_THRESHOLD) {
+            queued &= queueStateCommand(CMD_SET_THRESHOLD, values[i] / 10.0f);
+        } else if(reg == REG_HYSTERESIS) {
+            queued &= queueStateCommand(CMD_SET_HYSTERESIS, values[i] / 10.0f);
+        }
+    }
+    return queued ? MODBUS_OK : MODBUS_SERVER_BUSY;
+}
+
+void setupCoap() {
+    coap.on("aqi", COAP_FORMAT_OCTET_STREAM, true, handleCoapAqi);
+    coap.on("history", COAP_FORMAT_OCTET_STREAM, true, handleCoapHistory);
+    coap.on("settings", COAP_FORMAT_OCTET_STREAM, true, handleCoapSettings);
+    if(coap.begin()) {
+        LOG_INFO("CoAP server started on port %d", COAP_PORT);
+    } else {
+        LOG_ERROR("CoAP server failed to start");
+    }
+}
+
+uint8_t handleCoapAqi(uint8_t method, const uint8_t* payload, size_t length, uint8_t* out, size_t& outLength) {
+    if(method != COAP_GET) {
+        return COAP_METHOD_NOT_ALLOWED;
+    }
+    ControlState state = sharedState.read();
+    CoapAqi value;
+    value.aqi = state.aqi;
+    value.fanOn = state.fanOn;
+    value.autoMode = state.fanAuto;
+    value.fanAlert = fanTach.alert();
+    outLength = encodeCoapAqi(value, out);
+    return COAP_CONTENT;
+}
+
+uint8_t handleCoapHistory(uint8_t method, const uint8_t* payload, size_t length, uint8_t* out, size_t& outLength) {
+    if(method != COAP_GET) {
+        return COAP_METHOD_NOT_ALLOWED;
+    }
+    outLength = encodeCoapHistory(pipeline.history().means(), pipeline.history().filled(), out, COAP_PAYLOAD_MAX);
+    return COAP_CONTENT;
+}
+
+// PUT or POST takes the GET layout, with 0xFFFF for fields to leave alone,
+// and goes through the same checks as /api/settings
+uint8_t handleCoapSettings(uint8_t method, const uint8_t* payload, size_t length, uint8_t* out, size_t& outLength) {
+    if(method == COAP_GET) {
+        ControlState state = sharedState.read();
+        CoapSettings value;
+        value.threshold = state.threshold;
+        value.hysteresis = state.hysteresis;
+        value.minOnMs = state.minOnMs;
+        value.minOffMs = state.minOffMs;
+        value.nominalRpm = state.nominalRpm;
+        outLength = encodeCoapSettings(value, out);
+        return COAP_CONTENT;
+    }
+    if(method != COAP_PUT && method != COAP_POST) {
+        return COAP_METHOD_NOT_ALLOWED;
+    }
+    
+    CoapSettings value;
+    if(!decodeCoapSettings(payload, length, value)) {
+        return COAP_BAD_REQUEST;
+    }
+    struct {
+        StateCommandType type;
+        float value;
+    } fields[] = {
+        {CMD_SET_THRESHOLD, value.threshold},
+        {CMD_SET_HYSTERESIS, value.hysteresis},
+        {CMD_SET_MIN_ON_TIME, value.minOnMs},
+        {CMD_SET_MIN_OFF_TIME, value.minOffMs},
+        {CMD_SET_FAN_NOMINAL_RPM, value.nominalRpm},
+    };
+    for(const auto& field : fields) {
+        if(!isnan(field.value) && !settingValid(field.type, field.value)) {
+            return COAP_BAD_REQUEST;
+        }
+    }
+    bool queued = true;
+    for(const auto& field : fields) {
+        if(!isnan(field.value)) {
+            queued &= queueStateCommand(field.type, field.value);
+        }
+    }
+    return queued ? COAP_CHANGED : COAP_SERVICE_UNAVAILABLE;
+}
+
+void loadBeaconConfig() {
+    EEPROM.get(BEACON_CONFIG_ADDR, beaconConfig);
+    
+    if(beaconConfig.magic != BEACON_CONFIG_MAGIC ||
+       beaconConfig.intervalMs < BEACON_INTERVAL_MIN_MS || beaconConfig.intervalMs > BEACON_INTERVAL_MAX_MS) {
+        beaconConfig.magic = BEACON_CONFIG_MAGIC;
+        beaconConfig.enabled = true;
+        beaconConfig.intervalMs = BEACON_INTERVAL_DEFAULT_MS;
+    }
+    LOG_INFO("Beacon config - Enabled: %d, Interval: %lu ms", beaconConfig.enabled, (unsigned long)beaconConfig.intervalMs);
+}
+
+void setupBeacon() {
+    // The device id is the MAC; the boot id lets receivers tell a reboot
+    // (sequence back to 0) from old, duplicated datagrams
+    uint64_t mac = ESP.getEfuseMac();
+    for(int i = 0; i < 6; i++) {
+        beaconPacket.deviceId[i] = (mac >> (8 * i)) & 0xFF;
+    }
+    beaconPacket.bootId = esp_random() & 0xFFFF;
+    beaconPacket.sequence = 0;
+    
+    if(beaconSender.begin(BEACON_GROUP, BEACON_PORT)) {
+        LOG_INFO("Beacon to %s:%d", BEACON_GROUP, BEACON_PORT);
+    } else {
+        LOG_ERROR("Beacon socket failed");
+    }
+}
+
+void sendBeacon() {
+    if(!beaconConfig.enabled || WiFi.status() != WL_CONNECTED) {
+        return;
+    }
+    ControlState state = sharedState.read();
+    beaconPacket.aqi = state.aqi;
+    beaconPacket.pm25 = NAN; // No PM sensor fitted yet
+    beaconPacket.pm10 = NAN;
+    beaconPacket.threshold = state.threshold;
+    beaconPacket.flags = (state.fanOn ? BEACON_FAN_ON : 0) | (state.fanAuto ? BEACON_AUTO : 0) |
+                         (fanTach.hasAlert() ? BEACON_ALERT : 0);
+    beaconPacket.intervalMs = beaconConfig.intervalMs;
+    beaconSender.send(beaconPacket);
+    // Numbered per attempt, so a receiver's count of missing beacons also
+    // covers ones the socket refused
+    beaconPacket.sequence++;
+}
+
+void handleGetBeacon() {
+    StaticJsonDocument<256> doc;
+    doc["enabled"] = beaconConfig.enabled;
+    doc["intervalMs"] = beaconConfig.intervalMs;
+    doc["group"] = BEACON_GROUP;
+    doc["port"] = BEACON_PORT;
+    doc["sent"] = beaconSender.sentCount();
+    doc["failed"] = beaconSender.failedCount();
+    sendJson(200, doc);
+}
+
+void handleBeaconConfig() {
+    if(!server.hasBody()) {
+        server.send(400, "application/json", "{\"error\":\"Invalid request\"}");
+        return;
+    }
+    StaticJsonDocument<128> doc;
+    if(deserializeJson(doc, server.body(), server.bodyLength())) {
+        server.send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
+        return;
+    }
+    
+    BeaconConfig config = beaconConfig;
+    if(doc.containsKey("enabled")) {
+        config.enabled = doc["enabled"];
+    }
+    if(doc.containsKey("intervalMs")) {
+        long intervalMs = doc["intervalMs"];
+        if(intervalMs < BEACON_INTERVAL_MIN_MS || intervalMs > (long)BEACON_INTERVAL_MAX_MS) {
+            server.send(400, "application/json", "{\"error\":\"intervalMs must be 500 to 3600000\"}");
+            return;
+        }
+        config.intervalMs = intervalMs;
+    }
+    
+    beaconConfig = config;
+    EEPROM.put(BEACON_CONFIG_ADDR, beaconConfig);
+    commitEEPROM();
+    scheduler.setPeriod(beaconJobId, beaconConfig.intervalMs);
+    server.send(200, "application/json", "{\"status\":\"success\"}");
+}
+
+OtaResult startOtaUpload() {
+    // The client names the image and says where it continues from
+    OtaResult result = ota.begin(strtoul(server.arg("size"), nullptr, 10), server.arg("sha256"));
+    if(result == OTA_OK && strtoul(server.arg("offset"), nullptr, 10) != ota.received()) {
+        result = OTA_WRONG_OFFSET;
+    }
+    return result;
+}
+
+bool receiveOtaPiece(const uint8_t* data, size_t length) {
+    // Runs in loop() a piece at a time, so sensing and control carry on
+    // between pieces
+    if(server.streamedLength() == 0) {
+        otaRequestResult = otaAuthorize(server.header("Authorization"), otaConfig.token);
+        if(otaRequestResult == OTA_OK) {
+            otaRequestResult = startOtaUpload();
+        }
+        if(otaRequestResult != OTA_OK) {
+            return false;
+        }
+    }
+    otaRequestResult = ota.write(data, length);
+    return otaRequestResult == OTA_OK;
+}
+
+void handleOtaUpload() {
+    // PUT /api/ota?size=<bytes>&sha256=<hex>&offset=<n> with the image from
+    // offset n on; the body may stop short and a later PUT carry on
+    if(server.streamedLength() == 0) {
+        // Empty body: just start or check
+        otaRequestResult = otaAuthorize(server.header("Authorization"), otaConfig.token);
+        if(otaRequestResult == OTA_OK) {
+            otaRequestResult = startOtaUpload();
+        }
+    }
+    
+    int code = 500;
+    switch(otaRequestResult) {
+        case OTA_OK: code = 200; break;
+        case OTA_UNAUTHORIZED: code = 401; break;
+        case OTA_DISABLED: code = 403; break;
+        case OTA_BAD_REQUEST: code = 400; break;
+        case OTA_TOO_LARGE: code = 413; break;
+        case OTA_WRONG_OFFSET:
+        case OTA_NOT_RECEIVING: code = 409; break;
+        case OTA_DIGEST_MISMATCH:
+        case OTA_INVALID_IMAGE: code = 422; break;
+        case OTA_WRITE_FAILED: code = 500; break;
+    }
+    sendOtaStatus(code, otaRequestResult);
+    
+    if(code != 200) {
+        LOG_WARN("OTA upload refused: %s", OtaUpdate::resultName(otaRequestResult));
+    } else if(ota.state() == OTA_READY) {
+        LOG_INFO("OTA image of %u bytes verified, rebooting", (unsigned)ota.size());
+        delay(1000);
+        ESP.restart();
+    }
+}
+
+void handleGetOta() {
+    sendOtaStatus(200, ota.error());
+}
+
+void handleOtaAbort() {
+    OtaResult result = otaAuthorize(server.header("Authorization"), otaConfig.token);
+    if(result != OTA_OK) {
+        sendOtaStatus(result == OTA_DISABLED ? 403 : 401, result);
+        return;
+    }
+    ota.abort();
+    sendOtaStatus(200, OTA_OK);
+}
+
+void loadOtaConfig() {
+    EEPROM.get(OTA_CONFIG_ADDR, otaConfig);
+    if(otaConfig.magic != OTA_CONFIG_MAGIC) {
+        memset(&otaConfig, 0, sizeof(otaConfig));
+        otaConfig.magic = OTA_CONFIG_MAGIC;
+    }
+    otaConfig.token[sizeof(otaConfig.token) - 1] = '\0';
+    LOG_INFO("OTA updates %s", otaConfig.token[0] ? "enabled" : "disabled (no token set)");
+}
+
+void sendOtaStatus(int code, OtaResult result) {
+    StaticJsonDocument<256> doc;
+    doc["state"] = OtaUpdate::stateName(ota.state());
+    doc["size"] = ota.size();
+    doc["received"] = ota.received();
+    doc["sha256"] = ota.digest();
+    doc["error"] = OtaUpdate::resultName(result);
+    doc["capacity"] = otaTarget.capacity();
+    doc["enabled"] = otaConfig.token[0] != '\0';
+    sendJson(code, doc);
+}
+
+void setupMdns() {
+    snprintf(hostName, sizeof(hostName), "openair-%06llx", (unsigned long long)(ESP.getEfuseMac() & 0xFFFFFF));
+    publishSummarySnapshot();
+    
+    // An empty list until the first browse completes
+    StaticJsonDocument<64> doc;
+    doc["version"] = peersSnapshot.nextVersion();
+    doc.createNestedArray("peers");
+    publishSnapshot(peersSnapshot, doc);
+    
+    if(isConfigMode) {
+        return;
+    }
+    if(!MDNS.begin(hostName)) {
+        LOG_ERROR("mDNS failed to start");
+        return;
+    }
+    MDNS.addService("http", "tcp", 80);
+    MDNS.addServiceTxt("http", "tcp", "model", "openair");
+    MDNS.addServiceTxt("http", "tcp", "summary", "/api/summary");
+    mdns_service_subtype_add_for_host(nullptr, "_http", "_tcp", nullptr, "_openair");
+    LOG_INFO("mDNS: %s.local, _openair._sub._http._tcp", hostName);
+    
+    // Room for the PeerList copy SeqLock::write() makes on the stack
+    if(xTaskCreate(mdnsTask, "mdns", 6144, nullptr, 1, nullptr) != pdPASS) {
+        LOG_ERROR("mDNS browse task could not be started");
+    }
+}
+
+// Browsing blocks for the query timeout, so it has a task of its own. Other
+// web servers answer _http._tcp too; only units with our TXT record count.
+void mdnsTask(void*) {
+    static PeerList list;
+    for(;;) {
+        int found = MDNS.queryService("http", "tcp");
+        list.count = 0;
+        for(int i = 0; i < found && list.count < FLEET_MAX_PEERS; i++) {
+            if(MDNS.txt(i, "model") == "openair") {
+                strlcpy(list.peers[list.count].name, MDNS.hostname(i).c_str(), sizeof(list.peers[0].name));
+                snprintf(list.peers[list.count].host, sizeof(list.peers[0].host), "%s:%u",
+                         MDNS.IP(i).toString().c_str(), MDNS.port(i));
+                list.count++;
+            }
+        }
+        peerList.write(list);
+        vTaskDelay(pdMS_TO_TICKS(FLEET_BROWSE_PERIOD_MS));
+    }
+}
+
+// Loop task: the snapshot is only ever flipped while no response is reading it
+void publishPeersSnapshot() {
+    static PeerList list;
+    static StaticJsonDocument<3072> doc;
+    peerListPublished = peerList.version();
+    list = peerList.read();
+    doc.clear();
+    doc["version"] = peersSnapshot.nextVersion();
+    JsonArray peers = doc.createNestedArray("peers");
+    for(int i = 0; i < list.count; i++) {
+        JsonObject peer = peers.createNestedObject();
+        peer["name"] = list.peers[i].name;
+        peer["host"] = list.peers[i].host;
+    }
+    publishSnapshot(peersSnapshot, doc);
+}
+
+// Just what a fleet tile shows, so polling many units stays cheap
+void publishSummarySnapshot() {
+    ControlState state = sharedState.read();
+    StaticJsonDocument<160> doc;
+    doc["name"] = hostName;
+    doc["aqi"] = roundf(state.aqi * 10) / 10;
+    doc["fan"] = state.fanOn;
+    doc["auto"] = state.fanAuto;
+    doc["threshold"] = state.threshold;
+    doc["alert"] = fanTach.hasAlert();
+    publishSnapshot(summarySnapshot, doc);
+}
+
+void handleGetSummary() {
+    // The fleet page on another unit fetches this cross-origin
+    server.sendHeader("Access-Control-Allow-Origin", "*");
+    sendSnapshot(summarySnapshot);
+}
+
+void handleGetPeers() {
+    sendSnapshot(peersSnapshot);
+}
+
 void handleNotFound() {
-    Serial.print("404 - Not found: ");
-    Serial.print(server.uri());
-    Serial.print(" - Method: ");
-    Serial.println(server.method() == HTTP_GET ? "GET" : "POST");
+    LOG_DEBUG("404 - Not found: %s - Method: %s", server.uri(),
+              server.method() == HTTP_GET ? "GET" : "POST");
     
-    String message = "File Not Found\n\n";
-    message += "URI: ";
-    message += server.uri();
-    message += "\nMethod: ";
-    message += (server.method() == HTTP_GET) ? "GET" : "POST";
-    message += "\nArguments: ";
-    message += server.args();
-    message += "\n";
+    int used = snprintf(responseBuffer, sizeof(responseBuffer),
+                        "File Not Found\n\nURI: %s\nMethod: %s\nArguments: %d\n",
+                        server.uri(), (server.method() == HTTP_GET) ? "GET" : "POST", server.args());
     
-    for (uint8_t i = 0; i < server.args(); i++) {
-        message += " " + server.argName(i) + ": " + server.arg(i) + "\n";
+    for (int i = 0; i < server.args() && used < (int)sizeof(responseBuffer); i++) {
+        used += snprintf(responseBuffer + used, sizeof(responseBuffer) - used, " %s: %s\n",
+                         server.argName(i), server.arg(i));
     }
     
-    server.send(404, "text/plain", message);
+    server.send(404, "text/plain", responseBuffer);
 }
 
-void updateAQIFromSensor() {
+float readAQIFromSensor() {
     // Replace this function with your actual sensor reading code
     // This is a placeholder that simulates reading from a sensor
     
@@ -1511,33 +3487,16 @@ void updateAQIFromSensor() {
     float simulatedSensorValue = 50.0 + random(-20, 20);
     
     // Apply calibration
-    float calibratedValue = (simulatedSensorValue + sensorConfig.calibrationOffset) * sensorConfig.calibrationMultiplier;
-    
-    currentAQI = calibratedValue;
+    float aqi = (simulatedSensorValue + sensorConfig.calibrationOffset) * sensorConfig.calibrationMultiplier;
     
     // Keep AQI in reasonable range
-    if(currentAQI < 0) currentAQI = 0;
-    if(currentAQI > 500) currentAQI = 500;
-    
-    // Update history (shift array)
-    for(int i = 23; i > 0; i--) {
-        aqiHistory[i] = aqiHistory[i-1];
-    }
-    aqiHistory[0] = currentAQI;
+    if(aqi < 0) aqi = 0;
+    if(aqi > 500) aqi = 500;
+    return aqi;
 }
 
-void updateAQISimulation() {
-    // Simulate AQI changes
-    float change = (random(-100, 100)) / 10.0;
-    currentAQI += change;
-    
-    // Keep AQI in reasonable range
-    if(currentAQI < 0) currentAQI = 0;
-    if(currentAQI > 500) currentAQI = 500;
-    
-    // Update history (shift array)
-    for(int i = 23; i > 0; i--) {
-        aqiHistory[i] = aqiHistory[i-1];
-    }
-    aqiHistory[0] = currentAQI;
-}
\ No newline at end of file
+float simulateAQI() {
+    // The room responds to the fan, so the simulated AQI falls while it runs
+    uint32_t now = millis();
+    return simulatedRoom.update(syntheticAqi.sample(now), digitalRead(FAN_PIN), now);
+}